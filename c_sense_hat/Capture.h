@@ -0,0 +1,176 @@
+#ifndef SENSE_HAT_CAPTURE
+#define SENSE_HAT_CAPTURE
+
+#include "stddef.h"
+#include "stdint.h"
+
+/* Binary capture format written by start_capture.
+ *
+ * A capture is a directory of append-only segment files named
+ * capture-NNNNNN.shc. A segment starts with a CAPTURE_HEADER_BYTES header
+ * followed by blocks, each holding the samples of one kind column by
+ * column: all timestamps, then all values of the first field, and so on.
+ * Every block carries a CRC-32 and is written whole, so a segment cut short
+ * by a crash only loses its last, partial block.
+ *
+ * Segments of a CAPTURE_RAW capture hold blocks of exactly
+ * CAPTURE_BLOCK_BYTES, which can be used in place. Segments of a
+ * CAPTURE_COMPRESSED capture hold the columns compressed (see
+ * capture_encode), each block padded to 8 bytes, and end with an index of
+ * the blocks once the segment is closed. A segment without an index is
+ * read by walking the blocks from the start.
+ *
+ * Values are stored in the byte order of the machine that wrote them,
+ * see CaptureHeader.byte_order. */
+
+#define CAPTURE_MAGIC "SHCAP01"
+#define CAPTURE_VERSION 2
+#define CAPTURE_BYTE_ORDER 0x01020304u
+#define CAPTURE_BLOCK_MAGIC 0x42434853u    // "SHCB"
+#define CAPTURE_INDEX_MAGIC 0x49434853u    // "SHCI"
+#define CAPTURE_HEADER_BYTES 4096
+#define CAPTURE_BLOCK_BYTES 32768
+#define CAPTURE_IMU_SAMPLES 512             // Per block
+#define CAPTURE_ENVIRONMENT_SAMPLES 1024
+
+// Bits of the valid column of an IMU block
+#define CAPTURE_FUSION_VALID 0x01
+#define CAPTURE_COMPASS_VALID 0x02
+#define CAPTURE_GYRO_VALID 0x04
+#define CAPTURE_ACCEL_VALID 0x08
+// Bits of the valid column of an environment block
+#define CAPTURE_HUMIDITY_VALID 0x01
+#define CAPTURE_PRESSURE_VALID 0x02
+#define CAPTURE_TEMPERATURE_FROM_HUMIDITY_VALID 0x04
+#define CAPTURE_TEMPERATURE_FROM_PRESSURE_VALID 0x08
+
+typedef enum CaptureKind {
+    CAPTURE_IMU = 1,
+    CAPTURE_ENVIRONMENT = 2
+} CaptureKind;
+
+typedef enum CaptureEncoding {
+    CAPTURE_RAW = 0,
+    CAPTURE_COMPRESSED = 1
+} CaptureEncoding;
+
+/* Start of every segment, padded with zeros to CAPTURE_HEADER_BYTES */
+typedef struct CaptureHeader {
+    char magic[8];              // CAPTURE_MAGIC
+    uint32_t version;
+    uint32_t byte_order;        // CAPTURE_BYTE_ORDER as written
+    uint32_t header_bytes;
+    uint32_t block_bytes;
+    uint32_t imu_samples;       // Capacity of the blocks
+    uint32_t environment_samples;
+    uint32_t segment;           // Number of the segment in its capture
+    uint32_t encoding;          // CaptureEncoding of the segment
+    uint64_t created;           // Microseconds since the epoch
+} CaptureHeader;
+
+typedef struct CaptureBlockHeader {
+    uint32_t magic;             // CAPTURE_BLOCK_MAGIC
+    uint16_t kind;              // CaptureKind
+    uint16_t encoding;          // CaptureEncoding of the columns that follow
+    uint32_t count;             // Samples used, the rest of the columns is zero
+    uint32_t sequence;          // Number of the block in the segment
+    uint64_t first;             // Timestamps of the first and last sample
+    uint64_t last;
+    uint32_t bytes;             // Size of the columns that follow
+    uint32_t crc;               // CRC-32 of this header, with crc zero, and the columns
+} CaptureBlockHeader;
+
+/* Layout of an IMU block. Values hold the last valid value when their
+ * flag is not set, like ImuSample */
+typedef struct CaptureImuBlock {
+    CaptureBlockHeader header;
+    uint64_t timestamp[CAPTURE_IMU_SAMPLES];    // Microseconds since the epoch
+    float roll[CAPTURE_IMU_SAMPLES];            // Fusion pose in radians
+    float pitch[CAPTURE_IMU_SAMPLES];
+    float yaw[CAPTURE_IMU_SAMPLES];
+    float compass_x[CAPTURE_IMU_SAMPLES];       // uT
+    float compass_y[CAPTURE_IMU_SAMPLES];
+    float compass_z[CAPTURE_IMU_SAMPLES];
+    float gyro_x[CAPTURE_IMU_SAMPLES];          // Radians per second
+    float gyro_y[CAPTURE_IMU_SAMPLES];
+    float gyro_z[CAPTURE_IMU_SAMPLES];
+    float accel_x[CAPTURE_IMU_SAMPLES];         // Gs
+    float accel_y[CAPTURE_IMU_SAMPLES];
+    float accel_z[CAPTURE_IMU_SAMPLES];
+    uint8_t valid[CAPTURE_IMU_SAMPLES];         // CAPTURE_FUSION_VALID, ...
+} CaptureImuBlock;
+
+/* Layout of an environment block */
+typedef struct CaptureEnvironmentBlock {
+    CaptureBlockHeader header;
+    uint64_t timestamp[CAPTURE_ENVIRONMENT_SAMPLES];
+    float humidity[CAPTURE_ENVIRONMENT_SAMPLES];
+    float pressure[CAPTURE_ENVIRONMENT_SAMPLES];
+    float temperature_from_humidity[CAPTURE_ENVIRONMENT_SAMPLES];
+    float temperature_from_pressure[CAPTURE_ENVIRONMENT_SAMPLES];
+    uint8_t valid[CAPTURE_ENVIRONMENT_SAMPLES]; // CAPTURE_HUMIDITY_VALID, ...
+} CaptureEnvironmentBlock;
+
+/* Index at the end of a closed CAPTURE_COMPRESSED segment: one entry per
+ * block, then the footer, which is the last thing in the file */
+typedef struct CaptureIndexEntry {
+    uint64_t offset;            // Of the block header in the segment
+    uint64_t first;
+    uint64_t last;
+    uint32_t kind;
+    uint32_t count;
+} CaptureIndexEntry;
+
+typedef struct CaptureIndexFooter {
+    uint64_t offset;            // Of the first entry
+    uint32_t entries;
+    uint32_t crc;               // CRC-32 of the entries
+    uint32_t magic;             // CAPTURE_INDEX_MAGIC
+    uint32_t reserved;
+} CaptureIndexFooter;
+
+/* Reader (CaptureReader.c). Maps a segment read only, raw blocks are
+ * returned as pointers into the mapping, nothing is copied */
+typedef struct CaptureSegment {
+    const uint8_t *base;
+    size_t size;
+    const CaptureHeader *header;
+    size_t blocks;              // Complete blocks in the segment
+    const CaptureIndexEntry *index; // Compressed segments, NULL for raw ones
+    CaptureIndexEntry *scanned; // Index built at open when the segment has none
+} CaptureSegment;
+
+// Maps the segment at path. 0 on success, -1 if it cannot be read or is
+// not a segment written on a machine of the same byte order
+int capture_open(CaptureSegment *, const char *);
+void capture_close(CaptureSegment *);
+// Header of block n, NULL if it is out of range or fails its CRC
+const CaptureBlockHeader * capture_block(const CaptureSegment *, size_t);
+// Block n in place, NULL if it is not a raw block of that kind
+const CaptureImuBlock * capture_imu_block(const CaptureSegment *, size_t);
+const CaptureEnvironmentBlock * capture_environment_block(const CaptureSegment *, size_t);
+// Copies or decompresses block n into out. 0 on success, -1 if it is not
+// a good block of that kind
+int capture_read_imu(const CaptureSegment *, size_t, CaptureImuBlock *);
+int capture_read_environment(const CaptureSegment *, size_t, CaptureEnvironmentBlock *);
+// First block of kind with samples at or after timestamp, blocks if none.
+// Only the index or the block headers are looked at
+size_t capture_seek(const CaptureSegment *, CaptureKind, uint64_t);
+
+/* Codec (CaptureCodec.c).
+ *
+ * Timestamps are stored as delta-of-deltas and floats XORed with the
+ * previous value of their column, keeping only the bits that differ
+ * (Gorilla, Pelkonen et al., VLDB 2015). Samples a fixed interval apart
+ * cost one bit for the timestamp, and values that stay put one bit each */
+
+// Updates crc with size bytes, start from 0
+uint32_t capture_crc32(uint32_t, const void *, size_t);
+// Compresses the columns of block, a CaptureImuBlock or
+// CaptureEnvironmentBlock, to out. Bytes used, 0 if they do not fit
+size_t capture_encode(const CaptureBlockHeader *, uint8_t *, size_t);
+// Decompresses size bytes of columns described by header into out, a
+// block of the same kind. 0 on success, -1 if the columns are damaged
+int capture_decode(const CaptureBlockHeader *, const uint8_t *, size_t, CaptureBlockHeader *);
+
+#endif /* SENSE_HAT_CAPTURE */
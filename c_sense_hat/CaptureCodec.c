@@ -0,0 +1,299 @@
+#define _POSIX_C_SOURCE 200809L
+#include "Capture.h"
+#include "pthread.h"
+#include "string.h"
+
+/***** CRC-32 (IEEE 802.3, as zlib) *****/
+
+static uint32_t crc_table[256];
+static pthread_once_t crc_once = PTHREAD_ONCE_INIT;
+
+static void make_crc_table(void) {
+    for (uint32_t n = 0; n < 256; n++) {
+        uint32_t c = n;
+        for (int k = 0; k < 8; k++) {
+            c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+        }
+        crc_table[n] = c;
+    }
+}
+
+uint32_t capture_crc32(uint32_t crc, const void *data, size_t size) {
+    pthread_once(&crc_once, make_crc_table);
+    const uint8_t *p = (const uint8_t *) data;
+    crc = ~crc;
+    while (size--) {
+        crc = crc_table[(crc ^ *p++) & 0xFF] ^ (crc >> 8);
+    }
+    return ~crc;
+}
+
+/***** Bit streams, most significant bit first *****/
+
+typedef struct BitWriter {
+    uint8_t *out;
+    size_t capacity;
+    size_t used;
+    uint64_t bits;              // Pending bits, fewer than 8 between calls
+    int count;
+    int overflow;
+} BitWriter;
+
+/* Appends the low n bits of value, n at most 32 */
+static inline void put_bits(BitWriter *w, uint32_t value, int n) {
+    w->bits = (w->bits << n) | (n == 32 ? value : value & ((1u << n) - 1));
+    w->count += n;
+    while (w->count >= 8) {
+        w->count -= 8;
+        if (w->used < w->capacity) {
+            w->out[w->used++] = (uint8_t) (w->bits >> w->count);
+        } else {
+            w->overflow = 1;
+        }
+    }
+}
+
+static inline void put_bits64(BitWriter *w, uint64_t value) {
+    put_bits(w, (uint32_t) (value >> 32), 32);
+    put_bits(w, (uint32_t) value, 32);
+}
+
+/* Pads the last byte with zeros. Bytes used, 0 on overflow */
+static size_t finish_bits(BitWriter *w) {
+    if (w->count > 0) {
+        put_bits(w, 0, 8 - w->count);
+    }
+    return w->overflow ? 0 : w->used;
+}
+
+typedef struct BitReader {
+    const uint8_t *in;
+    size_t size;
+    size_t used;
+    uint64_t bits;
+    int count;
+    int overrun;                // Read past the end
+} BitReader;
+
+/* Next n bits, n at most 32 */
+static inline uint32_t get_bits(BitReader *r, int n) {
+    while (r->count < n) {
+        uint8_t byte = 0;
+        if (r->used < r->size) {
+            byte = r->in[r->used++];
+        } else {
+            r->overrun = 1;
+        }
+        r->bits = (r->bits << 8) | byte;
+        r->count += 8;
+    }
+    r->count -= n;
+    uint64_t value = r->bits >> r->count;
+    return n == 32 ? (uint32_t) value : (uint32_t) value & ((1u << n) - 1);
+}
+
+static inline uint64_t get_bits64(BitReader *r) {
+    uint64_t high = get_bits(r, 32);
+    return (high << 32) | get_bits(r, 32);
+}
+
+/***** Columns *****/
+
+/* Where the columns of a block kind are */
+typedef struct BlockLayout {
+    uint32_t capacity;
+    size_t timestamp;
+    size_t floats;              // First float column, the others follow it
+    int float_columns;
+    size_t valid;
+} BlockLayout;
+
+static int layout_of(uint32_t kind, BlockLayout *layout) {
+    switch (kind) {
+    case CAPTURE_IMU:
+        layout->capacity = CAPTURE_IMU_SAMPLES;
+        layout->timestamp = offsetof(CaptureImuBlock, timestamp);
+        layout->floats = offsetof(CaptureImuBlock, roll);
+        layout->float_columns = 12;
+        layout->valid = offsetof(CaptureImuBlock, valid);
+        return 0;
+    case CAPTURE_ENVIRONMENT:
+        layout->capacity = CAPTURE_ENVIRONMENT_SAMPLES;
+        layout->timestamp = offsetof(CaptureEnvironmentBlock, timestamp);
+        layout->floats = offsetof(CaptureEnvironmentBlock, humidity);
+        layout->float_columns = 4;
+        layout->valid = offsetof(CaptureEnvironmentBlock, valid);
+        return 0;
+    default:
+        return -1;
+    }
+}
+
+/* Timestamps: the first as is, then the change in the delta between
+ * samples, zigzag coded, in the smallest of these that holds it */
+#define DOD_CLASSES 5
+static const int dod_bits[DOD_CLASSES] = {7, 9, 12, 20, 32};
+
+static inline uint64_t zigzag(int64_t v) {
+    return ((uint64_t) v << 1) ^ (uint64_t) (v >> 63);
+}
+
+static inline int64_t unzigzag(uint64_t v) {
+    return (int64_t) (v >> 1) ^ -(int64_t) (v & 1);
+}
+
+static void encode_timestamps(BitWriter *w, const uint64_t *t, uint32_t count) {
+    put_bits64(w, t[0]);
+    uint64_t delta = 0;
+    for (uint32_t i = 1; i < count; i++) {
+        uint64_t d = t[i] - t[i - 1];
+        uint64_t z = zigzag((int64_t) (d - delta));
+        delta = d;
+        if (z == 0) {
+            put_bits(w, 0, 1);
+            continue;
+        }
+        int c = 0;
+        while (c < DOD_CLASSES && z >> dod_bits[c]) {
+            c++;
+        }
+        // Prefix 10, 110, 1110, 11110, 111110, then 111111 for 64 bits
+        if (c < DOD_CLASSES) {
+            put_bits(w, ((1u << (c + 1)) - 1) << 1, c + 2);
+            put_bits(w, (uint32_t) z, dod_bits[c]);
+        } else {
+            put_bits(w, 0x3F, 6);
+            put_bits64(w, z);
+        }
+    }
+}
+
+static void decode_timestamps(BitReader *r, uint64_t *t, uint32_t count) {
+    t[0] = get_bits64(r);
+    uint64_t delta = 0;
+    for (uint32_t i = 1; i < count; i++) {
+        int c = 0;
+        while (c <= DOD_CLASSES && get_bits(r, 1)) {
+            c++;
+        }
+        if (c > 0) {
+            uint64_t z = c <= DOD_CLASSES ? get_bits(r, dod_bits[c - 1]) : get_bits64(r);
+            delta += (uint64_t) unzigzag(z);
+        }
+        t[i] = t[i - 1] + delta;
+    }
+}
+
+/* Floats: the first as is, then XOR with the previous value. 0 when they
+ * are equal, 10 and the differing bits when they fit in the window of the
+ * last value stored, otherwise 11, the leading zeros in 5 bits, the number
+ * of differing bits less one in 5 bits and those bits */
+static void encode_floats(BitWriter *w, const float *v, uint32_t count) {
+    uint32_t prev;
+    memcpy(&prev, &v[0], 4);
+    put_bits(w, prev, 32);
+    int lead = 32, trail = 0;   // Window, none yet
+    for (uint32_t i = 1; i < count; i++) {
+        uint32_t bits;
+        memcpy(&bits, &v[i], 4);
+        uint32_t x = bits ^ prev;
+        prev = bits;
+        if (x == 0) {
+            put_bits(w, 0, 1);
+            continue;
+        }
+        int l = __builtin_clz(x);
+        int t = __builtin_ctz(x);
+        if (l >= lead && t >= trail) {
+            put_bits(w, 2, 2);
+            put_bits(w, x >> trail, 32 - lead - trail);
+        } else {
+            lead = l;
+            trail = t;
+            int n = 32 - l - t;
+            put_bits(w, (3u << 10) | ((uint32_t) l << 5) | (uint32_t) (n - 1), 12);
+            put_bits(w, x >> t, n);
+        }
+    }
+}
+
+static void decode_floats(BitReader *r, float *v, uint32_t count) {
+    uint32_t prev = get_bits(r, 32);
+    memcpy(&v[0], &prev, 4);
+    int lead = 32, trail = 0;
+    for (uint32_t i = 1; i < count; i++) {
+        if (get_bits(r, 1)) {
+            if (get_bits(r, 1)) {
+                uint32_t head = get_bits(r, 10);
+                lead = head >> 5;
+                trail = 32 - lead - (int) (head & 31) - 1;
+                if (trail < 0) {
+                    r->overrun = 1;     // Not something the encoder writes
+                    trail = 0;
+                }
+            }
+            int n = 32 - lead - trail;
+            if (n <= 0) {
+                r->overrun = 1;
+                n = 1;
+            }
+            prev ^= get_bits(r, n) << trail;
+        }
+        memcpy(&v[i], &prev, 4);
+    }
+}
+
+/* Valid flags: the first as is, then 0 when unchanged or 1 and the byte */
+static void encode_valid(BitWriter *w, const uint8_t *v, uint32_t count) {
+    put_bits(w, v[0], 8);
+    for (uint32_t i = 1; i < count; i++) {
+        if (v[i] == v[i - 1]) {
+            put_bits(w, 0, 1);
+        } else {
+            put_bits(w, 0x100 | v[i], 9);
+        }
+    }
+}
+
+static void decode_valid(BitReader *r, uint8_t *v, uint32_t count) {
+    v[0] = (uint8_t) get_bits(r, 8);
+    for (uint32_t i = 1; i < count; i++) {
+        v[i] = get_bits(r, 1) ? (uint8_t) get_bits(r, 8) : v[i - 1];
+    }
+}
+
+size_t capture_encode(const CaptureBlockHeader *block, uint8_t *out, size_t capacity) {
+    BlockLayout layout;
+    if (layout_of(block->kind, &layout) != 0 || block->count == 0 || block->count > layout.capacity) {
+        return 0;
+    }
+    const uint8_t *base = (const uint8_t *) block;
+    BitWriter w = {out, capacity, 0, 0, 0, 0};
+    encode_timestamps(&w, (const uint64_t *) (base + layout.timestamp), block->count);
+    const float *floats = (const float *) (base + layout.floats);
+    for (int c = 0; c < layout.float_columns; c++) {
+        encode_floats(&w, floats + (size_t) c * layout.capacity, block->count);
+    }
+    encode_valid(&w, base + layout.valid, block->count);
+    return finish_bits(&w);
+}
+
+int capture_decode(const CaptureBlockHeader *header, const uint8_t *in, size_t size, CaptureBlockHeader *out) {
+    BlockLayout layout;
+    if (layout_of(header->kind, &layout) != 0 || header->count == 0 || header->count > layout.capacity) {
+        return -1;
+    }
+    size_t block_size = header->kind == CAPTURE_IMU ?
+        sizeof(CaptureImuBlock) : sizeof(CaptureEnvironmentBlock);
+    memset(out, 0, block_size);
+    *out = *header;
+    uint8_t *base = (uint8_t *) out;
+    BitReader r = {in, size, 0, 0, 0, 0};
+    decode_timestamps(&r, (uint64_t *) (base + layout.timestamp), header->count);
+    float *floats = (float *) (base + layout.floats);
+    for (int c = 0; c < layout.float_columns; c++) {
+        decode_floats(&r, floats + (size_t) c * layout.capacity, header->count);
+    }
+    decode_valid(&r, base + layout.valid, header->count);
+    return r.overrun ? -1 : 0;
+}
@@ -0,0 +1,223 @@
+#define _POSIX_C_SOURCE 200809L
+#include "Capture.h"
+#include "fcntl.h"
+#include "stdlib.h"
+#include "string.h"
+#include "sys/mman.h"
+#include "sys/stat.h"
+#include "unistd.h"
+
+/* CRC of a block header with crc taken as zero, and its columns */
+static uint32_t block_crc(const CaptureBlockHeader *block) {
+    CaptureBlockHeader header = *block;
+    header.crc = 0;
+    uint32_t crc = capture_crc32(0, &header, sizeof(header));
+    return capture_crc32(crc, block + 1, block->bytes);
+}
+
+/* Checks the header of the block at offset can be trusted as far as its
+ * size goes. The columns are only checked on use */
+static const CaptureBlockHeader * block_at(const CaptureSegment *segment, size_t offset) {
+    if (offset + sizeof(CaptureBlockHeader) > segment->size) {
+        return NULL;
+    }
+    const CaptureBlockHeader *block = (const CaptureBlockHeader *) (segment->base + offset);
+    if (block->magic != CAPTURE_BLOCK_MAGIC ||
+            block->bytes > segment->size - offset - sizeof(CaptureBlockHeader)) {
+        return NULL;
+    }
+    return block;
+}
+
+/* Reads the index at the end of a closed compressed segment. -1 if there
+ * is none or it is damaged. A closed segment ends 8 byte aligned, one cut
+ * anywhere else cannot have a footer and is not looked at unaligned */
+static int read_index(CaptureSegment *segment) {
+    if (segment->size < CAPTURE_HEADER_BYTES + sizeof(CaptureIndexFooter) || segment->size % 8 != 0) {
+        return -1;
+    }
+    const CaptureIndexFooter *footer = (const CaptureIndexFooter *)
+        (segment->base + segment->size - sizeof(CaptureIndexFooter));
+    if (footer->magic != CAPTURE_INDEX_MAGIC || footer->offset < CAPTURE_HEADER_BYTES ||
+            footer->offset + (uint64_t) footer->entries * sizeof(CaptureIndexEntry) +
+            sizeof(CaptureIndexFooter) != segment->size) {
+        return -1;
+    }
+    const CaptureIndexEntry *index = (const CaptureIndexEntry *) (segment->base + footer->offset);
+    if (capture_crc32(0, index, footer->entries * sizeof(CaptureIndexEntry)) != footer->crc) {
+        return -1;
+    }
+    segment->index = index;
+    segment->blocks = footer->entries;
+    return 0;
+}
+
+/* Walks the blocks of a compressed segment that was never closed, up to
+ * the first one cut short */
+static int scan_index(CaptureSegment *segment) {
+    size_t capacity = 64;
+    size_t count = 0;
+    CaptureIndexEntry *index = malloc(capacity * sizeof(CaptureIndexEntry));
+    if (!index) {
+        return -1;
+    }
+    size_t offset = CAPTURE_HEADER_BYTES;
+    const CaptureBlockHeader *block;
+    while ((block = block_at(segment, offset)) != NULL) {
+        if (count == capacity) {
+            capacity *= 2;
+            CaptureIndexEntry *grown = realloc(index, capacity * sizeof(CaptureIndexEntry));
+            if (!grown) {
+                free(index);
+                return -1;
+            }
+            index = grown;
+        }
+        CaptureIndexEntry *entry = &index[count++];
+        entry->offset = offset;
+        entry->first = block->first;
+        entry->last = block->last;
+        entry->kind = block->kind;
+        entry->count = block->count;
+        offset += (sizeof(CaptureBlockHeader) + block->bytes + 7) & ~(size_t) 7;
+    }
+    segment->index = segment->scanned = index;
+    segment->blocks = count;
+    return 0;
+}
+
+/* Maps the segment at path read only and checks its header */
+int capture_open(CaptureSegment *segment, const char *path) {
+    memset(segment, 0, sizeof(CaptureSegment));
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return -1;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size < CAPTURE_HEADER_BYTES) {
+        close(fd);
+        return -1;
+    }
+    void *mem = mmap(0, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (mem == MAP_FAILED) {
+        return -1;
+    }
+    const CaptureHeader *header = (const CaptureHeader *) mem;
+    if (memcmp(header->magic, CAPTURE_MAGIC, sizeof(header->magic)) != 0 ||
+            header->version != CAPTURE_VERSION ||
+            header->byte_order != CAPTURE_BYTE_ORDER ||
+            header->header_bytes != CAPTURE_HEADER_BYTES ||
+            header->block_bytes != CAPTURE_BLOCK_BYTES ||
+            header->imu_samples != CAPTURE_IMU_SAMPLES ||
+            header->environment_samples != CAPTURE_ENVIRONMENT_SAMPLES ||
+            (header->encoding != CAPTURE_RAW && header->encoding != CAPTURE_COMPRESSED)) {
+        munmap(mem, st.st_size);
+        return -1;
+    }
+    // Blocks are read front to back
+    posix_madvise(mem, st.st_size, POSIX_MADV_SEQUENTIAL);
+    segment->base = (const uint8_t *) mem;
+    segment->size = st.st_size;
+    segment->header = header;
+    if (header->encoding == CAPTURE_RAW) {
+        segment->blocks = (st.st_size - CAPTURE_HEADER_BYTES) / CAPTURE_BLOCK_BYTES;
+    } else if (read_index(segment) != 0 && scan_index(segment) != 0) {
+        capture_close(segment);
+        return -1;
+    }
+    return 0;
+}
+
+void capture_close(CaptureSegment *segment) {
+    if (segment->base) {
+        munmap((void *) segment->base, segment->size);
+    }
+    free(segment->scanned);
+    memset(segment, 0, sizeof(CaptureSegment));
+}
+
+/* Header of block n without looking at its columns */
+static const CaptureBlockHeader * block_header(const CaptureSegment *segment, size_t n) {
+    if (n >= segment->blocks) {
+        return NULL;
+    }
+    if (segment->index) {
+        return block_at(segment, segment->index[n].offset);
+    }
+    return block_at(segment, CAPTURE_HEADER_BYTES + n * CAPTURE_BLOCK_BYTES);
+}
+
+const CaptureBlockHeader * capture_block(const CaptureSegment *segment, size_t n) {
+    const CaptureBlockHeader *block = block_header(segment, n);
+    if (!block || block_crc(block) != block->crc) {
+        return NULL;
+    }
+    return block;
+}
+
+/* Block n if it is a good raw block of kind holding at most capacity
+ * samples */
+static const CaptureBlockHeader * raw_block(const CaptureSegment *segment, size_t n,
+        CaptureKind kind, uint32_t capacity) {
+    const CaptureBlockHeader *block = capture_block(segment, n);
+    if (!block || block->kind != kind || block->encoding != CAPTURE_RAW ||
+            block->count > capacity ||
+            block->bytes != CAPTURE_BLOCK_BYTES - sizeof(CaptureBlockHeader)) {
+        return NULL;
+    }
+    return block;
+}
+
+const CaptureImuBlock * capture_imu_block(const CaptureSegment *segment, size_t n) {
+    return (const CaptureImuBlock *) raw_block(segment, n, CAPTURE_IMU, CAPTURE_IMU_SAMPLES);
+}
+
+const CaptureEnvironmentBlock * capture_environment_block(const CaptureSegment *segment, size_t n) {
+    return (const CaptureEnvironmentBlock *) raw_block(segment, n,
+        CAPTURE_ENVIRONMENT, CAPTURE_ENVIRONMENT_SAMPLES);
+}
+
+/* Copies or decodes block n of kind to out, size bytes long */
+static int read_block(const CaptureSegment *segment, size_t n, CaptureKind kind,
+        CaptureBlockHeader *out, size_t size) {
+    const CaptureBlockHeader *block = capture_block(segment, n);
+    if (!block || block->kind != kind) {
+        return -1;
+    }
+    if (block->encoding == CAPTURE_COMPRESSED) {
+        return capture_decode(block, (const uint8_t *) (block + 1), block->bytes, out);
+    }
+    const CaptureBlockHeader *raw = raw_block(segment, n, kind,
+        kind == CAPTURE_IMU ? CAPTURE_IMU_SAMPLES : CAPTURE_ENVIRONMENT_SAMPLES);
+    if (!raw) {
+        return -1;
+    }
+    memcpy(out, raw, size);
+    return 0;
+}
+
+int capture_read_imu(const CaptureSegment *segment, size_t n, CaptureImuBlock *out) {
+    return read_block(segment, n, CAPTURE_IMU, &out->header, sizeof(CaptureImuBlock));
+}
+
+int capture_read_environment(const CaptureSegment *segment, size_t n, CaptureEnvironmentBlock *out) {
+    return read_block(segment, n, CAPTURE_ENVIRONMENT, &out->header, sizeof(CaptureEnvironmentBlock));
+}
+
+size_t capture_seek(const CaptureSegment *segment, CaptureKind kind, uint64_t timestamp) {
+    for (size_t n = 0; n < segment->blocks; n++) {
+        if (segment->index) {
+            const CaptureIndexEntry *entry = &segment->index[n];
+            if (entry->kind == (uint32_t) kind && entry->last >= timestamp) {
+                return n;
+            }
+            continue;
+        }
+        const CaptureBlockHeader *block = block_header(segment, n);
+        if (block && block->kind == kind && block->count > 0 && block->last >= timestamp) {
+            return n;
+        }
+    }
+    return segment->blocks;
+}
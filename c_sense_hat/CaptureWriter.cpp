@@ -0,0 +1,359 @@
+#include "CaptureWriter.hpp"
+#include "PollScheduler.hpp"
+
+#include "cstdlib"
+#include "cstring"
+
+#include "errno.h"
+#include "fcntl.h"
+#include "sys/time.h"
+#include "unistd.h"
+
+static_assert(sizeof(CaptureHeader) <= CAPTURE_HEADER_BYTES, "Capture header too large");
+static_assert(sizeof(CaptureImuBlock) <= CAPTURE_BLOCK_BYTES, "IMU block too large");
+static_assert(sizeof(CaptureEnvironmentBlock) <= CAPTURE_BLOCK_BYTES, "Environment block too large");
+
+/* Path of segment n of the capture in directory */
+static std::string segment_path(const std::string &directory, uint32_t n) {
+    char name[32];
+    snprintf(name, sizeof(name), "/capture-%06u.shc", n);
+    return directory + name;
+}
+
+/* Constructor. Opens the first segment in directory, after any segments
+ * already there, so an earlier capture is never overwritten */
+CaptureWriter::CaptureWriter(const char *path, CaptureEncoding how) {
+    directory = path;
+    encoding = how;
+    void *mem = NULL;
+    // One more block to compress into
+    if (posix_memalign(&mem, 4096, (size_t) (CAPTURE_BUFFERS + 1) * CAPTURE_BLOCK_BYTES) != 0) {
+        throw "Could not allocate capture buffers";
+    }
+    buffers = (uint8_t *) mem;
+    packed = buffer(CAPTURE_BUFFERS);
+    if (encoding == CAPTURE_COMPRESSED) {
+        block_index.reserve(CAPTURE_SEGMENT_BLOCKS);
+    }
+    queue_head = queued = 0;
+    free_count = 0;
+    for (int i = CAPTURE_BUFFERS - 1; i >= 0; i--) {
+        free_buffers[free_count++] = i;
+    }
+    imu_samples = environment_samples = 0;
+    blocks = segments = dropped = bytes = 0;
+    fd = -1;
+    segment = 0;
+    while (access(segment_path(directory, segment).c_str(), F_OK) == 0) {
+        segment++;
+    }
+    open_segment();
+    if (fd < 0) {
+        free(buffers);
+        throw "Could not create capture segment";
+    }
+    imu_block = start_block(CAPTURE_IMU);
+    environment_block = start_block(CAPTURE_ENVIRONMENT);
+    running = true;
+    writer = std::thread(&CaptureWriter::write_blocks, this);
+}
+
+/* Destructor. Writes the blocks that are not full yet and closes the
+ * segment */
+CaptureWriter::~CaptureWriter() {
+    submit(imu_block, false);
+    submit(environment_block, false);
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        running = false;
+    }
+    wake.notify_one();
+    writer.join();
+    close_segment();
+    free(buffers);
+}
+
+void CaptureWriter::stats(CaptureStats &out) const {
+    out.imu_samples = imu_samples.load(std::memory_order_relaxed);
+    out.environment_samples = environment_samples.load(std::memory_order_relaxed);
+    out.blocks = blocks.load(std::memory_order_relaxed);
+    out.segments = segments.load(std::memory_order_relaxed);
+    out.dropped = dropped.load(std::memory_order_relaxed);
+    out.bytes = bytes.load(std::memory_order_relaxed);
+}
+
+/* Makes buffer index an empty block of kind */
+void CaptureWriter::clear_block(int index, CaptureKind kind) noexcept {
+    uint8_t *block = buffer(index);
+    memset(block, 0, CAPTURE_BLOCK_BYTES);
+    CaptureBlockHeader *header = (CaptureBlockHeader *) block;
+    header->magic = CAPTURE_BLOCK_MAGIC;
+    header->kind = kind;
+}
+
+/* Takes a free buffer and makes it an empty block of kind. -1 if every
+ * buffer is in use */
+int CaptureWriter::start_block(CaptureKind kind) noexcept {
+    int index;
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        if (free_count == 0) {
+            return -1;
+        }
+        index = free_buffers[--free_count];
+    }
+    clear_block(index, kind);
+    return index;
+}
+
+/* Queues the block in buffer index for writing, if it has any samples.
+ * With next set returns a fresh block of the same kind to fill, or the
+ * same one emptied if no buffer is free (its samples are dropped then) */
+int CaptureWriter::submit(int index, bool next) noexcept {
+    if (index < 0) {
+        return -1;
+    }
+    CaptureBlockHeader *header = (CaptureBlockHeader *) buffer(index);
+    CaptureKind kind = (CaptureKind) header->kind;
+    if (header->count == 0) {
+        if (next) {
+            return index;
+        }
+        std::lock_guard<std::mutex> guard(lock);
+        free_buffers[free_count++] = index;
+        return -1;
+    }
+    bool drop;
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        drop = next && free_count == 0;
+        if (!drop) {
+            queue[(queue_head + queued++) % CAPTURE_BUFFERS] = index;
+        }
+    }
+    if (drop) {
+        dropped.fetch_add(header->count, std::memory_order_relaxed);
+        clear_block(index, kind);
+        return index;
+    }
+    wake.notify_one();
+    return next ? start_block(kind) : -1;
+}
+
+/* Appends an IMU sample to the block being filled */
+void CaptureWriter::add_imu(const ImuSample &sample) noexcept {
+    if (imu_block < 0 && (imu_block = start_block(CAPTURE_IMU)) < 0) {
+        dropped.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+    CaptureImuBlock *block = (CaptureImuBlock *) buffer(imu_block);
+    uint32_t n = block->header.count;
+    if (n == 0) {
+        block->header.first = sample.timestamp;
+    }
+    block->header.last = sample.timestamp;
+    block->timestamp[n] = sample.timestamp;
+    block->roll[n] = sample.fusion.roll;
+    block->pitch[n] = sample.fusion.pitch;
+    block->yaw[n] = sample.fusion.yaw;
+    block->compass_x[n] = sample.compass.x;
+    block->compass_y[n] = sample.compass.y;
+    block->compass_z[n] = sample.compass.z;
+    block->gyro_x[n] = sample.gyro.x;
+    block->gyro_y[n] = sample.gyro.y;
+    block->gyro_z[n] = sample.gyro.z;
+    block->accel_x[n] = sample.accel.x;
+    block->accel_y[n] = sample.accel.y;
+    block->accel_z[n] = sample.accel.z;
+    block->valid[n] = (sample.fusion_valid ? CAPTURE_FUSION_VALID : 0) |
+        (sample.compass_valid ? CAPTURE_COMPASS_VALID : 0) |
+        (sample.gyro_valid ? CAPTURE_GYRO_VALID : 0) |
+        (sample.accel_valid ? CAPTURE_ACCEL_VALID : 0);
+    block->header.count = n + 1;
+    imu_samples.fetch_add(1, std::memory_order_relaxed);
+    if (n + 1 == CAPTURE_IMU_SAMPLES) {
+        imu_block = submit(imu_block, true);
+    }
+}
+
+/* Appends an environment sample to the block being filled */
+void CaptureWriter::add_environment(const EnvironmentSample &sample) noexcept {
+    if (environment_block < 0 && (environment_block = start_block(CAPTURE_ENVIRONMENT)) < 0) {
+        dropped.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+    CaptureEnvironmentBlock *block = (CaptureEnvironmentBlock *) buffer(environment_block);
+    uint32_t n = block->header.count;
+    if (n == 0) {
+        block->header.first = sample.timestamp;
+    }
+    block->header.last = sample.timestamp;
+    block->timestamp[n] = sample.timestamp;
+    block->humidity[n] = sample.humidity;
+    block->pressure[n] = sample.pressure;
+    block->temperature_from_humidity[n] = sample.temperature_from_humidity;
+    block->temperature_from_pressure[n] = sample.temperature_from_pressure;
+    block->valid[n] = (sample.humidity_valid ? CAPTURE_HUMIDITY_VALID : 0) |
+        (sample.pressure_valid ? CAPTURE_PRESSURE_VALID : 0) |
+        (sample.temperature_from_humidity_valid ? CAPTURE_TEMPERATURE_FROM_HUMIDITY_VALID : 0) |
+        (sample.temperature_from_pressure_valid ? CAPTURE_TEMPERATURE_FROM_PRESSURE_VALID : 0);
+    block->header.count = n + 1;
+    environment_samples.fetch_add(1, std::memory_order_relaxed);
+    if (n + 1 == CAPTURE_ENVIRONMENT_SAMPLES) {
+        environment_block = submit(environment_block, true);
+    }
+}
+
+/***** Writer thread *****/
+
+/* Creates segment number segment and writes its header. Leaves fd at -1
+ * if it cannot be created */
+void CaptureWriter::open_segment(void) {
+    fd = open(segment_path(directory, segment).c_str(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        return;
+    }
+    uint8_t page[CAPTURE_HEADER_BYTES];
+    memset(page, 0, sizeof(page));
+    CaptureHeader *header = (CaptureHeader *) page;
+    memcpy(header->magic, CAPTURE_MAGIC, sizeof(header->magic));
+    header->version = CAPTURE_VERSION;
+    header->byte_order = CAPTURE_BYTE_ORDER;
+    header->header_bytes = CAPTURE_HEADER_BYTES;
+    header->block_bytes = CAPTURE_BLOCK_BYTES;
+    header->imu_samples = CAPTURE_IMU_SAMPLES;
+    header->environment_samples = CAPTURE_ENVIRONMENT_SAMPLES;
+    header->segment = segment;
+    header->encoding = encoding;
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    header->created = (uint64_t) tv.tv_sec * 1000000ull + tv.tv_usec;
+    offset = 0;
+    write_out(page, CAPTURE_HEADER_BYTES);
+    segment_blocks = 0;
+    block_index.clear();
+    segments.fetch_add(1, std::memory_order_relaxed);
+}
+
+/* Appends the index of a compressed segment, flushes the segment to the
+ * card and closes it */
+void CaptureWriter::close_segment(void) {
+    if (fd >= 0 && encoding == CAPTURE_COMPRESSED) {
+        CaptureIndexFooter footer;
+        memset(&footer, 0, sizeof(footer));
+        footer.offset = offset;
+        footer.entries = block_index.size();
+        footer.crc = capture_crc32(0, block_index.data(), block_index.size() * sizeof(CaptureIndexEntry));
+        footer.magic = CAPTURE_INDEX_MAGIC;
+        write_out((const uint8_t *) block_index.data(), block_index.size() * sizeof(CaptureIndexEntry));
+        if (fd >= 0) {
+            write_out((const uint8_t *) &footer, sizeof(footer));
+        }
+    }
+    if (fd >= 0) {
+        fdatasync(fd);
+        close(fd);
+        fd = -1;
+    }
+}
+
+/* Appends size bytes to the segment. Raw blocks are whole pages, so the
+ * card never has to rewrite a page it already holds; compressed blocks
+ * are small enough that the page cache gathers them */
+void CaptureWriter::write_out(const uint8_t *data, size_t size) {
+    size_t done = 0;
+    while (done < size) {
+        ssize_t n = write(fd, data + done, size - done);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            // Card full or gone. Cut the partial block off so the segment
+            // stays readable, and give up on it
+            if (ftruncate(fd, offset) != 0) {}
+            close(fd);
+            fd = -1;
+            return;
+        }
+        done += n;
+    }
+    offset += size;
+    bytes.fetch_add(size, std::memory_order_relaxed);
+}
+
+/* Seals the block in header with its CRC, compressed if that makes it
+ * smaller, and appends it to the segment */
+void CaptureWriter::write_block(CaptureBlockHeader *header) {
+    header->sequence = segment_blocks;
+    uint64_t start = offset;
+    size_t size = 0;
+    if (encoding == CAPTURE_COMPRESSED) {
+        size = capture_encode(header, packed + sizeof(CaptureBlockHeader),
+            CAPTURE_BLOCK_BYTES - sizeof(CaptureBlockHeader) - 8);
+    }
+    const uint8_t *data;
+    size_t total;
+    if (size > 0) {
+        header->encoding = CAPTURE_COMPRESSED;
+        header->bytes = size;
+        // Keeps the next block header 8 byte aligned
+        total = (sizeof(CaptureBlockHeader) + size + 7) & ~(size_t) 7;
+        memset(packed + sizeof(CaptureBlockHeader) + size, 0, total - sizeof(CaptureBlockHeader) - size);
+        data = packed;
+    } else {
+        header->encoding = CAPTURE_RAW;
+        header->bytes = CAPTURE_BLOCK_BYTES - sizeof(CaptureBlockHeader);
+        total = CAPTURE_BLOCK_BYTES;
+        data = (const uint8_t *) header;
+    }
+    header->crc = 0;
+    uint32_t crc = capture_crc32(0, header, sizeof(CaptureBlockHeader));
+    header->crc = capture_crc32(crc, data + sizeof(CaptureBlockHeader), header->bytes);
+    if (data == packed) {
+        memcpy(packed, header, sizeof(CaptureBlockHeader));
+    }
+    write_out(data, total);
+    if (fd >= 0 && encoding == CAPTURE_COMPRESSED) {
+        CaptureIndexEntry entry;
+        entry.offset = start;
+        entry.first = header->first;
+        entry.last = header->last;
+        entry.kind = header->kind;
+        entry.count = header->count;
+        block_index.push_back(entry);
+    }
+}
+
+/* Body of the writer thread */
+void CaptureWriter::write_blocks(void) {
+    std::unique_lock<std::mutex> guard(lock);
+    while (true) {
+        wake.wait(guard, [this] { return queued > 0 || !running; });
+        if (queued == 0) {
+            break;      // Stopped and everything is written
+        }
+        int slot = queue[queue_head];
+        queue_head = (queue_head + 1) % CAPTURE_BUFFERS;
+        queued--;
+        guard.unlock();
+
+        CaptureBlockHeader *header = (CaptureBlockHeader *) buffer(slot);
+        if (segment_blocks == CAPTURE_SEGMENT_BLOCKS) {
+            close_segment();
+            segment++;
+            open_segment();
+        }
+        if (fd >= 0) {
+            write_block(header);
+        }
+        if (fd >= 0) {
+            segment_blocks++;
+            blocks.fetch_add(1, std::memory_order_relaxed);
+        } else {
+            dropped.fetch_add(header->count, std::memory_order_relaxed);
+        }
+
+        guard.lock();
+        free_buffers[free_count++] = slot;
+    }
+}
@@ -0,0 +1,83 @@
+#ifndef CAPTURE_WRITER_HPP
+#define CAPTURE_WRITER_HPP
+
+extern "C" {
+    #include "Capture.h"
+    #include "SenseHatSensors.h"
+}
+
+#include "atomic"
+#include "condition_variable"
+#include "mutex"
+#include "string"
+#include "thread"
+#include "vector"
+
+// Blocks in memory per capture: one being filled per kind, the rest
+// waiting for or being written to the card
+#define CAPTURE_BUFFERS 8
+// A new segment is started every 2048 blocks (at most 64 MiB, about 1.5
+// hours of IMU samples at 200 Hz)
+#define CAPTURE_SEGMENT_BLOCKS 2048
+
+/* Writes samples to the segment files of a capture (see Capture.h).
+ *
+ * Samples are stored straight into the columns of a block in memory. Only
+ * a full block is handed to the writer thread, which writes it with a
+ * single write, so the caller never waits for the card and the file only
+ * grows in whole blocks. The writer thread also computes the CRC of the
+ * block and, for a CAPTURE_COMPRESSED capture, compresses it, keeping it
+ * raw if that does not make it smaller. If the card falls so far behind
+ * that no buffer is free, the samples of a block are dropped instead.
+ *
+ * add_imu and add_environment must be called from one thread. */
+class CaptureWriter {
+public:
+    CaptureWriter(const char *, CaptureEncoding);
+    ~CaptureWriter();
+    void add_imu(const ImuSample &) noexcept;
+    void add_environment(const EnvironmentSample &) noexcept;
+    void stats(CaptureStats &) const;
+private:
+    uint8_t * buffer(int index) {
+        return buffers + (size_t) index * CAPTURE_BLOCK_BYTES;
+    }
+    void clear_block(int, CaptureKind) noexcept;
+    int start_block(CaptureKind) noexcept;
+    int submit(int, bool) noexcept;
+    void open_segment(void);
+    void close_segment(void);
+    void write_out(const uint8_t *, size_t);
+    void write_block(CaptureBlockHeader *);
+    void write_blocks(void);
+    std::string directory;
+    CaptureEncoding encoding;
+    uint8_t *buffers;           // CAPTURE_BUFFERS blocks, page aligned
+    int imu_block;              // Buffers being filled
+    int environment_block;
+    // Buffers owned by the writer thread, guarded by lock
+    int queue[CAPTURE_BUFFERS];
+    size_t queue_head;
+    size_t queued;
+    int free_buffers[CAPTURE_BUFFERS];
+    size_t free_count;
+    bool running;
+    std::mutex lock;
+    std::condition_variable wake;
+    std::thread writer;
+    // Used by the writer thread only
+    int fd;                     // Current segment, -1 if it could not be opened
+    uint32_t segment;
+    uint32_t segment_blocks;    // Blocks in the current segment
+    uint64_t offset;            // Size of the current segment
+    std::vector<CaptureIndexEntry> block_index;    // Of the current segment
+    uint8_t *packed;            // A compressed block, CAPTURE_BLOCK_BYTES
+    std::atomic<uint64_t> imu_samples;
+    std::atomic<uint64_t> environment_samples;
+    std::atomic<uint64_t> blocks;
+    std::atomic<uint64_t> segments;
+    std::atomic<uint64_t> dropped;
+    std::atomic<uint64_t> bytes;
+};
+
+#endif /* CAPTURE_WRITER_HPP */
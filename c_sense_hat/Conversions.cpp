@@ -0,0 +1,220 @@
+extern "C" {
+    #include "SenseHatSensors.h"
+}
+
+#include "cmath"
+
+/* Bulk conversions of the C API (see SenseHatSensors.h).
+ *
+ * Every conversion is written once, as a template over a "lane" type, and
+ * instantiated for plain floats and for NEON or SSE2 vectors when the
+ * compiler targets them. Both run the same float operations in the same
+ * order, so the vector kernels give bit for bit the result of the scalar
+ * ones, which also handle the elements left over at the end. The one
+ * exception is 32 bit ARM, whose NEON unit flushes denormals to zero.
+ * The lanes are in Lanes.hpp. */
+
+#ifdef __clang__
+#pragma clang fp contract(off)      // a * b + c must not become an FMA
+#endif
+
+#include "Lanes.hpp"
+
+static_assert(sizeof(Orientation) == 3 * sizeof(float), "Orientation must be three packed floats");
+static_assert(sizeof(Coordinates) == 3 * sizeof(float), "Coordinates must be three packed floats");
+static_assert(sizeof(Quaternion) == 4 * sizeof(float), "Quaternion must be four packed floats");
+
+#define RAD_TO_DEGREE ((float) (180.0 / 3.14159265358979323846))
+#define DEGREE_TO_RAD ((float) (3.14159265358979323846 / 180.0))
+#define HALF_PI ((float) (3.14159265358979323846 / 2.0))
+#define PI ((float) 3.14159265358979323846)
+
+/***** Conversions, one lane at a time *****/
+
+/* Radians to degrees, negative angles moved up to 0 to 360 */
+template <typename L>
+static inline typename L::V to_degrees(typename L::V r) {
+    typename L::V d = L::mul(r, L::set(RAD_TO_DEGREE));
+    return L::select(L::lt(d, L::set(0.0f)), L::add(d, L::set(360.0f)), d);
+}
+
+/* Degrees to radians, angles over 180 moved down to -180 to 180 first */
+template <typename L>
+static inline typename L::V to_radians(typename L::V d) {
+    d = L::select(L::gt(d, L::set(180.0f)), L::sub(d, L::set(360.0f)), d);
+    return L::mul(d, L::set(DEGREE_TO_RAD));
+}
+
+template <typename L>
+static inline typename L::V magnitude(typename L::V x, typename L::V y, typename L::V z) {
+    return L::sqrt(L::add(L::add(L::mul(x, x), L::mul(y, y)), L::mul(z, z)));
+}
+
+/* atan2 without a library call: a polynomial for atan on [0, 1]
+ * (Abramowitz and Stegun 4.4.49, error below 2e-8 rad before rounding),
+ * then the octant is restored. atan2(0, 0) is 0 */
+template <typename L>
+static inline typename L::V arctan2(typename L::V y, typename L::V x) {
+    typedef typename L::V V;
+    V ax = L::abs(x), ay = L::abs(y);
+    typename L::M steep = L::gt(ay, ax);
+    V num = L::select(steep, ax, ay);
+    V den = L::select(steep, ay, ax);
+    V a = L::select(L::eq(den, L::set(0.0f)), L::set(0.0f), L::div(num, den));
+    V s = L::mul(a, a);
+    V p = L::set(-0.0040540580f);
+    p = L::add(L::mul(p, s), L::set(0.0218612288f));
+    p = L::add(L::mul(p, s), L::set(-0.0559098861f));
+    p = L::add(L::mul(p, s), L::set(0.0964200441f));
+    p = L::add(L::mul(p, s), L::set(-0.1390853351f));
+    p = L::add(L::mul(p, s), L::set(0.1994653599f));
+    p = L::add(L::mul(p, s), L::set(-0.3332985605f));
+    p = L::add(L::mul(p, s), L::set(0.9999993329f));
+    V r = L::mul(p, a);
+    r = L::select(steep, L::sub(L::set(HALF_PI), r), r);
+    r = L::select(L::lt(x, L::set(0.0f)), L::sub(L::set(PI), r), r);
+    return L::select(L::lt(y, L::set(0.0f)), L::neg(r), r);
+}
+
+/* Euler angles in radians of a unit quaternion, as RTQuaternion::toEuler
+ * computes them. The asin of the pitch is taken as an atan2, with its
+ * argument clamped to [-1, 1] so rounding cannot give NaN */
+template <typename L>
+static inline void euler(typename L::V w, typename L::V x, typename L::V y, typename L::V z,
+        typename L::V &roll, typename L::V &pitch, typename L::V &yaw) {
+    typedef typename L::V V;
+    V one = L::set(1.0f), two = L::set(2.0f);
+    roll = arctan2<L>(L::mul(two, L::add(L::mul(y, z), L::mul(w, x))),
+        L::sub(one, L::mul(two, L::add(L::mul(x, x), L::mul(y, y)))));
+    V t = L::mul(two, L::sub(L::mul(w, y), L::mul(x, z)));
+    t = L::select(L::gt(t, one), one, t);
+    t = L::select(L::lt(t, L::neg(one)), L::neg(one), t);
+    pitch = arctan2<L>(t, L::sqrt(L::mul(L::sub(one, t), L::add(one, t))));
+    yaw = arctan2<L>(L::mul(two, L::add(L::mul(x, y), L::mul(w, z))),
+        L::sub(one, L::mul(two, L::add(L::mul(y, y), L::mul(z, z)))));
+}
+
+/***** Arrays *****/
+
+/* Each of these converts from element i on, as far as whole groups of
+ * L::width go, and returns where it stopped */
+
+template <typename L>
+static size_t degrees_from(const float *in, float *out, size_t count, size_t i) {
+    for (; i + L::width <= count; i += L::width) {
+        L::store(out + i, to_degrees<L>(L::load(in + i)));
+    }
+    return i;
+}
+
+template <typename L>
+static size_t radians_from(const float *in, float *out, size_t count, size_t i) {
+    for (; i + L::width <= count; i += L::width) {
+        L::store(out + i, to_radians<L>(L::load(in + i)));
+    }
+    return i;
+}
+
+template <typename L>
+static size_t scale_from(const float *in, float *out, size_t count, float factor, size_t i) {
+    for (; i + L::width <= count; i += L::width) {
+        L::store(out + i, L::mul(L::load(in + i), L::set(factor)));
+    }
+    return i;
+}
+
+template <typename L>
+static size_t magnitudes_from(const Coordinates *in, float *out, size_t count, size_t i) {
+    for (; i + L::width <= count; i += L::width) {
+        typename L::V x, y, z;
+        L::load3(&in[i].x, x, y, z);
+        L::store(out + i, magnitude<L>(x, y, z));
+    }
+    return i;
+}
+
+template <typename L>
+static size_t magnitudes_soa_from(const float *x, const float *y, const float *z,
+        float *out, size_t count, size_t i) {
+    for (; i + L::width <= count; i += L::width) {
+        L::store(out + i, magnitude<L>(L::load(x + i), L::load(y + i), L::load(z + i)));
+    }
+    return i;
+}
+
+template <typename L>
+static size_t euler_from(const Quaternion *in, Orientation *out, size_t count, size_t i) {
+    for (; i + L::width <= count; i += L::width) {
+        typename L::V w, x, y, z, roll, pitch, yaw;
+        L::load4(&in[i].w, w, x, y, z);
+        euler<L>(w, x, y, z, roll, pitch, yaw);
+        L::store3(&out[i].roll, roll, pitch, yaw);
+    }
+    return i;
+}
+
+template <typename L>
+static size_t euler_soa_from(const float *w, const float *x, const float *y, const float *z,
+        float *roll, float *pitch, float *yaw, size_t count, size_t i) {
+    for (; i + L::width <= count; i += L::width) {
+        typename L::V r, p, q;
+        euler<L>(L::load(w + i), L::load(x + i), L::load(y + i), L::load(z + i), r, p, q);
+        L::store(roll + i, r);
+        L::store(pitch + i, p);
+        L::store(yaw + i, q);
+    }
+    return i;
+}
+
+#ifdef LANES_VECTOR
+#define VECTOR(call) call
+#else
+#define VECTOR(call) 0
+#endif
+
+/***** C API *****/
+
+// An Orientation array is a float array three times as long, and every
+// element converts on its own
+void radians_to_degrees(const Orientation *in, Orientation *out, size_t count) {
+    radians_to_degrees_soa(&in->roll, &out->roll, 3 * count);
+}
+
+void degrees_to_radians(const Orientation *in, Orientation *out, size_t count) {
+    degrees_to_radians_soa(&in->roll, &out->roll, 3 * count);
+}
+
+void radians_to_degrees_soa(const float *in, float *out, size_t count) {
+    degrees_from<ScalarLanes>(in, out, count, VECTOR(degrees_from<VectorLanes>(in, out, count, 0)));
+}
+
+void degrees_to_radians_soa(const float *in, float *out, size_t count) {
+    radians_from<ScalarLanes>(in, out, count, VECTOR(radians_from<VectorLanes>(in, out, count, 0)));
+}
+
+void quaternions_to_euler(const Quaternion *in, Orientation *out, size_t count) {
+    euler_from<ScalarLanes>(in, out, count, VECTOR(euler_from<VectorLanes>(in, out, count, 0)));
+}
+
+void quaternions_to_euler_soa(const float *w, const float *x, const float *y, const float *z,
+        float *roll, float *pitch, float *yaw, size_t count) {
+    euler_soa_from<ScalarLanes>(w, x, y, z, roll, pitch, yaw, count,
+        VECTOR(euler_soa_from<VectorLanes>(w, x, y, z, roll, pitch, yaw, count, 0)));
+}
+
+void magnitudes(const Coordinates *in, float *out, size_t count) {
+    magnitudes_from<ScalarLanes>(in, out, count, VECTOR(magnitudes_from<VectorLanes>(in, out, count, 0)));
+}
+
+void magnitudes_soa(const float *x, const float *y, const float *z, float *out, size_t count) {
+    magnitudes_soa_from<ScalarLanes>(x, y, z, out, count,
+        VECTOR(magnitudes_soa_from<VectorLanes>(x, y, z, out, count, 0)));
+}
+
+void scale_coordinates(const Coordinates *in, Coordinates *out, size_t count, float factor) {
+    scale_soa(&in->x, &out->x, 3 * count, factor);
+}
+
+void scale_soa(const float *in, float *out, size_t count, float factor) {
+    scale_from<ScalarLanes>(in, out, count, factor, VECTOR(scale_from<VectorLanes>(in, out, count, factor, 0)));
+}
@@ -0,0 +1,309 @@
+#include "GestureDetector.hpp"
+#include "Lanes.hpp"
+#include "SampleChannels.hpp"
+
+#include "algorithm"
+#include "cmath"
+#include "cstring"
+
+// Time constants of the filters, seconds
+#define GESTURE_HIGH_PASS 0.1f
+#define GESTURE_LOW_PASS 0.2f
+// Samples further apart than this start the filters over, microseconds
+#define GESTURE_GAP 500000
+// Swings smaller than this, in g, are not zero crossings
+#define GESTURE_DEADBAND 0.05f
+// Filtered values smaller than this are 0
+#define GESTURE_FLUSH 1e-6f
+// Share of gravity along an axis for the board to rest on that side
+#define GESTURE_SIDE 0.8f
+// Slower turns, in radians per second, count as resting
+#define GESTURE_STILL 0.5f
+
+const GestureSettings default_gesture_settings = {1.5f, 60, 0.5f, 2.0f, 120.0f, 300};
+
+namespace {
+
+enum TapState {
+    TAP_IDLE,
+    TAP_PEAK,               // Above the threshold
+    TAP_TOO_LONG            // Above half of it for longer than a tap
+};
+
+template <typename L>
+float sum(typename L::V v) {
+    float lanes[L::width];
+    L::store(lanes, v);
+    float total = 0.0f;
+    for (size_t k = 0; k < L::width; k++) {
+        total += lanes[k];
+    }
+    return total;
+}
+
+/* Adds x[i] squared to energy, and to crossings 1 for every x[i] of the
+ * other sign than x[i - 1], for i from i up to n as far as whole lanes go.
+ * Returns where it stopped */
+template <typename L>
+size_t window_from(const float *x, size_t n, size_t i, float &energy, float &crossings) {
+    typedef typename L::V V;
+    V e = L::set(0.0f);
+    V c = L::set(0.0f);
+    V one = L::set(1.0f);
+    V zero = L::set(0.0f);
+    V dead = L::set(-GESTURE_DEADBAND * GESTURE_DEADBAND);
+    for (; i + L::width <= n; i += L::width) {
+        V v = L::load(x + i);
+        e = L::add(e, L::mul(v, v));
+        c = L::add(c, L::select(L::lt(L::mul(v, L::load(x + i - 1)), dead), one, zero));
+    }
+    energy += sum<L>(e);
+    crossings += sum<L>(c);
+    return i;
+}
+
+/* Sum of squares and zero crossings of a window */
+void window_stats(const float *x, float &energy, float &crossings) {
+    energy = x[0] * x[0];
+    crossings = 0.0f;
+    size_t i = 1;
+#ifdef LANES_VECTOR
+    i = window_from<VectorLanes>(x, GESTURE_WINDOW, i, energy, crossings);
+#endif
+    window_from<ScalarLanes>(x, GESTURE_WINDOW, i, energy, crossings);
+}
+
+bool positive(float x) {
+    return x > 0 && std::isfinite(x);
+}
+
+/* Axis of the largest of three values, by absolute value */
+int strongest(const float *v) {
+    int axis = fabsf(v[1]) > fabsf(v[0]) ? 1 : 0;
+    return fabsf(v[2]) > fabsf(v[axis]) ? 2 : axis;
+}
+
+}
+
+GestureDetector::GestureDetector() {
+    running = false;
+    settings = default_gesture_settings;
+    queued = 0;
+    drained = 0;
+    reset();
+}
+
+/* Starts looking for gestures with the given settings, from scratch.
+ * Throws if a setting is out of range */
+void GestureDetector::start(const GestureSettings &tuning) {
+    if (!positive(tuning.tap_threshold) || !positive(tuning.shake_threshold) || !positive(tuning.shake_hz) ||
+            !(tuning.flip_degrees >= 0 && std::isfinite(tuning.flip_degrees)) || tuning.tap_ms == 0) {
+        throw "Gesture thresholds must be positive";
+    }
+    std::lock_guard<std::mutex> guard(lock);
+    settings = tuning;
+    reset();
+    running = true;
+}
+
+void GestureDetector::stop(void) noexcept {
+    std::lock_guard<std::mutex> guard(lock);
+    running = false;
+}
+
+/* Copies up to max gestures queued since the last drain, oldest first.
+ * Gestures that were overwritten before they were drained are skipped */
+size_t GestureDetector::drain(Gesture *gestures, size_t max) noexcept {
+    std::lock_guard<std::mutex> guard(lock);
+    if (queued - drained > GESTURE_QUEUE) {
+        drained = queued - GESTURE_QUEUE;
+    }
+    size_t count = std::min<uint64_t>(queued - drained, max);
+    for (size_t i = 0; i < count; i++) {
+        gestures[i] = queue[(drained + i) % GESTURE_QUEUE];
+    }
+    drained += count;
+    return count;
+}
+
+/* Filters an IMU sample into the window and looks for gestures */
+void GestureDetector::add_imu(const ImuSample &sample) noexcept {
+    if (!sample.accel_valid) {
+        return;
+    }
+    std::lock_guard<std::mutex> guard(lock);
+    if (!running.load(std::memory_order_relaxed) || (primed && sample.timestamp <= last_time)) {
+        return; // Stopped meanwhile, or a reading seen already
+    }
+    const float a[3] = {sample.accel.x, sample.accel.y, sample.accel.z};
+    if (!primed || sample.timestamp - last_time > GESTURE_GAP) {
+        memcpy(previous, a, sizeof(previous));
+        memcpy(low, a, sizeof(low));
+        memset(high, 0, sizeof(high));
+        last_time = sample.timestamp;
+        primed = true;
+        return;
+    }
+
+    float dt = (sample.timestamp - last_time) / 1e6f;
+    float pass = GESTURE_HIGH_PASS / (GESTURE_HIGH_PASS + dt);
+    float follow = dt / (GESTURE_LOW_PASS + dt);
+    size_t slot = samples % GESTURE_WINDOW;
+    for (int k = 0; k < 3; k++) {
+        high[k] = pass * (high[k] + a[k] - previous[k]);
+        low[k] += follow * (a[k] - low[k]);
+        // Both decay into denormals towards a steady 0, slow to work with
+        if (fabsf(high[k]) < GESTURE_FLUSH) {
+            high[k] = 0.0f;
+        }
+        if (fabsf(low[k]) < GESTURE_FLUSH) {
+            low[k] = 0.0f;
+        }
+        previous[k] = a[k];
+        window[k][slot] = high[k];
+        window[k][slot + GESTURE_WINDOW] = high[k];
+    }
+    times[slot] = sample.timestamp;
+    last_time = sample.timestamp;
+    samples++;
+
+    detect_tap(sample.timestamp);
+    if (samples >= GESTURE_WINDOW && samples % GESTURE_HOP == 0) {
+        detect_shake(sample.timestamp);
+    }
+    detect_flip(sample, dt);
+}
+
+// Needs lock
+void GestureDetector::reset(void) noexcept {
+    primed = false;
+    last_time = 0;
+    memset(previous, 0, sizeof(previous));
+    memset(high, 0, sizeof(high));
+    memset(low, 0, sizeof(low));
+    // Fault the pages in now rather than in the sampling path
+    memset(window, 0, sizeof(window));
+    memset(times, 0, sizeof(times));
+    samples = 0;
+    quiet = true;
+    tap_state = TAP_IDLE;
+    tap_start = 0;
+    tap_time = 0;
+    tap_peak = 0.0f;
+    tap_axis = 0;
+    tap_direction = 0;
+    shaking = false;
+    face = -1;
+    candidate = -1;
+    candidate_since = 0;
+    turned = 0.0f;
+    turn_seen = false;
+}
+
+// Needs lock
+void GestureDetector::detect_tap(uint64_t now) noexcept {
+    uint64_t longest = settings.tap_ms * 1000ull;
+    float m = sqrtf(high[0] * high[0] + high[1] * high[1] + high[2] * high[2]);
+    float release = settings.tap_threshold / 2;
+    switch (tap_state) {
+    case TAP_IDLE:
+        // The filter rings for a moment after a tap, which is no new one
+        if (m > settings.tap_threshold && quiet && !shaking && now > tap_time + longest) {
+            tap_state = TAP_PEAK;
+            tap_start = now;
+            tap_time = now;
+            tap_peak = m;
+            tap_axis = strongest(high);
+            tap_direction = high[tap_axis] < 0 ? -1 : 1;
+        }
+        break;
+    case TAP_PEAK:
+        if (m > tap_peak) {
+            tap_time = now;
+            tap_peak = m;
+            tap_axis = strongest(high);
+            tap_direction = high[tap_axis] < 0 ? -1 : 1;
+        }
+        if (now - tap_start > longest) {
+            tap_state = TAP_TOO_LONG;
+        } else if (m < release) {
+            report(tap_time, GESTURE_TAP, tap_axis, tap_direction, tap_peak);
+            tap_state = TAP_IDLE;
+        }
+        break;
+    case TAP_TOO_LONG:
+        if (m < release) {
+            tap_state = TAP_IDLE;
+        }
+        break;
+    }
+}
+
+// Needs lock and a full window
+void GestureDetector::detect_shake(uint64_t now) noexcept {
+    // The newest sample is at slot, so the window starts after it
+    size_t slot = (samples - 1) % GESTURE_WINDOW;
+    float energy[3], crossings[3];
+    for (int k = 0; k < 3; k++) {
+        window_stats(window[k] + slot + 1, energy[k], crossings[k]);
+    }
+    int axis = strongest(energy);
+    float rms = sqrtf(energy[axis] / GESTURE_WINDOW);
+    float span = (times[slot] - times[samples % GESTURE_WINDOW]) / 1e6f;
+    float rate = span > 0 ? crossings[axis] / span : 0.0f;
+    quiet = sqrtf((energy[0] + energy[1] + energy[2]) / GESTURE_WINDOW) < settings.tap_threshold / 4;
+    if (!shaking && rms >= settings.shake_threshold && rate >= 2 * settings.shake_hz) {
+        shaking = true;
+        report(now, GESTURE_SHAKE, axis, 0, rms);
+    } else if (shaking && rms < settings.shake_threshold / 2) {
+        shaking = false;
+    }
+}
+
+// Needs lock
+void GestureDetector::detect_flip(const ImuSample &sample, float dt) noexcept {
+    float rate = sample.gyro_valid ? magnitude(sample.gyro) : 0.0f;
+    if (sample.gyro_valid) {
+        turned += rate * dt;
+        turn_seen = true;
+    }
+    int axis = strongest(low);
+    int side = fabsf(low[axis]) > GESTURE_SIDE ? 2 * axis + (low[axis] < 0) : -1;
+    if (side != candidate) {
+        candidate = side;
+        candidate_since = sample.timestamp;
+    }
+    if (side < 0) {
+        return;
+    }
+    if (side == face) {
+        // The low pass lags, so a turn may have started while gravity
+        // still seems to be on this side. Counted from the last stillness
+        if (rate < GESTURE_STILL) {
+            turned = 0.0f;
+            turn_seen = false;
+        }
+        return;
+    }
+    if (sample.timestamp - candidate_since < settings.flip_ms * 1000ull) {
+        return;
+    }
+    float degrees = turned * (float) (180.0 / M_PI);
+    if (face >= 0 && side == (face ^ 1) && (!turn_seen || degrees >= settings.flip_degrees)) {
+        report(sample.timestamp, GESTURE_FLIP, axis, low[axis] < 0 ? -1 : 1, turn_seen ? degrees : 0.0f);
+    }
+    face = side;
+    turned = 0.0f;
+    turn_seen = false;
+}
+
+// Needs lock
+void GestureDetector::report(uint64_t timestamp, GestureKind kind, int axis, int direction, float strength) noexcept {
+    Gesture &gesture = queue[queued % GESTURE_QUEUE];
+    gesture.timestamp = timestamp;
+    gesture.kind = kind;
+    gesture.axis = axis;
+    gesture.direction = direction;
+    gesture.strength = strength;
+    queued++;
+}
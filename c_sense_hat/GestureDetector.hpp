@@ -0,0 +1,89 @@
+#ifndef GESTURE_DETECTOR_HPP
+#define GESTURE_DETECTOR_HPP
+
+extern "C" {
+    #include "SenseHatSensors.h"
+}
+
+#include "atomic"
+#include "cstdint"
+#include "mutex"
+
+// Samples in the window of the shake detector, about 0.64 s at 100 Hz
+#define GESTURE_WINDOW 64
+// The window is looked at every this many samples
+#define GESTURE_HOP 8
+// Gestures kept for drain_gestures, older ones are dropped
+#define GESTURE_QUEUE 64
+
+// Used for NULL settings, see start_gestures
+extern const GestureSettings default_gesture_settings;
+
+/* Taps, shakes and flips seen in the IMU samples, fed by the Wrapper like
+ * ChannelWindows.
+ *
+ * Each accelerometer sample goes through two one pole filters: a high
+ * pass that takes gravity out, and a low pass that keeps only gravity.
+ *  - A tap is a peak of the high passed magnitude over tap_threshold that
+ *    falls back under half of it within tap_ms, after a quiet window.
+ *  - A shake is a window whose strongest axis has an RMS over
+ *    shake_threshold and crosses zero at least twice shake_hz times a
+ *    second. It is reported once, and again only after the RMS fell under
+ *    half the threshold.
+ *  - A flip is the low passed gravity settling, for flip_ms, on the axis
+ *    it was on before but with the other sign, after the gyroscope saw
+ *    the board turn flip_degrees since it last rested.
+ *
+ * The window is a fixed array per axis in which each sample is written
+ * twice, GESTURE_WINDOW apart, so the newest GESTURE_WINDOW samples are
+ * always contiguous and the energy and zero crossings come from one
+ * vector kernel (see Lanes.hpp) every GESTURE_HOP samples. Nothing is
+ * allocated after construction. */
+class GestureDetector {
+public:
+    GestureDetector();
+    void start(const GestureSettings &);
+    void stop(void) noexcept;
+    size_t drain(Gesture *, size_t) noexcept;
+    void add_imu(const ImuSample &) noexcept;
+
+    /* True while started, checked before building samples */
+    bool detecting(void) const noexcept {
+        return running.load(std::memory_order_relaxed);
+    }
+private:
+    void reset(void) noexcept;
+    void detect_tap(uint64_t) noexcept;
+    void detect_shake(uint64_t) noexcept;
+    void detect_flip(const ImuSample &, float) noexcept;
+    void report(uint64_t, GestureKind, int, int, float) noexcept;
+    std::mutex lock;            // Held while samples are added or settings changed
+    std::atomic<bool> running;
+    GestureSettings settings;
+    bool primed;                // The filters hold a sample
+    uint64_t last_time;
+    float previous[3];          // Accelerometer of the last sample
+    float high[3];              // High passed
+    float low[3];               // Low passed
+    float window[3][2 * GESTURE_WINDOW];    // High passed, see above
+    uint64_t times[GESTURE_WINDOW];
+    uint64_t samples;           // Since started
+    bool quiet;                 // The last window was still enough for taps
+    int tap_state;
+    uint64_t tap_start;
+    uint64_t tap_time;          // Of the peak
+    float tap_peak;
+    int tap_axis;
+    int tap_direction;
+    bool shaking;
+    int face;                   // Side resting down, 2 * axis + (sign < 0), -1 if none yet
+    int candidate;              // Side down now, -1 if none
+    uint64_t candidate_since;
+    float turned;               // Radians since the board last rested
+    bool turn_seen;             // Some gyroscope sample was valid meanwhile
+    Gesture queue[GESTURE_QUEUE];
+    uint64_t queued;            // Gestures ever queued
+    uint64_t drained;           // Of those, handed out by drain or dropped
+};
+
+#endif /* GESTURE_DETECTOR_HPP */
@@ -0,0 +1,171 @@
+#ifndef LANES_HPP
+#define LANES_HPP
+
+#include "cmath"
+#include "cstddef"
+
+/* Float lanes for kernels written once as a template over the lane type
+ * (see Conversions.cpp): ScalarLanes, one float, and VectorLanes, four in
+ * a NEON or SSE2 register, when the compiler targets either. LANES_VECTOR
+ * is defined when VectorLanes exists.
+ *
+ * SSE2 is only used when float maths is done in SSE registers too, not on
+ * the x87 stack (-m32 without -mfpmath=sse), where the scalar results
+ * would carry extra precision. */
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include "arm_neon.h"
+#define LANES_NEON
+#define LANES_VECTOR
+#elif defined(__SSE2__) && defined(__SSE2_MATH__)
+#include "emmintrin.h"
+#define LANES_SSE2
+#define LANES_VECTOR
+#endif
+
+struct ScalarLanes {
+    typedef float V;
+    typedef bool M;
+    static const size_t width = 1;
+    static V load(const float *p) { return *p; }
+    static void store(float *p, V v) { *p = v; }
+    static V set(float x) { return x; }
+    static V add(V a, V b) { return a + b; }
+    static V sub(V a, V b) { return a - b; }
+    static V mul(V a, V b) { return a * b; }
+    static V div(V a, V b) { return a / b; }
+    static V sqrt(V a) { return sqrtf(a); }
+    static V abs(V a) { return fabsf(a); }
+    static V neg(V a) { return -a; }
+    static M lt(V a, V b) { return a < b; }
+    static M gt(V a, V b) { return a > b; }
+    static M eq(V a, V b) { return a == b; }
+    static V select(M m, V a, V b) { return m ? a : b; }
+    static void load3(const float *p, V &x, V &y, V &z) {
+        x = p[0];
+        y = p[1];
+        z = p[2];
+    }
+    static void store3(float *p, V x, V y, V z) {
+        p[0] = x;
+        p[1] = y;
+        p[2] = z;
+    }
+    static void load4(const float *p, V &w, V &x, V &y, V &z) {
+        w = p[0];
+        x = p[1];
+        y = p[2];
+        z = p[3];
+    }
+};
+
+#ifdef LANES_NEON
+struct VectorLanes {
+    typedef float32x4_t V;
+    typedef uint32x4_t M;
+    static const size_t width = 4;
+    static V load(const float *p) { return vld1q_f32(p); }
+    static void store(float *p, V v) { vst1q_f32(p, v); }
+    static V set(float x) { return vdupq_n_f32(x); }
+    static V add(V a, V b) { return vaddq_f32(a, b); }
+    static V sub(V a, V b) { return vsubq_f32(a, b); }
+    static V mul(V a, V b) { return vmulq_f32(a, b); }
+#ifdef __aarch64__
+    static V div(V a, V b) { return vdivq_f32(a, b); }
+    static V sqrt(V a) { return vsqrtq_f32(a); }
+#else
+    // ARMv7 NEON only has estimates, which would not match the scalar
+    // results, so these two go lane by lane
+    static V div(V a, V b) {
+        float x[4], y[4];
+        vst1q_f32(x, a);
+        vst1q_f32(y, b);
+        for (int i = 0; i < 4; i++) {
+            x[i] = x[i] / y[i];
+        }
+        return vld1q_f32(x);
+    }
+    static V sqrt(V a) {
+        float x[4];
+        vst1q_f32(x, a);
+        for (int i = 0; i < 4; i++) {
+            x[i] = sqrtf(x[i]);
+        }
+        return vld1q_f32(x);
+    }
+#endif
+    static V abs(V a) { return vabsq_f32(a); }
+    static V neg(V a) { return vnegq_f32(a); }
+    static M lt(V a, V b) { return vcltq_f32(a, b); }
+    static M gt(V a, V b) { return vcgtq_f32(a, b); }
+    static M eq(V a, V b) { return vceqq_f32(a, b); }
+    static V select(M m, V a, V b) { return vbslq_f32(m, a, b); }
+    static void load3(const float *p, V &x, V &y, V &z) {
+        float32x4x3_t v = vld3q_f32(p);
+        x = v.val[0];
+        y = v.val[1];
+        z = v.val[2];
+    }
+    static void store3(float *p, V x, V y, V z) {
+        float32x4x3_t v = {{x, y, z}};
+        vst3q_f32(p, v);
+    }
+    static void load4(const float *p, V &w, V &x, V &y, V &z) {
+        float32x4x4_t v = vld4q_f32(p);
+        w = v.val[0];
+        x = v.val[1];
+        y = v.val[2];
+        z = v.val[3];
+    }
+};
+#endif
+
+#ifdef LANES_SSE2
+struct VectorLanes {
+    typedef __m128 V;
+    typedef __m128 M;
+    static const size_t width = 4;
+    static V load(const float *p) { return _mm_loadu_ps(p); }
+    static void store(float *p, V v) { _mm_storeu_ps(p, v); }
+    static V set(float x) { return _mm_set1_ps(x); }
+    static V add(V a, V b) { return _mm_add_ps(a, b); }
+    static V sub(V a, V b) { return _mm_sub_ps(a, b); }
+    static V mul(V a, V b) { return _mm_mul_ps(a, b); }
+    static V div(V a, V b) { return _mm_div_ps(a, b); }
+    static V sqrt(V a) { return _mm_sqrt_ps(a); }
+    static V abs(V a) { return _mm_andnot_ps(_mm_set1_ps(-0.0f), a); }
+    static V neg(V a) { return _mm_xor_ps(_mm_set1_ps(-0.0f), a); }
+    static M lt(V a, V b) { return _mm_cmplt_ps(a, b); }
+    static M gt(V a, V b) { return _mm_cmpgt_ps(a, b); }
+    static M eq(V a, V b) { return _mm_cmpeq_ps(a, b); }
+    static V select(M m, V a, V b) { return _mm_or_ps(_mm_and_ps(m, a), _mm_andnot_ps(m, b)); }
+    // Four x, y, z triples in three vectors a, b, c:
+    // x0 y0 z0 x1 | y1 z1 x2 y2 | z2 x3 y3 z3
+    static void load3(const float *p, V &x, V &y, V &z) {
+        V a = _mm_loadu_ps(p), b = _mm_loadu_ps(p + 4), c = _mm_loadu_ps(p + 8);
+        x = _mm_shuffle_ps(_mm_shuffle_ps(a, b, _MM_SHUFFLE(2, 2, 3, 0)),
+            _mm_shuffle_ps(b, c, _MM_SHUFFLE(1, 1, 2, 2)), _MM_SHUFFLE(2, 0, 1, 0));
+        y = _mm_shuffle_ps(_mm_shuffle_ps(a, b, _MM_SHUFFLE(0, 0, 1, 1)),
+            _mm_shuffle_ps(b, c, _MM_SHUFFLE(2, 2, 3, 3)), _MM_SHUFFLE(2, 0, 2, 0));
+        z = _mm_shuffle_ps(_mm_shuffle_ps(a, b, _MM_SHUFFLE(1, 1, 2, 2)),
+            _mm_shuffle_ps(c, c, _MM_SHUFFLE(3, 3, 0, 0)), _MM_SHUFFLE(2, 0, 2, 0));
+    }
+    static void store3(float *p, V x, V y, V z) {
+        _mm_storeu_ps(p, _mm_shuffle_ps(_mm_shuffle_ps(x, y, _MM_SHUFFLE(0, 0, 0, 0)),
+            _mm_shuffle_ps(z, x, _MM_SHUFFLE(1, 1, 0, 0)), _MM_SHUFFLE(2, 0, 2, 0)));
+        _mm_storeu_ps(p + 4, _mm_shuffle_ps(_mm_shuffle_ps(y, z, _MM_SHUFFLE(1, 1, 1, 1)),
+            _mm_shuffle_ps(x, y, _MM_SHUFFLE(2, 2, 2, 2)), _MM_SHUFFLE(2, 0, 2, 0)));
+        _mm_storeu_ps(p + 8, _mm_shuffle_ps(_mm_shuffle_ps(z, x, _MM_SHUFFLE(3, 3, 2, 2)),
+            _mm_shuffle_ps(y, z, _MM_SHUFFLE(3, 3, 3, 3)), _MM_SHUFFLE(2, 0, 2, 0)));
+    }
+    static void load4(const float *p, V &w, V &x, V &y, V &z) {
+        w = _mm_loadu_ps(p);
+        x = _mm_loadu_ps(p + 4);
+        y = _mm_loadu_ps(p + 8);
+        z = _mm_loadu_ps(p + 12);
+        _MM_TRANSPOSE4_PS(w, x, y, z);
+    }
+};
+#endif
+
+#endif /* LANES_HPP */
@@ -0,0 +1,257 @@
+#include "LedAnimator.hpp"
+
+/* Constructor. The player thread is only started by the first play */
+LedAnimator::LedAnimator(framebuffer *target, std::mutex *target_lock) {
+    fb = target;
+    fb_lock = target_lock;
+    quit = false;
+    active = false;
+    restart = false;
+    loop = false;
+    text = false;
+    strip_length = 0;
+    text_colour = 0xFFFF;
+    back_colour = 0;
+    column_time = std::chrono::milliseconds(100);
+    total = clock::duration::zero();
+    index = 0;
+    shown = 0;
+    dropped = 0;
+}
+
+/* Destructor */
+LedAnimator::~LedAnimator() {
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        quit = true;
+    }
+    wake.notify_one();
+    if (player.joinable()) {
+        player.join();
+    }
+}
+
+/* Plays count frames of 64 pixels each, frame i is shown for
+ * durations_ms[i] milliseconds. An animation that is already playing is
+ * replaced at once */
+void LedAnimator::play(const uint16_t *images, const uint32_t *durations_ms, size_t count, bool repeat) {
+    if (count == 0) {
+        throw "An animation needs at least one frame";
+    }
+    // Build the new timeline before taking the lock, so the player is
+    // never held up by the copy
+    std::vector<framebuffer> new_frames(count);
+    std::vector<clock::duration> new_offsets(count);
+    clock::duration length = clock::duration::zero();
+    for (size_t i = 0; i < count; i++) {
+        if (durations_ms[i] == 0) {
+            throw "Frame durations must be at least 1 ms";
+        }
+        memcpy(&new_frames[i], images + i * 64, sizeof(framebuffer));
+        new_offsets[i] = length;
+        length += std::chrono::milliseconds(durations_ms[i]);
+    }
+
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        frames.swap(new_frames);
+        offsets.swap(new_offsets);
+        total = length;
+        loop = repeat;
+        text = false;
+        start();
+    }
+    wake.notify_one();
+}
+
+/* Scrolls message from right to left, moving one column every
+ * ms_per_column milliseconds. Replaces whatever is playing */
+void LedAnimator::show_message(const char *message, uint16_t colour, uint16_t background,
+        uint32_t ms_per_column, bool repeat) {
+    if (ms_per_column == 0) {
+        throw "Scroll speed must be at least 1 ms per column";
+    }
+    // Render outside the lock, the glyphs are shifted down one row so the
+    // 7 pixel high font sits at the bottom of the display
+    uint8_t columns[MESSAGE_COLUMNS];
+    size_t length = 0;
+    memset(columns, 0, 8);
+    length += 8;
+    for (size_t i = 0; message[i] != '\0' && i < MAX_MESSAGE_LENGTH; i++) {
+        const uint8_t *g = glyph(message[i]);
+        for (size_t x = 0; x < GLYPH_WIDTH; x++) {
+            columns[length++] = (uint8_t) (g[x] << 1);
+        }
+        columns[length++] = 0;
+    }
+    memset(columns + length, 0, 8);
+    length += 8;
+
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        memcpy(strip, columns, length);
+        strip_length = length;
+        text_colour = colour;
+        back_colour = background;
+        column_time = std::chrono::milliseconds(ms_per_column);
+        loop = repeat;
+        text = true;
+        total = frame_count() * column_time;
+        start();
+    }
+    wake.notify_one();
+}
+
+/* Changes the scroll speed of the current message without restarting it */
+void LedAnimator::set_message_speed(uint32_t ms_per_column) {
+    if (ms_per_column == 0) {
+        throw "Scroll speed must be at least 1 ms per column";
+    }
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        column_time = std::chrono::milliseconds(ms_per_column);
+        if (text) {
+            total = frame_count() * column_time;
+            // Keep the position, the next step comes one new step from now
+            cycle_start = clock::now() - (index > 0 ? index - 1 : 0) * column_time;
+        }
+    }
+    wake.notify_one();
+}
+
+/* Changes the colours of the current message from its next step on */
+void LedAnimator::set_message_colour(uint16_t colour, uint16_t background) {
+    std::lock_guard<std::mutex> guard(lock);
+    text_colour = colour;
+    back_colour = background;
+}
+
+/* Starts playing what was just handed over. Called with the lock held */
+void LedAnimator::start(void) {
+    active = true;
+    restart = true;
+    if (!player.joinable()) {
+        player = std::thread(&LedAnimator::run, this);
+    }
+}
+
+/* Number of frames, or scroll steps, in one cycle */
+size_t LedAnimator::frame_count(void) {
+    if (text) {
+        // When looping the last step (all blank) is the same as the first
+        return strip_length - 7 - (loop ? 1 : 0);
+    }
+    return frames.size();
+}
+
+/* Time from the start of the cycle until frame i is shown */
+LedAnimator::clock::duration LedAnimator::frame_offset(size_t i) {
+    if (text) {
+        return i * column_time;
+    }
+    return offsets[i];
+}
+
+/* Copies frame i, or scroll step i, to the LEDs in one go. Called with the
+ * lock held, fb_lock is taken after it */
+void LedAnimator::render(size_t i) {
+    if (!text) {
+        std::lock_guard<std::mutex> guard(*fb_lock);
+        memcpy(fb, &frames[i], sizeof(framebuffer));
+        return;
+    }
+    framebuffer out;
+    for (size_t x = 0; x < 8; x++) {
+        uint8_t column = strip[i + x];
+        for (size_t y = 0; y < 8; y++) {
+            out.frame[y][x] = (column >> y) & 1 ? text_colour : back_colour;
+        }
+    }
+    std::lock_guard<std::mutex> guard(*fb_lock);
+    memcpy(fb, &out, sizeof(framebuffer));
+}
+
+/* Stops the animation, the current frame stays on the LEDs */
+void LedAnimator::stop(void) {
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        active = false;
+    }
+    wake.notify_one();
+}
+
+bool LedAnimator::playing(void) {
+    return owns_display();
+}
+
+uint64_t LedAnimator::frames_shown(void) {
+    std::lock_guard<std::mutex> guard(lock);
+    return shown;
+}
+
+uint64_t LedAnimator::frames_dropped(void) {
+    std::lock_guard<std::mutex> guard(lock);
+    return dropped;
+}
+
+/* Body of the player thread */
+void LedAnimator::run(void) {
+    std::unique_lock<std::mutex> guard(lock);
+    while (!quit) {
+        if (!active) {
+            wake.wait(guard);
+            continue;
+        }
+        if (restart) {
+            restart = false;
+            cycle_start = clock::now();
+            index = 0;
+        }
+        if (index == frame_count()) {
+            // Played once, the last frame keeps the display for its whole
+            // duration before the animation ends
+            clock::time_point end = cycle_start + total;
+            if (clock::now() < end) {
+                wake.wait_until(guard, end);
+            } else {
+                active = false;
+            }
+            continue;
+        }
+        clock::time_point due = cycle_start + frame_offset(index);
+        if (clock::now() < due) {
+            // Woken early by play, stop or exit, everything is checked again
+            wake.wait_until(guard, due);
+            continue;
+        }
+        show_due_frame(clock::now());
+    }
+}
+
+/* Shows the newest frame whose time has come and skips the ones before it.
+ * Called with the lock held */
+void LedAnimator::show_due_frame(clock::time_point now) {
+    clock::duration elapsed = now - cycle_start;
+    size_t count = frame_count();
+    if (loop && elapsed >= total) {
+        // Overslept into a later cycle
+        uint64_t cycles = elapsed / total;
+        dropped += (count - index) + (cycles - 1) * count;
+        cycle_start += cycles * total;
+        elapsed -= cycles * total;
+        index = 0;
+    }
+    size_t next = index;
+    while (next + 1 < count && frame_offset(next + 1) <= elapsed) {
+        next++;
+    }
+    dropped += next - index;
+    render(next);
+    shown++;
+
+    index = next + 1;
+    if (index == count && loop) {
+        cycle_start += total;
+        index = 0;
+    }
+}
@@ -0,0 +1,83 @@
+#ifndef LED_ANIMATOR_HPP
+#define LED_ANIMATOR_HPP
+
+#include "SenseHatSensors.hpp"
+#include "FontAtlas.hpp"
+
+#include "chrono"
+#include "condition_variable"
+#include "vector"
+
+// Longest message show_message accepts, longer ones are cut off
+#define MAX_MESSAGE_LENGTH 128
+// A blank screen before and after the text lets it scroll in and out
+#define MESSAGE_COLUMNS (8 + MAX_MESSAGE_LENGTH * (GLYPH_WIDTH + 1) + 8)
+
+/* Plays a sequence of LED frames on its own thread.
+ *
+ * The timeline is precomputed when an animation is handed over: every frame
+ * gets a fixed offset from the start of the animation, and the player
+ * sleeps until the absolute time of the next frame. The frame rate does not
+ * depend on the load of the calling thread and does not drift. If the
+ * player wakes up too late, the frames it missed are skipped and counted as
+ * dropped.
+ *
+ * Besides frame sequences it can scroll a message. The text is rendered
+ * once into a strip of pixel columns and every step copies the next 8
+ * columns of the strip to the LEDs, so scrolling never allocates.
+ *
+ * Frames are copied to the LEDs under the lock of the Wrapper that guards
+ * the framebuffer, so they never interleave with a direct draw. While a
+ * timeline is being played the display belongs to the animator, see
+ * owns_display. */
+class LedAnimator {
+public:
+    LedAnimator(framebuffer *, std::mutex *);
+    ~LedAnimator();
+    void play(const uint16_t *, const uint32_t *, size_t, bool);
+    void show_message(const char *, uint16_t, uint16_t, uint32_t, bool);
+    void set_message_speed(uint32_t);
+    void set_message_colour(uint16_t, uint16_t);
+    void stop(void);
+    bool playing(void);
+    uint64_t frames_shown(void);
+    uint64_t frames_dropped(void);
+
+    /* True while a timeline is being played. Read without the lock, so the
+     * Wrapper can check it while holding its own */
+    bool owns_display(void) const noexcept {
+        return active.load(std::memory_order_acquire);
+    }
+private:
+    typedef std::chrono::steady_clock clock;
+    void run(void);
+    void show_due_frame(clock::time_point);
+    size_t frame_count(void);
+    clock::duration frame_offset(size_t);
+    void render(size_t);
+    void start(void);
+    framebuffer *fb;
+    std::mutex *fb_lock;            // The Wrapper's led_lock, guards fb
+    std::thread player;
+    std::mutex lock;
+    std::condition_variable wake;   // Signalled on play, stop and exit
+    bool quit;
+    std::atomic<bool> active;       // A timeline is being played
+    bool restart;                   // A new timeline was handed over
+    bool loop;
+    bool text;                      // Scrolling a message, not playing frames
+    std::vector<framebuffer> frames;
+    std::vector<clock::duration> offsets;  // Start of every frame
+    uint8_t strip[MESSAGE_COLUMNS]; // One byte per column, bit 0 at the top
+    size_t strip_length;
+    uint16_t text_colour;
+    uint16_t back_colour;
+    clock::duration column_time;    // Time every scroll step is shown
+    clock::duration total;
+    clock::time_point cycle_start;
+    size_t index;                   // Next frame to show, frame_count() after the last of a single run
+    uint64_t shown;
+    uint64_t dropped;
+};
+
+#endif /* LED_ANIMATOR_HPP */
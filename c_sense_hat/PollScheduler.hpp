@@ -0,0 +1,91 @@
+#ifndef POLL_SCHEDULER_HPP
+#define POLL_SCHEDULER_HPP
+
+#include "atomic"
+#include "cstdint"
+
+#include "errno.h"
+#include "time.h"
+
+/* Current time on the monotonic clock in nanoseconds */
+static inline uint64_t monotonic_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/* Sleeps until the monotonic clock reaches deadline (nanoseconds) */
+static inline void sleep_until_ns(uint64_t deadline) {
+    struct timespec ts;
+    ts.tv_sec = deadline / 1000000000ull;
+    ts.tv_nsec = deadline % 1000000000ull;
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR) {}
+}
+
+/* Keeps track of when the IMU has its next sample ready.
+ *
+ * Reads are placed on a fixed grid of one poll interval, so a reader only
+ * sleeps for what is left of the current interval and never after a
+ * successful read. If a read fails it is retried after a backoff that
+ * doubles on every attempt. Readers may wait from any thread, advance
+ * must only be called by one reader at a time. */
+class PollScheduler {
+public:
+    PollScheduler() : interval(0), next_due(0), max_attempts(3), backoff(0) {}
+
+    void set_interval(uint64_t interval_ns) {
+        interval = interval_ns;
+    }
+
+    /* Sets the number of reads tried per sample and the delay before the
+     * first retry. A backoff of 0 retries after one poll interval */
+    void set_policy(int attempts, uint64_t backoff_ns) {
+        max_attempts = attempts;
+        backoff = backoff_ns;
+    }
+
+    int attempts(void) const {
+        return max_attempts;
+    }
+
+    /* Sleeps until the next sample is due, returns at once if it is late.
+     * Returns the nanoseconds slept */
+    uint64_t wait_due(void) const {
+        uint64_t now = monotonic_ns();
+        uint64_t due = next_due.load(std::memory_order_relaxed);
+        if (now >= due) {
+            return 0;
+        }
+        sleep_until_ns(due);
+        return monotonic_ns() - now;
+    }
+
+    /* Sleeps before retry number n, counting from 1. Returns the
+     * nanoseconds slept */
+    uint64_t wait_retry(int n) const {
+        uint64_t delay = backoff ? backoff.load() : interval.load();
+        uint64_t now = monotonic_ns();
+        sleep_until_ns(now + (delay << (n > 16 ? 15 : n - 1)));
+        return monotonic_ns() - now;
+    }
+
+    /* Moves the deadline to the next grid point. A reader that fell more
+     * than an interval behind starts a new grid from now */
+    void advance(void) {
+        uint64_t now = monotonic_ns();
+        uint64_t due = next_due.load(std::memory_order_relaxed) + interval;
+        if (due <= now) {
+            due = now + interval;
+        }
+        next_due.store(due, std::memory_order_relaxed);
+    }
+
+private:
+    // Everything may be read by another thread while a reader is polling
+    std::atomic<uint64_t> interval;
+    std::atomic<uint64_t> next_due;
+    std::atomic<int> max_attempts;
+    std::atomic<uint64_t> backoff;
+};
+
+#endif /* POLL_SCHEDULER_HPP */
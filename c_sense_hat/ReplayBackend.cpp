@@ -0,0 +1,230 @@
+#include "ReplayBackend.hpp"
+
+#include "cmath"
+#include "cstdlib"
+
+#include "string.h"
+
+// Sample spacing of synthetic signals when playing as fast as possible
+#define SYNTHETIC_INTERVAL_US 10000
+
+/* Constructor. trace is NULL for a synthetic signal */
+ReplayBackend::ReplayBackend(const char *trace, float rate_hz) {
+    synthetic = (trace == NULL);
+    interval_us = rate_hz > 0 ? (int) (1000000 / rate_hz) : 0;
+    imu_span = 0;
+    env_span = 0;
+    imu_count = 0;
+    env_count = 0;
+    memset(&env, 0, sizeof(env_record));
+    env_pressure_read = true;   // Forces the first read to load a sample
+    env_humidity_read = true;
+    if (!synthetic) {
+        load(trace);
+    }
+}
+
+/* Reads every sample of a trace file into memory */
+void ReplayBackend::load(const char *trace) {
+    FILE *file = fopen(trace, "r");
+    if (!file) {
+        throw "Could not open trace";
+    }
+    char line[256];
+    while (fgets(line, sizeof(line), file)) {
+        unsigned long long timestamp;
+        if (strncmp(line, "imu ", 4) == 0) {
+            imu_record r;
+            if (sscanf(line + 4, "%llu %f %f %f %f %f %f %f %f %f", &timestamp,
+                        &r.gyro[0], &r.gyro[1], &r.gyro[2],
+                        &r.accel[0], &r.accel[1], &r.accel[2],
+                        &r.compass[0], &r.compass[1], &r.compass[2]) == 10) {
+                r.timestamp = timestamp;
+                imu_records.push_back(r);
+            }
+        } else if (strncmp(line, "env ", 4) == 0) {
+            env_record r;
+            if (sscanf(line + 4, "%llu %f %f %f %f", &timestamp, &r.pressure,
+                        &r.pressure_temperature, &r.humidity, &r.humidity_temperature) == 5) {
+                r.timestamp = timestamp;
+                env_records.push_back(r);
+            }
+        }
+    }
+    fclose(file);
+
+    // Looping continues the timestamps one average interval after the end
+    size_t n = imu_records.size();
+    if (n > 1) {
+        uint64_t length = imu_records[n - 1].timestamp - imu_records[0].timestamp;
+        imu_span = length + length / (n - 1);
+    }
+    n = env_records.size();
+    if (n > 1) {
+        uint64_t length = env_records[n - 1].timestamp - env_records[0].timestamp;
+        env_span = length + length / (n - 1);
+    }
+}
+
+void ReplayBackend::open_imu(void) {
+    if (!synthetic && imu_records.empty()) {
+        throw "No IMU found";
+    }
+}
+
+void ReplayBackend::open_pressure(void) {
+    if (!synthetic && env_records.empty()) {
+        throw "No pressure sensor found";
+    }
+}
+
+void ReplayBackend::open_humidity(void) {
+    if (!synthetic && env_records.empty()) {
+        throw "No humidity sensor found";
+    }
+}
+
+bool ReplayBackend::imu_init(void) {
+    return true;
+}
+
+int ReplayBackend::imu_poll_interval_us(void) {
+    return interval_us;
+}
+
+/* Hands out the next IMU sample, fused like RTIMU does */
+bool ReplayBackend::imu_read(RTIMU_DATA &data) {
+    imu_record r;
+    if (synthetic) {
+        synthesize_imu(imu_count, r);
+    } else {
+        size_t n = imu_records.size();
+        r = imu_records[imu_count % n];
+        r.timestamp += (imu_count / n) * imu_span;
+    }
+    imu_count++;
+
+    data.timestamp = r.timestamp;
+    data.gyroValid = !std::isnan(r.gyro[0]);
+    data.gyro = RTVector3(r.gyro[0], r.gyro[1], r.gyro[2]);
+    data.accelValid = !std::isnan(r.accel[0]);
+    data.accel = RTVector3(r.accel[0], r.accel[1], r.accel[2]);
+    data.compassValid = !std::isnan(r.compass[0]);
+    data.compass = RTVector3(r.compass[0], r.compass[1], r.compass[2]);
+    data.pressureValid = false;
+    data.temperatureValid = false;
+    data.humidityValid = false;
+    fusion.newIMUData(data, settings);
+    return true;
+}
+
+void ReplayBackend::set_imu_config(bool compass_enabled, bool gyro_enabled, bool accel_enabled) {
+    fusion.setCompassEnable(compass_enabled);
+    fusion.setGyroEnable(gyro_enabled);
+    fusion.setAccelEnable(accel_enabled);
+}
+
+bool ReplayBackend::pressure_init(void) {
+    return true;
+}
+
+/* The pressure and humidity reads of one read_environment share a sample,
+ * the next sample is taken when a chip is read a second time */
+const ReplayBackend::env_record & ReplayBackend::next_env(void) {
+    if (synthetic) {
+        synthesize_env(env_count, env);
+    } else {
+        size_t n = env_records.size();
+        env = env_records[env_count % n];
+        env.timestamp += (env_count / n) * env_span;
+    }
+    env_count++;
+    env_pressure_read = false;
+    env_humidity_read = false;
+    return env;
+}
+
+bool ReplayBackend::pressure_read(RTIMU_DATA &data) {
+    const env_record &r = env_pressure_read ? next_env() : env;
+    env_pressure_read = true;
+    data.timestamp = r.timestamp;
+    data.pressureValid = !std::isnan(r.pressure);
+    data.pressure = r.pressure;
+    data.temperatureValid = !std::isnan(r.pressure_temperature);
+    data.temperature = r.pressure_temperature;
+    return true;
+}
+
+bool ReplayBackend::humidity_init(void) {
+    return true;
+}
+
+bool ReplayBackend::humidity_read(RTIMU_DATA &data) {
+    const env_record &r = env_humidity_read ? next_env() : env;
+    env_humidity_read = true;
+    data.timestamp = r.timestamp;
+    data.humidityValid = !std::isnan(r.humidity);
+    data.humidity = r.humidity;
+    data.temperatureValid = !std::isnan(r.humidity_temperature);
+    data.temperature = r.humidity_temperature;
+    return true;
+}
+
+/* The recorded time of the environment sample being played */
+uint64_t ReplayBackend::environment_time(void) {
+    return env.timestamp;
+}
+
+/***** Synthetic signals *****/
+
+/* A board that slowly wobbles and turns, sample n */
+void ReplayBackend::synthesize_imu(uint64_t n, imu_record &r) {
+    uint64_t step = interval_us > 0 ? interval_us : SYNTHETIC_INTERVAL_US;
+    r.timestamp = n * step;
+    double t = r.timestamp / 1000000.0;
+    r.gyro[0] = (float) (0.1 * std::sin(0.5 * t));
+    r.gyro[1] = (float) (0.1 * std::cos(0.3 * t));
+    r.gyro[2] = (float) (0.05 * std::sin(0.2 * t));
+    r.accel[0] = (float) (0.05 * std::sin(0.7 * t));
+    r.accel[1] = (float) (0.05 * std::cos(0.9 * t));
+    r.accel[2] = 1.0f;
+    r.compass[0] = (float) (20.0 * std::cos(0.1 * t));
+    r.compass[1] = (float) (20.0 * std::sin(0.1 * t));
+    r.compass[2] = -40.0f;
+}
+
+/* Slowly drifting weather, one sample per second */
+void ReplayBackend::synthesize_env(uint64_t n, env_record &r) {
+    r.timestamp = n * 1000000;
+    double t = (double) n;
+    r.pressure = (float) (1013.25 + 2.0 * std::sin(0.01 * t));
+    r.pressure_temperature = (float) (21.0 + std::sin(0.005 * t));
+    r.humidity = (float) (40.0 + 5.0 * std::sin(0.003 * t));
+    r.humidity_temperature = (float) (21.5 + std::sin(0.005 * t));
+}
+
+/***** Recording *****/
+
+static float or_nan(bool valid, float value) {
+    return valid ? value : NAN;
+}
+
+/* Appends an IMU reading to a trace */
+void ReplayBackend::write_imu(FILE *file, const RTIMU_DATA &data) {
+    fprintf(file, "imu %llu %g %g %g %g %g %g %g %g %g\n", (unsigned long long) data.timestamp,
+            or_nan(data.gyroValid, data.gyro.x()), or_nan(data.gyroValid, data.gyro.y()),
+            or_nan(data.gyroValid, data.gyro.z()),
+            or_nan(data.accelValid, data.accel.x()), or_nan(data.accelValid, data.accel.y()),
+            or_nan(data.accelValid, data.accel.z()),
+            or_nan(data.compassValid, data.compass.x()), or_nan(data.compassValid, data.compass.y()),
+            or_nan(data.compassValid, data.compass.z()));
+}
+
+/* Appends an environment reading to a trace */
+void ReplayBackend::write_environment(FILE *file, const EnvironmentSample &sample) {
+    fprintf(file, "env %llu %g %g %g %g\n", (unsigned long long) sample.timestamp,
+            or_nan(sample.pressure_valid, sample.pressure),
+            or_nan(sample.temperature_from_pressure_valid, sample.temperature_from_pressure),
+            or_nan(sample.humidity_valid, sample.humidity),
+            or_nan(sample.temperature_from_humidity_valid, sample.temperature_from_humidity));
+}
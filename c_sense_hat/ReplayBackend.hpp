@@ -0,0 +1,79 @@
+#ifndef REPLAY_BACKEND_HPP
+#define REPLAY_BACKEND_HPP
+
+#include "SensorBackend.hpp"
+
+extern "C" {
+    #include "SenseHatSensors.h"
+}
+
+#include "vector"
+
+#include "stdio.h"
+
+/* Backend that plays back a recorded trace, or a synthetic signal, instead
+ * of talking to the hardware.
+ *
+ * A trace is a text file with one sample per line:
+ *   imu <timestamp> <gyro x y z> <accel x y z> <compass x y z>
+ *   env <timestamp> <pressure> <temp from pressure> <humidity> <temp from humidity>
+ * Timestamps are in microseconds, values use the units of the getters and
+ * "nan" marks a value that was not valid. Lines starting with # are
+ * ignored. The IMU and environment samples are each played in order and
+ * the trace starts over when it runs out. Traces are written by
+ * record_trace.
+ *
+ * IMU samples are handed out at rate_hz, or as fast as they are asked for
+ * if rate_hz is 0, and go through an RTQF fusion filter like the real IMU.
+ * The output only depends on the trace, so runs are repeatable. */
+class ReplayBackend : public SensorBackend {
+public:
+    ReplayBackend(const char *, float);
+    void open_imu(void);
+    void open_pressure(void);
+    void open_humidity(void);
+    bool imu_init(void);
+    int imu_poll_interval_us(void);
+    bool imu_read(RTIMU_DATA &);
+    void set_imu_config(bool, bool, bool);
+    bool pressure_init(void);
+    bool pressure_read(RTIMU_DATA &);
+    bool humidity_init(void);
+    bool humidity_read(RTIMU_DATA &);
+    uint64_t environment_time(void);
+
+    static void write_imu(FILE *, const RTIMU_DATA &);
+    static void write_environment(FILE *, const EnvironmentSample &);
+private:
+    typedef struct imu_record {
+        uint64_t timestamp;
+        float gyro[3];
+        float accel[3];
+        float compass[3];
+    } imu_record;
+    typedef struct env_record {
+        uint64_t timestamp;
+        float pressure;
+        float pressure_temperature;
+        float humidity;
+        float humidity_temperature;
+    } env_record;
+    void load(const char *);
+    void synthesize_imu(uint64_t, imu_record &);
+    void synthesize_env(uint64_t, env_record &);
+    const env_record & next_env(void);
+    bool synthetic;         // No trace was given
+    int interval_us;
+    std::vector<imu_record> imu_records;
+    std::vector<env_record> env_records;
+    uint64_t imu_span;      // Timestamp shift applied every time the trace loops
+    uint64_t env_span;      // Likewise for the environment records
+    uint64_t imu_count;
+    uint64_t env_count;
+    env_record env;         // Sample shared by the pressure and humidity reads
+    bool env_pressure_read;
+    bool env_humidity_read;
+    RTFusionRTQF fusion;
+};
+
+#endif /* REPLAY_BACKEND_HPP */
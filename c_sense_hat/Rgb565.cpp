@@ -0,0 +1,122 @@
+#include "Rgb565.hpp"
+
+#include "cmath"
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include "arm_neon.h"
+#define RGB565_NEON
+#elif defined(__SSSE3__)
+#include "tmmintrin.h"
+#define RGB565_SSSE3
+#define RGB565_SSE2
+#elif defined(__SSE2__)
+#include "emmintrin.h"
+#define RGB565_SSE2
+#endif
+
+static inline uint16_t pack(uint8_t r, uint8_t g, uint8_t b) {
+    return (uint16_t) (((r & 0xF8) << 8) | ((g & 0xFC) << 3) | (b >> 3));
+}
+
+#ifdef RGB565_NEON
+/* Packs 8 pixels given as separate channel vectors */
+static inline uint16x8_t pack_neon(uint8x8_t r, uint8x8_t g, uint8x8_t b) {
+    uint16x8_t out = vshll_n_u8(r, 8);
+    out = vsriq_n_u16(out, vshll_n_u8(g, 8), 5);
+    return vsriq_n_u16(out, vshll_n_u8(b, 8), 11);
+}
+#endif
+
+#ifdef RGB565_SSE2
+/* Packs two vectors of four pixels stored as 32 bit r, g, b, x lanes */
+static inline __m128i pack_sse2(__m128i lo, __m128i hi) {
+    const __m128i red = _mm_set1_epi32(0xF8);
+    const __m128i green = _mm_set1_epi32(0xFC00);
+    const __m128i blue = _mm_set1_epi32(0x1F);
+    const __m128i bias = _mm_set1_epi32(0x8000);
+    __m128i a = _mm_or_si128(_mm_slli_epi32(_mm_and_si128(lo, red), 8),
+            _mm_or_si128(_mm_srli_epi32(_mm_and_si128(lo, green), 5),
+                _mm_and_si128(_mm_srli_epi32(lo, 19), blue)));
+    __m128i b = _mm_or_si128(_mm_slli_epi32(_mm_and_si128(hi, red), 8),
+            _mm_or_si128(_mm_srli_epi32(_mm_and_si128(hi, green), 5),
+                _mm_and_si128(_mm_srli_epi32(hi, 19), blue)));
+    // SSE2 only has a signed 32 to 16 bit pack, so shift the values into
+    // the signed range and back again
+    __m128i packed = _mm_packs_epi32(_mm_sub_epi32(a, bias), _mm_sub_epi32(b, bias));
+    return _mm_xor_si128(packed, _mm_set1_epi16((short) 0x8000));
+}
+#endif
+
+void rgb888_to_rgb565(const uint8_t *src, uint16_t *dst, size_t count) {
+    size_t i = 0;
+#if defined(RGB565_NEON)
+    for (; i + 16 <= count; i += 16) {
+        uint8x16x3_t px = vld3q_u8(src + 3 * i);
+        vst1q_u16(dst + i, pack_neon(vget_low_u8(px.val[0]), vget_low_u8(px.val[1]), vget_low_u8(px.val[2])));
+        vst1q_u16(dst + i + 8, pack_neon(vget_high_u8(px.val[0]), vget_high_u8(px.val[1]), vget_high_u8(px.val[2])));
+    }
+#elif defined(RGB565_SSSE3)
+    // Spreads four 3 byte pixels out to 32 bit lanes. Every load reads 16
+    // bytes for 12 bytes of pixels, so stop while that stays in bounds
+    const __m128i spread = _mm_setr_epi8(0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1);
+    for (; i + 10 <= count; i += 8) {
+        __m128i lo = _mm_loadu_si128((const __m128i *) (src + 3 * i));
+        __m128i hi = _mm_loadu_si128((const __m128i *) (src + 3 * i + 12));
+        lo = _mm_shuffle_epi8(lo, spread);
+        hi = _mm_shuffle_epi8(hi, spread);
+        _mm_storeu_si128((__m128i *) (dst + i), pack_sse2(lo, hi));
+    }
+#endif
+    for (; i < count; i++) {
+        dst[i] = pack(src[3 * i], src[3 * i + 1], src[3 * i + 2]);
+    }
+}
+
+void rgba_to_rgb565(const uint8_t *src, uint16_t *dst, size_t count) {
+    size_t i = 0;
+#if defined(RGB565_NEON)
+    for (; i + 16 <= count; i += 16) {
+        uint8x16x4_t px = vld4q_u8(src + 4 * i);
+        vst1q_u16(dst + i, pack_neon(vget_low_u8(px.val[0]), vget_low_u8(px.val[1]), vget_low_u8(px.val[2])));
+        vst1q_u16(dst + i + 8, pack_neon(vget_high_u8(px.val[0]), vget_high_u8(px.val[1]), vget_high_u8(px.val[2])));
+    }
+#elif defined(RGB565_SSE2)
+    for (; i + 8 <= count; i += 8) {
+        __m128i lo = _mm_loadu_si128((const __m128i *) (src + 4 * i));
+        __m128i hi = _mm_loadu_si128((const __m128i *) (src + 4 * i + 16));
+        _mm_storeu_si128((__m128i *) (dst + i), pack_sse2(lo, hi));
+    }
+#endif
+    for (; i < count; i++) {
+        dst[i] = pack(src[4 * i], src[4 * i + 1], src[4 * i + 2]);
+    }
+}
+
+/***** Gamma *****/
+
+/* Constructor, starts out linear */
+GammaTable::GammaTable() {
+    set(1.0);
+}
+
+/* Rebuilds the table for out = 255 * (in / 255) ^ gamma */
+void GammaTable::set(float gamma) {
+    if (!(gamma > 0.0)) {
+        throw "Gamma must be greater than 0";
+    }
+    identity = (gamma == 1.0);
+    for (int i = 0; i < 256; i++) {
+        lut[i] = (uint8_t) std::lround(255.0 * std::pow(i / 255.0, gamma));
+    }
+}
+
+bool GammaTable::linear(void) const {
+    return identity;
+}
+
+/* Maps count bytes from src through the table into dst */
+void GammaTable::apply(const uint8_t *src, uint8_t *dst, size_t count) const {
+    for (size_t i = 0; i < count; i++) {
+        dst[i] = lut[src[i]];
+    }
+}
@@ -0,0 +1,29 @@
+#ifndef RGB565_HPP
+#define RGB565_HPP
+
+#include "cstddef"
+#include "cstdint"
+
+/* Bulk conversion of 8 bit per channel images to the RGB565 format used by
+ * the LED framebuffer. The kernels use NEON or SSSE3/SSE2 when the compiler
+ * targets them and fall back to plain C otherwise; every variant gives the
+ * same result as RGB565() in SenseHatSensors.h. */
+
+// count pixels of 3 bytes (r, g, b)
+void rgb888_to_rgb565(const uint8_t *, uint16_t *, size_t);
+// count pixels of 4 bytes (r, g, b, a), alpha is ignored
+void rgba_to_rgb565(const uint8_t *, uint16_t *, size_t);
+
+/* Lookup table mapping every 8 bit channel value through a gamma curve */
+class GammaTable {
+public:
+    GammaTable();
+    void set(float);
+    bool linear(void) const;
+    void apply(const uint8_t *, uint8_t *, size_t) const;
+private:
+    uint8_t lut[256];
+    bool identity;
+};
+
+#endif /* RGB565_HPP */
@@ -0,0 +1,187 @@
+#include "RollingWindow.hpp"
+#include "SampleChannels.hpp"
+
+#include "algorithm"
+#include "cmath"
+#include "cstring"
+
+/* Constructor. window_us is the length of the window, ema_us the time
+ * constant of the exponential moving average (0 for none, the EMA is then
+ * the newest value) */
+RollingWindow::RollingWindow(uint64_t window_us, uint64_t ema_us) {
+    window = window_us;
+    ema_time = ema_us;
+    oldest = next = 0;
+    min_front = min_back = 0;
+    max_front = max_back = 0;
+    shift = sum = sum_squares = 0.0;
+    ema = 0.0;
+    last_time = 0;
+}
+
+/* Drops the oldest sample from the sums and the queues */
+void RollingWindow::pop_oldest(void) {
+    double d = value(oldest) - shift;
+    sum -= d;
+    sum_squares -= d * d;
+    if (min_queue[min_front % WINDOW_SAMPLES] == oldest) {
+        min_front++;
+    }
+    if (max_queue[max_front % WINDOW_SAMPLES] == oldest) {
+        max_front++;
+    }
+    oldest++;
+}
+
+/* Adds a sample taken at timestamp (microseconds) and drops the ones that
+ * are now older than the window. Samples that are not newer than the
+ * newest one are ignored, so the same reading may be pushed twice */
+void RollingWindow::push(uint64_t timestamp, float x) {
+    bool first = next == 0;
+    if (!first && timestamp <= last_time) {
+        return;
+    }
+    if (next - oldest == WINDOW_SAMPLES) {
+        pop_oldest();
+    }
+    while (oldest < next && times[oldest % WINDOW_SAMPLES] + window <= timestamp) {
+        pop_oldest();
+    }
+    if (oldest == next) {
+        // Starting over also sheds the rounding error of the sums
+        shift = x;
+        sum = sum_squares = 0.0;
+    }
+
+    uint64_t n = next++;
+    times[n % WINDOW_SAMPLES] = timestamp;
+    values[n % WINDOW_SAMPLES] = x;
+    double d = x - shift;
+    sum += d;
+    sum_squares += d * d;
+    while (min_back > min_front && value(min_queue[(min_back - 1) % WINDOW_SAMPLES]) >= x) {
+        min_back--;
+    }
+    min_queue[min_back++ % WINDOW_SAMPLES] = n;
+    while (max_back > max_front && value(max_queue[(max_back - 1) % WINDOW_SAMPLES]) <= x) {
+        max_back--;
+    }
+    max_queue[max_back++ % WINDOW_SAMPLES] = n;
+
+    if (first || ema_time == 0) {
+        ema = x;
+    } else {
+        // Weighted by the time since the last sample, so the EMA does not
+        // depend on the sample rate
+        double alpha = 1.0 - exp(-(double) (timestamp - last_time) / ema_time);
+        ema += alpha * (x - ema);
+    }
+    last_time = timestamp;
+}
+
+void RollingWindow::snapshot(WindowStats &stats) const {
+    memset(&stats, 0, sizeof(WindowStats));
+    uint64_t count = next - oldest;
+    if (count == 0) {
+        return;
+    }
+    double mean = sum / count;
+    stats.count = (uint32_t) count;
+    stats.oldest = times[oldest % WINDOW_SAMPLES];
+    stats.newest = last_time;
+    stats.min = value(min_queue[min_front % WINDOW_SAMPLES]);
+    stats.max = value(max_queue[max_front % WINDOW_SAMPLES]);
+    stats.mean = shift + mean;
+    stats.variance = std::max(0.0, sum_squares / count - mean * mean);
+    stats.ema = ema;
+}
+
+/***** Channels *****/
+
+ChannelWindows::ChannelWindows() {
+    for (int i = 0; i < SENSE_HAT_CHANNELS; i++) {
+        windows[i] = NULL;
+    }
+    watched = 0;
+}
+
+ChannelWindows::~ChannelWindows() {
+    for (int i = 0; i < SENSE_HAT_CHANNELS; i++) {
+        delete windows[i];
+    }
+}
+
+/* Starts keeping the aggregates of channel over the last window_ms
+ * milliseconds, with an EMA of time constant ema_ms. A channel that was
+ * already watched starts over. A window_ms of 0 stops watching it */
+void ChannelWindows::watch(SenseHatChannel channel, uint32_t window_ms, uint32_t ema_ms) {
+    if (channel < 0 || channel >= SENSE_HAT_CHANNELS) {
+        throw "No such channel";
+    }
+    RollingWindow *window = NULL;
+    if (window_ms > 0) {
+        window = new RollingWindow(window_ms * 1000ull, ema_ms * 1000ull);
+    }
+    RollingWindow *old;
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        old = windows[channel];
+        windows[channel] = window;
+        publish(channel);
+        if (window) {
+            watched |= 1u << channel;
+        } else {
+            watched &= ~(1u << channel);
+        }
+    }
+    delete old;
+}
+
+/* Aggregates of channel. SENSE_HAT_NOT_ENABLED if it is not watched,
+ * SENSE_HAT_NO_DATA if no sample arrived yet */
+SenseHatStatus ChannelWindows::query(SenseHatChannel channel, WindowStats &stats) const noexcept {
+    if (channel < 0 || channel >= SENSE_HAT_CHANNELS) {
+        memset(&stats, 0, sizeof(WindowStats));
+        return SENSE_HAT_OUT_OF_RANGE;
+    }
+    stats = results[channel].load();
+    if (!(watched.load(std::memory_order_relaxed) & (1u << channel))) {
+        return SENSE_HAT_NOT_ENABLED;
+    }
+    return stats.count > 0 ? SENSE_HAT_OK : SENSE_HAT_NO_DATA;
+}
+
+// Needs lock
+void ChannelWindows::add(SenseHatChannel channel, uint64_t timestamp, float x) noexcept {
+    if (windows[channel]) {
+        windows[channel]->push(timestamp, x);
+        publish(channel);
+    }
+}
+
+// Needs lock
+void ChannelWindows::publish(SenseHatChannel channel) noexcept {
+    WindowStats stats;
+    if (windows[channel]) {
+        windows[channel]->snapshot(stats);
+    } else {
+        memset(&stats, 0, sizeof(WindowStats));
+    }
+    results[channel].store(stats);
+}
+
+/* Adds the valid values of an IMU sample to their channels */
+void ChannelWindows::add_imu(const ImuSample &sample) noexcept {
+    std::lock_guard<std::mutex> guard(lock);
+    for_each_channel(sample, [this, &sample](SenseHatChannel channel, float x) {
+        add(channel, sample.timestamp, x);
+    });
+}
+
+/* Adds the valid values of an environment sample to their channels */
+void ChannelWindows::add_environment(const EnvironmentSample &sample) noexcept {
+    std::lock_guard<std::mutex> guard(lock);
+    for_each_channel(sample, [this, &sample](SenseHatChannel channel, float x) {
+        add(channel, sample.timestamp, x);
+    });
+}
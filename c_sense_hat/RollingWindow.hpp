@@ -0,0 +1,81 @@
+#ifndef ROLLING_WINDOW_HPP
+#define ROLLING_WINDOW_HPP
+
+#include "Seqlock.hpp"
+
+extern "C" {
+    #include "SenseHatSensors.h"
+}
+
+#include "atomic"
+#include "cstdint"
+#include "mutex"
+
+// Most samples a window holds, older ones leave it early. About 10 s of
+// IMU readings at 100 Hz
+#define WINDOW_SAMPLES 1024
+
+/* Aggregates of the samples of one channel in the last window_us
+ * microseconds.
+ *
+ * Every push and every eviction is O(1) amortised: the sum and sum of
+ * squares are kept running (relative to a shift, so the variance does not
+ * cancel out), and min and max come from monotonic queues of sample
+ * numbers, each sample entering and leaving them once. Nothing is
+ * allocated after construction. Not thread safe, see ChannelWindows. */
+class RollingWindow {
+public:
+    RollingWindow(uint64_t, uint64_t);
+    void push(uint64_t, float);
+    void snapshot(WindowStats &) const;
+private:
+    void pop_oldest(void);
+    float value(uint64_t n) const {
+        return values[n % WINDOW_SAMPLES];
+    }
+    uint64_t window;            // Microseconds
+    uint64_t ema_time;          // Time constant of the EMA, microseconds
+    uint64_t times[WINDOW_SAMPLES];
+    float values[WINDOW_SAMPLES];
+    uint64_t oldest;            // Sample numbers, the window is [oldest, next)
+    uint64_t next;
+    uint64_t min_queue[WINDOW_SAMPLES];     // Sample numbers with increasing values
+    uint64_t min_front, min_back;
+    uint64_t max_queue[WINDOW_SAMPLES];     // Sample numbers with decreasing values
+    uint64_t max_front, max_back;
+    double shift;               // First value since the window was last empty
+    double sum;                 // Of value - shift
+    double sum_squares;
+    double ema;
+    uint64_t last_time;         // Timestamp of the newest sample
+};
+
+/* Rolling windows of every channel that is watched, fed by the Wrapper
+ * from each new reading.
+ *
+ * Samples are added under one lock, after which the result of each window
+ * is published to a seqlock, so a query is a copy and never waits for a
+ * thread that is adding samples. */
+class ChannelWindows {
+public:
+    ChannelWindows();
+    ~ChannelWindows();
+    void watch(SenseHatChannel, uint32_t, uint32_t);
+    SenseHatStatus query(SenseHatChannel, WindowStats &) const noexcept;
+    void add_imu(const ImuSample &) noexcept;
+    void add_environment(const EnvironmentSample &) noexcept;
+
+    /* True if any channel is watched, checked before building samples */
+    bool watching(void) const noexcept {
+        return watched.load(std::memory_order_relaxed) != 0;
+    }
+private:
+    void add(SenseHatChannel, uint64_t, float) noexcept;
+    void publish(SenseHatChannel) noexcept;
+    std::mutex lock;            // Held while samples are added or windows swapped
+    RollingWindow *windows[SENSE_HAT_CHANNELS];     // NULL if not watched
+    Seqlock<WindowStats> results[SENSE_HAT_CHANNELS];
+    std::atomic<uint32_t> watched;                  // Bit per channel
+};
+
+#endif /* ROLLING_WINDOW_HPP */
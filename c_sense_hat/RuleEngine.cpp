@@ -0,0 +1,269 @@
+#include "RuleEngine.hpp"
+#include "SampleChannels.hpp"
+
+#include "algorithm"
+#include "cmath"
+#include "cstring"
+
+namespace {
+
+const float PI = (float) M_PI;
+
+/* 1 if x passes the test of a rule, see RuleTable */
+inline int32_t condition(float p, float q, float reference, float bound, float x, bool angle) {
+    float d = x - reference;
+    if (angle) {
+        // The short way round, both angles are within [-pi, pi]
+        d = d > PI ? d - 2 * PI : (d < -PI ? d + 2 * PI : d);
+    }
+    float a = p * d;
+    float b = q * d;
+    return (a > b ? a : b) > bound;
+}
+
+/* Moves rule i of the table on after its scan, holds being whether its
+ * condition held. True if it fired or cleared, with event filled in */
+bool step(RuleTable &table, uint32_t i, bool holds, float x, uint64_t now, RuleEvent &event) {
+    int32_t &state = table.state[i];
+    CompiledRule &rule = table.rules[i];
+    if (state & RULE_PRIMING) {
+        // Changes are measured from the first value
+        table.reference[i] = x;
+        state &= ~RULE_PRIMING;
+        return false;
+    }
+    if (holds) {
+        if (state & RULE_ACTIVE) {
+            return false;
+        }
+        if (!(state & RULE_PENDING)) {
+            state |= RULE_PENDING;
+            rule.since = now;
+        }
+        if (now < rule.since + rule.hold) {
+            return false;
+        }
+        state &= ~RULE_PENDING;
+        if (rule.kind == RULE_CHANGE) {
+            // Fires once per change, the next one is measured from here
+            table.reference[i] = x;
+        } else {
+            state |= RULE_ACTIVE;
+            table.bound[i] = rule.exit;
+        }
+        event.fired = TRUE;
+    } else {
+        state &= ~RULE_PENDING;
+        if (!(state & RULE_ACTIVE)) {
+            return false;
+        }
+        state &= ~RULE_ACTIVE;
+        table.bound[i] = rule.enter;
+        event.fired = FALSE;
+    }
+    event.timestamp = now;
+    event.rule = rule.id;
+    event.value = x;
+    return true;
+}
+
+}
+
+RuleEngine::RuleEngine() {
+    defined = 0;
+    next_id = 0;
+    memset(tables, 0, sizeof(tables));
+    table = &tables[0];
+    queued = 0;
+    drained = 0;
+    callback = NULL;
+    context = NULL;
+    channels = 0;
+}
+
+/* Adds a rule and returns its id. Throws if the rule is not valid or
+ * RULE_MAX rules are set */
+int RuleEngine::add(const SensorRule &rule) {
+    if (rule.channel < 0 || rule.channel >= SENSE_HAT_CHANNELS) {
+        throw "No such channel";
+    }
+    if (rule.kind < 0 || rule.kind >= RULE_KINDS) {
+        throw "No such kind of rule";
+    }
+    if (!std::isfinite(rule.threshold) || !std::isfinite(rule.hysteresis) || rule.hysteresis < 0) {
+        throw "Threshold and hysteresis must be finite, the hysteresis not negative";
+    }
+    std::lock_guard<std::mutex> guard(lock);
+    if (defined == RULE_MAX) {
+        throw "Too many rules";
+    }
+    int32_t id = next_id++;
+    definitions[defined] = rule;
+    ids[defined] = id;
+    defined++;
+    compile();
+    return id;
+}
+
+/* Removes rule id. False if there is none */
+bool RuleEngine::remove(int id) noexcept {
+    std::lock_guard<std::mutex> guard(lock);
+    uint32_t i = std::find(ids, ids + defined, id) - ids;
+    if (i == defined) {
+        return false;
+    }
+    memmove(&definitions[i], &definitions[i + 1], (defined - i - 1) * sizeof(SensorRule));
+    memmove(&ids[i], &ids[i + 1], (defined - i - 1) * sizeof(int32_t));
+    defined--;
+    compile();
+    return true;
+}
+
+/* Sets the function every event is passed to, NULL for none */
+void RuleEngine::set_callback(RuleCallback function, void *data) noexcept {
+    std::lock_guard<std::mutex> guard(lock);
+    callback = function;
+    context = data;
+}
+
+/* Copies up to max events queued since the last drain, oldest first.
+ * Events that were overwritten before they were drained are skipped */
+size_t RuleEngine::drain(RuleEvent *events, size_t max) noexcept {
+    std::lock_guard<std::mutex> guard(lock);
+    if (queued - drained > RULE_QUEUE) {
+        drained = queued - RULE_QUEUE;
+    }
+    size_t count = std::min<uint64_t>(queued - drained, max);
+    for (size_t i = 0; i < count; i++) {
+        events[i] = queue[(drained + i) % RULE_QUEUE];
+    }
+    drained += count;
+    return count;
+}
+
+/* Evaluates the rules of the valid values of an IMU sample */
+void RuleEngine::add_imu(const ImuSample &sample) noexcept {
+    evaluate(sample);
+}
+
+/* Evaluates the rules of the valid values of an environment sample */
+void RuleEngine::add_environment(const EnvironmentSample &sample) noexcept {
+    evaluate(sample);
+}
+
+/* Builds the evaluation table of the definitions in the table not in use,
+ * rules that were already set keeping their state, and switches to it.
+ * Needs lock */
+void RuleEngine::compile(void) noexcept {
+    RuleTable &next = table == &tables[0] ? tables[1] : tables[0];
+    uint16_t fill[SENSE_HAT_CHANNELS];
+    memset(fill, 0, sizeof(fill));
+    for (uint32_t i = 0; i < defined; i++) {
+        fill[definitions[i].channel]++;
+    }
+    next.first[0] = 0;
+    for (int c = 0; c < SENSE_HAT_CHANNELS; c++) {
+        next.first[c + 1] = next.first[c] + fill[c];
+        fill[c] = next.first[c];
+    }
+
+    uint32_t mask = 0;
+    for (uint32_t i = 0; i < defined; i++) {
+        const SensorRule &definition = definitions[i];
+        uint32_t row = fill[definition.channel]++;
+        CompiledRule &rule = next.rules[row];
+        float sign = definition.kind == RULE_BELOW ? -1.0f : 1.0f;
+        rule.enter = sign * definition.threshold;
+        rule.exit = definition.kind == RULE_CHANGE ? rule.enter : rule.enter - definition.hysteresis;
+        rule.kind = definition.kind;
+        rule.id = ids[i];
+        rule.hold = definition.hold_ms * 1000ull;
+        rule.since = 0;
+        next.p[row] = sign;
+        next.q[row] = definition.kind == RULE_ABOVE || definition.kind == RULE_BELOW ? sign : -sign;
+        next.reference[row] = 0.0f;
+        next.state[row] = definition.kind == RULE_CHANGE ? RULE_PRIMING : 0;
+        for (uint32_t j = 0; j < table->count; j++) {
+            if (table->rules[j].id == rule.id) {
+                next.reference[row] = table->reference[j];
+                next.state[row] = table->state[j];
+                rule.since = table->rules[j].since;
+                break;
+            }
+        }
+        next.bound[row] = next.state[row] & RULE_ACTIVE ? rule.exit : rule.enter;
+        mask |= 1u << definition.channel;
+    }
+    next.count = defined;
+    table = &next;
+    channels = mask;
+}
+
+/* Checks every rule of channel against its value x, taken at now, and
+ * writes an event for each one that fired or cleared. Returns how many.
+ * Needs lock */
+size_t RuleEngine::scan(SenseHatChannel channel, float x, uint64_t now, RuleEvent *events) noexcept {
+    RuleTable &rules = *table;
+    uint32_t begin = rules.first[channel];
+    uint32_t n = rules.first[channel + 1] - begin;
+    if (n == 0) {
+        return 0;
+    }
+    const float *p = rules.p + begin;
+    const float *q = rules.q + begin;
+    const float *reference = rules.reference + begin;
+    const float *bound = rules.bound + begin;
+    const int32_t *state = rules.state + begin;
+    bool angle = channel == CHANNEL_ROLL || channel == CHANNEL_PITCH || channel == CHANNEL_YAW;
+
+    // A rule needs a step if its condition holds and it is not active or
+    // the other way round, or if it is pending or priming. Mostly none
+    // does, and finding that out is a reduction without branches
+    int32_t any = 0;
+    for (uint32_t i = 0; i < n; i++) {
+        int32_t holds = condition(p[i], q[i], reference[i], bound[i], x, angle);
+        any |= (holds ^ (state[i] & RULE_ACTIVE)) | (state[i] >> 1);
+    }
+    if (!any) {
+        return 0;
+    }
+
+    size_t count = 0;
+    for (uint32_t i = 0; i < n; i++) {
+        int32_t holds = condition(p[i], q[i], reference[i], bound[i], x, angle);
+        if (((holds ^ (state[i] & RULE_ACTIVE)) | (state[i] >> 1)) &&
+                step(rules, begin + i, holds, x, now, events[count])) {
+            count++;
+        }
+    }
+    return count;
+}
+
+template <typename S>
+void RuleEngine::evaluate(const S &sample) noexcept {
+    // Each rule yields at most one event per sample
+    RuleEvent events[RULE_MAX];
+    size_t count = 0;
+    RuleCallback function;
+    void *data;
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        uint32_t mask = channels.load(std::memory_order_relaxed);
+        for_each_channel(sample, [&](SenseHatChannel channel, float x) {
+            if (mask & (1u << channel)) {
+                count += scan(channel, x, sample.timestamp, events + count);
+            }
+        });
+        for (size_t i = 0; i < count; i++) {
+            queue[queued % RULE_QUEUE] = events[i];
+            queued++;
+        }
+        function = callback;
+        data = context;
+    }
+    if (function) {
+        for (size_t i = 0; i < count; i++) {
+            function(&events[i], data);
+        }
+    }
+}
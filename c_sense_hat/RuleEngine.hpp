@@ -0,0 +1,97 @@
+#ifndef RULE_ENGINE_HPP
+#define RULE_ENGINE_HPP
+
+extern "C" {
+    #include "SenseHatSensors.h"
+}
+
+#include "atomic"
+#include "cstdint"
+#include "mutex"
+
+// Most rules of one SenseHatSensors
+#define RULE_MAX 256
+// Events kept for drain_rule_events, older ones are dropped
+#define RULE_QUEUE 256
+
+// State of a compiled rule
+#define RULE_ACTIVE 1       // Fired and not cleared yet
+#define RULE_PENDING 2      // The condition holds, since is when it started
+#define RULE_PRIMING 4      // RULE_CHANGE is waiting for its first value
+
+/* What a rule needs beyond the scan, only read when its condition changes */
+typedef struct CompiledRule {
+    float enter;
+    float exit;             // enter less the hysteresis
+    uint8_t kind;           // RuleKind
+    int32_t id;
+    uint64_t hold;          // Microseconds
+    uint64_t since;         // Timestamp the condition started holding
+} CompiledRule;
+
+/* The evaluation table, columns of every rule sorted by channel. The rules
+ * of channel c are rows first[c] to first[c + 1] - 1, so a value only
+ * touches the rules of its channel.
+ *
+ * Every kind is turned into one test: with d = x - reference, the rule
+ * holds if max(p d, q d) > bound. RULE_ABOVE has p = q = 1, RULE_BELOW
+ * p = q = -1 and negated thresholds, RULE_ABS_ABOVE p = 1, q = -1, and
+ * RULE_CHANGE the same with the value it last fired at as reference (0 for
+ * the others). bound is enter, or exit while the rule is active. So the
+ * rules of a channel are checked by one loop without branches, that the
+ * compiler vectorises, and only the rules whose condition changed, or
+ * that wait out their hold time, go on to the state machine. */
+typedef struct RuleTable {
+    uint32_t count;
+    uint16_t first[SENSE_HAT_CHANNELS + 1];
+    float p[RULE_MAX];
+    float q[RULE_MAX];
+    float reference[RULE_MAX];
+    float bound[RULE_MAX];
+    int32_t state[RULE_MAX];
+    CompiledRule rules[RULE_MAX];
+} RuleTable;
+
+/* Threshold rules checked against every new reading, fed by the Wrapper
+ * like ChannelWindows.
+ *
+ * Adding or removing a rule compiles the definitions into the other of two
+ * tables (see RuleTable), carrying over the state of the rules that stay,
+ * and switches to it. Evaluating a sample is one pass over the rules of its
+ * channels under the lock, with no allocation. Events are queued in a
+ * fixed ring and passed to the callback after the lock is released, so the
+ * callback may add or remove rules. */
+class RuleEngine {
+public:
+    RuleEngine();
+    int add(const SensorRule &);
+    bool remove(int) noexcept;
+    void set_callback(RuleCallback, void *) noexcept;
+    size_t drain(RuleEvent *, size_t) noexcept;
+    void add_imu(const ImuSample &) noexcept;
+    void add_environment(const EnvironmentSample &) noexcept;
+
+    /* True if any rule is set, checked before building samples */
+    bool active(void) const noexcept {
+        return channels.load(std::memory_order_relaxed) != 0;
+    }
+private:
+    void compile(void) noexcept;
+    template <typename S> void evaluate(const S &) noexcept;
+    size_t scan(SenseHatChannel, float, uint64_t, RuleEvent *) noexcept;
+    std::mutex lock;            // Held while rules are changed or evaluated
+    SensorRule definitions[RULE_MAX];
+    int32_t ids[RULE_MAX];
+    uint32_t defined;
+    int32_t next_id;
+    RuleTable tables[2];
+    RuleTable *table;           // One of tables, the other is compiled into
+    RuleEvent queue[RULE_QUEUE];
+    uint64_t queued;            // Events ever queued
+    uint64_t drained;           // Of those, handed out by drain or dropped
+    RuleCallback callback;
+    void *context;
+    std::atomic<uint32_t> channels;     // Bit per channel with rules
+};
+
+#endif /* RULE_ENGINE_HPP */
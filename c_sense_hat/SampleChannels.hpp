@@ -0,0 +1,61 @@
+#ifndef SAMPLE_CHANNELS_HPP
+#define SAMPLE_CHANNELS_HPP
+
+extern "C" {
+    #include "SenseHatSensors.h"
+}
+
+#include "cmath"
+
+/* Splitting samples into the values of their channels (SenseHatChannel),
+ * shared by everything that keeps data per channel. Only valid values are
+ * passed on: f(channel, value) */
+
+inline float magnitude(const Coordinates &c) {
+    return sqrtf(c.x * c.x + c.y * c.y + c.z * c.z);
+}
+
+template <typename F>
+void for_each_channel(const ImuSample &sample, F f) {
+    if (sample.fusion_valid) {
+        f(CHANNEL_ROLL, sample.fusion.roll);
+        f(CHANNEL_PITCH, sample.fusion.pitch);
+        f(CHANNEL_YAW, sample.fusion.yaw);
+    }
+    if (sample.compass_valid) {
+        f(CHANNEL_COMPASS_X, sample.compass.x);
+        f(CHANNEL_COMPASS_Y, sample.compass.y);
+        f(CHANNEL_COMPASS_Z, sample.compass.z);
+        f(CHANNEL_COMPASS_MAGNITUDE, magnitude(sample.compass));
+    }
+    if (sample.gyro_valid) {
+        f(CHANNEL_GYRO_X, sample.gyro.x);
+        f(CHANNEL_GYRO_Y, sample.gyro.y);
+        f(CHANNEL_GYRO_Z, sample.gyro.z);
+        f(CHANNEL_GYRO_MAGNITUDE, magnitude(sample.gyro));
+    }
+    if (sample.accel_valid) {
+        f(CHANNEL_ACCEL_X, sample.accel.x);
+        f(CHANNEL_ACCEL_Y, sample.accel.y);
+        f(CHANNEL_ACCEL_Z, sample.accel.z);
+        f(CHANNEL_ACCEL_MAGNITUDE, magnitude(sample.accel));
+    }
+}
+
+template <typename F>
+void for_each_channel(const EnvironmentSample &sample, F f) {
+    if (sample.humidity_valid) {
+        f(CHANNEL_HUMIDITY, sample.humidity);
+    }
+    if (sample.pressure_valid) {
+        f(CHANNEL_PRESSURE, sample.pressure);
+    }
+    if (sample.temperature_from_humidity_valid) {
+        f(CHANNEL_TEMPERATURE_FROM_HUMIDITY, sample.temperature_from_humidity);
+    }
+    if (sample.temperature_from_pressure_valid) {
+        f(CHANNEL_TEMPERATURE_FROM_PRESSURE, sample.temperature_from_pressure);
+    }
+}
+
+#endif /* SAMPLE_CHANNELS_HPP */
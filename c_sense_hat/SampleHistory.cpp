@@ -0,0 +1,296 @@
+#include "SampleHistory.hpp"
+#include "SampleChannels.hpp"
+
+#include "algorithm"
+#include "cstring"
+
+/* Constructor. Keeps the last samples samples, rounded up to a power of
+ * two */
+ChannelHistory::ChannelHistory(uint32_t samples) {
+    size_t capacity = 1;
+    while (capacity < samples) {
+        capacity <<= 1;
+    }
+    times = new uint64_t[capacity];
+    try {
+        values = new float[capacity];
+    } catch (...) {
+        delete[] times;
+        throw;
+    }
+    // Fault the pages in now rather than in the sampler
+    memset(times, 0, capacity * sizeof(uint64_t));
+    memset(values, 0, capacity * sizeof(float));
+    mask = capacity - 1;
+    oldest = next = 0;
+}
+
+ChannelHistory::~ChannelHistory() {
+    delete[] times;
+    delete[] values;
+}
+
+/* Adds a sample, dropping it if it is not newer than the newest kept */
+void ChannelHistory::push(uint64_t timestamp, float x) noexcept {
+    if (next > oldest && timestamp <= times[(next - 1) & mask]) {
+        return;
+    }
+    times[next & mask] = timestamp;
+    values[next & mask] = x;
+    next++;
+    if (next - oldest > mask + 1) {
+        oldest++;
+    }
+}
+
+/* Number, counted from the oldest, of the first sample at or after
+ * timestamp, size() if there is none */
+size_t ChannelHistory::lower_bound(uint64_t timestamp) const noexcept {
+    size_t low = 0, high = size();
+    while (low < high) {
+        size_t middle = low + (high - low) / 2;
+        if (times[slot(middle)] < timestamp) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+    return low;
+}
+
+/* Copies count samples from sample number first on, at most two runs
+ * since the arrays wrap around */
+size_t ChannelHistory::copy(size_t first, size_t count, uint64_t *t, float *v) const noexcept {
+    size_t start = slot(first);
+    size_t run = std::min(count, mask + 1 - start);
+    memcpy(t, times + start, run * sizeof(uint64_t));
+    memcpy(v, values + start, run * sizeof(float));
+    memcpy(t + run, times, (count - run) * sizeof(uint64_t));
+    memcpy(v + run, values, (count - run) * sizeof(float));
+    return count;
+}
+
+/* Newest sample at or before timestamp. False if there is none, because
+ * timestamp is older than everything kept */
+bool ChannelHistory::at(uint64_t timestamp, HistoryPoint &point) const noexcept {
+    size_t n = timestamp == UINT64_MAX ? size() : lower_bound(timestamp + 1);
+    if (n == 0) {
+        return false;
+    }
+    point.timestamp = times[slot(n - 1)];
+    point.value = values[slot(n - 1)];
+    return true;
+}
+
+/* Copies the samples from t0 to t1, both included, oldest first, up to
+ * max of them. Returns how many */
+size_t ChannelHistory::range(uint64_t t0, uint64_t t1, uint64_t *t, float *v, size_t max) const noexcept {
+    if (t1 < t0) {
+        return 0;
+    }
+    size_t begin = lower_bound(t0);
+    size_t end = t1 == UINT64_MAX ? size() : lower_bound(t1 + 1);
+    return copy(begin, std::min(end - begin, max), t, v);
+}
+
+/* Sets up cursor to split the part of [t0, t1] that holds samples into
+ * points stretches of equal length, see SampleHistory::downsample. False if
+ * there is nothing to split */
+bool ChannelHistory::start_downsample(uint64_t t0, uint64_t t1, size_t points, DownsampleCursor &cursor) const noexcept {
+    if (points == 0 || size() == 0) {
+        return false;
+    }
+    cursor.low = std::max(t0, times[slot(0)]);
+    cursor.high = std::min(t1, times[slot(size() - 1)]);
+    if (cursor.low > cursor.high) {
+        return false;
+    }
+    cursor.width = (cursor.high - cursor.low) / points + 1;
+    cursor.points = points;
+    cursor.stretch = 0;
+    cursor.from = cursor.low;
+    cursor.sum = 0.0;
+    cursor.count = 0;
+    return true;
+}
+
+/* Goes on with the stretches of cursor, writing the mean of each one from
+ * written on, timed halfway between its first and last sample. Stretches
+ * without samples are left out. Stops after about budget samples, and
+ * returns how many points were written in all */
+size_t ChannelHistory::downsample(DownsampleCursor &cursor, uint64_t *t, float *v, size_t written,
+        size_t budget) const noexcept {
+    size_t i = lower_bound(cursor.from);
+    size_t end = cursor.high == UINT64_MAX ? size() : lower_bound(cursor.high + 1);
+    while (cursor.stretch < cursor.points && budget > 0) {
+        size_t bound = std::min(lower_bound(cursor.low + (cursor.stretch + 1) * cursor.width), end);
+        size_t e = std::min(bound, i + budget);
+        if (e > i) {
+            for (size_t n = i; n < e; n++) {
+                cursor.sum += values[slot(n)];
+            }
+            if (cursor.count == 0) {
+                cursor.first = times[slot(i)];
+            }
+            cursor.last = times[slot(e - 1)];
+            cursor.count += e - i;
+            cursor.from = cursor.last + 1;
+            budget -= e - i;
+            i = e;
+        }
+        if (e < bound) {
+            break;  // Out of budget halfway through the stretch
+        }
+        if (cursor.count > 0) {
+            t[written] = cursor.first + (cursor.last - cursor.first) / 2;
+            v[written] = (float) (cursor.sum / cursor.count);
+            written++;
+        }
+        cursor.sum = 0.0;
+        cursor.count = 0;
+        cursor.stretch++;
+        // The search counts too, for the stretches without samples
+        if (budget > 0) {
+            budget--;
+        }
+    }
+    return written;
+}
+
+SampleHistory::SampleHistory() {
+    for (int i = 0; i < SENSE_HAT_CHANNELS; i++) {
+        channels[i] = NULL;
+    }
+    kept = 0;
+}
+
+SampleHistory::~SampleHistory() {
+    for (int i = 0; i < SENSE_HAT_CHANNELS; i++) {
+        delete channels[i];
+    }
+}
+
+/* Starts keeping the last samples values of channel. A channel that was
+ * already kept starts over. 0 samples stops keeping it */
+void SampleHistory::keep(SenseHatChannel channel, uint32_t samples) {
+    if (channel < 0 || channel >= SENSE_HAT_CHANNELS) {
+        throw "No such channel";
+    }
+    if (samples > HISTORY_MAX_SAMPLES) {
+        throw "History too long";
+    }
+    ChannelHistory *history = NULL;
+    if (samples > 0) {
+        history = new ChannelHistory(samples);
+    }
+    ChannelHistory *old;
+    {
+        std::lock_guard<std::mutex> guard(locks[channel]);
+        old = channels[channel];
+        channels[channel] = history;
+        if (history) {
+            kept |= 1u << channel;
+        } else {
+            kept &= ~(1u << channel);
+        }
+    }
+    delete old;
+}
+
+/* Newest value of channel at or before timestamp. SENSE_HAT_NOT_ENABLED if
+ * the channel is not kept, SENSE_HAT_NO_DATA if there is no such value */
+SenseHatStatus SampleHistory::at(SenseHatChannel channel, uint64_t timestamp, HistoryPoint &point) const noexcept {
+    memset(&point, 0, sizeof(HistoryPoint));
+    if (channel < 0 || channel >= SENSE_HAT_CHANNELS) {
+        return SENSE_HAT_OUT_OF_RANGE;
+    }
+    std::lock_guard<std::mutex> guard(locks[channel]);
+    if (!channels[channel]) {
+        return SENSE_HAT_NOT_ENABLED;
+    }
+    return channels[channel]->at(timestamp, point) ? SENSE_HAT_OK : SENSE_HAT_NO_DATA;
+}
+
+/* Copies the samples of channel from t0 to t1, both included, oldest
+ * first, up to max of them. Returns how many */
+size_t SampleHistory::range(SenseHatChannel channel, uint64_t t0, uint64_t t1,
+        uint64_t *times, float *values, size_t max) const noexcept {
+    if (channel < 0 || channel >= SENSE_HAT_CHANNELS) {
+        return 0;
+    }
+    size_t count = 0;
+    while (count < max && t0 <= t1) {
+        size_t chunk = std::min<size_t>(max - count, HISTORY_CHUNK);
+        size_t copied;
+        {
+            std::lock_guard<std::mutex> guard(locks[channel]);
+            ChannelHistory *history = channels[channel];
+            if (!history) {
+                break;
+            }
+            HistoryPoint newest;
+            if (count == 0 && history->at(UINT64_MAX, newest)) {
+                t1 = std::min(t1, newest.timestamp);
+            }
+            copied = history->range(t0, t1, times + count, values + count, chunk);
+        }
+        count += copied;
+        if (copied < chunk || times[count - 1] == UINT64_MAX) {
+            break;
+        }
+        t0 = times[count - 1] + 1;
+    }
+    return count;
+}
+
+/* Splits the part of [t0, t1] that holds samples of channel into points
+ * stretches of equal length and gives the mean of each stretch, timed
+ * halfway between its first and last sample. Stretches without samples
+ * are left out. Returns how many points were written */
+size_t SampleHistory::downsample(SenseHatChannel channel, uint64_t t0, uint64_t t1,
+        uint64_t *times, float *values, size_t points) const noexcept {
+    if (channel < 0 || channel >= SENSE_HAT_CHANNELS) {
+        return 0;
+    }
+    DownsampleCursor cursor;
+    size_t written = 0;
+    {
+        std::lock_guard<std::mutex> guard(locks[channel]);
+        if (!channels[channel] || !channels[channel]->start_downsample(t0, t1, points, cursor)) {
+            return 0;
+        }
+    }
+    while (cursor.stretch < cursor.points) {
+        std::lock_guard<std::mutex> guard(locks[channel]);
+        if (!channels[channel]) {
+            break;
+        }
+        written = channels[channel]->downsample(cursor, times, values, written, HISTORY_CHUNK);
+    }
+    return written;
+}
+
+// Adds a valid value to channel, if it is kept
+void SampleHistory::add(SenseHatChannel channel, uint64_t timestamp, float x) noexcept {
+    if (!(kept.load(std::memory_order_relaxed) & (1u << channel))) {
+        return;
+    }
+    std::lock_guard<std::mutex> guard(locks[channel]);
+    if (channels[channel]) {
+        channels[channel]->push(timestamp, x);
+    }
+}
+
+/* Adds the valid values of an IMU sample to the channels kept */
+void SampleHistory::add_imu(const ImuSample &sample) noexcept {
+    for_each_channel(sample, [this, &sample](SenseHatChannel channel, float x) {
+        add(channel, sample.timestamp, x);
+    });
+}
+
+/* Adds the valid values of an environment sample to the channels kept */
+void SampleHistory::add_environment(const EnvironmentSample &sample) noexcept {
+    for_each_channel(sample, [this, &sample](SenseHatChannel channel, float x) {
+        add(channel, sample.timestamp, x);
+    });
+}
@@ -0,0 +1,94 @@
+#ifndef SAMPLE_HISTORY_HPP
+#define SAMPLE_HISTORY_HPP
+
+extern "C" {
+    #include "SenseHatSensors.h"
+}
+
+#include "atomic"
+#include "cstdint"
+#include "mutex"
+
+// Most samples kept of one channel: 48 MiB, or about 5.8 hours at 200 Hz
+#define HISTORY_MAX_SAMPLES (1u << 22)
+// Most samples a query copies or sums before it lets the sampler in again
+#define HISTORY_CHUNK 4096
+
+/* Where a downsample stopped, so it can go on after the lock was released */
+typedef struct DownsampleCursor {
+    uint64_t low;           // Start of the first stretch
+    uint64_t high;          // Newest timestamp taken into account
+    uint64_t width;         // Of every stretch
+    size_t points;          // Stretches
+    size_t stretch;         // The one being summed, points once done
+    uint64_t from;          // Samples before this were summed already
+    double sum;             // Of the stretch so far
+    size_t count;
+    uint64_t first;         // Timestamps of the stretch so far
+    uint64_t last;
+} DownsampleCursor;
+
+/* The newest samples of one channel, oldest overwritten first.
+ *
+ * Timestamps and values are two separate arrays of a power of two length,
+ * allocated and touched up front, so a push is two stores and a search
+ * only walks the timestamps. Timestamps only grow (older ones are dropped),
+ * so every query is a binary search. Not thread safe, see SampleHistory. */
+class ChannelHistory {
+public:
+    ChannelHistory(uint32_t);
+    ~ChannelHistory();
+    void push(uint64_t, float) noexcept;
+    bool at(uint64_t, HistoryPoint &) const noexcept;
+    size_t range(uint64_t, uint64_t, uint64_t *, float *, size_t) const noexcept;
+    bool start_downsample(uint64_t, uint64_t, size_t, DownsampleCursor &) const noexcept;
+    size_t downsample(DownsampleCursor &, uint64_t *, float *, size_t, size_t) const noexcept;
+private:
+    size_t size(void) const {
+        return next - oldest;
+    }
+    // Sample number i counted from the oldest kept
+    size_t slot(size_t i) const {
+        return (oldest + i) & mask;
+    }
+    size_t lower_bound(uint64_t) const noexcept;
+    size_t copy(size_t, size_t, uint64_t *, float *) const noexcept;
+    uint64_t *times;
+    float *values;
+    size_t mask;                // Length of the arrays less one
+    uint64_t oldest;            // Sample numbers, kept are [oldest, next)
+    uint64_t next;
+};
+
+/* Histories of the channels asked for, fed by the Wrapper from each new
+ * reading like ChannelWindows.
+ *
+ * Every channel has its own lock, taken to add a sample or answer a query.
+ * A query copies or sums at most HISTORY_CHUNK samples at a time and
+ * releases the lock in between, going on from the timestamp it got to, so
+ * the sampler never waits for more than one chunk however long the reply
+ * is. A reply taken in chunks is cut at the newest sample there was when
+ * it started. */
+class SampleHistory {
+public:
+    SampleHistory();
+    ~SampleHistory();
+    void keep(SenseHatChannel, uint32_t);
+    SenseHatStatus at(SenseHatChannel, uint64_t, HistoryPoint &) const noexcept;
+    size_t range(SenseHatChannel, uint64_t, uint64_t, uint64_t *, float *, size_t) const noexcept;
+    size_t downsample(SenseHatChannel, uint64_t, uint64_t, uint64_t *, float *, size_t) const noexcept;
+    void add_imu(const ImuSample &) noexcept;
+    void add_environment(const EnvironmentSample &) noexcept;
+
+    /* True if any channel is kept, checked before building samples */
+    bool keeping(void) const noexcept {
+        return kept.load(std::memory_order_relaxed) != 0;
+    }
+private:
+    void add(SenseHatChannel, uint64_t, float) noexcept;
+    mutable std::mutex locks[SENSE_HAT_CHANNELS];   // One per channel
+    ChannelHistory *channels[SENSE_HAT_CHANNELS];   // NULL if not kept
+    std::atomic<uint32_t> kept;                     // Bit per channel
+};
+
+#endif /* SAMPLE_HISTORY_HPP */
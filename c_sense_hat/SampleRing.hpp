@@ -0,0 +1,83 @@
+#ifndef SAMPLE_RING_HPP
+#define SAMPLE_RING_HPP
+
+#include "atomic"
+#include "cstddef"
+#include "cstdint"
+
+/* Lock-free ring holding the N most recent samples.
+ *
+ * There is exactly one producer, which never waits for the readers. Any
+ * number of consumers may read concurrently. Every slot carries a sequence
+ * number that is odd while the slot is being written; readers check it
+ * before and after copying the value (a per slot seqlock), so a slot that is
+ * overwritten during the copy is detected instead of returning torn data.
+ *
+ * Samples are numbered from 1 in the order they were pushed, 0 means
+ * "no sample". */
+template <typename T, size_t N>
+class SampleRing {
+public:
+    SampleRing() : head(0) {
+        for (size_t i = 0; i < N; i++) {
+            slots[i].seq.store(0, std::memory_order_relaxed);
+        }
+    }
+
+    /* Stores a new sample, overwriting the oldest one. Producer only. */
+    void push(const T &value) {
+        uint64_t n = head.load(std::memory_order_relaxed) + 1;
+        Slot &slot = slots[n % N];
+        slot.seq.store(2 * n - 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        slot.value = value;
+        slot.seq.store(2 * n, std::memory_order_release);
+        head.store(n, std::memory_order_release);
+    }
+
+    /* Number of the newest sample, 0 if nothing has been pushed yet */
+    uint64_t newest(void) const {
+        return head.load(std::memory_order_acquire);
+    }
+
+    /* Copies sample n into out. Fails if n has not been pushed yet or has
+     * already been overwritten by a newer sample. */
+    bool read(uint64_t n, T &out) const {
+        if (n == 0) {
+            return false;
+        }
+        const Slot &slot = slots[n % N];
+        uint64_t before = slot.seq.load(std::memory_order_acquire);
+        if (before != 2 * n) {
+            return false;
+        }
+        out = slot.value;
+        std::atomic_thread_fence(std::memory_order_acquire);
+        return slot.seq.load(std::memory_order_relaxed) == before;
+    }
+
+    /* Copies the newest sample into out. Returns false if the ring is empty */
+    bool latest(T &out) const {
+        uint64_t n;
+        while ((n = newest()) != 0) {
+            if (read(n, out)) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    static size_t capacity(void) {
+        return N;
+    }
+
+private:
+    struct Slot {
+        std::atomic<uint64_t> seq;
+        T value;
+    };
+    std::atomic<uint64_t> head;
+    Slot slots[N];
+};
+
+#endif /* SAMPLE_RING_HPP */
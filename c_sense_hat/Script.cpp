@@ -0,0 +1,292 @@
+#include "Script.hpp"
+#include "PollScheduler.hpp"
+
+#include "algorithm"
+#include "chrono"
+#include "cmath"
+#include "cstdarg"
+#include "cstdio"
+#include "cstring"
+#include "thread"
+
+// Longest a sleep goes without checking for stop
+#define SCRIPT_SLEEP_SLICE_NS 10000000ull
+
+/* Constructor. Compiles source, throwing ScriptError if it does not
+ * compile, and allocates everything the script will ever need */
+Script::Script(Wrapper &wrapper, const char *source) : sense(wrapper) {
+    program = compile_script(source);
+    stack = new double[SCRIPT_STACK + program.heap_cells];
+    try {
+        frames = new ScriptFrame[SCRIPT_FRAMES];
+    } catch (...) {
+        delete[] stack;
+        throw;
+    }
+    // Fault the pages in now rather than while running
+    memset(stack, 0, (SCRIPT_STACK + program.heap_cells) * sizeof(double));
+    memset(frames, 0, SCRIPT_FRAMES * sizeof(ScriptFrame));
+    heap = stack + SCRIPT_STACK;
+    memset(&imu, 0, sizeof(ImuSample));
+    started = monotonic_ns();
+    stopping.store(false);
+    threaded = false;
+    message[0] = '\0';
+}
+
+Script::~Script() {
+    delete[] stack;
+    delete[] frames;
+}
+
+/* Runs the top level. SENSE_HAT_OUT_OF_RANGE on a runtime error, see
+ * error. Stopping is not an error */
+SenseHatStatus Script::run(void) noexcept {
+    double result;
+    started = monotonic_ns();
+    return execute(0, NULL, 0, result);
+}
+
+/* Index of the function called name, -1 if the script has none */
+int Script::function(const char *name) const noexcept {
+    for (size_t i = 1; i < program.functions.size(); i++) {
+        if (program.functions[i].name == name) {
+            return (int) i;
+        }
+    }
+    return -1;
+}
+
+/* Calls a function of the script with count arguments */
+SenseHatStatus Script::call(int function, const double *args, size_t count, double &result) noexcept {
+    result = 0.0;
+    if (function < 1 || (size_t) function >= program.functions.size() ||
+            program.functions[function].params != count) {
+        return SENSE_HAT_OUT_OF_RANGE;
+    }
+    return execute(function, args, count, result);
+}
+
+/* Message of the last runtime error, "" if the last run or call had none */
+const char * Script::error(void) const noexcept {
+    return message;
+}
+
+/* Elements of array number index, NULL if there is no such array */
+double * Script::array(size_t index, size_t &size) noexcept {
+    if (index >= program.arrays.size()) {
+        size = 0;
+        return NULL;
+    }
+    size = program.arrays[index].size;
+    return heap + program.arrays[index].offset;
+}
+
+const char * Script::string(size_t index) const noexcept {
+    return index < program.strings.size() ? program.strings[index].c_str() : "";
+}
+
+/* Sleeps for ms milliseconds, cut short by stop. False if it was */
+bool Script::sleep_ms(double ms) noexcept {
+    uint64_t end = monotonic_ns() + (uint64_t) (std::min(std::max(ms, 0.0), 1e9) * 1e6);
+    for (;;) {
+        if (stopping.load(std::memory_order_relaxed)) {
+            return false;
+        }
+        uint64_t now = monotonic_ns();
+        if (now >= end) {
+            return true;
+        }
+        std::this_thread::sleep_for(std::chrono::nanoseconds(std::min<uint64_t>(end - now, SCRIPT_SLEEP_SLICE_NS)));
+    }
+}
+
+/* Milliseconds since the last run started */
+double Script::elapsed_ms(void) const noexcept {
+    return (monotonic_ns() - started) / 1e6;
+}
+
+SenseHatStatus Script::fail(const ScriptInstruction *pc, const char *format, ...) noexcept {
+    int n = snprintf(message, sizeof(message), "line %u: ", program.lines[pc - program.code.data()]);
+    va_list args;
+    va_start(args, format);
+    vsnprintf(message + n, sizeof(message) - n, format, args);
+    va_end(args);
+    return SENSE_HAT_OUT_OF_RANGE;
+}
+
+/* The interpreter loop.
+ *
+ * Threaded, every instruction ends by jumping to the code of the next one
+ * through its handler, so each opcode has its own indirect branch for the
+ * predictor instead of sharing the one of a switch. The handlers are
+ * filled in on the first run, labels only exist inside this function.
+ * Calls keep running in this loop, with the caller's place on frames */
+#ifdef SCRIPT_THREADED
+// Labels as values and computed gotos are GNU extensions
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpedantic"
+#define OP(name) L_##name:
+#define DISPATCH() goto *pc->handler
+#else
+#define OP(name) case OP_##name:
+#define DISPATCH() goto dispatch
+#endif
+#define NEXT() do { pc++; DISPATCH(); } while (0)
+#define JUMP() do { pc += pc->x; DISPATCH(); } while (0)
+#define A (pc->a)
+#define B (pc->b)
+#define C (pc->c)
+#define K (pc->k)
+
+SenseHatStatus Script::execute(size_t function, const double *args, size_t count, double &result) noexcept {
+#ifdef SCRIPT_THREADED
+#define SCRIPT_LABEL(name) &&L_##name,
+    static const void * const labels[] = {
+        SCRIPT_OPCODES(SCRIPT_LABEL)
+    };
+#undef SCRIPT_LABEL
+    if (!threaded) {
+        for (ScriptInstruction &i : program.code) {
+            i.handler = labels[i.op];
+        }
+        threaded = true;
+    }
+#endif
+    const ScriptInstruction *code = program.code.data();
+    const ScriptFunction *functions = program.functions.data();
+    const ScriptArray *arrays = program.arrays.data();
+    double * const end = stack + SCRIPT_STACK;
+    // Other calls go above the globals of the top level
+    double *R = function == 0 ? stack : stack + functions[0].registers;
+    const ScriptInstruction *pc = code + functions[function].entry;
+    size_t depth = 0;
+    double value;
+    message[0] = '\0';
+    memcpy(R, args, count * sizeof(double));
+
+#ifdef SCRIPT_THREADED
+    DISPATCH();
+#else
+dispatch:
+    switch (pc->op) {
+#endif
+    OP(MOVE) R[A] = R[B]; NEXT();
+    OP(LOADK) R[A] = K; NEXT();
+    OP(ADD) R[A] = R[B] + R[C]; NEXT();
+    OP(SUB) R[A] = R[B] - R[C]; NEXT();
+    OP(MUL) R[A] = R[B] * R[C]; NEXT();
+    OP(DIV) R[A] = R[B] / R[C]; NEXT();
+    OP(MOD) R[A] = fmod(R[B], R[C]); NEXT();
+    OP(ADDK) R[A] = R[B] + K; NEXT();
+    OP(SUBK) R[A] = R[B] - K; NEXT();
+    OP(MULK) R[A] = R[B] * K; NEXT();
+    OP(DIVK) R[A] = R[B] / K; NEXT();
+    OP(MODK) R[A] = fmod(R[B], K); NEXT();
+    OP(NEG) R[A] = -R[B]; NEXT();
+    OP(NOT) R[A] = R[B] == 0; NEXT();
+    OP(EQ) R[A] = R[B] == R[C]; NEXT();
+    OP(NE) R[A] = R[B] != R[C]; NEXT();
+    OP(LT) R[A] = R[B] < R[C]; NEXT();
+    OP(LE) R[A] = R[B] <= R[C]; NEXT();
+    OP(EQK) R[A] = R[B] == K; NEXT();
+    OP(NEK) R[A] = R[B] != K; NEXT();
+    OP(LTK) R[A] = R[B] < K; NEXT();
+    OP(LEK) R[A] = R[B] <= K; NEXT();
+    OP(GTK) R[A] = R[B] > K; NEXT();
+    OP(GEK) R[A] = R[B] >= K; NEXT();
+    OP(IFEQ) if (!(R[A] == R[B])) JUMP(); NEXT();
+    OP(IFNE) if (!(R[A] != R[B])) JUMP(); NEXT();
+    OP(IFLT) if (!(R[A] < R[B])) JUMP(); NEXT();
+    OP(IFLE) if (!(R[A] <= R[B])) JUMP(); NEXT();
+    OP(IFEQK) if (!(R[A] == K)) JUMP(); NEXT();
+    OP(IFNEK) if (!(R[A] != K)) JUMP(); NEXT();
+    OP(IFLTK) if (!(R[A] < K)) JUMP(); NEXT();
+    OP(IFLEK) if (!(R[A] <= K)) JUMP(); NEXT();
+    OP(IFGTK) if (!(R[A] > K)) JUMP(); NEXT();
+    OP(IFGEK) if (!(R[A] >= K)) JUMP(); NEXT();
+    OP(JMP) JUMP();
+    OP(JMPF) if (R[A] == 0) JUMP(); NEXT();
+    OP(JMPT) if (R[A] != 0) JUMP(); NEXT();
+    OP(LOOP)
+        if (stopping.load(std::memory_order_relaxed)) {
+            result = 0.0;
+            return SENSE_HAT_OK;
+        }
+        JUMP();
+    OP(GETG) R[A] = stack[pc->x]; NEXT();
+    OP(SETG) stack[pc->x] = R[A]; NEXT();
+    OP(GETA) {
+        const ScriptArray &array = arrays[B];
+        double i = R[C];
+        if (!(i >= 0 && i < array.size)) {
+            return fail(pc, "index %g is outside %s", i, array.name.c_str());
+        }
+        R[A] = heap[array.offset + (uint32_t) i];
+        NEXT();
+    }
+    OP(SETA) {
+        const ScriptArray &array = arrays[A];
+        double i = R[B];
+        if (!(i >= 0 && i < array.size)) {
+            return fail(pc, "index %g is outside %s", i, array.name.c_str());
+        }
+        heap[array.offset + (uint32_t) i] = R[C];
+        NEXT();
+    }
+    OP(CALL) {
+        const ScriptFunction &callee = functions[pc->x];
+        if (depth == SCRIPT_FRAMES || R + A + callee.registers > end) {
+            return fail(pc, "calls nested too deep");
+        }
+        frames[depth].pc = pc + 1;
+        frames[depth].base = R;
+        depth++;
+        R += A;
+        pc = code + callee.entry;
+        DISPATCH();
+    }
+    OP(NATIVE) R[A] = script_natives[pc->x].call(*this, R + A); NEXT();
+    OP(RET)
+        value = R[A];
+        goto ret;
+    OP(RET0)
+        value = 0.0;
+        goto ret;
+    OP(PRINTS) fputs(program.strings[pc->x].c_str(), stdout); NEXT();
+    OP(PRINTN) printf("%g", R[A]); NEXT();
+    OP(PRINTEND)
+        putchar('\n');
+        fflush(stdout);
+        NEXT();
+#ifndef SCRIPT_THREADED
+    default:
+        return fail(pc, "bad opcode %u", pc->op);
+    }
+#endif
+
+ret:
+    if (depth == 0) {
+        result = value;
+        return SENSE_HAT_OK;
+    }
+    // The result goes to the first register of the callee, the register
+    // of the call in the caller
+    R[0] = value;
+    depth--;
+    pc = frames[depth].pc;
+    R = frames[depth].base;
+    DISPATCH();
+}
+
+#undef OP
+#undef DISPATCH
+#undef NEXT
+#undef JUMP
+#undef A
+#undef B
+#undef C
+#undef K
+#ifdef SCRIPT_THREADED
+#pragma GCC diagnostic pop
+#endif
@@ -0,0 +1,230 @@
+#ifndef SCRIPT_HPP
+#define SCRIPT_HPP
+
+extern "C" {
+    #include "SenseHatSensors.h"
+}
+
+#include "atomic"
+#include "cstdint"
+#include "string"
+#include "vector"
+
+/* Scripts for the Sense HAT.
+ *
+ * A small language compiled to the bytecode of a register machine, so the
+ * behaviour of a device can be changed by shipping a script instead of a
+ * binary:
+ *
+ *     # Comments run to the end of the line
+ *     var limit = 28                  # Numbers are doubles
+ *     array bar[8]                    # Arrays only at the top level
+ *
+ *     def level(t) {
+ *         if t > limit { return 0xF800 } elif t > 20 { return 0x07E0 }
+ *         return 0x001F
+ *     }
+ *
+ *     while 1 {
+ *         var t = temperature()
+ *         set_pixels(level(t))
+ *         print "temperature ", t
+ *         sleep(500)
+ *     }
+ *
+ * Statements are var, assignment (=, +=, -=, *=, /=, also to array[i]),
+ * if/elif/else, while, break, continue, return, print and calls. Operators
+ * are or, and, not, == != < <= > >=, + -, * / % and unary -, with 0 false
+ * and anything else true. Variables declared at the top level are globals,
+ * seen by the functions defined after them. Functions may be called before
+ * they are defined. The built in functions are listed in ScriptNatives.cpp:
+ * the sensor getters and LED calls of the C API, bound straight to the
+ * Wrapper, and a few from math.h.
+ *
+ * Instructions have up to three 8 bit register operands, a 32 bit jump or
+ * index and a constant. Every register, the call stack and the arrays are
+ * allocated when the script is loaded, running it allocates nothing. With
+ * GCC and clang each instruction holds the address of its code in the
+ * interpreter loop (direct threading); elsewhere, or built with
+ * SCRIPT_SWITCH_DISPATCH, the loop switches on the opcode. */
+
+class Wrapper;
+
+// Registers of all active calls together
+#define SCRIPT_STACK 4096
+// Deepest nesting of calls
+#define SCRIPT_FRAMES 128
+// Array elements of one script
+#define SCRIPT_HEAP_MAX (1u << 16)
+// Deepest nesting of blocks and of parentheses, unary operators and calls
+// in an expression. The compiler recurses on both
+#define SCRIPT_NESTING 200
+// Longest error message, line number included
+#define SCRIPT_ERROR_SIZE 160
+
+#if (defined(__GNUC__) || defined(__clang__)) && !defined(SCRIPT_SWITCH_DISPATCH)
+#define SCRIPT_THREADED 1
+#endif
+
+// X(name) for every opcode. R is the registers of the running call, K the
+// constant of the instruction and X its jump or index
+#define SCRIPT_OPCODES(X) \
+    X(MOVE)         /* R[A] = R[B] */ \
+    X(LOADK)        /* R[A] = K */ \
+    X(ADD)          /* R[A] = R[B] + R[C] */ \
+    X(SUB) \
+    X(MUL) \
+    X(DIV) \
+    X(MOD)          /* fmod */ \
+    X(ADDK)         /* R[A] = R[B] + K */ \
+    X(SUBK) \
+    X(MULK) \
+    X(DIVK) \
+    X(MODK) \
+    X(NEG)          /* R[A] = -R[B] */ \
+    X(NOT)          /* R[A] = R[B] == 0 */ \
+    X(EQ)           /* R[A] = R[B] == R[C], 1 or 0 */ \
+    X(NE) \
+    X(LT) \
+    X(LE) \
+    X(EQK)          /* R[A] = R[B] == K */ \
+    X(NEK) \
+    X(LTK) \
+    X(LEK) \
+    X(GTK) \
+    X(GEK) \
+    X(IFEQ)         /* Unless R[A] == R[B], jump X. Same order as EQ.. */ \
+    X(IFNE) \
+    X(IFLT) \
+    X(IFLE) \
+    X(IFEQK)        /* Unless R[A] == K, jump X */ \
+    X(IFNEK) \
+    X(IFLTK) \
+    X(IFLEK) \
+    X(IFGTK) \
+    X(IFGEK) \
+    X(JMP)          /* Jump X forward */ \
+    X(JMPF)         /* Jump X if R[A] is false */ \
+    X(JMPT)         /* Jump X if R[A] is true */ \
+    X(LOOP)         /* Jump X back, or return if the script is stopped */ \
+    X(GETG)         /* R[A] = global X */ \
+    X(SETG)         /* Global X = R[A] */ \
+    X(GETA)         /* R[A] = array B[R[C]] */ \
+    X(SETA)         /* Array A[R[B]] = R[C] */ \
+    X(CALL)         /* R[A] = function X(R[A], ..., R[A + B - 1]) */ \
+    X(NATIVE)       /* R[A] = built in X(R[A], ..., R[A + B - 1]) */ \
+    X(RET)          /* Return R[A] */ \
+    X(RET0)         /* Return 0 */ \
+    X(PRINTS)       /* Print string X */ \
+    X(PRINTN)       /* Print R[A] */ \
+    X(PRINTEND)     /* End the line */
+
+enum ScriptOpcode {
+#define SCRIPT_ENUM(name) OP_##name,
+    SCRIPT_OPCODES(SCRIPT_ENUM)
+#undef SCRIPT_ENUM
+    SCRIPT_OPCODE_COUNT
+};
+
+typedef struct ScriptInstruction {
+    const void *handler;    // Code of op in the interpreter, when threaded
+    uint8_t op;             // ScriptOpcode
+    uint8_t a;
+    uint8_t b;
+    uint8_t c;
+    int32_t x;              // Jump relative to this instruction, or an index
+    double k;
+} ScriptInstruction;
+
+typedef struct ScriptFunction {
+    std::string name;       // Empty for the top level
+    uint32_t entry;         // First instruction
+    uint32_t params;
+    uint32_t registers;     // Parameters included
+    uint32_t line;          // Of the first call if it was never defined
+    bool defined;
+} ScriptFunction;
+
+typedef struct ScriptArray {
+    std::string name;
+    uint32_t offset;        // In the heap
+    uint32_t size;
+} ScriptArray;
+
+// Output of the compiler
+typedef struct ScriptProgram {
+    std::vector<ScriptInstruction> code;
+    std::vector<uint32_t> lines;            // Source line of each instruction
+    std::vector<ScriptFunction> functions;  // The top level is function 0
+    std::vector<ScriptArray> arrays;
+    std::vector<std::string> strings;       // Literals of print and the natives
+    uint32_t heap_cells;                    // Elements of all the arrays
+} ScriptProgram;
+
+// Thrown by the compiler, message starts with the line
+struct ScriptError {
+    char message[SCRIPT_ERROR_SIZE];
+};
+
+ScriptProgram compile_script(const char *);
+
+class Script;
+
+// A built in function. params has a letter per parameter: n a number, a
+// the name of an array and s a string literal, passed as their index
+typedef struct ScriptNative {
+    const char *name;
+    const char *params;
+    double (*call)(Script &, const double *);
+} ScriptNative;
+
+extern const ScriptNative script_natives[];
+extern const size_t script_native_count;
+
+typedef struct ScriptFrame {
+    const ScriptInstruction *pc;    // Where the caller continues
+    double *base;                   // Registers of the caller
+} ScriptFrame;
+
+/* A loaded script and the memory it runs in.
+ *
+ * Used from one thread at a time, except for stop. The top level keeps
+ * its registers, the globals, between runs, and call runs the functions
+ * above them. */
+class Script {
+public:
+    Script(Wrapper &, const char *);
+    ~Script();
+    SenseHatStatus run(void) noexcept;
+    int function(const char *) const noexcept;
+    SenseHatStatus call(int, const double *, size_t, double &) noexcept;
+    const char * error(void) const noexcept;
+
+    /* Makes the running script, and every later run, return at the next
+     * loop iteration or sleep. Only an atomic store, so it may be called
+     * from any thread or a signal handler */
+    void stop(void) noexcept {
+        stopping.store(true, std::memory_order_relaxed);
+    }
+
+    // For the natives
+    Wrapper &sense;
+    ImuSample imu;                  // From the last sample()
+    double * array(size_t, size_t &) noexcept;
+    const char * string(size_t) const noexcept;
+    bool sleep_ms(double) noexcept;
+    double elapsed_ms(void) const noexcept;
+private:
+    SenseHatStatus execute(size_t, const double *, size_t, double &) noexcept;
+    SenseHatStatus fail(const ScriptInstruction *, const char *, ...) noexcept;
+    ScriptProgram program;
+    double *stack;                  // SCRIPT_STACK registers, then the heap
+    double *heap;
+    ScriptFrame *frames;
+    uint64_t started;               // monotonic_ns of the last run
+    std::atomic<bool> stopping;
+    bool threaded;                  // Handlers filled in
+    char message[SCRIPT_ERROR_SIZE];
+};
+
+#endif /* SCRIPT_HPP */
@@ -0,0 +1,1193 @@
+#include "Script.hpp"
+
+#include "algorithm"
+#include "cctype"
+#include "cmath"
+#include "cstdarg"
+#include "cstdio"
+#include "cstdlib"
+#include "cstring"
+
+/* Single pass compiler from the script language (Script.hpp) to bytecode.
+ *
+ * A recursive descent parser emits the code of each function as it goes.
+ * Locals live in the registers numbered in the order they are declared,
+ * temporaries in the registers above them, taken and given back like a
+ * stack. Expressions hand back a constant or the register their value is
+ * in, so constants are folded and end up in the K operand, reading a local
+ * costs nothing, and a result is written straight into the variable it is
+ * assigned to. A comparison that decides a jump is fused with it. */
+
+namespace {
+
+// Tokens other than these are the character itself
+enum {
+    T_END = 256,
+    T_NUMBER,
+    T_STRING,
+    T_NAME,
+    T_VAR,
+    T_ARRAY,
+    T_DEF,
+    T_IF,
+    T_ELIF,
+    T_ELSE,
+    T_WHILE,
+    T_BREAK,
+    T_CONTINUE,
+    T_RETURN,
+    T_PRINT,
+    T_AND,
+    T_OR,
+    T_NOT,
+    T_EQ,           // ==
+    T_NE,           // !=
+    T_LE,           // <=
+    T_GE,           // >=
+    T_ADD_TO,       // +=
+    T_SUB_FROM,     // -=
+    T_MUL_BY,       // *=
+    T_DIV_BY,       // /=
+};
+
+const struct {
+    const char *word;
+    int token;
+} keywords[] = {
+    {"var", T_VAR}, {"array", T_ARRAY}, {"def", T_DEF}, {"if", T_IF},
+    {"elif", T_ELIF}, {"else", T_ELSE}, {"while", T_WHILE}, {"break", T_BREAK},
+    {"continue", T_CONTINUE}, {"return", T_RETURN}, {"print", T_PRINT},
+    {"and", T_AND}, {"or", T_OR}, {"not", T_NOT},
+};
+
+const struct {
+    char first;
+    char second;
+    int token;
+} pairs[] = {
+    {'=', '=', T_EQ}, {'!', '=', T_NE}, {'<', '=', T_LE}, {'>', '=', T_GE},
+    {'+', '=', T_ADD_TO}, {'-', '=', T_SUB_FROM}, {'*', '=', T_MUL_BY}, {'/', '=', T_DIV_BY},
+};
+
+typedef struct Token {
+    int kind;
+    double number;
+    std::string text;       // Name, or string literal with escapes resolved
+    uint32_t line;
+} Token;
+
+// A constant not loaded yet, or the register holding a value
+typedef struct Operand {
+    bool constant;
+    double k;
+    int reg;
+} Operand;
+
+Operand constant(double k) {
+    Operand o = {true, k, 0};
+    return o;
+}
+
+Operand in_register(int reg) {
+    Operand o = {false, 0.0, reg};
+    return o;
+}
+
+enum NameKind {
+    NAME_NONE,
+    NAME_LOCAL,         // index is the register
+    NAME_GLOBAL,        // A local of the top level seen from a function
+    NAME_ARRAY,
+    NAME_FUNCTION,
+    NAME_NATIVE,
+};
+
+typedef struct Name {
+    NameKind kind;
+    int index;
+} Name;
+
+typedef struct Loop {
+    uint32_t top;
+    std::vector<uint32_t> breaks;
+} Loop;
+
+// The function being compiled
+typedef struct FunctionState {
+    uint32_t index;
+    std::vector<ScriptInstruction> code;
+    std::vector<uint32_t> lines;
+    std::vector<std::string> locals;    // Register i holds locals[i]
+    std::vector<Loop> loops;
+    int free;                           // First free register
+    int registers;                      // Most in use at once
+    uint32_t target;                    // Last instruction jumped to
+} FunctionState;
+
+class Compiler {
+    friend class Nested;
+public:
+    Compiler(const char *);
+    ScriptProgram compile(void);
+private:
+    // Lexer
+    void advance(void);
+    void lex(Token &);
+    bool accept(int);
+    void expect(int, const char *);
+    std::string expect_name(void);
+    [[noreturn]] void fail(const char *, ...) const;
+    [[noreturn]] void fail_at(uint32_t, const char *, ...) const;
+    ScriptError error(uint32_t, const char *, va_list) const;
+    std::string describe(const Token &) const;
+
+    // Code
+    uint32_t pc(void) const {
+        return (uint32_t) f->code.size();
+    }
+    uint32_t emit(int, int, int, int, int32_t, double);
+    void patch_here(uint32_t);
+    int reserve(void);
+    bool is_temp(const Operand &o) const {
+        return !o.constant && o.reg >= (int) f->locals.size();
+    }
+    void release(const Operand &);
+    void release(const Operand &, const Operand &);
+    Operand to_register(const Operand &);
+    Operand to_temp(const Operand &);
+    bool retargetable(int) const;
+    void store(int, const Operand &);
+
+    // Names
+    Name resolve(const std::string &) const;
+    void check_new(const std::string &) const;
+    void finish(FunctionState &);
+
+    // Statements
+    void statement(void);
+    void block(void);
+    void define(void);
+    void declare_array(void);
+    void declare_var(void);
+    void if_statement(void);
+    void while_statement(void);
+    void return_statement(void);
+    void print_statement(void);
+    void name_statement(void);
+
+    // Expressions
+    int64_t condition(void);
+    Operand expression(void);
+    Operand short_circuit(int, Operand, Operand (Compiler::*)(void));
+    Operand disjunction(void);
+    Operand conjunction(void);
+    Operand negation(void);
+    Operand comparison(void);
+    Operand sum(void);
+    Operand term(void);
+    Operand unary(void);
+    Operand primary(void);
+    Operand call(const std::string &);
+    Operand binary(int, Operand, Operand);
+
+    const char *p;
+    uint32_t line;
+    uint32_t depth;                     // Nesting, see Nested
+    Token cur;
+    uint32_t last_line;                 // Of the token before cur
+    ScriptProgram program;
+    std::vector<std::vector<ScriptInstruction> > codes;    // Per function
+    std::vector<std::vector<uint32_t> > lines;
+    FunctionState top;
+    FunctionState *f;                   // &top or the function being defined
+};
+
+/* Counts one level of nesting for as long as it lives, so deep input fails
+ * before the recursion runs out of stack */
+class Nested {
+public:
+    Nested(Compiler &c) : compiler(c) {
+        if (++compiler.depth > SCRIPT_NESTING) {
+            compiler.depth--;
+            compiler.fail("nested too deep");
+        }
+    }
+    ~Nested() {
+        compiler.depth--;
+    }
+private:
+    Compiler &compiler;
+};
+
+Compiler::Compiler(const char *source) {
+    p = source;
+    line = 1;
+    depth = 0;
+    last_line = 1;
+    program.heap_cells = 0;
+    top.index = 0;
+    top.free = 0;
+    top.registers = 0;
+    top.target = 0;
+    f = &top;
+    cur.kind = T_END;
+    cur.line = 1;
+    ScriptFunction main = {"", 0, 0, 0, 0, true};
+    program.functions.push_back(main);
+}
+
+/***** Lexer *****/
+
+/* Error at the current token */
+void Compiler::fail(const char *format, ...) const {
+    va_list args;
+    va_start(args, format);
+    ScriptError e = error(cur.line, format, args);
+    va_end(args);
+    throw e;
+}
+
+/* Error about something on an earlier line, such as a name just read */
+void Compiler::fail_at(uint32_t at, const char *format, ...) const {
+    va_list args;
+    va_start(args, format);
+    ScriptError e = error(at, format, args);
+    va_end(args);
+    throw e;
+}
+
+ScriptError Compiler::error(uint32_t at, const char *format, va_list args) const {
+    ScriptError e;
+    int n = snprintf(e.message, sizeof(e.message), "line %u: ", at);
+    vsnprintf(e.message + n, sizeof(e.message) - n, format, args);
+    return e;
+}
+
+std::string Compiler::describe(const Token &t) const {
+    switch (t.kind) {
+    case T_END:
+        return "end of script";
+    case T_NUMBER:
+        return "number";
+    case T_STRING:
+        return "string";
+    case T_NAME:
+        return "'" + t.text + "'";
+    }
+    for (const auto &k : keywords) {
+        if (k.token == t.kind) {
+            return std::string("'") + k.word + "'";
+        }
+    }
+    for (const auto &pair : pairs) {
+        if (pair.token == t.kind) {
+            return std::string("'") + pair.first + pair.second + "'";
+        }
+    }
+    return std::string("'") + (char) t.kind + "'";
+}
+
+void Compiler::advance(void) {
+    last_line = cur.line;
+    lex(cur);
+}
+
+void Compiler::lex(Token &t) {
+    // Semicolons may separate statements but are never needed
+    for (;;) {
+        if (*p == '\n') {
+            line++;
+            p++;
+        } else if (*p == ' ' || *p == '\t' || *p == '\r' || *p == ';') {
+            p++;
+        } else if (*p == '#') {
+            while (*p && *p != '\n') {
+                p++;
+            }
+        } else {
+            break;
+        }
+    }
+    t.line = line;
+    t.text.clear();
+    if (*p == '\0') {
+        t.kind = T_END;
+        return;
+    }
+    if (isdigit((unsigned char) *p) || (*p == '.' && isdigit((unsigned char) p[1]))) {
+        char *end;
+        t.kind = T_NUMBER;
+        t.number = strtod(p, &end);
+        p = end;
+        if (isalnum((unsigned char) *p) || *p == '_') {
+            fail("malformed number");
+        }
+        return;
+    }
+    if (isalpha((unsigned char) *p) || *p == '_') {
+        const char *start = p;
+        while (isalnum((unsigned char) *p) || *p == '_') {
+            p++;
+        }
+        t.text.assign(start, p - start);
+        t.kind = T_NAME;
+        for (const auto &k : keywords) {
+            if (t.text == k.word) {
+                t.kind = k.token;
+            }
+        }
+        return;
+    }
+    if (*p == '"') {
+        p++;
+        while (*p != '"') {
+            if (*p == '\0' || *p == '\n') {
+                fail("unfinished string");
+            }
+            char c = *p++;
+            if (c == '\\') {
+                c = *p++;
+                if (c == 'n') {
+                    c = '\n';
+                } else if (c == 't') {
+                    c = '\t';
+                } else if (c != '"' && c != '\\') {
+                    fail("unknown escape in string");
+                }
+            }
+            t.text += c;
+        }
+        p++;
+        t.kind = T_STRING;
+        return;
+    }
+    for (const auto &pair : pairs) {
+        if (p[0] == pair.first && p[1] == pair.second) {
+            p += 2;
+            t.kind = pair.token;
+            return;
+        }
+    }
+    if (strchr("(){}[],=<>+-*/%", *p)) {
+        t.kind = *p++;
+        return;
+    }
+    fail("unexpected character '%c'", *p);
+}
+
+bool Compiler::accept(int kind) {
+    if (cur.kind != kind) {
+        return false;
+    }
+    advance();
+    return true;
+}
+
+void Compiler::expect(int kind, const char *what) {
+    if (!accept(kind)) {
+        fail("expected %s before %s", what, describe(cur).c_str());
+    }
+}
+
+std::string Compiler::expect_name(void) {
+    if (cur.kind != T_NAME) {
+        fail("expected a name before %s", describe(cur).c_str());
+    }
+    std::string name = cur.text;
+    advance();
+    return name;
+}
+
+/***** Code *****/
+
+uint32_t Compiler::emit(int op, int a, int b, int c, int32_t x, double k) {
+    ScriptInstruction i = {NULL, (uint8_t) op, (uint8_t) a, (uint8_t) b, (uint8_t) c, x, k};
+    f->code.push_back(i);
+    f->lines.push_back(last_line);
+    return pc() - 1;
+}
+
+/* Points the jump at the next instruction */
+void Compiler::patch_here(uint32_t jump) {
+    f->code[jump].x = (int32_t) (pc() - jump);
+    f->target = pc();
+}
+
+int Compiler::reserve(void) {
+    if (f->free == 256) {
+        fail("too many variables or expression too deep");
+    }
+    f->free++;
+    f->registers = std::max(f->registers, f->free);
+    return f->free - 1;
+}
+
+/* Gives back a temporary, the most recent one first */
+void Compiler::release(const Operand &o) {
+    if (is_temp(o)) {
+        f->free--;
+    }
+}
+
+void Compiler::release(const Operand &a, const Operand &b) {
+    if (a.reg > b.reg) {
+        release(a);
+        release(b);
+    } else {
+        release(b);
+        release(a);
+    }
+}
+
+Operand Compiler::to_register(const Operand &o) {
+    if (!o.constant) {
+        return o;
+    }
+    int reg = reserve();
+    emit(OP_LOADK, reg, 0, 0, 0, o.k);
+    return in_register(reg);
+}
+
+/* A register the value may be overwritten in */
+Operand Compiler::to_temp(const Operand &o) {
+    if (is_temp(o)) {
+        return o;
+    }
+    int reg = reserve();
+    store(reg, o);
+    return in_register(reg);
+}
+
+/* True if the last instruction only computes reg, so it can write its
+ * result to another register instead. Never if something jumps past it */
+bool Compiler::retargetable(int reg) const {
+    if (f->code.empty() || f->target == pc()) {
+        return false;
+    }
+    const ScriptInstruction &i = f->code.back();
+    bool computes = (i.op >= OP_MOVE && i.op <= OP_GEK) || i.op == OP_GETG || i.op == OP_GETA;
+    return computes && i.a == reg;
+}
+
+/* Puts value in reg and releases it */
+void Compiler::store(int reg, const Operand &value) {
+    if (value.constant) {
+        emit(OP_LOADK, reg, 0, 0, 0, value.k);
+    } else if (value.reg != reg) {
+        if (is_temp(value) && retargetable(value.reg)) {
+            f->code.back().a = (uint8_t) reg;
+        } else {
+            emit(OP_MOVE, reg, value.reg, 0, 0, 0.0);
+        }
+    }
+    release(value);
+}
+
+/***** Names *****/
+
+Name Compiler::resolve(const std::string &name) const {
+    Name n = {NAME_NONE, 0};
+    for (size_t i = f->locals.size(); i-- > 0;) {
+        if (f->locals[i] == name) {
+            n.kind = NAME_LOCAL;
+            n.index = (int) i;
+            return n;
+        }
+    }
+    if (f != &top) {
+        for (size_t i = 0; i < top.locals.size(); i++) {
+            if (top.locals[i] == name) {
+                n.kind = NAME_GLOBAL;
+                n.index = (int) i;
+                return n;
+            }
+        }
+    }
+    for (size_t i = 0; i < program.arrays.size(); i++) {
+        if (program.arrays[i].name == name) {
+            n.kind = NAME_ARRAY;
+            n.index = (int) i;
+            return n;
+        }
+    }
+    for (size_t i = 1; i < program.functions.size(); i++) {
+        if (program.functions[i].name == name) {
+            n.kind = NAME_FUNCTION;
+            n.index = (int) i;
+            return n;
+        }
+    }
+    for (size_t i = 0; i < script_native_count; i++) {
+        if (name == script_natives[i].name) {
+            n.kind = NAME_NATIVE;
+            n.index = (int) i;
+            return n;
+        }
+    }
+    return n;
+}
+
+/* Fails if name cannot be declared here. Locals of a function may hide
+ * globals, nothing else may be declared twice */
+void Compiler::check_new(const std::string &name) const {
+    Name n = resolve(name);
+    if (n.kind != NAME_NONE && n.kind != NAME_GLOBAL) {
+        fail_at(last_line, "'%s' is already declared", name.c_str());
+    }
+    if (name == "len") {
+        fail_at(last_line, "'len' is built in");
+    }
+}
+
+void Compiler::finish(FunctionState &state) {
+    if (codes.size() <= state.index) {
+        codes.resize(state.index + 1);
+        lines.resize(state.index + 1);
+    }
+    codes[state.index].swap(state.code);
+    lines[state.index].swap(state.lines);
+    program.functions[state.index].registers = (uint32_t) state.registers;
+}
+
+/***** Statements *****/
+
+ScriptProgram Compiler::compile(void) {
+    advance();
+    while (cur.kind != T_END) {
+        if (cur.kind == T_DEF) {
+            define();
+        } else if (cur.kind == T_ARRAY) {
+            declare_array();
+        } else {
+            statement();
+        }
+    }
+    emit(OP_RET0, 0, 0, 0, 0, 0.0);
+    finish(top);
+
+    for (const ScriptFunction &function : program.functions) {
+        if (!function.defined) {
+            fail_at(function.line, "'%s' is not defined", function.name.c_str());
+        }
+    }
+    for (size_t i = 0; i < program.functions.size(); i++) {
+        program.functions[i].entry = (uint32_t) program.code.size();
+        program.code.insert(program.code.end(), codes[i].begin(), codes[i].end());
+        program.lines.insert(program.lines.end(), lines[i].begin(), lines[i].end());
+    }
+    return program;
+}
+
+void Compiler::statement(void) {
+    switch (cur.kind) {
+    case T_VAR:
+        declare_var();
+        break;
+    case T_IF:
+        if_statement();
+        break;
+    case T_WHILE:
+        while_statement();
+        break;
+    case T_BREAK:
+        if (f->loops.empty()) {
+            fail("break outside a loop");
+        }
+        advance();
+        f->loops.back().breaks.push_back(emit(OP_JMP, 0, 0, 0, 0, 0.0));
+        break;
+    case T_CONTINUE:
+        if (f->loops.empty()) {
+            fail("continue outside a loop");
+        }
+        advance();
+        emit(OP_LOOP, 0, 0, 0, (int32_t) (f->loops.back().top - pc()), 0.0);
+        break;
+    case T_RETURN:
+        return_statement();
+        break;
+    case T_PRINT:
+        print_statement();
+        break;
+    case T_NAME:
+        name_statement();
+        break;
+    case '{':
+        block();
+        break;
+    case T_DEF:
+    case T_ARRAY:
+        fail("%s only at the top level", describe(cur).c_str());
+    default:
+        fail("unexpected %s", describe(cur).c_str());
+    }
+    f->free = (int) f->locals.size();
+}
+
+void Compiler::block(void) {
+    expect('{', "'{'");
+    Nested nested(*this);
+    size_t locals = f->locals.size();
+    while (cur.kind != '}' && cur.kind != T_END) {
+        statement();
+    }
+    expect('}', "'}'");
+    f->locals.resize(locals);
+    f->free = (int) locals;
+}
+
+void Compiler::define(void) {
+    advance();
+    std::string name = expect_name();
+    Name n = resolve(name);
+    bool called = n.kind == NAME_FUNCTION && !program.functions[n.index].defined;
+    uint32_t index;
+    if (called) {
+        index = (uint32_t) n.index;
+    } else {
+        check_new(name);
+        index = (uint32_t) program.functions.size();
+        ScriptFunction function = {name, 0, 0, 0, cur.line, false};
+        program.functions.push_back(function);
+    }
+
+    FunctionState state;
+    state.index = index;
+    state.target = 0;
+    f = &state;
+    expect('(', "'('");
+    if (cur.kind != ')') {
+        do {
+            std::string param = expect_name();
+            check_new(param);
+            state.locals.push_back(param);
+        } while (accept(','));
+    }
+    expect(')', "')'");
+    ScriptFunction &function = program.functions[index];
+    if (called && function.params != state.locals.size()) {
+        fail("'%s' is called with %u arguments", name.c_str(), function.params);
+    }
+    function.params = (uint32_t) state.locals.size();
+    function.defined = true;
+    state.free = state.registers = (int) state.locals.size();
+
+    block();
+    emit(OP_RET0, 0, 0, 0, 0, 0.0);
+    f = &top;
+    finish(state);
+}
+
+void Compiler::declare_array(void) {
+    advance();
+    std::string name = expect_name();
+    check_new(name);
+    expect('[', "'['");
+    double size = cur.number;
+    if (cur.kind != T_NUMBER || size < 1 || size != floor(size) ||
+            program.heap_cells + size > SCRIPT_HEAP_MAX) {
+        fail("array size must be a whole number from 1 to %u in all", SCRIPT_HEAP_MAX);
+    }
+    advance();
+    expect(']', "']'");
+    ScriptArray array = {name, program.heap_cells, (uint32_t) size};
+    program.arrays.push_back(array);
+    program.heap_cells += (uint32_t) size;
+}
+
+void Compiler::declare_var(void) {
+    advance();
+    std::string name = expect_name();
+    check_new(name);
+    expect('=', "'='");
+    // A computed value is already in the register the variable gets
+    Operand value = expression();
+    if (!is_temp(value)) {
+        store(reserve(), value);
+    }
+    f->locals.push_back(name);
+}
+
+void Compiler::if_statement(void) {
+    std::vector<uint32_t> ends;
+    advance();
+    int64_t skip = condition();
+    block();
+    while (cur.kind == T_ELIF || cur.kind == T_ELSE) {
+        bool elif = cur.kind == T_ELIF;
+        advance();
+        ends.push_back(emit(OP_JMP, 0, 0, 0, 0, 0.0));
+        if (skip >= 0) {
+            patch_here((uint32_t) skip);
+        }
+        skip = elif ? condition() : -1;
+        block();
+        if (!elif) {
+            break;
+        }
+    }
+    if (skip >= 0) {
+        patch_here((uint32_t) skip);
+    }
+    for (uint32_t end : ends) {
+        patch_here(end);
+    }
+}
+
+void Compiler::while_statement(void) {
+    advance();
+    Loop loop;
+    loop.top = f->target = pc();
+    int64_t exit = condition();
+    f->loops.push_back(loop);
+    block();
+    emit(OP_LOOP, 0, 0, 0, (int32_t) (f->loops.back().top - pc()), 0.0);
+    if (exit >= 0) {
+        patch_here((uint32_t) exit);
+    }
+    for (uint32_t jump : f->loops.back().breaks) {
+        patch_here(jump);
+    }
+    f->loops.pop_back();
+}
+
+void Compiler::return_statement(void) {
+    advance();
+    if (cur.kind == '}' || cur.kind == T_END) {
+        emit(OP_RET0, 0, 0, 0, 0, 0.0);
+        return;
+    }
+    Operand value = to_register(expression());
+    emit(OP_RET, value.reg, 0, 0, 0, 0.0);
+    release(value);
+}
+
+void Compiler::print_statement(void) {
+    advance();
+    do {
+        if (cur.kind == T_STRING) {
+            emit(OP_PRINTS, 0, 0, 0, (int32_t) program.strings.size(), 0.0);
+            program.strings.push_back(cur.text);
+            advance();
+        } else {
+            Operand value = to_register(expression());
+            emit(OP_PRINTN, value.reg, 0, 0, 0, 0.0);
+            release(value);
+        }
+    } while (accept(','));
+    emit(OP_PRINTEND, 0, 0, 0, 0, 0.0);
+}
+
+/* Arithmetic of an assignment operator */
+static int assigned_op(int token) {
+    switch (token) {
+    case T_ADD_TO:
+        return '+';
+    case T_SUB_FROM:
+        return '-';
+    case T_MUL_BY:
+        return '*';
+    case T_DIV_BY:
+        return '/';
+    }
+    return '=';
+}
+
+/* A call, or an assignment to a variable or array element */
+void Compiler::name_statement(void) {
+    std::string name = cur.text;
+    advance();
+    if (cur.kind == '(') {
+        release(call(name));
+        return;
+    }
+    Name n = resolve(name);
+    if (n.kind == NAME_NONE) {
+        fail_at(last_line, "'%s' is not declared", name.c_str());
+    }
+    if (n.kind == NAME_ARRAY) {
+        expect('[', "'['");
+        Operand index = to_register(expression());
+        expect(']', "']'");
+        int op = assigned_op(cur.kind);
+        if (op == '=' && cur.kind != '=') {
+            fail("expected an assignment before %s", describe(cur).c_str());
+        }
+        advance();
+        Operand value;
+        if (op != '=') {
+            int old = reserve();
+            emit(OP_GETA, old, n.index, index.reg, 0, 0.0);
+            value = binary(op, in_register(old), expression());
+        } else {
+            value = expression();
+        }
+        value = to_register(value);
+        emit(OP_SETA, n.index, index.reg, value.reg, 0, 0.0);
+        release(value, index);
+        return;
+    }
+    if (n.kind != NAME_LOCAL && n.kind != NAME_GLOBAL) {
+        fail_at(last_line, "cannot assign to '%s'", name.c_str());
+    }
+    int op = assigned_op(cur.kind);
+    if (op == '=' && cur.kind != '=') {
+        fail("expected an assignment before %s", describe(cur).c_str());
+    }
+    advance();
+    if (n.kind == NAME_LOCAL) {
+        Operand value = expression();
+        if (op != '=') {
+            value = binary(op, in_register(n.index), value);
+        }
+        store(n.index, value);
+        return;
+    }
+    Operand value;
+    if (op != '=') {
+        int old = reserve();
+        emit(OP_GETG, old, 0, 0, n.index, 0.0);
+        value = binary(op, in_register(old), expression());
+    } else {
+        value = expression();
+    }
+    value = to_register(value);
+    emit(OP_SETG, value.reg, 0, 0, n.index, 0.0);
+    release(value);
+}
+
+/***** Expressions *****/
+
+/* Compiles an expression and a jump taken when it is false. Returns the
+ * jump to patch, or -1 if the expression is never false */
+int64_t Compiler::condition(void) {
+    Operand value = expression();
+    if (value.constant) {
+        if (value.k != 0) {
+            return -1;
+        }
+        return emit(OP_JMP, 0, 0, 0, 0, 0.0);
+    }
+    if (is_temp(value) && retargetable(value.reg)) {
+        ScriptInstruction &i = f->code.back();
+        if (i.op >= OP_EQ && i.op <= OP_GEK) {
+            // R[A] = R[B] < R[C] becomes: unless R[B] < R[C], jump
+            i.op = (uint8_t) (i.op - OP_EQ + OP_IFEQ);
+            i.a = i.b;
+            i.b = i.c;
+            i.c = 0;
+            release(value);
+            return pc() - 1;
+        }
+        if (i.op == OP_NOT) {
+            i.op = OP_JMPT;
+            i.a = i.b;
+            release(value);
+            return pc() - 1;
+        }
+    }
+    release(value);
+    return emit(OP_JMPF, value.reg, 0, 0, 0, 0.0);
+}
+
+Operand Compiler::expression(void) {
+    return disjunction();
+}
+
+/* left or/and right, which gives the left value if it decides the result.
+ * jump is JMPT for or and JMPF for and */
+Operand Compiler::short_circuit(int jump, Operand left, Operand (Compiler::*right)(void)) {
+    Operand result = to_temp(left);
+    uint32_t skip = emit(jump, result.reg, 0, 0, 0, 0.0);
+    store(result.reg, (this->*right)());
+    patch_here(skip);
+    return result;
+}
+
+Operand Compiler::disjunction(void) {
+    Operand left = conjunction();
+    while (accept(T_OR)) {
+        left = short_circuit(OP_JMPT, left, &Compiler::conjunction);
+    }
+    return left;
+}
+
+Operand Compiler::conjunction(void) {
+    Operand left = negation();
+    while (accept(T_AND)) {
+        left = short_circuit(OP_JMPF, left, &Compiler::negation);
+    }
+    return left;
+}
+
+Operand Compiler::negation(void) {
+    if (!accept(T_NOT)) {
+        return comparison();
+    }
+    Nested nested(*this);
+    Operand value = negation();
+    if (value.constant) {
+        return constant(value.k == 0);
+    }
+    release(value);
+    int reg = reserve();
+    emit(OP_NOT, reg, value.reg, 0, 0, 0.0);
+    return in_register(reg);
+}
+
+Operand Compiler::comparison(void) {
+    Operand left = sum();
+    for (;;) {
+        int op = cur.kind;
+        if (op != T_EQ && op != T_NE && op != '<' && op != T_LE && op != '>' && op != T_GE) {
+            return left;
+        }
+        advance();
+        left = binary(op, left, sum());
+    }
+}
+
+Operand Compiler::sum(void) {
+    Operand left = term();
+    while (cur.kind == '+' || cur.kind == '-') {
+        int op = cur.kind;
+        advance();
+        left = binary(op, left, term());
+    }
+    return left;
+}
+
+Operand Compiler::term(void) {
+    Operand left = unary();
+    while (cur.kind == '*' || cur.kind == '/' || cur.kind == '%') {
+        int op = cur.kind;
+        advance();
+        left = binary(op, left, unary());
+    }
+    return left;
+}
+
+Operand Compiler::unary(void) {
+    if (!accept('-')) {
+        return primary();
+    }
+    Nested nested(*this);
+    Operand value = unary();
+    if (value.constant) {
+        return constant(-value.k);
+    }
+    release(value);
+    int reg = reserve();
+    emit(OP_NEG, reg, value.reg, 0, 0, 0.0);
+    return in_register(reg);
+}
+
+Operand Compiler::primary(void) {
+    Nested nested(*this);
+    if (cur.kind == T_NUMBER) {
+        double k = cur.number;
+        advance();
+        return constant(k);
+    }
+    if (accept('(')) {
+        Operand value = expression();
+        expect(')', "')'");
+        return value;
+    }
+    if (cur.kind == T_STRING) {
+        fail("a string can only be printed or passed to a built in function");
+    }
+    std::string name = expect_name();
+    if (cur.kind == '(') {
+        return call(name);
+    }
+    Name n = resolve(name);
+    switch (n.kind) {
+    case NAME_LOCAL:
+        return in_register(n.index);
+    case NAME_GLOBAL: {
+        int reg = reserve();
+        emit(OP_GETG, reg, 0, 0, n.index, 0.0);
+        return in_register(reg);
+    }
+    case NAME_ARRAY: {
+        expect('[', "'['");
+        Operand index = to_register(expression());
+        expect(']', "']'");
+        release(index);
+        int reg = reserve();
+        emit(OP_GETA, reg, n.index, index.reg, 0, 0.0);
+        return in_register(reg);
+    }
+    case NAME_NONE:
+        fail_at(last_line, "'%s' is not declared", name.c_str());
+    default:
+        fail_at(last_line, "'%s' is a function", name.c_str());
+    }
+}
+
+/* Arguments go to consecutive registers from the first free one, which
+ * becomes the first register of the callee and gets the result */
+Operand Compiler::call(const std::string &name) {
+    uint32_t call_line = cur.line;
+    expect('(', "'('");
+    if (name == "len") {
+        Name n = resolve(expect_name());
+        if (n.kind != NAME_ARRAY) {
+            fail("len takes an array");
+        }
+        expect(')', "')'");
+        return constant(program.arrays[n.index].size);
+    }
+    Name n = resolve(name);
+    const char *params = NULL;
+    if (n.kind == NAME_NATIVE) {
+        params = script_natives[n.index].params;
+    } else if (n.kind != NAME_FUNCTION && n.kind != NAME_NONE) {
+        fail("'%s' is not a function", name.c_str());
+    }
+
+    int base = f->free;
+    uint32_t count = 0;
+    if (cur.kind != ')') {
+        do {
+            char kind = params && count < strlen(params) ? params[count] : 'n';
+            Operand arg;
+            if (kind == 'a') {
+                Name array = resolve(expect_name());
+                if (array.kind != NAME_ARRAY) {
+                    fail("argument %u of %s must be an array", count + 1, name.c_str());
+                }
+                arg = constant(array.index);
+            } else if (kind == 's') {
+                if (cur.kind != T_STRING) {
+                    fail("argument %u of %s must be a string", count + 1, name.c_str());
+                }
+                arg = constant((double) program.strings.size());
+                program.strings.push_back(cur.text);
+                advance();
+            } else {
+                arg = expression();
+            }
+            // A temporary is already in the right register
+            if (!is_temp(arg)) {
+                store(reserve(), arg);
+            }
+            count++;
+        } while (accept(','));
+    }
+    expect(')', "')'");
+
+    if (n.kind == NAME_NONE) {
+        // Defined further down, unless an argument was its first call
+        n = resolve(name);
+    }
+    if (n.kind == NAME_NONE) {
+        ScriptFunction function = {name, 0, count, 0, call_line, false};
+        n.kind = NAME_FUNCTION;
+        n.index = (int) program.functions.size();
+        program.functions.push_back(function);
+    }
+    uint32_t expected = n.kind == NAME_NATIVE ? (uint32_t) strlen(params) : program.functions[n.index].params;
+    if (count != expected) {
+        fail("%s takes %u arguments, not %u", name.c_str(), expected, count);
+    }
+    f->free = base;
+    int reg = reserve();
+    emit(n.kind == NAME_NATIVE ? OP_NATIVE : OP_CALL, base, count, 0, n.index, 0.0);
+    return in_register(reg);
+}
+
+static double fold(int op, double l, double r) {
+    switch (op) {
+    case '+':
+        return l + r;
+    case '-':
+        return l - r;
+    case '*':
+        return l * r;
+    case '/':
+        return l / r;
+    case '%':
+        return fmod(l, r);
+    case T_EQ:
+        return l == r;
+    case T_NE:
+        return l != r;
+    case '<':
+        return l < r;
+    case T_LE:
+        return l <= r;
+    case '>':
+        return l > r;
+    }
+    return l >= r;
+}
+
+/* l op r, into a new temporary */
+Operand Compiler::binary(int op, Operand l, Operand r) {
+    if (l.constant && r.constant) {
+        return constant(fold(op, l.k, r.k));
+    }
+    // A constant goes to the right where the operation allows it
+    if (l.constant && op != '-' && op != '/' && op != '%') {
+        std::swap(l, r);
+        op = op == '<' ? '>' : op == '>' ? '<' : op == T_LE ? T_GE : op == T_GE ? T_LE : op;
+    }
+    l = to_register(l);
+
+    int code;
+    bool swap = false;
+    switch (op) {
+    case '+':
+        code = r.constant ? OP_ADDK : OP_ADD;
+        break;
+    case '-':
+        code = r.constant ? OP_SUBK : OP_SUB;
+        break;
+    case '*':
+        code = r.constant ? OP_MULK : OP_MUL;
+        break;
+    case '/':
+        code = r.constant ? OP_DIVK : OP_DIV;
+        break;
+    case '%':
+        code = r.constant ? OP_MODK : OP_MOD;
+        break;
+    case T_EQ:
+        code = r.constant ? OP_EQK : OP_EQ;
+        break;
+    case T_NE:
+        code = r.constant ? OP_NEK : OP_NE;
+        break;
+    case '<':
+        code = r.constant ? OP_LTK : OP_LT;
+        break;
+    case T_LE:
+        code = r.constant ? OP_LEK : OP_LE;
+        break;
+    case '>':
+        code = r.constant ? OP_GTK : OP_LT;
+        swap = !r.constant;
+        break;
+    default:
+        code = r.constant ? OP_GEK : OP_LE;
+        swap = !r.constant;
+    }
+    release(l, r);
+    int reg = reserve();
+    if (swap) {
+        emit(code, reg, r.reg, l.reg, 0, 0.0);
+    } else {
+        emit(code, reg, l.reg, r.constant ? 0 : r.reg, 0, r.k);
+    }
+    return in_register(reg);
+}
+
+}
+
+/* Compiles source, throws ScriptError with the first error */
+ScriptProgram compile_script(const char *source) {
+    Compiler compiler(source);
+    return compiler.compile();
+}
@@ -0,0 +1,252 @@
+#include "Script.hpp"
+#include "SenseHatSensors.hpp"
+
+#include "algorithm"
+#include "cmath"
+
+/* The built in functions of scripts. Each one calls the Wrapper directly,
+ * without the C API or any copying in between, so they do not show up in
+ * the call latencies of SenseHatStats.
+ *
+ * Sensor getters return what the C getters do, the last valid value when
+ * a read fails. sample() reads the IMU once and returns the status; roll()
+ * to accel_z() are the values of that sample, so one reading can be looked
+ * at from every side. LED calls return their SenseHatStatus, 0 if they
+ * worked. */
+
+namespace {
+
+/* Arguments outside the range of the Sense HAT become a value the Wrapper
+ * turns down, never undefined behaviour */
+uint8_t to_coordinate(double x) {
+    return x >= 0 && x < 8 ? (uint8_t) x : 8;
+}
+
+bool to_colour(double x, uint16_t &colour) {
+    if (!(x >= 0 && x <= 0xFFFF)) {
+        return false;
+    }
+    colour = (uint16_t) x;
+    return true;
+}
+
+uint8_t to_byte(double x) {
+    return x >= 0 ? (x < 255 ? (uint8_t) x : 255) : 0;
+}
+
+/***** Environment *****/
+
+double humidity(Script &s, const double *) {
+    float x;
+    s.sense.get_humidity(x);
+    return x;
+}
+
+double pressure(Script &s, const double *) {
+    float x;
+    s.sense.get_pressure(x);
+    return x;
+}
+
+double temperature(Script &s, const double *) {
+    float x;
+    s.sense.temperature(x);
+    return x;
+}
+
+double temperature_from_humidity(Script &s, const double *) {
+    float x;
+    s.sense.temperature_from_humidity(x);
+    return x;
+}
+
+double temperature_from_pressure(Script &s, const double *) {
+    float x;
+    s.sense.temperature_from_pressure(x);
+    return x;
+}
+
+/***** IMU *****/
+
+double compass(Script &s, const double *) {
+    float x;
+    s.sense.compass(x);
+    return x;
+}
+
+double sample(Script &s, const double *) {
+    return s.sense.imu_sample(s.imu);
+}
+
+// Degrees, as get_orientation
+double roll(Script &s, const double *) {
+    Orientation pose;
+    radians_to_degrees(&s.imu.fusion, &pose, 1);
+    return pose.roll;
+}
+
+double pitch(Script &s, const double *) {
+    Orientation pose;
+    radians_to_degrees(&s.imu.fusion, &pose, 1);
+    return pose.pitch;
+}
+
+double yaw(Script &s, const double *) {
+    Orientation pose;
+    radians_to_degrees(&s.imu.fusion, &pose, 1);
+    return pose.yaw;
+}
+
+double compass_x(Script &s, const double *) { return s.imu.compass.x; }
+double compass_y(Script &s, const double *) { return s.imu.compass.y; }
+double compass_z(Script &s, const double *) { return s.imu.compass.z; }
+double gyro_x(Script &s, const double *) { return s.imu.gyro.x; }
+double gyro_y(Script &s, const double *) { return s.imu.gyro.y; }
+double gyro_z(Script &s, const double *) { return s.imu.gyro.z; }
+double accel_x(Script &s, const double *) { return s.imu.accel.x; }
+double accel_y(Script &s, const double *) { return s.imu.accel.y; }
+double accel_z(Script &s, const double *) { return s.imu.accel.z; }
+
+/***** LED *****/
+
+double rgb(Script &, const double *args) {
+    return RGB565(to_byte(args[0]), to_byte(args[1]), to_byte(args[2]));
+}
+
+// set_pixel(colour, x, y) as in the C API
+double set_pixel(Script &s, const double *args) {
+    uint16_t colour;
+    if (!to_colour(args[0], colour)) {
+        return SENSE_HAT_OUT_OF_RANGE;
+    }
+    return s.sense.set_pixel(colour, to_coordinate(args[1]), to_coordinate(args[2]));
+}
+
+double set_pixels(Script &s, const double *args) {
+    uint16_t colour;
+    if (!to_colour(args[0], colour)) {
+        return SENSE_HAT_OUT_OF_RANGE;
+    }
+    return s.sense.set_pixels(colour);
+}
+
+// The first 64 elements of an array, row by row
+double set_image(Script &s, const double *args) {
+    size_t size;
+    const double *cells = s.array((size_t) args[0], size);
+    uint16_t image[64];
+    if (size < 64) {
+        return SENSE_HAT_OUT_OF_RANGE;
+    }
+    for (int i = 0; i < 64; i++) {
+        if (!to_colour(cells[i], image[i])) {
+            return SENSE_HAT_OUT_OF_RANGE;
+        }
+    }
+    return s.sense.set_image(image);
+}
+
+double clear(Script &s, const double *) {
+    return s.sense.clear();
+}
+
+double begin_frame(Script &s, const double *) {
+    return s.sense.begin_frame();
+}
+
+double commit_frame(Script &s, const double *) {
+    bool written;
+    return s.sense.commit_frame(written);
+}
+
+// show_message("text", colour, background, ms_per_column), once
+double show_message(Script &s, const double *args) {
+    uint16_t colour, background;
+    if (!to_colour(args[1], colour) || !to_colour(args[2], background) || !(args[3] >= 0)) {
+        return SENSE_HAT_OUT_OF_RANGE;
+    }
+    try {
+        s.sense.show_message(s.string((size_t) args[0]), colour, background,
+            (uint32_t) std::min(args[3], 60000.0), false);
+    } catch (...) {
+        return SENSE_HAT_NOT_ENABLED;
+    }
+    return SENSE_HAT_OK;
+}
+
+double stop_animation(Script &s, const double *) {
+    try {
+        s.sense.stop_animation();
+    } catch (...) {
+        return SENSE_HAT_NOT_ENABLED;
+    }
+    return SENSE_HAT_OK;
+}
+
+/***** Time *****/
+
+// Returns 0, or 1 if the script was stopped while asleep
+double sleep(Script &s, const double *args) {
+    return s.sleep_ms(args[0]) ? 0 : 1;
+}
+
+// Milliseconds since the script was started
+double time(Script &s, const double *) {
+    return s.elapsed_ms();
+}
+
+/***** Math *****/
+
+double abs(Script &, const double *args) { return fabs(args[0]); }
+double sqrt(Script &, const double *args) { return ::sqrt(args[0]); }
+double floor(Script &, const double *args) { return ::floor(args[0]); }
+double min(Script &, const double *args) { return fmin(args[0], args[1]); }
+double max(Script &, const double *args) { return fmax(args[0], args[1]); }
+double sin(Script &, const double *args) { return ::sin(args[0]); }
+double cos(Script &, const double *args) { return ::cos(args[0]); }
+double atan2(Script &, const double *args) { return ::atan2(args[0], args[1]); }
+
+}
+
+const ScriptNative script_natives[] = {
+    {"humidity", "", humidity},
+    {"pressure", "", pressure},
+    {"temperature", "", temperature},
+    {"temperature_from_humidity", "", temperature_from_humidity},
+    {"temperature_from_pressure", "", temperature_from_pressure},
+    {"compass", "", compass},
+    {"sample", "", sample},
+    {"roll", "", roll},
+    {"pitch", "", pitch},
+    {"yaw", "", yaw},
+    {"compass_x", "", compass_x},
+    {"compass_y", "", compass_y},
+    {"compass_z", "", compass_z},
+    {"gyro_x", "", gyro_x},
+    {"gyro_y", "", gyro_y},
+    {"gyro_z", "", gyro_z},
+    {"accel_x", "", accel_x},
+    {"accel_y", "", accel_y},
+    {"accel_z", "", accel_z},
+    {"rgb", "nnn", rgb},
+    {"set_pixel", "nnn", set_pixel},
+    {"set_pixels", "n", set_pixels},
+    {"set_image", "a", set_image},
+    {"clear", "", clear},
+    {"begin_frame", "", begin_frame},
+    {"commit_frame", "", commit_frame},
+    {"show_message", "snnn", show_message},
+    {"stop_animation", "", stop_animation},
+    {"sleep", "n", sleep},
+    {"time", "", time},
+    {"abs", "n", abs},
+    {"sqrt", "n", sqrt},
+    {"floor", "n", floor},
+    {"min", "nn", min},
+    {"max", "nn", max},
+    {"sin", "n", sin},
+    {"cos", "n", cos},
+    {"atan2", "nn", atan2},
+};
+
+const size_t script_native_count = sizeof(script_natives) / sizeof(script_natives[0]);
@@ -1,505 +1,2134 @@
 #include "SenseHatSensors.hpp"
+#include "LedAnimator.hpp"
+#include "ReplayBackend.hpp"
+#include "Script.hpp"
+#include "SensorBus.hpp"
 
-/* Constructor*/
-Wrapper::Wrapper() {
-    open_framebuffer();
+/* Microseconds since begin (from monotonic_ns) */
+static uint32_t elapsed_us(uint64_t begin) {
+    return (uint32_t) ((monotonic_ns() - begin) / 1000);
+}
+
+/* Constructor. Only the subsystems in flags (SENSE_HAT_LED, ...) are
+ * brought up, using any other one throws. The sensors are read through
+ * source, which the Wrapper takes ownership of once constructed, or
+ * through RTIMULib if it is NULL. fb_path names a file to use as the LED
+ * framebuffer, see open_framebuffer */
+Wrapper::Wrapper(unsigned int flags, SensorBackend *source, const char *fb_path) {
+    fb = NULL;
+    animator = NULL;
+    backend = source;
+    has_imu = false;
+    imu_init = false;
+    has_pressure = false;
+    pressure_init = false;
+    has_humidity = false;
+    humidity_init = false;
+    trace = NULL;
+    for (int i = 0; i < FUSION_MODES; i++) {
+        fusion[i] = NULL;
+    }
+    memset(&startup, 0, sizeof(StartupTimes));
+    uint64_t begin;
+
+    // Whatever was brought up before a subsystem fails is freed again. A
+    // backend passed in stays with the caller then
+    try {
+        if (flags & SENSE_HAT_LED) {
+            begin = monotonic_ns();
+            open_framebuffer(fb_path);
+            animator = new LedAnimator(fb, &led_lock);
+            startup.led_us = elapsed_us(begin);
+        }
+
+        if (!backend && (flags & (SENSE_HAT_IMU | SENSE_HAT_PRESSURE | SENSE_HAT_HUMIDITY))) {
+            begin = monotonic_ns();
+            backend = new RTIMUBackend();
+            startup.settings_us = elapsed_us(begin);
+        }
+        if (flags & SENSE_HAT_IMU) {
+            begin = monotonic_ns();
+            backend->open_imu();
+            has_imu = true;
+            // Single sensor pipelines, fed from the same readings. Created
+            // here so reading the IMU never allocates
+            fusion[FUSION_COMPASS] = new RTFusionRTQF();
+            fusion[FUSION_COMPASS]->setGyroEnable(false);
+            fusion[FUSION_COMPASS]->setAccelEnable(false);
+            fusion[FUSION_GYRO] = new RTFusionRTQF();
+            fusion[FUSION_GYRO]->setCompassEnable(false);
+            fusion[FUSION_GYRO]->setAccelEnable(false);
+            fusion[FUSION_ACCEL] = new RTFusionRTQF();
+            fusion[FUSION_ACCEL]->setCompassEnable(false);
+            fusion[FUSION_ACCEL]->setGyroEnable(false);
+            startup.imu_us = elapsed_us(begin);
+        }
+        if (flags & SENSE_HAT_PRESSURE) {
+            begin = monotonic_ns();
+            backend->open_pressure();
+            has_pressure = true;
+            startup.pressure_us = elapsed_us(begin);
+        }
+        if (flags & SENSE_HAT_HUMIDITY) {
+            begin = monotonic_ns();
+            backend->open_humidity();
+            has_humidity = true;
+            startup.humidity_us = elapsed_us(begin);
+        }
+    } catch (...) {
+        release();
+        if (backend != source) {
+            delete backend;
+        }
+        throw;
+    }
+
+    environment_cache environment;
+    memset(&environment, 0, sizeof(environment_cache));
+    environment.status = SENSE_HAT_NO_DATA;
+    last_environment.store(environment);
+    imu_cache imu;
+    memset(&imu, 0, sizeof(imu_cache));
+    last_imu.store(imu);
+    imu_poll_interval = 0;
+    _compass_enabled = false;
+    _gyro_enabled = false;
+    _accel_enabled = false;
+    imu_streaming = false;
+    bus = NULL;
+    bus_fd = -1;
+    for (int i = 0; i < ENVIRONMENT_OUTPUTS; i++) {
+        environment_interval[i] = 0;
+    }
+    event_fd = -1;
+    imu_drained = 0;
+    environment_drained = 0;
+    memset(&imu_carried, 0, sizeof(ImuSample));
+    remote = backend ? backend->shared_bus() : NULL;
+    capture = NULL;
+    in_frame = false;
+}
+
+/* Destructor */
+Wrapper::~Wrapper() {
+    printf("Deleting Wrapper class!\n");
+    stop_bus();
+    stop_capture();
+    stop_imu_stream();
+    close_sample_events();
+    stop_trace();
+    release();
+    delete backend;
+}
+
+// Stops the animator and frees the fusion pipelines and the framebuffer
+// mapping. The backend is left alone
+void Wrapper::release(void) noexcept {
+    delete animator;
+    animator = NULL;
+    for (int i = 0; i < FUSION_MODES; i++) {
+        delete fusion[i];
+        fusion[i] = NULL;
+    }
+    if (fb) {
+        munmap(fb, sizeof(framebuffer));
+        fb = NULL;
+    }
+}
+
+/* Time spent bringing up every subsystem, including the initialisation
+ * that happens on first use */
+StartupTimes Wrapper::startup_times(void) {
+    std::lock_guard<std::mutex> guard(hardware_lock);
+    return startup;
+}
+
+/* Appends every reading from now on to a trace file that the replay
+ * backend can play back */
+void Wrapper::record_trace(const char *path) {
+    FILE *file = fopen(path, "w");
+    if (!file) {
+        throw "Could not open trace";
+    }
+    std::lock_guard<std::mutex> guard(trace_lock);
+    FILE *old = trace.exchange(file);
+    if (old) {
+        fclose(old);
+    }
+}
+
+void Wrapper::stop_trace(void) {
+    std::lock_guard<std::mutex> guard(trace_lock);
+    FILE *old = trace.exchange(NULL);
+    if (old) {
+        fclose(old);
+    }
+}
+
+/* Histogram the C functions record their calls in */
+LatencyHistogram & Wrapper::call_stats(SenseHatCall call) {
+    return stats.calls[call];
+}
+
+SenseHatStats Wrapper::stats_snapshot(void) {
+    SenseHatStats snapshot;
+    stats.snapshot(snapshot);
+    return snapshot;
+}
+
+void Wrapper::reset_stats(void) {
+    stats.reset();
+}
+
+/* Writes the stats to path (stderr if NULL) every interval_ms
+ * milliseconds, 0 stops writing them */
+void Wrapper::dump_stats(const char *path, uint32_t interval_ms) {
+    if (interval_ms == 0) {
+        stats.stop_dump();
+    } else {
+        stats.start_dump(path, interval_ms);
+    }
+}
+
+/***** Sensors *****/
+
+/* Initialises the humidity sensor via RTIMU */
+SenseHatStatus Wrapper::init_humidity(void) noexcept {
+    if (humidity_init.load(std::memory_order_acquire)) {
+        return SENSE_HAT_OK;
+    }
+    if (!has_humidity) {
+        return SENSE_HAT_NOT_ENABLED;
+    }
+    std::lock_guard<std::mutex> guard(hardware_lock);
+    if (!humidity_init.load(std::memory_order_relaxed)) {
+        uint64_t begin = monotonic_ns();
+        bool success = backend->humidity_init();
+        startup.humidity_us += elapsed_us(begin);
+        if (!success) {
+            return SENSE_HAT_INIT_FAILED;
+        }
+        humidity_init.store(true, std::memory_order_release);
+    }
+    return SENSE_HAT_OK;
+}
+
+/* Initialises the pressure sensor via RTIMU */
+SenseHatStatus Wrapper::init_pressure(void) noexcept {
+    if (pressure_init.load(std::memory_order_acquire)) {
+        return SENSE_HAT_OK;
+    }
+    if (!has_pressure) {
+        return SENSE_HAT_NOT_ENABLED;
+    }
+    std::lock_guard<std::mutex> guard(hardware_lock);
+    if (!pressure_init.load(std::memory_order_relaxed)) {
+        uint64_t begin = monotonic_ns();
+        bool success = backend->pressure_init();
+        startup.pressure_us += elapsed_us(begin);
+        if (!success) {
+            return SENSE_HAT_INIT_FAILED;
+        }
+        pressure_init.store(true, std::memory_order_release);
+    }
+    return SENSE_HAT_OK;
+}
+
+/* Precentage of relative humidity */
+SenseHatStatus Wrapper::get_humidity(float &humidity) noexcept {
+    humidity = 0.0;
+    SenseHatStatus status = init_humidity(); // Ensure humidity sensor is initialised
+    if (status != SENSE_HAT_OK) {
+        return status;
+    }
+    RTIMU_DATA data;
+    data.humidityValid = false;
+    {
+        std::lock_guard<std::mutex> guard(hardware_lock);
+        backend->humidity_read(data);
+    }
+    if (!data.humidityValid) {
+        SensorStats::add(stats.invalid_humidity);
+        return SENSE_HAT_NO_DATA;
+    }
+    humidity = data.humidity;
+    return SENSE_HAT_OK;
+}
+
+/* Pressure in Millibars */
+SenseHatStatus Wrapper::get_pressure(float &pressure) noexcept {
+    pressure = 0.0;
+    SenseHatStatus status = init_pressure(); // Ensure pressure sensor is initialised
+    if (status != SENSE_HAT_OK) {
+        return status;
+    }
+    RTIMU_DATA data;
+    data.pressureValid = false;
+    {
+        std::lock_guard<std::mutex> guard(hardware_lock);
+        backend->pressure_read(data);
+    }
+    if (!data.pressureValid) {
+        SensorStats::add(stats.invalid_pressure);
+        return SENSE_HAT_NO_DATA;
+    }
+    pressure = data.pressure;
+    return SENSE_HAT_OK;
+}
+
+/* Temperature in Celsius from the humidity sensor */
+SenseHatStatus Wrapper::temperature_from_humidity(float &temp) noexcept {
+    temp = 0.0;
+    SenseHatStatus status = init_humidity(); // Ensure humidity is initialised
+    if (status != SENSE_HAT_OK) {
+        return status;
+    }
+    RTIMU_DATA data;
+    data.temperatureValid = false;
+    {
+        std::lock_guard<std::mutex> guard(hardware_lock);
+        backend->humidity_read(data);
+    }
+    if (!data.temperatureValid) {
+        SensorStats::add(stats.invalid_temperature);
+        return SENSE_HAT_NO_DATA;
+    }
+    temp = data.temperature;
+    return SENSE_HAT_OK;
+}
+
+/* Temperature in Celsius from the pressure sensor */
+SenseHatStatus Wrapper::temperature_from_pressure(float &temp) noexcept {
+    temp = 0.0;
+    SenseHatStatus status = init_pressure();
+    if (status != SENSE_HAT_OK) {
+        return status;
+    }
+    RTIMU_DATA data;
+    data.temperatureValid = false;
+    {
+        std::lock_guard<std::mutex> guard(hardware_lock);
+        backend->pressure_read(data);
+    }
+    if (!data.temperatureValid) {
+        SensorStats::add(stats.invalid_temperature);
+        return SENSE_HAT_NO_DATA;
+    }
+    temp = data.temperature;
+    return SENSE_HAT_OK;
+}
+
+SenseHatStatus Wrapper::temperature(float &temp) noexcept {
+    // Same as in Python SenseHat
+    // Returns the temperature on Celsius
+    return temperature_from_humidity(temp);
+}
+
+/* Reads humidity, pressure and both temperatures with one read of each
+ * chip. Chips that were not enabled are skipped. If the last sample is
+ * younger than max_age_ms it is returned without touching the bus */
+SenseHatStatus Wrapper::read_environment(uint32_t max_age_ms, EnvironmentSample &sample) noexcept {
+    uint64_t now = monotonic_ns();
+    if (max_age_ms > 0) {
+        environment_cache last = last_environment.load();
+        if (last.time != 0 && now - last.time < max_age_ms * 1000000ull) {
+            sample = last.sample;
+            return last.status;
+        }
+    }
+
+    memset(&sample, 0, sizeof(EnvironmentSample));
+    if (!has_humidity && !has_pressure) {
+        return SENSE_HAT_NOT_ENABLED;
+    }
+    SenseHatStatus status;
+    if (has_humidity && (status = init_humidity()) != SENSE_HAT_OK) {
+        return status;
+    }
+    if (has_pressure && (status = init_pressure()) != SENSE_HAT_OK) {
+        return status;
+    }
+    status = SENSE_HAT_OK;
+    RTIMU_DATA humidity_data, pressure_data;
+    humidity_data.humidityValid = humidity_data.temperatureValid = false;
+    pressure_data.pressureValid = pressure_data.temperatureValid = false;
+    {
+        std::lock_guard<std::mutex> guard(hardware_lock);
+        if (has_humidity) {
+            backend->humidity_read(humidity_data);
+        }
+        if (has_pressure) {
+            backend->pressure_read(pressure_data);
+        }
+        sample.timestamp = backend->environment_time();
+    }
+    if (has_humidity) {
+        if (humidity_data.humidityValid) {
+            sample.humidity = humidity_data.humidity;
+            sample.humidity_valid = TRUE;
+        } else {
+            SensorStats::add(stats.invalid_humidity);
+            status = SENSE_HAT_NO_DATA;
+        }
+        if (humidity_data.temperatureValid) {
+            sample.temperature_from_humidity = humidity_data.temperature;
+            sample.temperature_from_humidity_valid = TRUE;
+        } else {
+            SensorStats::add(stats.invalid_temperature);
+            status = SENSE_HAT_NO_DATA;
+        }
+    }
+    if (has_pressure) {
+        if (pressure_data.pressureValid) {
+            sample.pressure = pressure_data.pressure;
+            sample.pressure_valid = TRUE;
+        } else {
+            SensorStats::add(stats.invalid_pressure);
+            status = SENSE_HAT_NO_DATA;
+        }
+        if (pressure_data.temperatureValid) {
+            sample.temperature_from_pressure = pressure_data.temperature;
+            sample.temperature_from_pressure_valid = TRUE;
+        } else {
+            SensorStats::add(stats.invalid_temperature);
+            status = SENSE_HAT_NO_DATA;
+        }
+    }
+
+    environment_cache last;
+    last.sample = sample;
+    last.status = status;
+    last.time = now;
+    last_environment.store(last);
+    if (channel_windows.watching()) {
+        channel_windows.add_environment(sample);
+    }
+    if (sample_history.keeping()) {
+        sample_history.add_environment(sample);
+    }
+    if (rules.active()) {
+        rules.add_environment(sample);
+    }
+    if (trace.load(std::memory_order_relaxed)) {
+        std::lock_guard<std::mutex> guard(trace_lock);
+        FILE *file = trace.load(std::memory_order_relaxed);
+        if (file) {
+            ReplayBackend::write_environment(file, sample);
+        }
+    }
+    return status;
+}
+
+/* Newest sample read by read_environment, by any thread. Never touches
+ * the sensors or waits for a thread that does */
+EnvironmentSample Wrapper::peek_environment(void) const noexcept {
+    return last_environment.load().sample;
+}
+
+/***** IMU sensor *****/
+
+/* Initialises the IMU sensor via RTIMU */
+SenseHatStatus Wrapper::init_imu(void) noexcept {
+    if (imu_init.load(std::memory_order_acquire)) {
+        return SENSE_HAT_OK;
+    }
+    if (!has_imu) {
+        return SENSE_HAT_NOT_ENABLED;
+    }
+    std::lock_guard<std::mutex> guard(hardware_lock);
+    if (!imu_init.load(std::memory_order_relaxed)) {
+        uint64_t begin = monotonic_ns();
+        bool success = backend->imu_init();
+        startup.imu_us += elapsed_us(begin);
+        if (!success) {
+            return SENSE_HAT_INIT_FAILED;
+        }
+        imu_poll_interval = backend->imu_poll_interval_us();
+        imu_schedule.set_interval(imu_poll_interval * 1000ull);
+        // Enable everything on the IMU
+        _compass_enabled = _gyro_enabled = _accel_enabled = true;
+        backend->set_imu_config(true, true, true);
+        imu_init.store(true, std::memory_order_release);
+    }
+    return SENSE_HAT_OK;
+}
+
+/* Enables and disables the gyroscope, accelerometer and/or magnetometer
+ * inpput to the orientation functions */
+SenseHatStatus Wrapper::set_imu_config(bool compass_enabled, bool gyro_enabled, bool accel_enabled) noexcept {
+    SenseHatStatus status = init_imu(); // Ensure the IMU is initialised
+    if (status != SENSE_HAT_OK) {
+        return status;
+    }
+
+    // No thread may read while the fusion is reconfigured
+    std::lock_guard<std::mutex> guard(hardware_lock);
+    if (_compass_enabled != compass_enabled || _gyro_enabled != gyro_enabled ||
+            _accel_enabled != accel_enabled) {
+        _compass_enabled = compass_enabled;
+        _gyro_enabled = gyro_enabled;
+        _accel_enabled = accel_enabled;
+        backend->set_imu_config(_compass_enabled, _gyro_enabled, _accel_enabled);
+    }
+    return SENSE_HAT_OK;
+}
+
+/* Sets how many times a read is tried before giving up and how long to
+ * wait before the first retry (doubled for every further retry). A backoff
+ * of 0 waits one IMU poll interval */
+void Wrapper::set_imu_poll_policy(int attempts, uint32_t backoff_us) {
+    if (attempts < 1) {
+        throw "At least one read attempt is needed";
+    }
+    imu_schedule.set_policy(attempts, backoff_us * 1000ull);
+}
+
+/* Sleeps until the IMU has a new sample, reads it, runs it through the
+ * fusion and caches it, retrying according to the poll policy. latest gets
+ * the newest values, see cache_imu. The IMU must be initialised. The sleeps
+ * happen without hardware_lock, so other threads can use the sensors
+ * meanwhile */
+bool Wrapper::read_imu(imu_frame &frame, ImuSample &latest) noexcept {
+    CallTimer timer(stats.calls[STATS_READ_IMU]);
+    bool success = false;
+    uint64_t slept = imu_schedule.wait_due();
+    std::unique_lock<std::mutex> hardware(hardware_lock, std::defer_lock);
+    int attempt;
+    for (attempt = 0; !success && attempt < imu_schedule.attempts(); attempt++) {
+        if (attempt > 0) {
+            hardware.unlock();
+            slept += imu_schedule.wait_retry(attempt);
+        }
+        hardware.lock();
+        success = backend->imu_read(frame.data);
+    }
+    imu_schedule.advance();
+    if (success) {
+        // Under the same lock, so the pipelines and the cache get the
+        // readings in order
+        fuse(frame);
+        latest = cache_imu(frame);
+    }
+    hardware.unlock();
+    SensorStats::add(stats.imu_reads);
+    SensorStats::add(stats.imu_retries, attempt - 1);
+    SensorStats::add(stats.imu_sleep_ns, slept);
+    if (!success) {
+        SensorStats::add(stats.imu_read_failures);
+    }
+    if (success && trace.load(std::memory_order_relaxed)) {
+        std::lock_guard<std::mutex> guard(trace_lock);
+        FILE *file = trace.load(std::memory_order_relaxed);
+        if (file) {
+            ReplayBackend::write_imu(file, frame.data);
+        }
+    }
+    return success;
+}
+
+/* Runs the reading in frame.data through every fusion pipeline. Needs
+ * hardware_lock */
+void Wrapper::fuse(imu_frame &frame) noexcept {
+    const RTIMU_DATA &data = frame.data;
+    frame.pose[FUSION_ALL].roll = data.fusionPose.x();
+    frame.pose[FUSION_ALL].pitch = data.fusionPose.y();
+    frame.pose[FUSION_ALL].yaw = data.fusionPose.z();
+    frame.pose_valid[FUSION_ALL] = data.fusionPoseValid;
+    for (int i = FUSION_ALL + 1; i < FUSION_MODES; i++) {
+        RTIMU_DATA copy = data;
+        fusion[i]->newIMUData(copy, backend->settings);
+        frame.pose[i].roll = copy.fusionPose.x();
+        frame.pose[i].pitch = copy.fusionPose.y();
+        frame.pose[i].yaw = copy.fusionPose.z();
+        frame.pose_valid[i] = copy.fusionPoseValid;
+    }
+}
+
+static Coordinates to_coordinates(const RTVector3 &vector) {
+    Coordinates coordinates;
+    coordinates.x = vector.x();
+    coordinates.y = vector.y();
+    coordinates.z = vector.z();
+    return coordinates;
+}
+
+// Copies the timestamp, the valid flags and the valid values of frame to
+// sample. Values that are not valid are left as they were
+static void copy_valid(const imu_frame &frame, ImuSample &sample) {
+    const RTIMU_DATA &data = frame.data;
+    sample.timestamp = data.timestamp;
+    if (frame.pose_valid[FUSION_ALL]) {
+        sample.fusion = frame.pose[FUSION_ALL];
+    }
+    sample.fusion_valid = frame.pose_valid[FUSION_ALL] ? TRUE : FALSE;
+    if (data.compassValid) {
+        sample.compass = to_coordinates(data.compass);
+    }
+    sample.compass_valid = data.compassValid ? TRUE : FALSE;
+    if (data.gyroValid) {
+        sample.gyro = to_coordinates(data.gyro);
+    }
+    sample.gyro_valid = data.gyroValid ? TRUE : FALSE;
+    if (data.accelValid) {
+        sample.accel = to_coordinates(data.accel);
+    }
+    sample.accel_valid = data.accelValid ? TRUE : FALSE;
+}
+
+/* Stores the valid values of frame in last_imu and returns the newest
+ * values, as in last_imu. Needs hardware_lock, so a reading taken later is
+ * never overwritten by an earlier one */
+ImuSample Wrapper::cache_imu(const imu_frame &frame) noexcept {
+    ImuSample latest;
+    last_imu.update([&frame, &latest](imu_cache &cache) {
+        const RTIMU_DATA &data = frame.data;
+        ImuSample &sample = cache.sample;
+        for (int i = 0; i < FUSION_MODES; i++) {
+            if (frame.pose_valid[i]) {
+                cache.pose[i] = frame.pose[i];
+            }
+        }
+        sample.timestamp = data.timestamp;
+        sample.fusion = cache.pose[FUSION_ALL];
+        sample.fusion_valid = frame.pose_valid[FUSION_ALL] ? TRUE : FALSE;
+        if (data.compassValid) {
+            sample.compass = to_coordinates(data.compass);
+        }
+        sample.compass_valid = data.compassValid ? TRUE : FALSE;
+        if (data.gyroValid) {
+            sample.gyro = to_coordinates(data.gyro);
+        }
+        sample.gyro_valid = data.gyroValid ? TRUE : FALSE;
+        if (data.accelValid) {
+            sample.accel = to_coordinates(data.accel);
+        }
+        sample.accel_valid = data.accelValid ? TRUE : FALSE;
+        latest = sample;
+    });
+    return latest;
+}
+
+/* Passes the newest values from cache_imu on to the rolling windows, the
+ * history, the rules and the gesture detector */
+void Wrapper::remember(const ImuSample &latest) noexcept {
+    if (channel_windows.watching()) {
+        channel_windows.add_imu(latest);
+    }
+    if (sample_history.keeping()) {
+        sample_history.add_imu(latest);
+    }
+    if (rules.active()) {
+        rules.add_imu(latest);
+    }
+    if (gestures.detecting()) {
+        gestures.add_imu(latest);
+    }
+}
+
+/* Gets the newest IMU reading. In streaming mode this is the last sample
+ * published by the sampler thread and never blocks, otherwise the IMU is
+ * read on the spot */
+SenseHatStatus Wrapper::imu_data(imu_frame &frame) noexcept {
+    if (remote) {
+        if (!has_imu) {
+            return SENSE_HAT_NOT_ENABLED;
+        }
+        // A frame left behind by a publisher that is gone is no reading
+        ImuSample latest;
+        {
+            // Read and cached under one lock, so two readers cannot cache
+            // their frames out of order
+            std::lock_guard<std::mutex> guard(hardware_lock);
+            if (!remote->imu_fresh() || !remote->imu.latest(frame)) {
+                return SENSE_HAT_NO_DATA;
+            }
+            latest = cache_imu(frame);
+        }
+        remember(latest);
+        return SENSE_HAT_OK;
+    }
+    if (imu_streaming) {
+        // The sampler has already remembered it
+        return imu_ring.latest(frame) ? SENSE_HAT_OK : SENSE_HAT_NO_DATA;
+    }
+    SenseHatStatus status = init_imu(); // Ensure the IMU is initialised
+    if (status != SENSE_HAT_OK) {
+        return status;
+    }
+    ImuSample latest;
+    if (!read_imu(frame, latest)) {
+        return SENSE_HAT_NO_DATA;
+    }
+    remember(latest);
+    return SENSE_HAT_OK;
+}
+
+/* Body of the sampler thread. Polls the IMU at its native rate and
+ * publishes every successful reading. The environment is read in between
+ * whenever one of the outputs is due, see environment_interval, and only
+ * handed to the outputs that are due */
+void Wrapper::sample_imu(void) {
+    imu_frame frame;
+    uint64_t environment_due[ENVIRONMENT_OUTPUTS];
+    for (int i = 0; i < ENVIRONMENT_OUTPUTS; i++) {
+        environment_due[i] = monotonic_ns();
+    }
+    bool environment = has_humidity || has_pressure;
+    while (imu_streaming.load(std::memory_order_relaxed)) {
+        ImuSample latest;
+        if (read_imu(frame, latest)) {
+            remember(latest);
+            if (capture) {
+                capture->add_imu(latest);
+            }
+            imu_ring.push(frame);
+            if (bus) {
+                bus->imu.push(frame);
+                bus->imu_time.store(monotonic_ns(), std::memory_order_release);
+            }
+            notify_sample();
+        }
+        if (bus) {
+            bus->alive.store(monotonic_ns(), std::memory_order_release);
+        }
+        if (!environment) {
+            continue;
+        }
+        uint64_t interval[ENVIRONMENT_OUTPUTS];
+        bool due[ENVIRONMENT_OUTPUTS];
+        bool any = false;
+        uint64_t now = 0;
+        for (int i = 0; i < ENVIRONMENT_OUTPUTS; i++) {
+            interval[i] = environment_interval[i].load(std::memory_order_relaxed);
+            if (interval[i] && !now) {
+                now = monotonic_ns();
+            }
+            due[i] = interval[i] && now >= environment_due[i];
+            any = any || due[i];
+        }
+        if (!any) {
+            continue;
+        }
+        EnvironmentSample sample;
+        read_environment(0, sample);
+        if (due[OUTPUT_BUS] && bus) {
+            bus->environment.push(sample);
+        }
+        if (due[OUTPUT_CAPTURE] && capture) {
+            capture->add_environment(sample);
+        }
+        if (due[OUTPUT_EVENTS]) {
+            environment_ring.push(sample);
+            notify_sample();
+        }
+        for (int i = 0; i < ENVIRONMENT_OUTPUTS; i++) {
+            if (due[i]) {
+                environment_due[i] = std::max(environment_due[i] + interval[i], now);
+            }
+        }
+    }
+}
+
+/* Tells the reader of the event fd that a sample was queued */
+void Wrapper::notify_sample(void) noexcept {
+    if (event_fd >= 0) {
+        uint64_t one = 1;
+        if (write(event_fd, &one, sizeof(one)) < 0) {
+            // Only fails if the counter is about to overflow, the fd is
+            // readable then anyway
+        }
+    }
+}
+
+/* Starts a background thread that keeps polling the IMU. Until the stream
+ * is stopped the IMU getters return the newest sample without blocking */
+void Wrapper::start_imu_stream(void) {
+    if (remote) {
+        return; // Reads from the bus never block anyway
+    }
+    if (init_imu() != SENSE_HAT_OK) {
+        throw "Could not initialise IMU";
+    }
+    std::lock_guard<std::recursive_mutex> guard(control_lock);
+    if (imu_streaming) {
+        return;
+    }
+    imu_streaming = true;
+    imu_sampler = std::thread(&Wrapper::sample_imu, this);
+}
+
+/* Stops the sampler thread, the getters go back to reading the IMU */
+void Wrapper::stop_imu_stream(void) {
+    std::lock_guard<std::recursive_mutex> guard(control_lock);
+    if (!imu_streaming) {
+        return;
+    }
+    imu_streaming = false;
+    imu_sampler.join();
+}
+
+/* Publishes every IMU sample, and the environment every
+ * environment_interval_ms (0 never), to the shared memory object name so
+ * other processes can read them through a BusBackend. Starts the IMU
+ * stream */
+void Wrapper::publish_bus(const char *name, uint32_t environment_interval_ms) {
+    if (remote) {
+        throw "Cannot publish readings taken from a bus";
+    }
+    if (init_imu() != SENSE_HAT_OK) {
+        throw "Could not initialise IMU";
+    }
+    std::lock_guard<std::recursive_mutex> guard(control_lock);
+    stop_bus();
+    // The sampler must not run while the bus is swapped
+    stop_imu_stream();
+    unsigned int flags = SENSE_HAT_IMU;
+    if (has_pressure && init_pressure() == SENSE_HAT_OK) {
+        flags |= SENSE_HAT_PRESSURE;
+    }
+    if (has_humidity && init_humidity() == SENSE_HAT_OK) {
+        flags |= SENSE_HAT_HUMIDITY;
+    }
+    bus = create_bus(name, flags, imu_poll_interval, bus_fd);
+    bus_name = name;
+    environment_interval[OUTPUT_BUS] = environment_interval_ms * 1000000ull;
+    start_imu_stream();
+}
+
+/* Starts the IMU stream and returns an eventfd that becomes readable
+ * whenever the sampler queues a sample. The environment is read every
+ * environment_interval_ms (0 never). Samples are picked up with
+ * drain_imu and drain_environment */
+int Wrapper::open_sample_events(uint32_t environment_interval_ms) {
+    if (remote) {
+        throw "Samples from a bus cannot be queued";
+    }
+    std::lock_guard<std::recursive_mutex> guard(control_lock);
+    if (event_fd < 0) {
+        // Set before the sampler starts, it reads event_fd unlocked
+        stop_imu_stream();
+        event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (event_fd < 0) {
+            throw "Could not create eventfd";
+        }
+        // Only samples from now on are queued
+        std::lock_guard<std::mutex> drain_guard(drain_lock);
+        imu_drained = imu_ring.newest();
+        environment_drained = environment_ring.newest();
+    }
+    environment_interval[OUTPUT_EVENTS] = environment_interval_ms * 1000000ull;
+    start_imu_stream();
+    return event_fd;
+}
+
+/* Closes the event fd. The IMU stream keeps running if a bus is being
+ * published, and is stopped otherwise */
+void Wrapper::close_sample_events(void) {
+    std::lock_guard<std::recursive_mutex> guard(control_lock);
+    if (event_fd < 0) {
+        return;
+    }
+    stop_imu_stream();
+    close(event_fd);
+    event_fd = -1;
+    environment_interval[OUTPUT_EVENTS] = 0;
+    if (bus || capture) {
+        start_imu_stream();
+    }
+}
+
+/* Copies up to max IMU samples queued since the last drain to samples,
+ * oldest first, and returns how many. Samples the sampler has already
+ * overwritten are skipped. Values that are not valid hold the last valid
+ * value of an earlier drained sample, never a newer one. Never blocks */
+size_t Wrapper::drain_imu(ImuSample *samples, size_t max) noexcept {
+    std::lock_guard<std::mutex> guard(drain_lock);
+    uint64_t newest = imu_ring.newest();
+    uint64_t n = std::max(imu_drained + 1, newest >= IMU_RING_SIZE ? newest - IMU_RING_SIZE + 1 : 1);
+    size_t count = 0;
+    imu_frame frame;
+    for (; n <= newest && count < max; n++) {
+        if (imu_ring.read(n, frame)) {
+            copy_valid(frame, imu_carried);
+            samples[count++] = imu_carried;
+        }
+    }
+    imu_drained = n - 1;
+    return count;
+}
+
+/* Same as drain_imu for the environment samples */
+size_t Wrapper::drain_environment(EnvironmentSample *samples, size_t max) noexcept {
+    std::lock_guard<std::mutex> guard(drain_lock);
+    uint64_t newest = environment_ring.newest();
+    uint64_t n = std::max(environment_drained + 1,
+            newest >= ENVIRONMENT_RING_SIZE ? newest - ENVIRONMENT_RING_SIZE + 1 : 1);
+    size_t count = 0;
+    for (; n <= newest && count < max; n++) {
+        if (environment_ring.read(n, samples[count])) {
+            count++;
+        }
+    }
+    environment_drained = n - 1;
+    return count;
+}
+
+/* Stops publishing and removes the bus. The IMU stream keeps running if
+ * sample events or a capture need it, and is stopped otherwise */
+void Wrapper::stop_bus(void) {
+    std::lock_guard<std::recursive_mutex> guard(control_lock);
+    if (!bus) {
+        return;
+    }
+    stop_imu_stream();
+    close_bus(bus, bus_name.c_str(), bus_fd);
+    bus = NULL;
+    bus_fd = -1;
+    environment_interval[OUTPUT_BUS] = 0;
+    if (event_fd >= 0 || capture) {
+        start_imu_stream();
+    }
+}
+
+/* Writes every IMU sample, and the environment every
+ * environment_interval_ms (0 never), to segment files in directory (see
+ * CaptureWriter), with the blocks stored as encoding. Starts the IMU
+ * stream */
+void Wrapper::start_capture(const char *directory, uint32_t environment_interval_ms,
+        CaptureEncoding encoding) {
+    if (remote) {
+        throw "Cannot capture readings taken from a bus";
+    }
+    if (init_imu() != SENSE_HAT_OK) {
+        throw "Could not initialise IMU";
+    }
+    std::lock_guard<std::recursive_mutex> guard(control_lock);
+    CaptureWriter *writer = new CaptureWriter(directory, encoding);
+    // The sampler reads capture unlocked
+    stop_imu_stream();
+    delete capture;
+    capture = writer;
+    environment_interval[OUTPUT_CAPTURE] = environment_interval_ms * 1000000ull;
+    start_imu_stream();
+}
+
+/* Writes out the blocks that are not full yet and ends the capture. The
+ * IMU stream keeps running if a bus or sample events need it */
+void Wrapper::stop_capture(void) {
+    std::lock_guard<std::recursive_mutex> guard(control_lock);
+    if (!capture) {
+        return;
+    }
+    stop_imu_stream();
+    delete capture;
+    capture = NULL;
+    environment_interval[OUTPUT_CAPTURE] = 0;
+    if (bus || event_fd >= 0) {
+        start_imu_stream();
+    }
+}
+
+/* Progress of the running capture, zeros if there is none */
+CaptureStats Wrapper::capture_stats(void) {
+    std::lock_guard<std::recursive_mutex> guard(control_lock);
+    CaptureStats stats;
+    memset(&stats, 0, sizeof(CaptureStats));
+    if (capture) {
+        capture->stats(stats);
+    }
+    return stats;
+}
+
+/* Pose of one fusion pipeline in radians. Without a valid pose the last
+ * valid one is returned */
+SenseHatStatus Wrapper::fusion_radians(FusionMode mode, Orientation &pose) noexcept {
+    imu_frame frame;
+    SenseHatStatus status = imu_data(frame);
+    if (status == SENSE_HAT_OK) {
+        if (frame.pose_valid[mode]) {
+            pose = frame.pose[mode];
+            return SENSE_HAT_OK;
+        }
+        SensorStats::add(stats.invalid_fusion);
+        status = SENSE_HAT_NO_DATA;
+    }
+    pose = last_imu.load().pose[mode];
+    return status;
+}
+
+/* Converts radians to degrees, 0 to 360, exactly as the bulk
+ * radians_to_degrees does */
+static Orientation to_degrees(Orientation ori) {
+    radians_to_degrees(&ori, &ori, 1);
+    return ori;
+}
+
+/* The current orientation in radians using the aicraft principal axes
+ * of pitch, roll and yaw */
+SenseHatStatus Wrapper::orientation_radians(Orientation &ori) noexcept {
+    return fusion_radians(FUSION_ALL, ori);
+}
+
+/* The current orientation in degrees, 0 to 360, using the aircraft axes
+ * of pitch, roll and yaw */
+SenseHatStatus Wrapper::orientation_degrees(Orientation &ori) noexcept {
+    SenseHatStatus status = orientation_radians(ori);
+    ori = to_degrees(ori);
+    return status;
+}
+
+SenseHatStatus Wrapper::orientation(Orientation &ori) noexcept {
+    return orientation_degrees(ori);
+}
+
+/* Direction of North form the magnetometer in degrees */
+SenseHatStatus Wrapper::compass(float &heading) noexcept {
+    Orientation pose;
+    SenseHatStatus status = fusion_radians(FUSION_COMPASS, pose);
+    heading = to_degrees(pose).yaw;
+    return status;
+}
+
+/* Megnetometer x y z raw data in uT (micro teslas) */
+SenseHatStatus Wrapper::compass_raw(Coordinates &compass) noexcept {
+    imu_frame frame;
+    SenseHatStatus status = imu_data(frame);
+    if (status == SENSE_HAT_OK) {
+        const RTIMU_DATA &data = frame.data;
+        if (data.compassValid) {
+            compass = to_coordinates(data.compass);
+            return SENSE_HAT_OK;
+        }
+        SensorStats::add(stats.invalid_compass);
+        status = SENSE_HAT_NO_DATA;
+    }
+    compass = last_imu.load().sample.compass;
+    return status;
+}
+
+/* Orientation in degrees from the gyroscope only */
+SenseHatStatus Wrapper::gyroscope(Orientation &ori) noexcept {
+    SenseHatStatus status = fusion_radians(FUSION_GYRO, ori);
+    ori = to_degrees(ori);
+    return status;
+}
+
+/* Gyroscope x y z raw data in radians per second */
+SenseHatStatus Wrapper::gyroscope_raw(Coordinates &gyro) noexcept {
+    imu_frame frame;
+    SenseHatStatus status = imu_data(frame);
+    if (status == SENSE_HAT_OK) {
+        const RTIMU_DATA &data = frame.data;
+        if (data.gyroValid) {
+            gyro = to_coordinates(data.gyro);
+            return SENSE_HAT_OK;
+        }
+        SensorStats::add(stats.invalid_gyro);
+        status = SENSE_HAT_NO_DATA;
+    }
+    gyro = last_imu.load().sample.gyro;
+    return status;
+}
+
+/* Orientation in degrees from the accelerometer only */
+SenseHatStatus Wrapper::accelerometer(Orientation &ori) noexcept {
+    SenseHatStatus status = fusion_radians(FUSION_ACCEL, ori);
+    ori = to_degrees(ori);
+    return status;
+}
+
+/* Accelerometer x y z raw data in Gs */
+SenseHatStatus Wrapper::accelerometer_raw(Coordinates &accel) noexcept {
+    imu_frame frame;
+    SenseHatStatus status = imu_data(frame);
+    if (status == SENSE_HAT_OK) {
+        const RTIMU_DATA &data = frame.data;
+        if (data.accelValid) {
+            accel = to_coordinates(data.accel);
+            return SENSE_HAT_OK;
+        }
+        SensorStats::add(stats.invalid_accel);
+        status = SENSE_HAT_NO_DATA;
+    }
+    accel = last_imu.load().sample.accel;
+    return status;
+}
+
+/* Reads the IMU once and returns the fusion pose and all raw values
+ * from that single reading */
+SenseHatStatus Wrapper::imu_sample(ImuSample &sample) noexcept {
+    imu_frame frame;
+    SenseHatStatus status = imu_data(frame);
+    SenseHatStatus valid = fill_sample(status == SENSE_HAT_OK ? &frame : NULL, sample);
+    return status == SENSE_HAT_OK ? valid : status;
+}
+
+/* The newest IMU values read by any thread. Never touches the IMU or
+ * waits for a thread that does */
+ImuSample Wrapper::peek_imu(void) const noexcept {
+    return last_imu.load().sample;
+}
+
+/* Keeps rolling statistics of channel from now on, see ChannelWindows */
+void Wrapper::watch_channel(SenseHatChannel channel, uint32_t window_ms, uint32_t ema_ms) {
+    channel_windows.watch(channel, window_ms, ema_ms);
+}
+
+SenseHatStatus Wrapper::window_stats(SenseHatChannel channel, WindowStats &stats) const noexcept {
+    return channel_windows.query(channel, stats);
+}
+
+/* Keeps the last samples values of channel from now on (see
+ * SampleHistory) */
+void Wrapper::keep_history(SenseHatChannel channel, uint32_t samples) {
+    sample_history.keep(channel, samples);
+}
+
+SenseHatStatus Wrapper::history_at(SenseHatChannel channel, uint64_t timestamp, HistoryPoint &point) const noexcept {
+    return sample_history.at(channel, timestamp, point);
+}
+
+size_t Wrapper::history(SenseHatChannel channel, uint64_t t0, uint64_t t1,
+        uint64_t *times, float *values, size_t max) const noexcept {
+    return sample_history.range(channel, t0, t1, times, values, max);
+}
+
+size_t Wrapper::history_downsampled(SenseHatChannel channel, uint64_t t0, uint64_t t1,
+        uint64_t *times, float *values, size_t points) const noexcept {
+    return sample_history.downsample(channel, t0, t1, times, values, points);
+}
+
+/* Checks rule against every reading from now on (see RuleEngine) and
+ * returns its id */
+int Wrapper::add_rule(const SensorRule &rule) {
+    return rules.add(rule);
+}
+
+bool Wrapper::remove_rule(int id) noexcept {
+    return rules.remove(id);
+}
+
+void Wrapper::set_rule_callback(RuleCallback callback, void *context) noexcept {
+    rules.set_callback(callback, context);
+}
+
+size_t Wrapper::drain_rule_events(RuleEvent *events, size_t max) noexcept {
+    return rules.drain(events, max);
+}
+
+/* Looks for gestures in every IMU reading from now on (see
+ * GestureDetector), with the default settings if settings is NULL */
+void Wrapper::start_gestures(const GestureSettings *settings) {
+    gestures.start(settings ? *settings : default_gesture_settings);
+}
+
+void Wrapper::stop_gestures(void) noexcept {
+    gestures.stop();
+}
 
-    // Get config file used by the Python SenseHat library
-    char ini_name[80];
-    snprintf(ini_name, sizeof(ini_name), "%s/.config/sense_hat/RTIMULib", std::getenv("HOME"));
+size_t Wrapper::drain_gestures(Gesture *out, size_t max) noexcept {
+    return gestures.drain(out, max);
+}
+
+/* Fills sample from frame, NULL if there was no reading. Values that are
+ * not valid hold the last valid value. Returns SENSE_HAT_NO_DATA unless
+ * every value is valid */
+SenseHatStatus Wrapper::fill_sample(const imu_frame *frame, ImuSample &sample) noexcept {
+    sample = last_imu.load().sample;
+    sample.timestamp = 0;
+    sample.fusion_valid = sample.compass_valid = sample.gyro_valid = sample.accel_valid = FALSE;
+    if (!frame) {
+        return SENSE_HAT_NO_DATA;
+    }
+    copy_valid(*frame, sample);
+    SenseHatStatus status = SENSE_HAT_OK;
+    if (!sample.fusion_valid) {
+        SensorStats::add(stats.invalid_fusion);
+        status = SENSE_HAT_NO_DATA;
+    }
+    if (!sample.compass_valid) {
+        SensorStats::add(stats.invalid_compass);
+        status = SENSE_HAT_NO_DATA;
+    }
+    if (!sample.gyro_valid) {
+        SensorStats::add(stats.invalid_gyro);
+        status = SENSE_HAT_NO_DATA;
+    }
+    if (!sample.accel_valid) {
+        SensorStats::add(stats.invalid_accel);
+        status = SENSE_HAT_NO_DATA;
+    }
+    return status;
+}
+
+/***** Framebuffer and LED *****/
+
+// Maps the first 128 bytes of fd as the LED framebuffer
+void Wrapper::map_framebuffer(int fd) {
+    void *mem = mmap(0, sizeof(framebuffer), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (mem == MAP_FAILED) {
+        throw "Could not open framebuffer";
+    }
+    fb = (framebuffer *) mem;
+}
+
+// Tries to locate and mmap the framebuffer. If path is given, or else
+// SENSE_HAT_FB is set, that file is used instead, which lets the LED code
+// run without the hardware
+void Wrapper::open_framebuffer(const char *path) {
+    struct fb_fix_screeninfo fix_info;
+    struct stat st;
+    glob_t globbuf;
+
+    if (!path) {
+        path = std::getenv("SENSE_HAT_FB");
+    }
+    if (path) {
+        int fd = open(path, O_RDWR | O_CREAT, 0644);
+        if (fd < 0) {
+            throw "Could not open framebuffer";
+        }
+        // A regular file must be large enough to back the mapping
+        if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size < (off_t) sizeof(framebuffer)) {
+            if (ftruncate(fd, sizeof(framebuffer)) != 0) {
+                close(fd);
+                throw "Could not open framebuffer";
+            }
+        }
+        map_framebuffer(fd);
+        return;
+    }
+
+    int err = glob("/dev/fb*", 0, NULL, &globbuf);
+    if (!err) {
+        for (size_t i = 0; i < globbuf.gl_pathc; i++) {
+            int fd = open(globbuf.gl_pathv[i], O_RDWR);
+            if (fd < 0) {
+                continue;
+            }
+            ioctl(fd, FBIOGET_FSCREENINFO, &fix_info);
+            if (strcmp(RPI_SENSE_FB, fix_info.id) == 0) {
+                globfree(&globbuf);
+                map_framebuffer(fd);
+                return;
+            }
+            close(fd);
+        }
+        globfree(&globbuf);
+    }
+    throw "Could not locate the framebuffer";
+}
+
+/* Sets the gamma curve applied by set_image_rgb888 and set_image_rgba.
+ * 1.0 (the default) leaves the colours as they are */
+void Wrapper::set_gamma(float value) {
+    std::lock_guard<std::mutex> guard(led_lock);
+    gamma.set(value);
+}
+
+/* Shows an image of 64 pixels given as r, g, b bytes */
+SenseHatStatus Wrapper::set_image_rgb888(const uint8_t rgb[192]) noexcept {
+    uint16_t image[64];
+    {
+        std::lock_guard<std::mutex> guard(led_lock);
+        if (gamma.linear()) {
+            rgb888_to_rgb565(rgb, image, 64);
+        } else {
+            uint8_t corrected[192];
+            gamma.apply(rgb, corrected, 192);
+            rgb888_to_rgb565(corrected, image, 64);
+        }
+    }
+    return set_image(image);
+}
+
+/* Shows an image of 64 pixels given as r, g, b, a bytes. Alpha is ignored */
+SenseHatStatus Wrapper::set_image_rgba(const uint8_t rgba[256]) noexcept {
+    uint16_t image[64];
+    {
+        std::lock_guard<std::mutex> guard(led_lock);
+        if (gamma.linear()) {
+            rgba_to_rgb565(rgba, image, 64);
+        } else {
+            uint8_t corrected[256];
+            gamma.apply(rgba, corrected, 256);
+            rgba_to_rgb565(corrected, image, 64);
+        }
+    }
+    return set_image(image);
+}
+
+// Throws unless the LEDs were brought up
+void Wrapper::require_leds(void) {
+    if (!fb) {
+        throw "LEDs not enabled";
+    }
+}
+
+// Buffer the drawing functions write to. Between begin_frame and
+// commit_frame this is the back buffer, otherwise the device itself. NULL
+// with status set if the LEDs were not brought up or an animation is
+// playing on them. Needs led_lock
+framebuffer * Wrapper::draw_target(SenseHatStatus &status) noexcept {
+    status = SENSE_HAT_OK;
+    if (!fb) {
+        status = SENSE_HAT_NOT_ENABLED;
+        return NULL;
+    }
+    if (animator->owns_display()) {
+        status = SENSE_HAT_BUSY;
+        return NULL;
+    }
+    return in_frame ? &back : fb;
+}
+
+/* Starts a new frame. Until commit_frame is called every draw goes to a
+ * back buffer which starts out as a copy of what is currently shown */
+SenseHatStatus Wrapper::begin_frame(void) noexcept {
+    if (!fb) {
+        return SENSE_HAT_NOT_ENABLED;
+    }
+    std::lock_guard<std::mutex> guard(led_lock);
+    if (animator->owns_display()) {
+        return SENSE_HAT_BUSY;
+    }
+    memcpy(&back, fb, sizeof(framebuffer));
+    in_frame = true;
+    return SENSE_HAT_OK;
+}
+
+/* Shows the frame started by begin_frame. The whole frame is copied to the
+ * device at once, and not at all if nothing changed. written tells if the
+ * device was written. A frame begun before an animation started playing is
+ * dropped */
+SenseHatStatus Wrapper::commit_frame(bool &written) noexcept {
+    written = false;
+    if (!fb) {
+        return SENSE_HAT_NOT_ENABLED;
+    }
+    std::lock_guard<std::mutex> guard(led_lock);
+    if (!in_frame) {
+        return SENSE_HAT_OK;
+    }
+    in_frame = false;
+    if (animator->owns_display()) {
+        return SENSE_HAT_BUSY;
+    }
+    if (memcmp(&back, fb, sizeof(framebuffer)) != 0) {
+        memcpy(fb, &back, sizeof(framebuffer));
+        written = true;
+    }
+    return SENSE_HAT_OK;
+}
+
+SenseHatStatus Wrapper::set_pixel(uint16_t color, uint8_t x, uint8_t y) noexcept {
+    if (x > 7 || y > 7) {
+        return SENSE_HAT_OUT_OF_RANGE;
+    }
+    std::lock_guard<std::mutex> guard(led_lock);
+    SenseHatStatus status;
+    framebuffer *target = draw_target(status);
+    if (!target) {
+        return status;
+    }
+    target->frame[y][x] = color;
+    return SENSE_HAT_OK;
+}
+
+SenseHatStatus Wrapper::set_pixels(uint16_t color) noexcept {
+    std::lock_guard<std::mutex> guard(led_lock);
+    SenseHatStatus status;
+    framebuffer *target = draw_target(status);
+    if (!target) {
+        return status;
+    }
+    uint8_t i, j;
+    for (i = 0; i < 8; i++) {
+        for (j = 0; j < 8; j++) {
+            target->frame[i][j] = color;
+        }
+    }
+    return SENSE_HAT_OK;
+}
+
+SenseHatStatus Wrapper::set_image(const uint16_t image[64]) noexcept {
+    std::lock_guard<std::mutex> guard(led_lock);
+    SenseHatStatus status;
+    framebuffer *target = draw_target(status);
+    if (!target) {
+        return status;
+    }
+    uint8_t i;
+    for (i = 0; i < 64; i++) {
+        target->frame[i / 8][i % 8] = image[i];
+    }
+    return SENSE_HAT_OK;
+}
+
+SenseHatStatus Wrapper::clear(void) noexcept {
+    std::lock_guard<std::mutex> guard(led_lock);
+    SenseHatStatus status;
+    framebuffer *target = draw_target(status);
+    if (!target) {
+        return status;
+    }
+    memset(target, 0, sizeof(framebuffer));
+    return SENSE_HAT_OK;
+}
+
+/* Plays count frames of 64 pixels from images on a timer thread, frame i
+ * is shown for durations_ms[i]. Replaces any animation already playing */
+void Wrapper::play_animation(const uint16_t *images, const uint32_t *durations_ms, size_t count, bool loop) {
+    require_leds();
+    animator->play(images, durations_ms, count, loop);
+}
+
+/* Scrolls a message across the LEDs on the animation thread, moving one
+ * column every ms_per_column milliseconds */
+void Wrapper::show_message(const char *message, uint16_t colour, uint16_t background,
+        uint32_t ms_per_column, bool loop) {
+    require_leds();
+    animator->show_message(message, colour, background, ms_per_column, loop);
+}
+
+void Wrapper::set_message_speed(uint32_t ms_per_column) {
+    require_leds();
+    animator->set_message_speed(ms_per_column);
+}
+
+void Wrapper::set_message_colour(uint16_t colour, uint16_t background) {
+    require_leds();
+    animator->set_message_colour(colour, background);
+}
+
+void Wrapper::stop_animation(void) {
+    require_leds();
+    animator->stop();
+}
+
+bool Wrapper::animation_playing(void) {
+    require_leds();
+    return animator->playing();
+}
+
+AnimationStats Wrapper::animation_stats(void) {
+    require_leds();
+    AnimationStats stats;
+    stats.frames_shown = animator->frames_shown();
+    stats.frames_dropped = animator->frames_dropped();
+    return stats;
+}
+
+/***** Code for C functions *****/
+
+SenseHatSensors * SenseHatSensors_new(void) {
+    try {
+        Wrapper *wrapper = new Wrapper();
+        return reinterpret_cast<SenseHatSensors*>(wrapper);
+    } catch (...) {
+        return NULL;
+    }
+}
+
+SenseHatSensors * SenseHatSensors_new_with(unsigned int flags) {
+    try {
+        Wrapper *wrapper = new Wrapper(flags);
+        return reinterpret_cast<SenseHatSensors*>(wrapper);
+    } catch (...) {
+        return NULL;
+    }
+}
+
+SenseHatSensors * SenseHatSensors_new_replay(const char *trace, float rate_hz, const char *fb_path,
+        unsigned int flags) {
+    ReplayBackend *backend = NULL;
+    try {
+        backend = new ReplayBackend(trace, rate_hz);
+        Wrapper *wrapper = new Wrapper(flags, backend, fb_path);
+        return reinterpret_cast<SenseHatSensors*>(wrapper);
+    } catch (...) {
+        delete backend;
+        return NULL;
+    }
+}
+
+SenseHatSensors * SenseHatSensors_attach(const char *name, unsigned int flags) {
+    BusBackend *backend = NULL;
+    try {
+        backend = new BusBackend(name);
+        const SensorBus *bus = backend->shared_bus();
+        Wrapper *wrapper = new Wrapper((flags & SENSE_HAT_LED) | bus->flags, backend);
+        return reinterpret_cast<SenseHatSensors*>(wrapper);
+    } catch (...) {
+        delete backend;
+        return NULL;
+    }
+}
+
+Bool_t record_trace(SenseHatSensors *sense, const char *path) {
+    try {
+        Wrapper *wrapper = reinterpret_cast<Wrapper*>(sense);
+        wrapper->record_trace(path);
+        return TRUE;
+    } catch (...) {
+        return FALSE;
+    }
+}
+
+void stop_trace(SenseHatSensors *sense) {
+    try {
+        Wrapper *wrapper = reinterpret_cast<Wrapper*>(sense);
+        wrapper->stop_trace();
+    } catch (...) {}
+}
+
+StartupTimes get_startup_times(SenseHatSensors *sense) {
+    try {
+        Wrapper *wrapper = reinterpret_cast<Wrapper*>(sense);
+        return wrapper->startup_times();
+    } catch (...) {
+        StartupTimes ret = {}; // Zero out all values
+        return ret;
+    }
+}
+
+SenseHatStats get_stats(SenseHatSensors *sense) {
+    try {
+        Wrapper *wrapper = reinterpret_cast<Wrapper*>(sense);
+        return wrapper->stats_snapshot();
+    } catch (...) {
+        SenseHatStats ret = {}; // Zero out all values
+        return ret;
+    }
+}
+
+void reset_stats(SenseHatSensors *sense) {
+    try {
+        Wrapper *wrapper = reinterpret_cast<Wrapper*>(sense);
+        wrapper->reset_stats();
+    } catch (...) {}
+}
+
+Bool_t dump_stats(SenseHatSensors *sense, const char *path, uint32_t interval_ms) {
+    try {
+        Wrapper *wrapper = reinterpret_cast<Wrapper*>(sense);
+        wrapper->dump_stats(path, interval_ms);
+        return TRUE;
+    } catch (...) {
+        return FALSE;
+    }
+}
+
+void SenseHatSensors_delete(SenseHatSensors *sense) {
+    try {
+        Wrapper *wrapper = reinterpret_cast<Wrapper*>(sense);
+        delete wrapper;
+    } catch (...) {}
+}
+
+/***** IMU config *****/
+
+SenseHatStatus try_set_imu_config(SenseHatSensors *sense, Bool_t compass_enabled, Bool_t gyro_enabled,
+        Bool_t accel_enabled) {
+    Wrapper *wrapper = reinterpret_cast<Wrapper*>(sense);
+    CallTimer timer(wrapper->call_stats(STATS_SET_IMU_CONFIG));
+    return timer.done(wrapper->set_imu_config(compass_enabled ? true : false,
+                gyro_enabled ? true : false,
+                accel_enabled ? true : false));
+}
+
+void set_imu_config(SenseHatSensors *sense, Bool_t compass_enabled, Bool_t gyro_enabled, Bool_t accel_enabled) {
+    try_set_imu_config(sense, compass_enabled, gyro_enabled, accel_enabled);
+}
+
+void start_imu_stream(SenseHatSensors *sense) {
+    try {
+        Wrapper *wrapper = reinterpret_cast<Wrapper*>(sense);
+        wrapper->start_imu_stream();
+    } catch (...) {}
+}
+
+void stop_imu_stream(SenseHatSensors *sense) {
+    try {
+        Wrapper *wrapper = reinterpret_cast<Wrapper*>(sense);
+        wrapper->stop_imu_stream();
+    } catch (...) {}
+}
+
+Bool_t publish_bus(SenseHatSensors *sense, const char *name, uint32_t environment_interval_ms) {
+    try {
+        Wrapper *wrapper = reinterpret_cast<Wrapper*>(sense);
+        wrapper->publish_bus(name, environment_interval_ms);
+        return TRUE;
+    } catch (...) {
+        return FALSE;
+    }
+}
+
+void stop_bus(SenseHatSensors *sense) {
+    try {
+        Wrapper *wrapper = reinterpret_cast<Wrapper*>(sense);
+        wrapper->stop_bus();
+    } catch (...) {}
+}
+
+int open_sample_events(SenseHatSensors *sense, uint32_t environment_interval_ms) {
+    try {
+        Wrapper *wrapper = reinterpret_cast<Wrapper*>(sense);
+        return wrapper->open_sample_events(environment_interval_ms);
+    } catch (...) {
+        return -1;
+    }
+}
+
+void close_sample_events(SenseHatSensors *sense) {
+    try {
+        Wrapper *wrapper = reinterpret_cast<Wrapper*>(sense);
+        wrapper->close_sample_events();
+    } catch (...) {}
+}
+
+size_t drain_imu_samples(SenseHatSensors *sense, ImuSample *samples, size_t max) {
+    Wrapper *wrapper = reinterpret_cast<Wrapper*>(sense);
+    return wrapper->drain_imu(samples, max);
+}
+
+size_t drain_environment_samples(SenseHatSensors *sense, EnvironmentSample *samples, size_t max) {
+    Wrapper *wrapper = reinterpret_cast<Wrapper*>(sense);
+    return wrapper->drain_environment(samples, max);
+}
+
+Bool_t start_capture(SenseHatSensors *sense, const char *directory, uint32_t environment_interval_ms) {
+    try {
+        Wrapper *wrapper = reinterpret_cast<Wrapper*>(sense);
+        wrapper->start_capture(directory, environment_interval_ms, CAPTURE_RAW);
+        return TRUE;
+    } catch (...) {
+        return FALSE;
+    }
+}
+
+Bool_t start_compressed_capture(SenseHatSensors *sense, const char *directory, uint32_t environment_interval_ms) {
+    try {
+        Wrapper *wrapper = reinterpret_cast<Wrapper*>(sense);
+        wrapper->start_capture(directory, environment_interval_ms, CAPTURE_COMPRESSED);
+        return TRUE;
+    } catch (...) {
+        return FALSE;
+    }
+}
+
+void stop_capture(SenseHatSensors *sense) {
+    try {
+        Wrapper *wrapper = reinterpret_cast<Wrapper*>(sense);
+        wrapper->stop_capture();
+    } catch (...) {}
+}
+
+CaptureStats get_capture_stats(SenseHatSensors *sense) {
+    Wrapper *wrapper = reinterpret_cast<Wrapper*>(sense);
+    return wrapper->capture_stats();
+}
+
+void set_imu_poll_policy(SenseHatSensors *sense, int attempts, uint32_t backoff_us) {
+    try {
+        Wrapper *wrapper = reinterpret_cast<Wrapper*>(sense);
+        wrapper->set_imu_poll_policy(attempts, backoff_us);
+    } catch (...) {}
+}
+
+/***** Sensors *****/
+
+SenseHatStatus try_get_humidity(SenseHatSensors *sense, float *value) {
+    Wrapper *wrapper = reinterpret_cast<Wrapper*>(sense);
+    CallTimer timer(wrapper->call_stats(STATS_GET_HUMIDITY));
+    return timer.done(wrapper->get_humidity(*value));
+}
+
+float get_humidity(SenseHatSensors *sense) {
+    float value;
+    try_get_humidity(sense, &value);
+    return value;
+}
 
-    settings = new RTIMUSettings(ini_name);
-    imu = RTIMU::createIMU(settings);
-    if ((imu == NULL) || (imu->IMUType() == RTIMU_TYPE_NULL)) {
-        throw "No IMU found";
-    }
-    imu_init = false;
-    pressure = RTPressure::createPressure(settings);
-    pressure_init = false;
-    humidity = RTHumidity::createHumidity(settings);
-    humidity_init = false;
-    imu_poll_interval = 0;
-    _compass_enabled = false;
-    _gyro_enabled = false;
-    _accel_enabled = false;
-    memset(&last_compass, 0, sizeof(Coordinates));
-    last_gyro = last_accel = last_compass;
-    memset(&last_orientation, 0, sizeof(Orientation));
+SenseHatStatus try_get_pressure(SenseHatSensors *sense, float *value) {
+    Wrapper *wrapper = reinterpret_cast<Wrapper*>(sense);
+    CallTimer timer(wrapper->call_stats(STATS_GET_PRESSURE));
+    return timer.done(wrapper->get_pressure(*value));
 }
 
-/* Destructor */
-Wrapper::~Wrapper() {
-    printf("Deleting Wrapper class!\n");
-    delete settings;
-    delete imu;
-    delete pressure;
-    delete humidity;
+float get_pressure(SenseHatSensors *sense) {
+    float value;
+    try_get_pressure(sense, &value);
+    return value;
 }
 
-/***** Sensors *****/
+SenseHatStatus try_get_temperature_from_humidity(SenseHatSensors *sense, float *value) {
+    Wrapper *wrapper = reinterpret_cast<Wrapper*>(sense);
+    CallTimer timer(wrapper->call_stats(STATS_GET_TEMPERATURE_FROM_HUMIDITY));
+    return timer.done(wrapper->temperature_from_humidity(*value));
+}
 
-/* Initialises the humidity sensor via RTIMU */
-void Wrapper::init_humidity(void) {
-    if (!humidity_init) {
-        humidity_init = humidity->humidityInit();
-        if (!humidity_init) {
-            throw "Could not initialise humidity";
-        }
-    }
+float get_temperature_from_humidity(SenseHatSensors *sense) {
+    float value;
+    try_get_temperature_from_humidity(sense, &value);
+    return value;
 }
 
-/* Initialises the pressure sensor via RTIMU */
-void Wrapper::init_pressure(void) {
-    if (!pressure_init) {
-        pressure_init = pressure->pressureInit();
-        if (!pressure_init) {
-            throw "Could not initialise pressure";
-        }
-    }
+SenseHatStatus try_get_temperature_from_pressure(SenseHatSensors *sense, float *value) {
+    Wrapper *wrapper = reinterpret_cast<Wrapper*>(sense);
+    CallTimer timer(wrapper->call_stats(STATS_GET_TEMPERATURE_FROM_PRESSURE));
+    return timer.done(wrapper->temperature_from_pressure(*value));
 }
 
-/* Returns precentage of relative humidity */
-float Wrapper::get_humidity(void) {
-    init_humidity(); // Ensure humidity sensor is initialised
-    float _humidity = 0.0;
-    RTIMU_DATA data;
-    humidity->humidityRead(data);
-    if (data.humidityValid) {
-        _humidity = data.humidity;
-    }
-    return _humidity;
+float get_temperature_from_pressure(SenseHatSensors *sense) {
+    float value;
+    try_get_temperature_from_pressure(sense, &value);
+    return value;
 }
 
-/* Returns the pressure in Millibars */
-float Wrapper::get_pressure(void) {
-    init_pressure(); // Ensure pressure sensor is initialised
-    float _pressure = 0.0;
-    RTIMU_DATA data;
-    pressure->pressureRead(data);
-    if (data.pressureValid) {
-        _pressure = data.pressure;
-    }
-    return _pressure;
+SenseHatStatus try_get_temperature(SenseHatSensors *sense, float *value) {
+    Wrapper *wrapper = reinterpret_cast<Wrapper*>(sense);
+    CallTimer timer(wrapper->call_stats(STATS_GET_TEMPERATURE));
+    return timer.done(wrapper->temperature(*value));
 }
 
-/* Returns the temperature in Celsius from the pressure sensor */
-float Wrapper::temperature_from_humidity(void) {
-    init_humidity(); // Ensure humidity is initialised
-    float temp = 0.0;
-    RTIMU_DATA data;
-    humidity->humidityRead(data);
-    if (data.temperatureValid) {
-        temp = data.temperature;
-    }
-    return temp;
+float get_temperature(SenseHatSensors *sense) {
+    float value;
+    try_get_temperature(sense, &value);
+    return value;
 }
 
-/* Returns the temperature in Celsius from the pressure sensor */
-float Wrapper::temperature_from_pressure(void) {
-    init_pressure();
-    float temp = 0.0;
-    RTIMU_DATA data;
-    pressure->pressureRead(data);
-    if (data.temperatureValid) {
-        temp = data.temperature;
-    }
-    return temp;
+SenseHatStatus try_get_environment(SenseHatSensors *sense, uint32_t max_age_ms, EnvironmentSample *value) {
+    Wrapper *wrapper = reinterpret_cast<Wrapper*>(sense);
+    CallTimer timer(wrapper->call_stats(STATS_GET_ENVIRONMENT));
+    return timer.done(wrapper->read_environment(max_age_ms, *value));
 }
 
-float Wrapper::temperature(void) {
-    // Same as in Python SenseHat
-    // Returns the temperature on Celsius
-    return temperature_from_humidity();
+EnvironmentSample get_environment(SenseHatSensors *sense, uint32_t max_age_ms) {
+    EnvironmentSample value;
+    try_get_environment(sense, max_age_ms, &value);
+    return value;
 }
 
-/***** IMU sensor *****/
+SenseHatStatus try_get_orientation_radians(SenseHatSensors *sense, Orientation *value) {
+    Wrapper *wrapper = reinterpret_cast<Wrapper*>(sense);
+    CallTimer timer(wrapper->call_stats(STATS_GET_ORIENTATION_RADIANS));
+    return timer.done(wrapper->orientation_radians(*value));
+}
 
-/* Initialises the IMU sensor via RTIMU */
-void Wrapper::init_imu(void) {
-    if (!imu_init) {
-        imu_init = imu->IMUInit();
-        if (imu_init) {
-            imu_poll_interval = imu->IMUGetPollInterval() * 1000;
-            // Enable everything on the IMU
-            set_imu_config(true, true, true);
-        } else {
-            throw "Could not initialise IMU";
-        }
-    }
+Orientation get_orientation_radians(SenseHatSensors *sense) {
+    Orientation value;
+    try_get_orientation_radians(sense, &value);
+    return value;
 }
 
-/* Enables and disables the gyroscope, accelerometer and/or magnetometer
- * inpput to the orientation functions */
-void Wrapper::set_imu_config(bool compass_enabled, bool gyro_enabled, bool accel_enabled) {
-    init_imu(); // Ensure the IMU is initialised
+SenseHatStatus try_get_orientation_degrees(SenseHatSensors *sense, Orientation *value) {
+    Wrapper *wrapper = reinterpret_cast<Wrapper*>(sense);
+    CallTimer timer(wrapper->call_stats(STATS_GET_ORIENTATION_DEGREES));
+    return timer.done(wrapper->orientation_degrees(*value));
+}
 
-    if (_compass_enabled != compass_enabled) {
-        _compass_enabled = compass_enabled;
-        imu->setCompassEnable(_compass_enabled);
-    }
-    if (_gyro_enabled != gyro_enabled) {
-        _gyro_enabled = gyro_enabled;
-        imu->setCompassEnable(_gyro_enabled);
-    }
-    if (_accel_enabled != accel_enabled) {
-        _accel_enabled = accel_enabled;
-        imu->setCompassEnable(_accel_enabled);
-    }
+Orientation get_orientation_degrees(SenseHatSensors *sense) {
+    Orientation value;
+    try_get_orientation_degrees(sense, &value);
+    return value;
 }
 
-/* Tries to read the IMU sensor three times before giving up */
-bool Wrapper::read_imu(void) {
-    init_imu(); // Ensure the IMU is initialised
+SenseHatStatus try_get_orientation(SenseHatSensors *sense, Orientation *value) {
+    Wrapper *wrapper = reinterpret_cast<Wrapper*>(sense);
+    CallTimer timer(wrapper->call_stats(STATS_GET_ORIENTATION));
+    return timer.done(wrapper->orientation(*value));
+}
 
-    int attempts = 0;
-    bool success = false;
+Orientation get_orientation(SenseHatSensors *sense) {
+    Orientation value;
+    try_get_orientation(sense, &value);
+    return value;
+}
 
-    while (!success && (attempts < 3)) {
-        success = imu->IMURead();
-        attempts += 1;
-        usleep(imu_poll_interval);
-    }
-    return success;
+SenseHatStatus try_get_compass(SenseHatSensors *sense, float *value) {
+    Wrapper *wrapper = reinterpret_cast<Wrapper*>(sense);
+    CallTimer timer(wrapper->call_stats(STATS_GET_COMPASS));
+    return timer.done(wrapper->compass(*value));
 }
 
-/* Returns a struct to represent the current orientation in
- * radians using the aicraft principal axes of pitch, roll and yaw */
-Orientation Wrapper::orientation_radians(void) {
-    if (read_imu()) {
-        RTIMU_DATA data = imu->getIMUData();
-        if (data.fusionPoseValid) {
-            last_orientation.roll = data.fusionPose.x();
-            last_orientation.pitch = data.fusionPose.y();
-            last_orientation.yaw = data.fusionPose.z();
-        }
-    }
-    return last_orientation;
+float get_compass(SenseHatSensors *sense) {
+    float value;
+    try_get_compass(sense, &value);
+    return value;
 }
 
-/* Returns a struct to represent the current orientation in
- * degrees, 0 to 360, using the aircraft axes of
- * pitch, roll and yaw */
-Orientation Wrapper::orientation_degrees(void) {
-    Orientation ori = orientation_radians();
-    ori.roll = ori.roll * RTMATH_RAD_TO_DEGREE;
-    ori.roll = ori.roll < 0.0 ? ori.roll + 360.0 : ori.roll;
-    ori.pitch = ori.pitch * RTMATH_RAD_TO_DEGREE;
-    ori.pitch = ori.pitch < 0.0 ? ori.pitch + 360.0 : ori.pitch;
-    ori.yaw = ori.yaw * RTMATH_RAD_TO_DEGREE;
-    ori.yaw = ori.yaw < 0.0 ? ori.yaw + 360.0 : ori.yaw;
-    return ori;
+SenseHatStatus try_get_compass_raw(SenseHatSensors *sense, Coordinates *value) {
+    Wrapper *wrapper = reinterpret_cast<Wrapper*>(sense);
+    CallTimer timer(wrapper->call_stats(STATS_GET_COMPASS_RAW));
+    return timer.done(wrapper->compass_raw(*value));
 }
 
-Orientation Wrapper::orientation(void) {
-    return orientation_degrees();
+Coordinates get_compass_raw(SenseHatSensors *sense) {
+    Coordinates value;
+    try_get_compass_raw(sense, &value);
+    return value;
 }
 
-/* Gets the direction of North form the magnetometer in degrees */
-float Wrapper::compass(void) {
-    set_imu_config(true, false, false);
-    return orientation().yaw;
+SenseHatStatus try_get_gyroscope(SenseHatSensors *sense, Orientation *value) {
+    Wrapper *wrapper = reinterpret_cast<Wrapper*>(sense);
+    CallTimer timer(wrapper->call_stats(STATS_GET_GYROSCOPE));
+    return timer.done(wrapper->gyroscope(*value));
 }
 
-/* Megnetometer x y z raw data in uT (micro teslas) */
-Coordinates Wrapper::compass_raw(void) {
-    if (read_imu()) {
-        RTIMU_DATA data = imu->getIMUData();
-        if (data.compassValid) {
-            last_compass.x = data.compass.x();
-            last_compass.y = data.compass.y();
-            last_compass.z = data.compass.z();
-        }
-    }
-    return last_compass;
+Orientation get_gyroscope(SenseHatSensors *sense) {
+    Orientation value;
+    try_get_gyroscope(sense, &value);
+    return value;
 }
 
-/* Get orientation in degrees from the gyroscope only */
-Orientation Wrapper::gyroscope(void) {
-    set_imu_config(false, true, false);
-    return orientation_degrees();
+SenseHatStatus try_get_gyroscope_raw(SenseHatSensors *sense, Coordinates *value) {
+    Wrapper *wrapper = reinterpret_cast<Wrapper*>(sense);
+    CallTimer timer(wrapper->call_stats(STATS_GET_GYROSCOPE_RAW));
+    return timer.done(wrapper->gyroscope_raw(*value));
 }
 
-/* Gyroscope x y z raw data in radians per second */
-Coordinates Wrapper::gyroscope_raw(void) {
-    if (read_imu()) {
-        RTIMU_DATA data = imu->getIMUData();
-        if (data.gyroValid) {
-            last_gyro.x = data.gyro.x();
-            last_gyro.y = data.gyro.y();
-            last_gyro.z = data.gyro.z();
-        }
-    }
-    return last_gyro;
+Coordinates get_gyroscope_raw(SenseHatSensors *sense) {
+    Coordinates value;
+    try_get_gyroscope_raw(sense, &value);
+    return value;
 }
 
-/* Gets the orientation in degrees from the accelerometer only */
-Orientation Wrapper::accelerometer(void) {
-    set_imu_config(false, false, true);
-    return orientation_degrees();
+SenseHatStatus try_get_accelerometer(SenseHatSensors *sense, Orientation *value) {
+    Wrapper *wrapper = reinterpret_cast<Wrapper*>(sense);
+    CallTimer timer(wrapper->call_stats(STATS_GET_ACCELEROMETER));
+    return timer.done(wrapper->accelerometer(*value));
 }
 
-/* Accelerometer x y z raw data in Gs */
-Coordinates Wrapper::accelerometer_raw(void) {
-    if (read_imu()) {
-        RTIMU_DATA data = imu->getIMUData();
-        if (data.accelValid) {
-            last_accel.x = data.accel.x();
-            last_accel.y = data.accel.y();
-            last_accel.z = data.accel.z();
-        }
-    }
-    return last_accel;
+Orientation get_accelerometer(SenseHatSensors *sense) {
+    Orientation value;
+    try_get_accelerometer(sense, &value);
+    return value;
 }
 
-/***** Framebuffer and LED *****/
+SenseHatStatus try_get_accelerometer_raw(SenseHatSensors *sense, Coordinates *value) {
+    Wrapper *wrapper = reinterpret_cast<Wrapper*>(sense);
+    CallTimer timer(wrapper->call_stats(STATS_GET_ACCELEROMETER_RAW));
+    return timer.done(wrapper->accelerometer_raw(*value));
+}
 
-// Tries to locate and mmap the framebuffer
-void Wrapper::open_framebuffer(void) {
-    struct fb_fix_screeninfo fix_info;
-    glob_t globbuf;
+Coordinates get_accelerometer_raw(SenseHatSensors *sense) {
+    Coordinates value;
+    try_get_accelerometer_raw(sense, &value);
+    return value;
+}
 
-    int err = glob("/dev/fb*", 0, NULL, &globbuf);
-    if (!err) {
-        for (size_t i = 0; i < globbuf.gl_pathc; i++) {
-            int fd = open(globbuf.gl_pathv[i], O_RDWR);
-            if (fd < 0) {
-                continue;
-            }
-            ioctl(fd, FBIOGET_FSCREENINFO, &fix_info);
-            if (strcmp(RPI_SENSE_FB, fix_info.id) == 0) {
-                fb = (framebuffer *) mmap(0, 128, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
-                close(fd);
-                if (!fb) {
-                    throw "Could not open framebuffer";
-                }
-                return;
-            }
-            close(fd);
-        }
-        globfree(&globbuf);
-    }
-    throw "Could not locate the framebuffer";
+SenseHatStatus try_get_imu_sample(SenseHatSensors *sense, ImuSample *value) {
+    Wrapper *wrapper = reinterpret_cast<Wrapper*>(sense);
+    CallTimer timer(wrapper->call_stats(STATS_GET_IMU_SAMPLE));
+    return timer.done(wrapper->imu_sample(*value));
 }
 
-void Wrapper::set_pixel(uint16_t color, uint8_t x, uint8_t y) {
-    if (x > 7) {
-        throw "X coordinates value must be between 0 and 7";
-    }
-    if (y > 7) {
-        throw "Y coordinates value must be between 0 and 7";
-    }
-    fb->frame[y][x] = color;
+ImuSample get_imu_sample(SenseHatSensors *sense) {
+    ImuSample value;
+    try_get_imu_sample(sense, &value);
+    return value;
+}
 
+ImuSample peek_imu_sample(SenseHatSensors *sense) {
+    return reinterpret_cast<Wrapper*>(sense)->peek_imu();
 }
-void Wrapper::set_pixels(uint16_t color) {
-    uint8_t i, j;
-    for (i = 0; i < 8; i++) {
-        for (j = 0; j < 8; j++) {
-            fb->frame[i][j] = color;
-        }
-    }
+
+EnvironmentSample peek_environment(SenseHatSensors *sense) {
+    return reinterpret_cast<Wrapper*>(sense)->peek_environment();
 }
 
-void Wrapper::set_image(uint16_t image[64]) {
-    uint8_t i;
-    for (i = 0; i < 64; i++) {
-        fb->frame[i / 8][i % 8] = image[i];
+Bool_t watch_channel(SenseHatSensors *sense, SenseHatChannel channel, uint32_t window_ms, uint32_t ema_ms) {
+    try {
+        reinterpret_cast<Wrapper*>(sense)->watch_channel(channel, window_ms, ema_ms);
+        return TRUE;
+    } catch (...) {
+        return FALSE;
     }
 }
 
-void Wrapper::clear(void) {
-    memset(fb, 0, 128);
+SenseHatStatus try_get_window_stats(SenseHatSensors *sense, SenseHatChannel channel, WindowStats *stats) {
+    return reinterpret_cast<Wrapper*>(sense)->window_stats(channel, *stats);
 }
 
-/***** Code for C functions *****/
+WindowStats get_window_stats(SenseHatSensors *sense, SenseHatChannel channel) {
+    WindowStats stats;
+    try_get_window_stats(sense, channel, &stats);
+    return stats;
+}
 
-SenseHatSensors * SenseHatSensors_new(void) {
+Bool_t keep_history(SenseHatSensors *sense, SenseHatChannel channel, uint32_t samples) {
     try {
-        Wrapper *wrapper = new Wrapper();
-        return reinterpret_cast<SenseHatSensors*>(wrapper);
+        reinterpret_cast<Wrapper*>(sense)->keep_history(channel, samples);
+        return TRUE;
     } catch (...) {
-        return NULL;
+        return FALSE;
     }
 }
 
-void SenseHatSensors_delete(SenseHatSensors *sense) {
-    try {
-        Wrapper *wrapper = reinterpret_cast<Wrapper*>(sense);
-        delete wrapper;
-    } catch (...) {}
+SenseHatStatus try_get_history_at(SenseHatSensors *sense, SenseHatChannel channel, uint64_t timestamp, HistoryPoint *point) {
+    return reinterpret_cast<Wrapper*>(sense)->history_at(channel, timestamp, *point);
 }
 
-/***** IMU config *****/
+HistoryPoint get_history_at(SenseHatSensors *sense, SenseHatChannel channel, uint64_t timestamp) {
+    HistoryPoint point;
+    try_get_history_at(sense, channel, timestamp, &point);
+    return point;
+}
 
+size_t get_history(SenseHatSensors *sense, SenseHatChannel channel, uint64_t t0, uint64_t t1,
+        uint64_t *times, float *values, size_t max) {
+    return reinterpret_cast<Wrapper*>(sense)->history(channel, t0, t1, times, values, max);
+}
 
-void set_imu_config(SenseHatSensors *sense, Bool_t compass_enabled, Bool_t gyro_enabled, Bool_t accel_enabled) {
-    try {
-        Wrapper *wrapper = reinterpret_cast<Wrapper*>(sense);
-        wrapper->set_imu_config(compass_enabled ? true : false,
-                gyro_enabled ? true : false,
-                accel_enabled ? true : false);
-    } catch (...) {}
+size_t get_history_downsampled(SenseHatSensors *sense, SenseHatChannel channel, uint64_t t0, uint64_t t1,
+        uint64_t *times, float *values, size_t points) {
+    return reinterpret_cast<Wrapper*>(sense)->history_downsampled(channel, t0, t1, times, values, points);
 }
-/***** Sensors *****/
 
-float get_humidity(SenseHatSensors *sense) {
+int add_rule(SenseHatSensors *sense, const SensorRule *rule) {
     try {
-        Wrapper *wrapper = reinterpret_cast<Wrapper*>(sense);
-        return wrapper->get_humidity();
+        return reinterpret_cast<Wrapper*>(sense)->add_rule(*rule);
     } catch (...) {
-        return 0.0;
+        return -1;
     }
 }
-float get_pressure(SenseHatSensors *sense) {
-    try {
-        Wrapper *wrapper = reinterpret_cast<Wrapper*>(sense);
-        return wrapper->get_pressure();
-    } catch (...) {
-        return 0.0;
-    }
+
+Bool_t remove_rule(SenseHatSensors *sense, int id) {
+    return reinterpret_cast<Wrapper*>(sense)->remove_rule(id) ? TRUE : FALSE;
 }
-float get_temperature_from_humidity(SenseHatSensors *sense) {
-    try {
-        Wrapper *wrapper = reinterpret_cast<Wrapper*>(sense);
-        return wrapper->temperature_from_humidity();
-    } catch (...) {
-        return 0.0;
-    }
+
+void set_rule_callback(SenseHatSensors *sense, RuleCallback callback, void *context) {
+    reinterpret_cast<Wrapper*>(sense)->set_rule_callback(callback, context);
 }
 
-float get_temperature_from_pressure(SenseHatSensors *sense) {
-    try {
-        Wrapper *wrapper = reinterpret_cast<Wrapper*>(sense);
-        return wrapper->temperature_from_pressure();
-    } catch (...) {
-        return 0.0;
-    }
+size_t drain_rule_events(SenseHatSensors *sense, RuleEvent *events, size_t max) {
+    return reinterpret_cast<Wrapper*>(sense)->drain_rule_events(events, max);
 }
-float get_temperature(SenseHatSensors *sense) {
+
+Bool_t start_gestures(SenseHatSensors *sense, const GestureSettings *settings) {
     try {
-        Wrapper *wrapper = reinterpret_cast<Wrapper*>(sense);
-        return wrapper->temperature();
+        reinterpret_cast<Wrapper*>(sense)->start_gestures(settings);
+        return TRUE;
     } catch (...) {
-        return 0.0;
+        return FALSE;
     }
 }
 
-Orientation get_orientation_radians(SenseHatSensors *sense) {
-    try {
-        Wrapper *wrapper = reinterpret_cast<Wrapper*>(sense);
-        return wrapper->orientation_radians();
-    } catch (...) {
-        Orientation ret = {}; // Zero out all values
-        return ret;
-    }
+void stop_gestures(SenseHatSensors *sense) {
+    reinterpret_cast<Wrapper*>(sense)->stop_gestures();
 }
 
-Orientation get_orientation_degrees(SenseHatSensors *sense) {
+size_t drain_gestures(SenseHatSensors *sense, Gesture *gestures, size_t max) {
+    return reinterpret_cast<Wrapper*>(sense)->drain_gestures(gestures, max);
+}
+
+/***** Framebuffer and LED *****/
+
+SenseHatStatus try_begin_frame(SenseHatSensors *sense) {
+    Wrapper *wrapper = reinterpret_cast<Wrapper*>(sense);
+    return wrapper->begin_frame();
+}
+
+void begin_frame(SenseHatSensors *sense) {
+    try_begin_frame(sense);
+}
+
+SenseHatStatus try_commit_frame(SenseHatSensors *sense, Bool_t *written) {
+    Wrapper *wrapper = reinterpret_cast<Wrapper*>(sense);
+    CallTimer timer(wrapper->call_stats(STATS_COMMIT_FRAME));
+    bool changed;
+    SenseHatStatus status = wrapper->commit_frame(changed);
+    *written = changed ? TRUE : FALSE;
+    return timer.done(status);
+}
+
+Bool_t commit_frame(SenseHatSensors *sense) {
+    Bool_t written;
+    try_commit_frame(sense, &written);
+    return written;
+}
+
+SenseHatStatus try_set_pixel(SenseHatSensors *sense, uint16_t color, uint8_t x, uint8_t y) {
+    Wrapper *wrapper = reinterpret_cast<Wrapper*>(sense);
+    CallTimer timer(wrapper->call_stats(STATS_SET_PIXEL));
+    return timer.done(wrapper->set_pixel(color, x, y));
+}
+
+void set_pixel(SenseHatSensors *sense, uint16_t color, uint8_t x, uint8_t y) {
+    try_set_pixel(sense, color, x, y);
+}
+
+SenseHatStatus try_set_pixels(SenseHatSensors *sense, uint16_t color) {
+    Wrapper *wrapper = reinterpret_cast<Wrapper*>(sense);
+    CallTimer timer(wrapper->call_stats(STATS_SET_PIXELS));
+    return timer.done(wrapper->set_pixels(color));
+}
+
+void set_pixels(SenseHatSensors *sense, uint16_t color) {
+    try_set_pixels(sense, color);
+}
+
+SenseHatStatus try_set_image(SenseHatSensors *sense, uint16_t image[64]) {
+    Wrapper *wrapper = reinterpret_cast<Wrapper*>(sense);
+    CallTimer timer(wrapper->call_stats(STATS_SET_IMAGE));
+    return timer.done(wrapper->set_image(image));
+}
+
+void set_image(SenseHatSensors *sense, uint16_t image[64]) {
+    try_set_image(sense, image);
+}
+
+void set_gamma(SenseHatSensors *sense, float gamma) {
     try {
         Wrapper *wrapper = reinterpret_cast<Wrapper*>(sense);
-        return wrapper->orientation_degrees();
-    } catch (...) {
-        Orientation ret = {}; // Zero out all values
-        return ret;
+        wrapper->set_gamma(gamma);
+    } catch (...) {}
+}
+
+SenseHatStatus try_set_image_rgb888(SenseHatSensors *sense, const uint8_t rgb[192]) {
+    Wrapper *wrapper = reinterpret_cast<Wrapper*>(sense);
+    CallTimer timer(wrapper->call_stats(STATS_SET_IMAGE_RGB888));
+    return timer.done(wrapper->set_image_rgb888(rgb));
+}
+
+void set_image_rgb888(SenseHatSensors *sense, const uint8_t rgb[192]) {
+    try_set_image_rgb888(sense, rgb);
+}
+
+SenseHatStatus try_set_image_rgba(SenseHatSensors *sense, const uint8_t rgba[256]) {
+    Wrapper *wrapper = reinterpret_cast<Wrapper*>(sense);
+    CallTimer timer(wrapper->call_stats(STATS_SET_IMAGE_RGBA));
+    return timer.done(wrapper->set_image_rgba(rgba));
+}
+
+void set_image_rgba(SenseHatSensors *sense, const uint8_t rgba[256]) {
+    try_set_image_rgba(sense, rgba);
+}
+
+SenseHatStatus try_clear(SenseHatSensors *sense) {
+    Wrapper *wrapper = reinterpret_cast<Wrapper*>(sense);
+    CallTimer timer(wrapper->call_stats(STATS_CLEAR));
+    return timer.done(wrapper->clear());
+}
+
+void clear(SenseHatSensors *sense) {
+    try_clear(sense);
+}
+
+const char * status_message(SenseHatStatus status) {
+    switch (status) {
+    case SENSE_HAT_OK:
+        return "OK";
+    case SENSE_HAT_NO_DATA:
+        return "No valid reading";
+    case SENSE_HAT_NOT_ENABLED:
+        return "Subsystem not enabled";
+    case SENSE_HAT_INIT_FAILED:
+        return "Could not initialise sensor";
+    case SENSE_HAT_OUT_OF_RANGE:
+        return "Argument out of range";
+    case SENSE_HAT_BUSY:
+        return "LEDs busy with an animation";
     }
+    return "Unknown status";
 }
 
-Orientation get_orientation(SenseHatSensors *sense) {
+/***** Animation *****/
+
+void play_animation(SenseHatSensors *sense, const uint16_t *images, const uint32_t *durations_ms, size_t count, Bool_t loop) {
     try {
         Wrapper *wrapper = reinterpret_cast<Wrapper*>(sense);
-        return wrapper->orientation();
-    } catch (...) {
-        Orientation ret = {}; // Zero out all values
-        return ret;
-    }
+        wrapper->play_animation(images, durations_ms, count, loop ? true : false);
+    } catch (...) {}
 }
 
-float get_compass(SenseHatSensors *sense) {
+void show_message(SenseHatSensors *sense, const char *message, uint16_t colour, uint16_t background,
+        uint32_t ms_per_column, Bool_t loop) {
     try {
         Wrapper *wrapper = reinterpret_cast<Wrapper*>(sense);
-        return wrapper->compass();
-    } catch (...) {
-        return 0.0;
-    }
+        wrapper->show_message(message, colour, background, ms_per_column, loop ? true : false);
+    } catch (...) {}
 }
 
-Coordinates get_compass_raw(SenseHatSensors *sense) {
+void set_message_speed(SenseHatSensors *sense, uint32_t ms_per_column) {
     try {
         Wrapper *wrapper = reinterpret_cast<Wrapper*>(sense);
-        return wrapper->compass_raw();
-    } catch (...) {
-        Coordinates ret = {}; // Zero out all values
-        return ret;
-    }
+        wrapper->set_message_speed(ms_per_column);
+    } catch (...) {}
 }
 
-Orientation get_gyroscope(SenseHatSensors *sense) {
+void set_message_colour(SenseHatSensors *sense, uint16_t colour, uint16_t background) {
     try {
         Wrapper *wrapper = reinterpret_cast<Wrapper*>(sense);
-        return wrapper->gyroscope();
-    } catch (...) {
-        Orientation ret = {}; // Zero out all values
-        return ret;
-    }
+        wrapper->set_message_colour(colour, background);
+    } catch (...) {}
 }
 
-Coordinates get_gyroscope_raw(SenseHatSensors *sense) {
+void stop_animation(SenseHatSensors *sense) {
     try {
         Wrapper *wrapper = reinterpret_cast<Wrapper*>(sense);
-        return wrapper->gyroscope_raw();
-    } catch (...) {
-        Coordinates ret = {}; // Zero out all values
-        return ret;
-    }
+        wrapper->stop_animation();
+    } catch (...) {}
 }
 
-Orientation get_accelerometer(SenseHatSensors *sense) {
+Bool_t animation_playing(SenseHatSensors *sense) {
     try {
         Wrapper *wrapper = reinterpret_cast<Wrapper*>(sense);
-        return wrapper->accelerometer();
+        return wrapper->animation_playing() ? TRUE : FALSE;
     } catch (...) {
-        Orientation ret = {}; // Zero out all values
-        return ret;
+        return FALSE;
     }
 }
 
-Coordinates get_accelerometer_raw(SenseHatSensors *sense) {
+AnimationStats get_animation_stats(SenseHatSensors *sense) {
     try {
         Wrapper *wrapper = reinterpret_cast<Wrapper*>(sense);
-        return wrapper->accelerometer_raw();
+        return wrapper->animation_stats();
     } catch (...) {
-        Coordinates ret = {}; // Zero out all values
+        AnimationStats ret = {}; // Zero out all values
         return ret;
     }
 }
 
-/***** Framebuffer and LED *****/
+/***** Scripts *****/
 
-void set_pixel(SenseHatSensors *sense, uint16_t color, uint8_t x, uint8_t y) {
+SenseHatScript * script_load(SenseHatSensors *sense, const char *source, char *error, size_t size) {
+    char reason[SCRIPT_ERROR_SIZE] = "Out of memory";
     try {
-        Wrapper *wrapper = reinterpret_cast<Wrapper*>(sense);
-        wrapper->set_pixel(color, x, y);
+        Script *script = new Script(*reinterpret_cast<Wrapper*>(sense), source);
+        return reinterpret_cast<SenseHatScript*>(script);
+    } catch (const ScriptError &e) {
+        memcpy(reason, e.message, sizeof(reason));
     } catch (...) {}
+    if (error && size > 0) {
+        snprintf(error, size, "%s", reason);
+    }
+    return NULL;
 }
 
-void set_pixels(SenseHatSensors *sense, uint16_t color) {
-    try {
-        Wrapper *wrapper = reinterpret_cast<Wrapper*>(sense);
-        wrapper->set_pixels(color);
-    } catch (...) {}
+SenseHatStatus script_run(SenseHatScript *script) {
+    return reinterpret_cast<Script*>(script)->run();
 }
 
-void set_image(SenseHatSensors *sense, uint16_t image[64]) {
-    try {
-        Wrapper *wrapper = reinterpret_cast<Wrapper*>(sense);
-        wrapper->set_image(image);
-    } catch (...) {}
+int script_function(SenseHatScript *script, const char *name) {
+    return reinterpret_cast<Script*>(script)->function(name);
 }
 
-void clear(SenseHatSensors *sense) {
-    try {
-        Wrapper *wrapper = reinterpret_cast<Wrapper*>(sense);
-        wrapper->clear();
-    } catch (...) {}
+SenseHatStatus script_call(SenseHatScript *script, int function, const double *args, size_t count, double *result) {
+    return reinterpret_cast<Script*>(script)->call(function, args, count, *result);
+}
+
+void script_stop(SenseHatScript *script) {
+    reinterpret_cast<Script*>(script)->stop();
+}
+
+const char * script_error(SenseHatScript *script) {
+    return reinterpret_cast<Script*>(script)->error();
 }
 
+void script_delete(SenseHatScript *script) {
+    delete reinterpret_cast<Script*>(script);
+}
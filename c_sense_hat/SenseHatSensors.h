@@ -1,6 +1,7 @@
 #ifndef SENSE_HAT_WRAPPER
 #define SENSE_HAT_WRAPPER
 
+#include "stddef.h"
 #include "stdint.h"
 
 typedef enum {
@@ -8,6 +9,19 @@ typedef enum {
     FALSE = 0,
 } Bool_t;
 
+/* Result of the try_ functions */
+typedef enum SenseHatStatus {
+    SENSE_HAT_OK = 0,
+    SENSE_HAT_NO_DATA,          // No valid reading, the last valid value (or 0) was returned
+    SENSE_HAT_NOT_ENABLED,      // The subsystem was not brought up
+    SENSE_HAT_INIT_FAILED,      // The sensor could not be initialised
+    SENSE_HAT_OUT_OF_RANGE,     // An argument was out of range
+    SENSE_HAT_BUSY,             // The LEDs are taken by a playing animation
+} SenseHatStatus;
+
+/* Packs 8 bit red, green and blue into the RGB565 format of the LEDs */
+#define RGB565(r, g, b) ((uint16_t) ((((r) & 0xF8) << 8) | (((g) & 0xFC) << 3) | (((b) & 0xFF) >> 3)))
+
 typedef struct Coordinates {
     float x;
     float y;
@@ -20,16 +34,320 @@ typedef struct Orientation {
     float yaw;
 } Orientation;
 
-/* Opaque type for the Wrapper (SenseHatSensors.cpp) */
+/* Rotation as a unit quaternion, as RTIMULib's fusionQPose */
+typedef struct Quaternion {
+    float w;
+    float x;
+    float y;
+    float z;
+} Quaternion;
+
+/* Every IMU value from a single read. Values whose flag is FALSE were not
+ * updated by that read and hold the last valid value instead */
+typedef struct ImuSample {
+    uint64_t timestamp;     // Microseconds since the epoch
+    Orientation fusion;     // Fusion pose in radians
+    Coordinates compass;    // uT (micro teslas)
+    Coordinates gyro;       // Radians per second
+    Coordinates accel;      // Gs
+    Bool_t fusion_valid;
+    Bool_t compass_valid;
+    Bool_t gyro_valid;
+    Bool_t accel_valid;
+} ImuSample;
+
+/* Everything the humidity and pressure chips measure in one read each.
+ * Values whose flag is FALSE could not be read */
+typedef struct EnvironmentSample {
+    uint64_t timestamp;     // Microseconds since the epoch
+    float humidity;         // Percentage of relative humidity
+    float pressure;         // Millibars
+    float temperature_from_humidity;    // Celsius
+    float temperature_from_pressure;    // Celsius
+    Bool_t humidity_valid;
+    Bool_t pressure_valid;
+    Bool_t temperature_from_humidity_valid;
+    Bool_t temperature_from_pressure_valid;
+} EnvironmentSample;
+
+/* Frame counters of the LED animation player */
+typedef struct AnimationStats {
+    uint64_t frames_shown;
+    uint64_t frames_dropped;    // Skipped because the player woke up late
+} AnimationStats;
+
+/* Subsystems for SenseHatSensors_new_with */
+#define SENSE_HAT_LED       0x01
+#define SENSE_HAT_IMU       0x02
+#define SENSE_HAT_PRESSURE  0x04
+#define SENSE_HAT_HUMIDITY  0x08
+#define SENSE_HAT_ALL       0x0F
+
+/* Microseconds spent bringing up each subsystem, 0 if it is not enabled.
+ * Sensor times include the initialisation done on first use */
+typedef struct StartupTimes {
+    uint32_t led_us;
+    uint32_t settings_us;   // Parsing the RTIMULib settings file
+    uint32_t imu_us;
+    uint32_t pressure_us;
+    uint32_t humidity_us;
+} StartupTimes;
+
+/* Functions with a latency histogram in SenseHatStats */
+typedef enum SenseHatCall {
+    STATS_READ_IMU = 0,     // Time blocked in every IMU read, including retries
+    STATS_GET_HUMIDITY,
+    STATS_GET_PRESSURE,
+    STATS_GET_TEMPERATURE_FROM_HUMIDITY,
+    STATS_GET_TEMPERATURE_FROM_PRESSURE,
+    STATS_GET_TEMPERATURE,
+    STATS_GET_ENVIRONMENT,
+    STATS_GET_ORIENTATION_RADIANS,
+    STATS_GET_ORIENTATION_DEGREES,
+    STATS_GET_ORIENTATION,
+    STATS_GET_COMPASS,
+    STATS_GET_COMPASS_RAW,
+    STATS_GET_GYROSCOPE,
+    STATS_GET_GYROSCOPE_RAW,
+    STATS_GET_ACCELEROMETER,
+    STATS_GET_ACCELEROMETER_RAW,
+    STATS_GET_IMU_SAMPLE,
+    STATS_SET_IMU_CONFIG,
+    STATS_SET_PIXEL,
+    STATS_SET_PIXELS,
+    STATS_SET_IMAGE,
+    STATS_SET_IMAGE_RGB888,
+    STATS_SET_IMAGE_RGBA,
+    STATS_CLEAR,
+    STATS_COMMIT_FRAME,
+    STATS_CALLS
+} SenseHatCall;
+
+/* Latency of one function. Percentiles come from a log-linear histogram
+ * and are at most 1/16 above the real value */
+typedef struct LatencyStats {
+    uint64_t count;
+    uint64_t failures;      // Calls that returned an error (not SENSE_HAT_NO_DATA)
+    uint64_t total_ns;
+    uint64_t p50_ns;
+    uint64_t p90_ns;
+    uint64_t p99_ns;
+    uint64_t p999_ns;
+    uint64_t max_ns;
+} LatencyStats;
+
+/* Counters since the SenseHatSensors was created or reset_stats */
+typedef struct SenseHatStats {
+    LatencyStats calls[STATS_CALLS];    // Indexed by SenseHatCall
+    uint64_t imu_reads;
+    uint64_t imu_retries;           // Extra attempts needed by IMU reads
+    uint64_t imu_read_failures;     // Reads that ran out of attempts
+    uint64_t imu_sleep_ns;          // Time the IMU reads spent sleeping
+    // Getters that returned the last valid (or a zero) value because the
+    // reading was not valid
+    uint64_t invalid_fusion;
+    uint64_t invalid_compass;
+    uint64_t invalid_gyro;
+    uint64_t invalid_accel;
+    uint64_t invalid_humidity;
+    uint64_t invalid_pressure;
+    uint64_t invalid_temperature;
+    uint64_t failures;              // Sum over all calls
+} SenseHatStats;
+
+/* Progress of the capture started by start_capture */
+typedef struct CaptureStats {
+    uint64_t imu_samples;           // Samples stored
+    uint64_t environment_samples;
+    uint64_t blocks;                // Blocks written to the card
+    uint64_t segments;              // Segment files created
+    uint64_t dropped;               // Samples lost because the card fell behind or failed
+    uint64_t bytes;                 // Written to the card, headers and indexes included
+} CaptureStats;
+
+/* Values the library can keep rolling statistics of, see watch_channel */
+typedef enum SenseHatChannel {
+    CHANNEL_HUMIDITY = 0,
+    CHANNEL_PRESSURE,
+    CHANNEL_TEMPERATURE_FROM_HUMIDITY,
+    CHANNEL_TEMPERATURE_FROM_PRESSURE,
+    CHANNEL_ROLL,           // Fusion pose in radians
+    CHANNEL_PITCH,
+    CHANNEL_YAW,
+    CHANNEL_COMPASS_X,
+    CHANNEL_COMPASS_Y,
+    CHANNEL_COMPASS_Z,
+    CHANNEL_COMPASS_MAGNITUDE,
+    CHANNEL_GYRO_X,
+    CHANNEL_GYRO_Y,
+    CHANNEL_GYRO_Z,
+    CHANNEL_GYRO_MAGNITUDE,
+    CHANNEL_ACCEL_X,
+    CHANNEL_ACCEL_Y,
+    CHANNEL_ACCEL_Z,
+    CHANNEL_ACCEL_MAGNITUDE,
+    SENSE_HAT_CHANNELS
+} SenseHatChannel;
+
+/* Aggregates of one channel over its window, which ends at the newest
+ * sample. A window holds at most 1024 samples */
+typedef struct WindowStats {
+    uint32_t count;         // Samples in the window
+    uint64_t oldest;        // Timestamps of the first and last of them
+    uint64_t newest;
+    float min;
+    float max;
+    float mean;
+    float variance;         // Population variance
+    float ema;              // Exponential moving average of every sample
+} WindowStats;
+
+/* A value of a channel and the timestamp of its sample */
+typedef struct HistoryPoint {
+    uint64_t timestamp;
+    float value;
+} HistoryPoint;
+
+/* What a rule compares its threshold with, see add_rule */
+typedef enum RuleKind {
+    RULE_ABOVE = 0,         // The value
+    RULE_BELOW,             // The value, fires when it is lower
+    RULE_ABS_ABOVE,         // Its absolute value
+    RULE_CHANGE,            // How far it moved since the rule last fired
+    RULE_KINDS
+} RuleKind;
+
+/* A condition on one channel, e.g. {CHANNEL_TEMPERATURE_FROM_HUMIDITY,
+ * RULE_ABOVE, 30, 0.5, 5000} for above 30 degrees for 5 s, or
+ * {CHANNEL_YAW, RULE_CHANGE, 0.52, 0, 0} for a heading change of 30
+ * degrees */
+typedef struct SensorRule {
+    SenseHatChannel channel;
+    RuleKind kind;
+    float threshold;        // In the unit of the channel
+    float hysteresis;       // A fired rule clears once the value is this far
+                            // back past the threshold. RULE_CHANGE never clears
+    uint32_t hold_ms;       // How long the condition must hold, over every
+                            // reading, before the rule fires
+} SensorRule;
+
+/* A rule firing or clearing */
+typedef struct RuleEvent {
+    uint64_t timestamp;     // Of the reading
+    int32_t rule;           // Id from add_rule
+    Bool_t fired;           // FALSE when the rule cleared
+    float value;            // Of the channel in that reading
+} RuleEvent;
+
+typedef void (*RuleCallback)(const RuleEvent *, void *);
+
+typedef enum GestureKind {
+    GESTURE_TAP = 0,
+    GESTURE_SHAKE,
+    GESTURE_FLIP,           // Turned upside down, along any axis
+    GESTURE_KINDS
+} GestureKind;
+
+/* How readily gestures are seen, see start_gestures. Accelerations are
+ * in g with gravity filtered out */
+typedef struct GestureSettings {
+    float tap_threshold;    // Least peak of a tap
+    uint32_t tap_ms;        // Longest a tap stays above half its threshold
+    float shake_threshold;  // Least RMS along one axis over the window
+    float shake_hz;         // Least rate of a shake, back and forth per second
+    float flip_degrees;     // Least the gyroscope must see the board turn
+    uint32_t flip_ms;       // How long it must rest on its new side
+} GestureSettings;
+
+typedef struct Gesture {
+    uint64_t timestamp;     // Of the sample it was seen in, the peak of a tap
+    GestureKind kind;
+    int32_t axis;           // 0 to 2 for x to z: strongest of a tap or
+                            // shake, the one gravity is along after a flip
+    int32_t direction;      // Sign of the tap or of gravity along the
+                            // axis, 0 for a shake
+    float strength;         // Peak of a tap, RMS of a shake in g, degrees
+                            // turned for a flip (0 without the gyroscope)
+} Gesture;
+
+/* Opaque type for the Wrapper (SenseHatSensors.cpp). One SenseHatSensors
+ * may be used from any number of threads at once */
 struct SenseHatSensors;
 typedef struct SenseHatSensors SenseHatSensors;
 
-// Constructor
+// Constructor. Set SENSE_HAT_FB to the path of a file to use it in place of
+// the LED framebuffer device
 SenseHatSensors * SenseHatSensors_new(void);
+// Constructor bringing up only the subsystems in flags (SENSE_HAT_LED, ...).
+// Functions of a subsystem that was left out fail
+SenseHatSensors * SenseHatSensors_new_with(unsigned int);
+StartupTimes get_startup_times(SenseHatSensors *);
+// Constructor that plays back a trace file (NULL for a synthetic signal)
+// instead of reading the hardware. IMU samples come at the given rate in
+// Hz, 0 as fast as they are read. The LEDs use the file at fb_path, or
+// SENSE_HAT_FB when it is NULL. Runs on any Linux machine
+SenseHatSensors * SenseHatSensors_new_replay(const char *, float, const char *, unsigned int);
+// Constructor for a client of a process that publishes its readings with
+// publish_bus. Sensor reads are loads from shared memory that never block
+// or touch the hardware. Of flags only SENSE_HAT_LED is used, the sensors
+// are whatever the publisher has. NULL if there is no such bus. Once the
+// publisher stops or dies, reads fail with SENSE_HAT_NO_DATA
+SenseHatSensors * SenseHatSensors_attach(const char *, unsigned int);
+// Appends every sensor reading to a trace file for SenseHatSensors_new_replay
+Bool_t record_trace(SenseHatSensors *, const char *);
+void stop_trace(SenseHatSensors *);
+// Instrumentation, see SenseHatStats
+SenseHatStats get_stats(SenseHatSensors *);
+void reset_stats(SenseHatSensors *);
+// Writes the stats as one line of JSON to the file at path (NULL for
+// stderr) every interval_ms milliseconds. 0 stops the dump
+Bool_t dump_stats(SenseHatSensors *, const char *, uint32_t);
 // Destructor
 void SenseHatSensors_delete(SenseHatSensors *);
 
 void set_imu_config(SenseHatSensors *, Bool_t, Bool_t, Bool_t);
+// Read attempts per IMU sample and the delay before the first retry,
+// doubled on every further retry. 0 waits one IMU poll interval
+void set_imu_poll_policy(SenseHatSensors *, int, uint32_t);
+// Polls the IMU from a background thread, the IMU getters then return the
+// newest sample without blocking
+void start_imu_stream(SenseHatSensors *);
+void stop_imu_stream(SenseHatSensors *);
+// Event queue for reactor loops. Starts the IMU stream and returns an
+// eventfd that becomes readable whenever a sample is queued; read the fd
+// to reset it, then drain. The environment is read every given number of
+// milliseconds (0 never). -1 on failure
+int open_sample_events(SenseHatSensors *, uint32_t);
+// Closes the fd and stops the stream, unless a bus or capture needs it
+void close_sample_events(SenseHatSensors *);
+// Copy up to max samples queued since the last drain, oldest first, and
+// return how many. Never block. The queue holds 256 IMU and 16
+// environment samples, older ones are lost if it is not drained in time
+size_t drain_imu_samples(SenseHatSensors *, ImuSample *, size_t);
+size_t drain_environment_samples(SenseHatSensors *, EnvironmentSample *, size_t);
+// Name of the bus used by busd
+#define SENSE_HAT_BUS "/sense_hat"
+// Publishes every IMU sample, and the environment every given number of
+// milliseconds (0 never), to the named POSIX shared memory object for
+// SenseHatSensors_attach. Starts the IMU stream. Fails if another process
+// that is still running publishes a bus of that name
+Bool_t publish_bus(SenseHatSensors *, const char *, uint32_t);
+// Removes the bus. The IMU stream is stopped unless sample events or a
+// capture still need it
+void stop_bus(SenseHatSensors *);
+// Logs every IMU sample, and the environment every given number of
+// milliseconds (0 never), to binary segment files in directory (see
+// Capture.h for the format and a reader). Starts the IMU stream; samples
+// are written from a background thread in blocks of 32 KiB
+Bool_t start_capture(SenseHatSensors *, const char *, uint32_t);
+// The same with the blocks compressed on the background thread, typically
+// to a fraction of their size. Read back with capture_read_imu and
+// capture_read_environment
+Bool_t start_compressed_capture(SenseHatSensors *, const char *, uint32_t);
+// Writes what is left and closes the segment. The IMU stream is stopped
+// unless a bus or sample events still need it
+void stop_capture(SenseHatSensors *);
+CaptureStats get_capture_stats(SenseHatSensors *);
 
 // Envoiromental sensors
 float get_humidity(SenseHatSensors *);
@@ -37,6 +355,10 @@ float get_pressure(SenseHatSensors *);
 float get_temperature_from_humidity(SenseHatSensors *);
 float get_temperature_from_pressure(SenseHatSensors *);
 float get_temperature(SenseHatSensors *);
+// All environmental values with a single read per chip. A sample taken
+// less than the given number of milliseconds ago is returned again
+// instead, 0 always reads the chips
+EnvironmentSample get_environment(SenseHatSensors *, uint32_t);
 
 // IMU Sensor
 Orientation get_orientation_radians(SenseHatSensors *);
@@ -48,12 +370,182 @@ Orientation get_gyroscope(SenseHatSensors *);
 Coordinates get_gyroscope_raw(SenseHatSensors *);
 Orientation get_accelerometer(SenseHatSensors *);
 Coordinates get_accelerometer_raw(SenseHatSensors *);
+ImuSample get_imu_sample(SenseHatSensors *);
+// Newest values read by any thread, without reading the sensors. These
+// never block, so a thread that must not wait for I2C can use them while
+// another one reads (or streams). Flags and values as in get_imu_sample
+// and get_environment; all FALSE before the first read
+ImuSample peek_imu_sample(SenseHatSensors *);
+EnvironmentSample peek_environment(SenseHatSensors *);
+// Rolling statistics. The library keeps min, max, mean and variance of a
+// channel over the last window_ms milliseconds, and an EMA with a time
+// constant of ema_ms, updated with every reading taken by any getter, the
+// IMU stream or the sample events. Each update is O(1). A window of 0 stops
+// watching the channel
+Bool_t watch_channel(SenseHatSensors *, SenseHatChannel, uint32_t, uint32_t);
+WindowStats get_window_stats(SenseHatSensors *, SenseHatChannel);
+// History. The library keeps the last samples values of a channel (at most
+// 4194304), taken like the rolling statistics, in preallocated arrays that
+// are searched by timestamp. 0 samples stops keeping the channel. Times are
+// sample timestamps; a t1 of UINT64_MAX reaches the newest sample
+Bool_t keep_history(SenseHatSensors *, SenseHatChannel, uint32_t);
+// Newest value at or before the given time, UINT64_MAX for the newest.
+// Zeros if there is none
+HistoryPoint get_history_at(SenseHatSensors *, SenseHatChannel, uint64_t);
+// Copies the samples with t0 <= timestamp <= t1, oldest first, to the
+// timestamp and value arrays, at most max of them. Returns how many
+size_t get_history(SenseHatSensors *, SenseHatChannel, uint64_t, uint64_t, uint64_t *, float *, size_t);
+// Reduces the samples in [t0, t1] to at most points means over stretches
+// of equal length, for plotting. Returns how many were written
+size_t get_history_downsampled(SenseHatSensors *, SenseHatChannel, uint64_t, uint64_t, uint64_t *, float *, size_t);
+// Rules. Every reading taken like the rolling statistics is checked
+// against the rules of its channels by the thread that took it, all of
+// them in one pass, so with the IMU stream (and sample events with an
+// environment interval for the environment) nothing needs to poll. Adds a
+// rule and returns its id, -1 if it is not valid or 256 rules are set
+int add_rule(SenseHatSensors *, const SensorRule *);
+Bool_t remove_rule(SenseHatSensors *, int);
+// Function called with every event, and its last argument, from the
+// thread that took the reading once the library holds no lock. It may add
+// or remove rules but should be quick. NULL for none
+void set_rule_callback(SenseHatSensors *, RuleCallback, void *);
+// Copies up to max events queued since the last call, oldest first, and
+// returns how many. The queue keeps the last 256
+size_t drain_rule_events(SenseHatSensors *, RuleEvent *, size_t);
+// Gestures. Once started, the detector goes through every IMU reading
+// taken like the rolling statistics, so run the IMU stream for it to see
+// them all. Settings NULL for the defaults: taps of 1.5 g lasting at most
+// 60 ms, shakes of 0.5 g RMS at 2 Hz or faster, flips turning at least 120
+// degrees and resting 300 ms. Starting again applies new settings and
+// forgets what was seen so far
+Bool_t start_gestures(SenseHatSensors *, const GestureSettings *);
+void stop_gestures(SenseHatSensors *);
+// Copies up to max gestures seen since the last call, oldest first, and
+// returns how many. The queue keeps the last 64
+size_t drain_gestures(SenseHatSensors *, Gesture *, size_t);
 
 // LED
 void set_pixel(SenseHatSensors *, uint16_t, uint8_t, uint8_t);
 void set_pixels(SenseHatSensors *, uint16_t);
 void set_image(SenseHatSensors *, uint16_t [64]);
 void clear(SenseHatSensors *);
+// 64 pixels of 8 bit r, g, b (and a, which is ignored), converted to RGB565
+// after going through the gamma curve set by set_gamma (default 1.0)
+void set_image_rgb888(SenseHatSensors *, const uint8_t [192]);
+void set_image_rgba(SenseHatSensors *, const uint8_t [256]);
+void set_gamma(SenseHatSensors *, float);
+// Draw calls between begin_frame and commit_frame go to a back buffer,
+// commit_frame shows the whole frame at once. Returns TRUE if the LEDs
+// were updated, FALSE if the frame did not change anything.
+// While an animation or message plays, draws and commits are refused with
+// SENSE_HAT_BUSY; stop_animation gives the LEDs back
+void begin_frame(SenseHatSensors *);
+Bool_t commit_frame(SenseHatSensors *);
+
+// Status code API. Same as the functions above, but the result goes to the
+// last argument and the status tells whether it is a real reading. The
+// result is always written, with what the plain function would return.
+// These never throw or allocate
+SenseHatStatus try_get_humidity(SenseHatSensors *, float *);
+SenseHatStatus try_get_pressure(SenseHatSensors *, float *);
+SenseHatStatus try_get_temperature_from_humidity(SenseHatSensors *, float *);
+SenseHatStatus try_get_temperature_from_pressure(SenseHatSensors *, float *);
+SenseHatStatus try_get_temperature(SenseHatSensors *, float *);
+// SENSE_HAT_NO_DATA if any enabled chip had an invalid value
+SenseHatStatus try_get_environment(SenseHatSensors *, uint32_t, EnvironmentSample *);
+SenseHatStatus try_get_orientation_radians(SenseHatSensors *, Orientation *);
+SenseHatStatus try_get_orientation_degrees(SenseHatSensors *, Orientation *);
+SenseHatStatus try_get_orientation(SenseHatSensors *, Orientation *);
+SenseHatStatus try_get_compass(SenseHatSensors *, float *);
+SenseHatStatus try_get_compass_raw(SenseHatSensors *, Coordinates *);
+SenseHatStatus try_get_gyroscope(SenseHatSensors *, Orientation *);
+SenseHatStatus try_get_gyroscope_raw(SenseHatSensors *, Coordinates *);
+SenseHatStatus try_get_accelerometer(SenseHatSensors *, Orientation *);
+SenseHatStatus try_get_accelerometer_raw(SenseHatSensors *, Coordinates *);
+// SENSE_HAT_NO_DATA if any of the valid flags is FALSE
+SenseHatStatus try_get_imu_sample(SenseHatSensors *, ImuSample *);
+// SENSE_HAT_NOT_ENABLED if the channel is not watched, SENSE_HAT_NO_DATA if
+// its window is still empty
+SenseHatStatus try_get_window_stats(SenseHatSensors *, SenseHatChannel, WindowStats *);
+// SENSE_HAT_NOT_ENABLED if the channel is not kept, SENSE_HAT_NO_DATA if no
+// value kept is that old
+SenseHatStatus try_get_history_at(SenseHatSensors *, SenseHatChannel, uint64_t, HistoryPoint *);
+SenseHatStatus try_set_imu_config(SenseHatSensors *, Bool_t, Bool_t, Bool_t);
+SenseHatStatus try_set_pixel(SenseHatSensors *, uint16_t, uint8_t, uint8_t);
+SenseHatStatus try_set_pixels(SenseHatSensors *, uint16_t);
+SenseHatStatus try_set_image(SenseHatSensors *, uint16_t [64]);
+SenseHatStatus try_set_image_rgb888(SenseHatSensors *, const uint8_t [192]);
+SenseHatStatus try_set_image_rgba(SenseHatSensors *, const uint8_t [256]);
+SenseHatStatus try_clear(SenseHatSensors *);
+SenseHatStatus try_begin_frame(SenseHatSensors *);
+SenseHatStatus try_commit_frame(SenseHatSensors *, Bool_t *);
+// Description of a status for error messages
+const char * status_message(SenseHatStatus);
+
+// Bulk conversions, for buffered or recorded samples. They work on arrays
+// of structs or, with _soa, on one array per field, and may convert in
+// place. NEON or SSE2 kernels are used when the compiler targets them and
+// give the same results as the plain C they fall back to
+// Radians to degrees, 0 to 360, as get_orientation_degrees
+void radians_to_degrees(const Orientation *, Orientation *, size_t);
+void radians_to_degrees_soa(const float *, float *, size_t);
+// Degrees to radians, -pi to pi
+void degrees_to_radians(const Orientation *, Orientation *, size_t);
+void degrees_to_radians_soa(const float *, float *, size_t);
+// Roll, pitch and yaw in radians of unit quaternions, within 1e-6 rad of
+// atan2f and asinf. The _soa form takes w, x, y, z and writes roll, pitch,
+// yaw
+void quaternions_to_euler(const Quaternion *, Orientation *, size_t);
+void quaternions_to_euler_soa(const float *, const float *, const float *, const float *,
+    float *, float *, float *, size_t);
+// Length of each vector
+void magnitudes(const Coordinates *, float *, size_t);
+void magnitudes_soa(const float *, const float *, const float *, float *, size_t);
+// Multiplies every value by a factor, such as one of these
+#define STANDARD_GRAVITY 9.80665f       // Gs to m/s^2
+#define RADIANS_TO_DEGREES 57.2957795f  // rad/s to deg/s, without wrapping
+#define MICROTESLA_TO_GAUSS 0.01f
+void scale_coordinates(const Coordinates *, Coordinates *, size_t, float);
+void scale_soa(const float *, float *, size_t, float);
+
+// Animation
+// Plays count frames of 64 pixels each (images holds count * 64 values),
+// showing frame i for durations_ms[i] milliseconds. Runs on its own thread
+// at a fixed rate and replaces any animation that is already playing.
+void play_animation(SenseHatSensors *, const uint16_t *, const uint32_t *, size_t, Bool_t);
+// Scrolls a message (up to 128 characters) from right to left in colour on
+// background, moving one column every given number of milliseconds. Shares
+// the animation thread, so it replaces a running animation and vice versa.
+void show_message(SenseHatSensors *, const char *, uint16_t, uint16_t, uint32_t, Bool_t);
+void set_message_speed(SenseHatSensors *, uint32_t);
+void set_message_colour(SenseHatSensors *, uint16_t, uint16_t);
+void stop_animation(SenseHatSensors *);
+Bool_t animation_playing(SenseHatSensors *);
+AnimationStats get_animation_stats(SenseHatSensors *);
+
+// Scripts
+// A script (see Script.hpp for the language) drives the SenseHatSensors it
+// is loaded for and must be deleted before it. One thread at a time may
+// run a script or call its functions
+struct SenseHatScript;
+typedef struct SenseHatScript SenseHatScript;
+// Compiles a script. NULL if it does not compile, with the line and the
+// reason written to error (of the given size, may be NULL)
+SenseHatScript * script_load(SenseHatSensors *, const char *, char *, size_t);
+// Runs the top level of the script until it returns or script_stop is
+// called. SENSE_HAT_OUT_OF_RANGE on a runtime error, see script_error
+SenseHatStatus script_run(SenseHatScript *);
+// Index of a function of the script for script_call, -1 if it has none
+int script_function(SenseHatScript *, const char *);
+// Calls a function with count arguments and stores what it returns. The
+// globals keep the values script_run left them with
+SenseHatStatus script_call(SenseHatScript *, int, const double *, size_t, double *);
+// Makes the script return at its next loop iteration or sleep, now and on
+// every later run. May be called from any thread or a signal handler
+void script_stop(SenseHatScript *);
+// Line and description of the last runtime error, "" if there was none
+const char * script_error(SenseHatScript *);
+void script_delete(SenseHatScript *);
 
 #endif /* SENSE_HAT_WRAPPER */
 
@@ -2,13 +2,28 @@
 #define SENSE_HAT_HPP
 
 #include "RTIMULib.h"
+#include "CaptureWriter.hpp"
+#include "GestureDetector.hpp"
+#include "PollScheduler.hpp"
+#include "Rgb565.hpp"
+#include "RollingWindow.hpp"
+#include "RuleEngine.hpp"
+#include "SampleHistory.hpp"
+#include "SampleRing.hpp"
+#include "Seqlock.hpp"
+#include "SensorBackend.hpp"
+#include "SensorStats.hpp"
 
 extern "C" {
     #include "SenseHatSensors.h"
 }
 
+#include "algorithm"
+#include "atomic"
 #include "cstdlib"
+#include "mutex"
 #include "string"
+#include "thread"
 
 #include "glob.h"
 #include "stdio.h"
@@ -17,63 +32,219 @@ extern "C" {
 #include "fcntl.h"
 #include "string.h"
 #include "sys/mman.h"
+#include "sys/eventfd.h"
+#include "sys/stat.h"
 
-const char * RPI_SENSE_FB = "RPi-Sense FB";
+const char * const RPI_SENSE_FB = "RPi-Sense FB";
 
 typedef struct framebuffer {
     uint16_t frame[8][8];
 } framebuffer;
 
-// Wrapper class for the RTIMU classes used by the Sense Hat API
+class LedAnimator;
+struct SensorBus;
+
+// Number of IMU samples kept by the streaming sampler, a few seconds at
+// the usual poll rates
+#define IMU_RING_SIZE 256
+// Number of environment samples kept for drain_environment
+#define ENVIRONMENT_RING_SIZE 16
+
+// Orientation pipelines. Each one keeps its own fusion state and is fed
+// from every IMU reading, so switching between them never resets a filter.
+enum FusionMode {
+    FUSION_ALL = 0,     // RTIMU's own fusion, configured by set_imu_config
+    FUSION_COMPASS,     // Magnetometer only
+    FUSION_GYRO,        // Gyroscope only
+    FUSION_ACCEL,       // Accelerometer only
+    FUSION_MODES
+};
+
+// One IMU reading together with the pose of every fusion pipeline
+typedef struct imu_frame {
+    RTIMU_DATA data;
+    Orientation pose[FUSION_MODES];     // Radians
+    bool pose_valid[FUSION_MODES];
+} imu_frame;
+
+// Outputs of the sampler thread that take environment samples, each at
+// its own interval
+enum EnvironmentOutput {
+    OUTPUT_BUS = 0,     // publish_bus
+    OUTPUT_EVENTS,      // open_sample_events, queued for drain_environment
+    OUTPUT_CAPTURE,     // start_capture
+    ENVIRONMENT_OUTPUTS
+};
+
+// Newest valid value of everything the IMU getters return. The flags of
+// sample tell which values came from the newest reading
+typedef struct imu_cache {
+    ImuSample sample;
+    Orientation pose[FUSION_MODES];     // Radians, sample.fusion is FUSION_ALL
+} imu_cache;
+
+// Newest sample of read_environment
+typedef struct environment_cache {
+    EnvironmentSample sample;
+    SenseHatStatus status;
+    uint64_t time;                      // monotonic_ns, 0 before the first read
+} environment_cache;
+
+// Wrapper class for the RTIMU classes used by the Sense Hat API.
+//
+// One Wrapper may be used from any number of threads. Everything that
+// talks to the sensors takes hardware_lock, the LED buffers are guarded by
+// led_lock, and the newest readings are kept in seqlocks that the peek
+// functions read without ever waiting for the hardware.
 class Wrapper {
 public:
-    Wrapper();      // Constructor
+    Wrapper(unsigned int = SENSE_HAT_ALL, SensorBackend * = NULL, const char * = NULL);  // Constructor
     ~Wrapper();     // Destructor
-    float get_humidity(void);
-    float get_pressure(void);
-    float temperature_from_humidity(void);
-    float temperature_from_pressure(void);
-    float temperature(void);
-    void set_imu_config(bool, bool, bool);
-    Orientation orientation_radians(void);
-    Orientation orientation_degrees(void);
-    Orientation orientation(void);
-    float compass(void);
-    Coordinates compass_raw(void);
-    Orientation gyroscope(void);
-    Coordinates gyroscope_raw(void);
-    Orientation accelerometer(void);
-    Coordinates accelerometer_raw(void);
-
-    void set_pixel(uint16_t, uint8_t, uint8_t);
-    void set_pixels(void);
-    void set_pixels(uint16_t);
-    void set_image(uint16_t [64]);
-    void clear(void);
+    StartupTimes startup_times(void);
+    void record_trace(const char *);
+    void stop_trace(void);
+    LatencyHistogram & call_stats(SenseHatCall);
+    SenseHatStats stats_snapshot(void);
+    void reset_stats(void);
+    void dump_stats(const char *, uint32_t);
+    SenseHatStatus get_humidity(float &) noexcept;
+    SenseHatStatus get_pressure(float &) noexcept;
+    SenseHatStatus temperature_from_humidity(float &) noexcept;
+    SenseHatStatus temperature_from_pressure(float &) noexcept;
+    SenseHatStatus temperature(float &) noexcept;
+    SenseHatStatus read_environment(uint32_t, EnvironmentSample &) noexcept;
+    SenseHatStatus set_imu_config(bool, bool, bool) noexcept;
+    void set_imu_poll_policy(int, uint32_t);
+    SenseHatStatus orientation_radians(Orientation &) noexcept;
+    SenseHatStatus orientation_degrees(Orientation &) noexcept;
+    SenseHatStatus orientation(Orientation &) noexcept;
+    SenseHatStatus compass(float &) noexcept;
+    SenseHatStatus compass_raw(Coordinates &) noexcept;
+    SenseHatStatus gyroscope(Orientation &) noexcept;
+    SenseHatStatus gyroscope_raw(Coordinates &) noexcept;
+    SenseHatStatus accelerometer(Orientation &) noexcept;
+    SenseHatStatus accelerometer_raw(Coordinates &) noexcept;
+    SenseHatStatus imu_sample(ImuSample &) noexcept;
+    ImuSample peek_imu(void) const noexcept;
+    EnvironmentSample peek_environment(void) const noexcept;
+    void watch_channel(SenseHatChannel, uint32_t, uint32_t);
+    SenseHatStatus window_stats(SenseHatChannel, WindowStats &) const noexcept;
+    void keep_history(SenseHatChannel, uint32_t);
+    SenseHatStatus history_at(SenseHatChannel, uint64_t, HistoryPoint &) const noexcept;
+    size_t history(SenseHatChannel, uint64_t, uint64_t, uint64_t *, float *, size_t) const noexcept;
+    size_t history_downsampled(SenseHatChannel, uint64_t, uint64_t, uint64_t *, float *, size_t) const noexcept;
+    int add_rule(const SensorRule &);
+    bool remove_rule(int) noexcept;
+    void set_rule_callback(RuleCallback, void *) noexcept;
+    size_t drain_rule_events(RuleEvent *, size_t) noexcept;
+    void start_gestures(const GestureSettings *);
+    void stop_gestures(void) noexcept;
+    size_t drain_gestures(Gesture *, size_t) noexcept;
+    void start_imu_stream(void);
+    void stop_imu_stream(void);
+    int open_sample_events(uint32_t);
+    void close_sample_events(void);
+    size_t drain_imu(ImuSample *, size_t) noexcept;
+    size_t drain_environment(EnvironmentSample *, size_t) noexcept;
+    void publish_bus(const char *, uint32_t);
+    void stop_bus(void);
+    void start_capture(const char *, uint32_t, CaptureEncoding);
+    void stop_capture(void);
+    CaptureStats capture_stats(void);
+
+    SenseHatStatus set_pixel(uint16_t, uint8_t, uint8_t) noexcept;
+    SenseHatStatus set_pixels(uint16_t) noexcept;
+    SenseHatStatus set_image(const uint16_t [64]) noexcept;
+    SenseHatStatus clear(void) noexcept;
+    void set_gamma(float);
+    SenseHatStatus set_image_rgb888(const uint8_t [192]) noexcept;
+    SenseHatStatus set_image_rgba(const uint8_t [256]) noexcept;
+    SenseHatStatus begin_frame(void) noexcept;
+    SenseHatStatus commit_frame(bool &) noexcept;
+    void play_animation(const uint16_t *, const uint32_t *, size_t, bool);
+    void show_message(const char *, uint16_t, uint16_t, uint32_t, bool);
+    void set_message_speed(uint32_t);
+    void set_message_colour(uint16_t, uint16_t);
+    void stop_animation(void);
+    bool animation_playing(void);
+    AnimationStats animation_stats(void);
 private:
-    void open_framebuffer(void);
-    bool read_imu(void);
-    void init_imu(void);
-    void init_humidity(void);
-    void init_pressure(void);
-    RTIMUSettings *settings;
-    RTIMU *imu;
-    bool imu_init;          // Will be initialised as and when needed
-    RTPressure *pressure;
-    bool pressure_init;     // Will be initialised as and when needed
-    RTHumidity *humidity;
-    bool humidity_init;     // Will be initialised as and when needed
+    void open_framebuffer(const char *);
+    void map_framebuffer(int);
+    void release(void) noexcept;
+    framebuffer *draw_target(SenseHatStatus &) noexcept;
+    void require_leds(void);
+    bool read_imu(imu_frame &, ImuSample &) noexcept;
+    SenseHatStatus imu_data(imu_frame &) noexcept;
+    void fuse(imu_frame &) noexcept;
+    ImuSample cache_imu(const imu_frame &) noexcept;
+    void remember(const ImuSample &) noexcept;
+    SenseHatStatus fusion_radians(FusionMode, Orientation &) noexcept;
+    void sample_imu(void);
+    void notify_sample(void) noexcept;
+    SenseHatStatus fill_sample(const imu_frame *, ImuSample &) noexcept;
+    SenseHatStatus init_imu(void) noexcept;
+    SenseHatStatus init_humidity(void) noexcept;
+    SenseHatStatus init_pressure(void) noexcept;
+    StartupTimes startup;
+    SensorStats stats;
+    SensorBackend *backend; // NULL if no sensor is enabled
+    // Held for every call into backend and the fusion pipelines, and while
+    // the sensors are initialised. Never held while sleeping
+    std::mutex hardware_lock;
+    bool has_imu;
+    std::atomic<bool> imu_init;         // Will be initialised as and when needed
+    bool has_pressure;
+    std::atomic<bool> pressure_init;    // Will be initialised as and when needed
+    bool has_humidity;
+    std::atomic<bool> humidity_init;    // Will be initialised as and when needed
+    std::atomic<FILE *> trace;          // Readings are appended here by record_trace
+    std::mutex trace_lock;
+    Seqlock<environment_cache> last_environment;
     int imu_poll_interval;
-    bool _compass_enabled;
+    PollScheduler imu_schedule;
+    bool _compass_enabled;  // The IMU configuration, guarded by hardware_lock
     bool _gyro_enabled;
     bool _accel_enabled;
-    Coordinates last_compass;
-    Orientation last_orientation;
-    Coordinates last_gyro;
-    Coordinates last_accel;
+    RTFusion *fusion[FUSION_MODES];     // NULL for FUSION_ALL
+    Seqlock<imu_cache> last_imu;
+    ChannelWindows channel_windows;     // Fed by remember and read_environment
+    SampleHistory sample_history;       // Likewise
+    RuleEngine rules;                   // Likewise
+    GestureDetector gestures;           // Fed by remember
+    // Held by whatever starts or stops the sampler thread and the outputs
+    // it feeds (bus, event fd)
+    std::recursive_mutex control_lock;
+    // Streaming mode: a sampler thread polls the IMU and publishes
+    // every reading into imu_ring, the getters only read the ring.
+    std::thread imu_sampler;
+    std::atomic<bool> imu_streaming;
+    SampleRing<imu_frame, IMU_RING_SIZE> imu_ring;
+    SampleRing<EnvironmentSample, ENVIRONMENT_RING_SIZE> environment_ring;
+    // Nanoseconds between the environment samples of every output, 0 for
+    // none. The sampler reads the sensors whenever one of them is due
+    std::atomic<uint64_t> environment_interval[ENVIRONMENT_OUTPUTS];
+    int event_fd;           // Written for every queued sample, -1 if closed
+    std::mutex drain_lock;  // Lets several threads drain the same queue
+    uint64_t imu_drained;   // Last sample number handed out by the drains
+    uint64_t environment_drained;
+    ImuSample imu_carried;  // Last sample handed out by drain_imu
+    // Shared memory bus this process publishes to (see SensorBus.hpp)
+    SensorBus *bus;
+    std::string bus_name;
+    int bus_fd;             // Holds the lock that makes this process its publisher
+    // Bus of another process the IMU frames are read from, NULL if this
+    // process reads the sensors itself
+    const SensorBus *remote;
+    CaptureWriter *capture; // Fed by the sampler thread, NULL if not capturing
     // The framebuffer is automaticaly closed when the program terminates
     // so there is no need to free it.
     framebuffer *fb;
+    std::mutex led_lock;    // Guards fb, back, in_frame and gamma
+    framebuffer back;       // Drawn to between begin_frame and commit_frame
+    bool in_frame;
+    LedAnimator *animator;
+    GammaTable gamma;       // Applied by the 8 bit per channel image uploads
 };
 
 #endif /* SENSE_HAT_HPP*/
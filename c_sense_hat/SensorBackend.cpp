@@ -0,0 +1,98 @@
+#include "SensorBackend.hpp"
+
+#include "cstdlib"
+
+/* Constructor, loads the settings unless load_settings is false */
+SensorBackend::SensorBackend(bool load_settings) {
+    settings = NULL;
+    if (!load_settings) {
+        return;
+    }
+    // Get config file used by the Python SenseHat library
+    char ini_name[80];
+    snprintf(ini_name, sizeof(ini_name), "%s/.config/sense_hat/RTIMULib", std::getenv("HOME"));
+    settings = new RTIMUSettings(ini_name);
+}
+
+/* Destructor */
+SensorBackend::~SensorBackend() {
+    delete settings;
+}
+
+uint64_t SensorBackend::environment_time(void) {
+    return RTMath::currentUSecsSinceEpoch();
+}
+
+const SensorBus * SensorBackend::shared_bus(void) {
+    return NULL;
+}
+
+/***** RTIMULib *****/
+
+/* Constructor. Nothing is created before it is opened */
+RTIMUBackend::RTIMUBackend() {
+    imu = NULL;
+    pressure = NULL;
+    humidity = NULL;
+}
+
+/* Destructor */
+RTIMUBackend::~RTIMUBackend() {
+    delete imu;
+    delete pressure;
+    delete humidity;
+}
+
+void RTIMUBackend::open_imu(void) {
+    imu = RTIMU::createIMU(settings);
+    if ((imu == NULL) || (imu->IMUType() == RTIMU_TYPE_NULL)) {
+        throw "No IMU found";
+    }
+}
+
+void RTIMUBackend::open_pressure(void) {
+    pressure = RTPressure::createPressure(settings);
+}
+
+void RTIMUBackend::open_humidity(void) {
+    humidity = RTHumidity::createHumidity(settings);
+}
+
+bool RTIMUBackend::imu_init(void) {
+    return imu->IMUInit();
+}
+
+int RTIMUBackend::imu_poll_interval_us(void) {
+    return imu->IMUGetPollInterval() * 1000;
+}
+
+/* Reads the IMU, data is only filled in if there was a new sample */
+bool RTIMUBackend::imu_read(RTIMU_DATA &data) {
+    if (imu->IMURead()) {
+        data = imu->getIMUData();
+        return true;
+    }
+    return false;
+}
+
+void RTIMUBackend::set_imu_config(bool compass_enabled, bool gyro_enabled, bool accel_enabled) {
+    imu->setCompassEnable(compass_enabled);
+    imu->setGyroEnable(gyro_enabled);
+    imu->setAccelEnable(accel_enabled);
+}
+
+bool RTIMUBackend::pressure_init(void) {
+    return pressure->pressureInit();
+}
+
+bool RTIMUBackend::pressure_read(RTIMU_DATA &data) {
+    return pressure->pressureRead(data);
+}
+
+bool RTIMUBackend::humidity_init(void) {
+    return humidity->humidityInit();
+}
+
+bool RTIMUBackend::humidity_read(RTIMU_DATA &data) {
+    return humidity->humidityRead(data);
+}
@@ -0,0 +1,64 @@
+#ifndef SENSOR_BACKEND_HPP
+#define SENSOR_BACKEND_HPP
+
+#include "RTIMULib.h"
+
+struct SensorBus;
+
+/* Source of the raw sensor readings used by Wrapper.
+ *
+ * A backend is opened one subsystem at a time (open_* throws if the
+ * subsystem is missing) and initialised when it is first used, the same
+ * way Wrapper drives RTIMULib. Readings are returned in RTIMU_DATA so the
+ * fusion code works the same for every backend. */
+class SensorBackend {
+public:
+    SensorBackend(bool = true);
+    virtual ~SensorBackend();
+    virtual void open_imu(void) = 0;
+    virtual void open_pressure(void) = 0;
+    virtual void open_humidity(void) = 0;
+
+    virtual bool imu_init(void) = 0;
+    virtual int imu_poll_interval_us(void) = 0;
+    virtual bool imu_read(RTIMU_DATA &) = 0;
+    virtual void set_imu_config(bool, bool, bool) = 0;
+
+    virtual bool pressure_init(void) = 0;
+    virtual bool pressure_read(RTIMU_DATA &) = 0;
+    virtual bool humidity_init(void) = 0;
+    virtual bool humidity_read(RTIMU_DATA &) = 0;
+    // Timestamp for the environment readings, microseconds since the epoch
+    virtual uint64_t environment_time(void);
+    // Shared memory the readings come from, if they come from another
+    // process. NULL for every backend that reads sensors itself
+    virtual const SensorBus * shared_bus(void);
+
+    // Settings file used by the Python SenseHat library, also needed by
+    // the fusion filters. NULL if the backend was told not to load it
+    RTIMUSettings *settings;
+};
+
+/* The Sense HAT itself, through RTIMULib */
+class RTIMUBackend : public SensorBackend {
+public:
+    RTIMUBackend();
+    ~RTIMUBackend();
+    void open_imu(void);
+    void open_pressure(void);
+    void open_humidity(void);
+    bool imu_init(void);
+    int imu_poll_interval_us(void);
+    bool imu_read(RTIMU_DATA &);
+    void set_imu_config(bool, bool, bool);
+    bool pressure_init(void);
+    bool pressure_read(RTIMU_DATA &);
+    bool humidity_init(void);
+    bool humidity_read(RTIMU_DATA &);
+private:
+    RTIMU *imu;
+    RTPressure *pressure;
+    RTHumidity *humidity;
+};
+
+#endif /* SENSOR_BACKEND_HPP */
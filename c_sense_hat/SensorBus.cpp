@@ -0,0 +1,206 @@
+#include "SensorBus.hpp"
+
+#include "cerrno"
+#include "new"
+
+#include "sys/file.h"
+#include "unistd.h"
+
+/* True if name refers to the shared memory object open as fd */
+static bool names(int fd, const char *name) {
+    int other = shm_open(name, O_RDONLY, 0);
+    if (other < 0) {
+        return false;
+    }
+    struct stat mine, theirs;
+    bool same = fstat(fd, &mine) == 0 && fstat(other, &theirs) == 0 &&
+        mine.st_dev == theirs.st_dev && mine.st_ino == theirs.st_ino;
+    close(other);
+    return same;
+}
+
+/* Creates the shared memory object name, or takes over the one a publisher
+ * that is gone left behind, and maps it for publishing.
+ *
+ * A publisher holds an exclusive flock on the object for as long as it
+ * publishes, on the descriptor stored in lock_fd and handed to close_bus.
+ * The lock is released by the kernel when the publisher dies, so whether
+ * it can be taken is what tells a bus left behind from a live one. Throws
+ * if another publisher holds it */
+SensorBus * create_bus(const char *name, unsigned int flags, int imu_poll_interval_us, int &lock_fd) {
+    for (int attempt = 0; attempt < BUS_OPEN_ATTEMPTS; attempt++) {
+        int fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0644);
+        if (fd < 0 && errno == EEXIST) {
+            fd = shm_open(name, O_RDWR, 0);
+        }
+        if (fd < 0) {
+            if (errno == ENOENT) {
+                continue;   // Removed in between
+            }
+            throw "Could not create bus";
+        }
+        if (flock(fd, LOCK_EX | LOCK_NB) != 0) {
+            close(fd);
+            throw "Bus is in use by another publisher";
+        }
+        if (!names(fd, name)) {
+            // Its publisher removed it before the lock was free
+            close(fd);
+            continue;
+        }
+        void *mem = MAP_FAILED;
+        if (ftruncate(fd, sizeof(SensorBus)) == 0) {
+            mem = mmap(0, sizeof(SensorBus), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        }
+        if (mem == MAP_FAILED) {
+            shm_unlink(name);
+            close(fd);
+            throw "Could not create bus";
+        }
+        SensorBus *bus = new (mem) SensorBus();
+        bus->flags = flags;
+        bus->imu_poll_interval_us = imu_poll_interval_us;
+        bus->magic.store(SENSOR_BUS_MAGIC, std::memory_order_release);
+        lock_fd = fd;
+        return bus;
+    }
+    throw "Could not create bus";
+}
+
+/* Unmaps and removes a bus made by create_bus and releases its lock.
+ * Clients that are attached keep their mapping and see no new samples */
+void close_bus(SensorBus *bus, const char *name, int lock_fd) {
+    bool own = names(lock_fd, name);
+    bus->alive.store(0, std::memory_order_release);
+    bus->~SensorBus();
+    munmap(bus, sizeof(SensorBus));
+    if (own) {
+        shm_unlink(name);
+    }
+    close(lock_fd);
+}
+
+/***** Client *****/
+
+/* Constructor, maps the bus name read only. The settings file is not
+ * needed, the publisher does all the fusion */
+BusBackend::BusBackend(const char *name) : SensorBackend(false) {
+    memset(&environment, 0, sizeof(EnvironmentSample));
+    environment_valid = false;
+    pressure_taken = true;      // Forces the first read to take a sample
+    humidity_taken = true;
+    int fd = shm_open(name, O_RDONLY, 0);
+    if (fd < 0) {
+        throw "No bus found";
+    }
+    void *mem = mmap(0, sizeof(SensorBus), PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (mem == MAP_FAILED) {
+        throw "Could not map bus";
+    }
+    bus = (const SensorBus *) mem;
+    if (bus->magic.load(std::memory_order_acquire) != SENSOR_BUS_MAGIC ||
+            bus->size != sizeof(SensorBus)) {
+        munmap(mem, sizeof(SensorBus));
+        throw "Bus is not ready or was made by another version";
+    }
+}
+
+/* Destructor */
+BusBackend::~BusBackend() {
+    munmap((void *) bus, sizeof(SensorBus));
+}
+
+void BusBackend::open_imu(void) {
+    if (!(bus->flags & SENSE_HAT_IMU)) {
+        throw "No IMU found";
+    }
+}
+
+void BusBackend::open_pressure(void) {
+    if (!(bus->flags & SENSE_HAT_PRESSURE)) {
+        throw "No pressure sensor found";
+    }
+}
+
+void BusBackend::open_humidity(void) {
+    if (!(bus->flags & SENSE_HAT_HUMIDITY)) {
+        throw "No humidity sensor found";
+    }
+}
+
+bool BusBackend::imu_init(void) {
+    return true;
+}
+
+int BusBackend::imu_poll_interval_us(void) {
+    return bus->imu_poll_interval_us;
+}
+
+/* Newest IMU reading on the bus. Wrapper reads whole frames from the bus
+ * instead, this is only here to complete the backend */
+bool BusBackend::imu_read(RTIMU_DATA &data) {
+    imu_frame frame;
+    if (!bus->imu_fresh() || !bus->imu.latest(frame)) {
+        return false;
+    }
+    data = frame.data;
+    return true;
+}
+
+/* The publisher owns the IMU configuration */
+void BusBackend::set_imu_config(bool, bool, bool) {}
+
+bool BusBackend::pressure_init(void) {
+    return true;
+}
+
+/* The pressure and humidity reads of one read_environment share a sample
+ * from the bus, the next one is taken when a chip is read a second time.
+ * False if there is none, or the publisher is gone */
+bool BusBackend::take_environment(bool &taken) {
+    if (taken) {
+        environment_valid = bus->publishing() && bus->environment.latest(environment);
+        pressure_taken = false;
+        humidity_taken = false;
+    }
+    taken = true;
+    return environment_valid;
+}
+
+bool BusBackend::pressure_read(RTIMU_DATA &data) {
+    if (!take_environment(pressure_taken)) {
+        return false;
+    }
+    data.timestamp = environment.timestamp;
+    data.pressureValid = environment.pressure_valid == TRUE;
+    data.pressure = environment.pressure;
+    data.temperatureValid = environment.temperature_from_pressure_valid == TRUE;
+    data.temperature = environment.temperature_from_pressure;
+    return true;
+}
+
+bool BusBackend::humidity_init(void) {
+    return true;
+}
+
+bool BusBackend::humidity_read(RTIMU_DATA &data) {
+    if (!take_environment(humidity_taken)) {
+        return false;
+    }
+    data.timestamp = environment.timestamp;
+    data.humidityValid = environment.humidity_valid == TRUE;
+    data.humidity = environment.humidity;
+    data.temperatureValid = environment.temperature_from_humidity_valid == TRUE;
+    data.temperature = environment.temperature_from_humidity;
+    return true;
+}
+
+/* Time the publisher took the environment sample last read */
+uint64_t BusBackend::environment_time(void) {
+    return environment.timestamp;
+}
+
+const SensorBus * BusBackend::shared_bus(void) {
+    return bus;
+}
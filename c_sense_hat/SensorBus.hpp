@@ -0,0 +1,94 @@
+#ifndef SENSOR_BUS_HPP
+#define SENSOR_BUS_HPP
+
+#include "SenseHatSensors.hpp"
+
+#include "atomic"
+
+// Samples kept on the bus, about a second of IMU data at 200 Hz
+#define BUS_IMU_SLOTS 256
+#define BUS_ENV_SLOTS 16
+#define SENSOR_BUS_MAGIC 0x53484231     // "SHB1"
+// Tries to open a bus that is removed while it is being opened
+#define BUS_OPEN_ATTEMPTS 8
+// A publisher that wrote nothing for this many IMU poll intervals, and at
+// least BUS_STALE_MIN_MS, is taken to be gone
+#define BUS_STALE_POLLS 4
+#define BUS_STALE_MIN_MS 100
+
+// The rings are shared between processes, which only works if their
+// atomics are lock free
+static_assert(ATOMIC_LLONG_LOCK_FREE == 2, "The sensor bus needs lock free 64 bit atomics");
+
+/* Layout of the POSIX shared memory object a publishing process writes its
+ * readings to.
+ *
+ * The publisher is the only writer. Clients map the object read only and
+ * read the rings like any other SampleRing reader, so a read is a couple
+ * of memory loads and never waits for the publisher or the I2C bus. The
+ * IMU frames already hold the pose of every fusion pipeline, clients do no
+ * fusion of their own.
+ *
+ * The publisher stamps the bus every round of its sampler, and clears the
+ * stamp when it closes the bus, so clients can tell a bus that is left
+ * behind from a quiet one. */
+struct SensorBus {
+    SensorBus() : magic(0), size(sizeof(SensorBus)), flags(0), imu_poll_interval_us(0), alive(0), imu_time(0) {}
+    std::atomic<uint32_t> magic;    // Set last, once the rest is ready
+    uint32_t size;                  // Catches clients built with another layout
+    uint32_t flags;                 // Subsystems of the publisher (SENSE_HAT_IMU, ...)
+    int32_t imu_poll_interval_us;
+    std::atomic<uint64_t> alive;    // monotonic_ns of the last sampler round, 0 once closed
+    std::atomic<uint64_t> imu_time; // monotonic_ns the newest IMU frame was pushed at
+    SampleRing<imu_frame, BUS_IMU_SLOTS> imu;
+    SampleRing<EnvironmentSample, BUS_ENV_SLOTS> environment;
+
+    /* True if the publisher is still running */
+    bool publishing(void) const {
+        return recent(alive.load(std::memory_order_acquire));
+    }
+
+    /* True if the newest IMU frame is no older than a few poll intervals */
+    bool imu_fresh(void) const {
+        return alive.load(std::memory_order_acquire) != 0 && recent(imu_time.load(std::memory_order_acquire));
+    }
+private:
+    // Load the time before calling, monotonic_ns must be read after it
+    bool recent(uint64_t time) const {
+        uint64_t stale = std::max<uint64_t>(BUS_STALE_POLLS * (uint64_t) imu_poll_interval_us * 1000,
+                BUS_STALE_MIN_MS * 1000000ull);
+        return time != 0 && monotonic_ns() - time <= stale;
+    }
+};
+
+SensorBus * create_bus(const char *, unsigned int, int, int &);
+void close_bus(SensorBus *, const char *, int);
+
+/* Backend of a client process, reading what a publisher put on the bus */
+class BusBackend : public SensorBackend {
+public:
+    BusBackend(const char *);
+    ~BusBackend();
+    void open_imu(void);
+    void open_pressure(void);
+    void open_humidity(void);
+    bool imu_init(void);
+    int imu_poll_interval_us(void);
+    bool imu_read(RTIMU_DATA &);
+    void set_imu_config(bool, bool, bool);
+    bool pressure_init(void);
+    bool pressure_read(RTIMU_DATA &);
+    bool humidity_init(void);
+    bool humidity_read(RTIMU_DATA &);
+    uint64_t environment_time(void);
+    const SensorBus * shared_bus(void);
+private:
+    bool take_environment(bool &);
+    const SensorBus *bus;
+    EnvironmentSample environment;  // Last sample read from the bus
+    bool environment_valid;
+    bool pressure_taken;            // The chip was read from environment
+    bool humidity_taken;
+};
+
+#endif /* SENSOR_BUS_HPP */
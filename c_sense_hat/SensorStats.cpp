@@ -0,0 +1,223 @@
+#include "SensorStats.hpp"
+
+#include "algorithm"
+#include "chrono"
+
+// Names used in the dump, indexed by SenseHatCall
+static const char * const call_names[STATS_CALLS] = {
+    "read_imu",
+    "get_humidity",
+    "get_pressure",
+    "get_temperature_from_humidity",
+    "get_temperature_from_pressure",
+    "get_temperature",
+    "get_environment",
+    "get_orientation_radians",
+    "get_orientation_degrees",
+    "get_orientation",
+    "get_compass",
+    "get_compass_raw",
+    "get_gyroscope",
+    "get_gyroscope_raw",
+    "get_accelerometer",
+    "get_accelerometer_raw",
+    "get_imu_sample",
+    "set_imu_config",
+    "set_pixel",
+    "set_pixels",
+    "set_image",
+    "set_image_rgb888",
+    "set_image_rgba",
+    "clear",
+    "commit_frame",
+};
+
+/***** Histogram *****/
+
+void LatencyHistogram::reset(void) {
+    for (size_t i = 0; i < HISTOGRAM_BUCKETS; i++) {
+        counts[i].store(0, std::memory_order_relaxed);
+    }
+    count.store(0, std::memory_order_relaxed);
+    failures.store(0, std::memory_order_relaxed);
+    total.store(0, std::memory_order_relaxed);
+    max.store(0, std::memory_order_relaxed);
+}
+
+/* Largest value that falls into bucket i */
+uint64_t LatencyHistogram::highest_in(size_t i) {
+    if (i < HISTOGRAM_SUB_BUCKETS) {
+        return i;
+    }
+    int shift = (int) (i / HISTOGRAM_SUB_BUCKETS) - 1;
+    uint64_t lowest = (uint64_t) (HISTOGRAM_SUB_BUCKETS + i % HISTOGRAM_SUB_BUCKETS) << shift;
+    return lowest + (1ull << shift) - 1;
+}
+
+/* Value at or below which fraction of the n recorded values fall */
+uint64_t LatencyHistogram::percentile(uint64_t n, double fraction) const {
+    uint64_t rank = (uint64_t) (fraction * n + 0.5);
+    if (rank == 0) {
+        rank = 1;
+    }
+    uint64_t seen = 0;
+    for (size_t i = 0; i < HISTOGRAM_BUCKETS; i++) {
+        seen += counts[i].load(std::memory_order_relaxed);
+        if (seen >= rank) {
+            return highest_in(i);
+        }
+    }
+    return highest_in(HISTOGRAM_BUCKETS - 1);
+}
+
+/* Copies the histogram out. Calls recorded during the copy may or may not
+ * be included */
+void LatencyHistogram::snapshot(LatencyStats &stats) const {
+    uint64_t n = 0;
+    for (size_t i = 0; i < HISTOGRAM_BUCKETS; i++) {
+        n += counts[i].load(std::memory_order_relaxed);
+    }
+    stats.count = n;
+    stats.failures = failures.load(std::memory_order_relaxed);
+    stats.total_ns = total.load(std::memory_order_relaxed);
+    stats.max_ns = max.load(std::memory_order_relaxed);
+    if (n == 0) {
+        stats.p50_ns = stats.p90_ns = stats.p99_ns = stats.p999_ns = 0;
+        return;
+    }
+    // Bucket bounds may lie above the largest value actually seen
+    stats.p50_ns = std::min(percentile(n, 0.50), stats.max_ns);
+    stats.p90_ns = std::min(percentile(n, 0.90), stats.max_ns);
+    stats.p99_ns = std::min(percentile(n, 0.99), stats.max_ns);
+    stats.p999_ns = std::min(percentile(n, 0.999), stats.max_ns);
+}
+
+/***** Counters *****/
+
+/* Constructor */
+SensorStats::SensorStats() {
+    dumping = false;
+    dump_file = NULL;
+    dump_interval = 0;
+    reset();
+}
+
+/* Destructor */
+SensorStats::~SensorStats() {
+    stop_dump();
+}
+
+void SensorStats::reset(void) {
+    for (int i = 0; i < STATS_CALLS; i++) {
+        calls[i].reset();
+    }
+    imu_reads = 0;
+    imu_retries = 0;
+    imu_read_failures = 0;
+    imu_sleep_ns = 0;
+    invalid_fusion = 0;
+    invalid_compass = 0;
+    invalid_gyro = 0;
+    invalid_accel = 0;
+    invalid_humidity = 0;
+    invalid_pressure = 0;
+    invalid_temperature = 0;
+}
+
+void SensorStats::snapshot(SenseHatStats &stats) const {
+    stats.failures = 0;
+    for (int i = 0; i < STATS_CALLS; i++) {
+        calls[i].snapshot(stats.calls[i]);
+        stats.failures += stats.calls[i].failures;
+    }
+    stats.imu_reads = imu_reads;
+    stats.imu_retries = imu_retries;
+    stats.imu_read_failures = imu_read_failures;
+    stats.imu_sleep_ns = imu_sleep_ns;
+    stats.invalid_fusion = invalid_fusion;
+    stats.invalid_compass = invalid_compass;
+    stats.invalid_gyro = invalid_gyro;
+    stats.invalid_accel = invalid_accel;
+    stats.invalid_humidity = invalid_humidity;
+    stats.invalid_pressure = invalid_pressure;
+    stats.invalid_temperature = invalid_temperature;
+}
+
+/* Writes a snapshot as one line of JSON. Functions that were never called
+ * are left out */
+void SensorStats::write(FILE *file) const {
+    SenseHatStats stats;
+    snapshot(stats);
+    fprintf(file, "{\"time_ns\": %llu, \"imu_reads\": %llu, \"imu_retries\": %llu, "
+            "\"imu_read_failures\": %llu, \"imu_sleep_ns\": %llu, \"invalid_fusion\": %llu, "
+            "\"invalid_compass\": %llu, \"invalid_gyro\": %llu, \"invalid_accel\": %llu, "
+            "\"invalid_humidity\": %llu, \"invalid_pressure\": %llu, \"invalid_temperature\": %llu, "
+            "\"failures\": %llu, \"calls\": {",
+            (unsigned long long) monotonic_ns(),
+            (unsigned long long) stats.imu_reads, (unsigned long long) stats.imu_retries,
+            (unsigned long long) stats.imu_read_failures, (unsigned long long) stats.imu_sleep_ns,
+            (unsigned long long) stats.invalid_fusion, (unsigned long long) stats.invalid_compass,
+            (unsigned long long) stats.invalid_gyro, (unsigned long long) stats.invalid_accel,
+            (unsigned long long) stats.invalid_humidity, (unsigned long long) stats.invalid_pressure,
+            (unsigned long long) stats.invalid_temperature, (unsigned long long) stats.failures);
+    bool first = true;
+    for (int i = 0; i < STATS_CALLS; i++) {
+        const LatencyStats &call = stats.calls[i];
+        if (call.count == 0) {
+            continue;
+        }
+        fprintf(file, "%s\"%s\": {\"count\": %llu, \"failures\": %llu, \"total_ns\": %llu, "
+                "\"p50_ns\": %llu, \"p90_ns\": %llu, \"p99_ns\": %llu, \"p999_ns\": %llu, \"max_ns\": %llu}",
+                first ? "" : ", ", call_names[i],
+                (unsigned long long) call.count, (unsigned long long) call.failures,
+                (unsigned long long) call.total_ns, (unsigned long long) call.p50_ns,
+                (unsigned long long) call.p90_ns, (unsigned long long) call.p99_ns,
+                (unsigned long long) call.p999_ns, (unsigned long long) call.max_ns);
+        first = false;
+    }
+    fprintf(file, "}}\n");
+    fflush(file);
+}
+
+/* Appends a snapshot to the file at path (stderr if NULL) every
+ * interval_ms milliseconds until stop_dump. Replaces a running dump */
+void SensorStats::start_dump(const char *path, uint32_t interval_ms) {
+    stop_dump();
+    FILE *file = path ? fopen(path, "a") : stderr;
+    if (!file) {
+        throw "Could not open stats file";
+    }
+    std::lock_guard<std::mutex> guard(dump_lock);
+    dump_file = file;
+    dump_interval = interval_ms * 1000000ull;
+    dumping = true;
+    dumper = std::thread(&SensorStats::dump, this);
+}
+
+void SensorStats::stop_dump(void) {
+    {
+        std::lock_guard<std::mutex> guard(dump_lock);
+        if (!dumping) {
+            return;
+        }
+        dumping = false;
+    }
+    dump_wake.notify_one();
+    dumper.join();
+    if (dump_file != stderr) {
+        fclose(dump_file);
+    }
+    dump_file = NULL;
+}
+
+/* Body of the dump thread */
+void SensorStats::dump(void) {
+    std::unique_lock<std::mutex> guard(dump_lock);
+    std::chrono::steady_clock::time_point next = std::chrono::steady_clock::now();
+    while (dumping) {
+        next += std::chrono::nanoseconds(dump_interval);
+        if (!dump_wake.wait_until(guard, next, [this] { return !dumping; })) {
+            write(dump_file);
+        }
+    }
+}
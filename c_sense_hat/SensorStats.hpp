@@ -0,0 +1,129 @@
+#ifndef SENSOR_STATS_HPP
+#define SENSOR_STATS_HPP
+
+#include "PollScheduler.hpp"
+
+extern "C" {
+    #include "SenseHatSensors.h"
+}
+
+#include "atomic"
+#include "condition_variable"
+#include "mutex"
+#include "thread"
+
+#include "stdio.h"
+
+// Linear sub-buckets per power of two, sets the resolution to 1/16
+#define HISTOGRAM_SUB_BITS 4
+#define HISTOGRAM_SUB_BUCKETS (1 << HISTOGRAM_SUB_BITS)
+// Latencies from 2^36 ns (about 69 s) up share the last bucket
+#define HISTOGRAM_MAX_BIT 36
+#define HISTOGRAM_BUCKETS (HISTOGRAM_SUB_BUCKETS * (HISTOGRAM_MAX_BIT - HISTOGRAM_SUB_BITS + 2))
+
+/* Latency histogram in the style of HdrHistogram.
+ *
+ * Values below 16 ns get a bucket each, above that every power of two is
+ * split into 16 equal buckets, so a bucket is never wider than 1/16 of its
+ * values. Recording is a few relaxed atomic adds and never allocates or
+ * locks, so any thread may record while another one reads. */
+class LatencyHistogram {
+public:
+    LatencyHistogram() {
+        reset();
+    }
+
+    void record(uint64_t ns, bool failed) {
+        counts[bucket(ns)].fetch_add(1, std::memory_order_relaxed);
+        count.fetch_add(1, std::memory_order_relaxed);
+        total.fetch_add(ns, std::memory_order_relaxed);
+        if (failed) {
+            failures.fetch_add(1, std::memory_order_relaxed);
+        }
+        uint64_t old = max.load(std::memory_order_relaxed);
+        while (ns > old && !max.compare_exchange_weak(old, ns, std::memory_order_relaxed)) {}
+    }
+
+    void reset(void);
+    void snapshot(LatencyStats &) const;
+
+private:
+    static size_t bucket(uint64_t ns) {
+        if (ns < HISTOGRAM_SUB_BUCKETS) {
+            return (size_t) ns;
+        }
+        int msb = 63 - __builtin_clzll(ns);
+        if (msb > HISTOGRAM_MAX_BIT) {
+            return HISTOGRAM_BUCKETS - 1;
+        }
+        int shift = msb - HISTOGRAM_SUB_BITS;
+        return HISTOGRAM_SUB_BUCKETS * (shift + 1) + ((ns >> shift) & (HISTOGRAM_SUB_BUCKETS - 1));
+    }
+    static uint64_t highest_in(size_t);
+    uint64_t percentile(uint64_t, double) const;
+    std::atomic<uint32_t> counts[HISTOGRAM_BUCKETS];
+    std::atomic<uint64_t> count;
+    std::atomic<uint64_t> failures;
+    std::atomic<uint64_t> total;
+    std::atomic<uint64_t> max;
+};
+
+/* Every counter behind get_stats, plus the thread that dumps them */
+class SensorStats {
+public:
+    SensorStats();
+    ~SensorStats();
+    void reset(void);
+    void snapshot(SenseHatStats &) const;
+    void write(FILE *) const;
+    void start_dump(const char *, uint32_t);
+    void stop_dump(void);
+
+    static void add(std::atomic<uint64_t> &counter, uint64_t n = 1) {
+        counter.fetch_add(n, std::memory_order_relaxed);
+    }
+
+    LatencyHistogram calls[STATS_CALLS];
+    std::atomic<uint64_t> imu_reads;
+    std::atomic<uint64_t> imu_retries;
+    std::atomic<uint64_t> imu_read_failures;
+    std::atomic<uint64_t> imu_sleep_ns;
+    std::atomic<uint64_t> invalid_fusion;
+    std::atomic<uint64_t> invalid_compass;
+    std::atomic<uint64_t> invalid_gyro;
+    std::atomic<uint64_t> invalid_accel;
+    std::atomic<uint64_t> invalid_humidity;
+    std::atomic<uint64_t> invalid_pressure;
+    std::atomic<uint64_t> invalid_temperature;
+private:
+    void dump(void);
+    std::thread dumper;
+    std::mutex dump_lock;
+    std::condition_variable dump_wake;
+    bool dumping;
+    FILE *dump_file;
+    uint64_t dump_interval;         // Nanoseconds
+};
+
+/* Times one call into the histogram of the given function */
+class CallTimer {
+public:
+    CallTimer(LatencyHistogram &histogram) noexcept
+        : target(histogram), begin(monotonic_ns()), failed(false) {}
+    ~CallTimer() {
+        target.record(monotonic_ns() - begin, failed);
+    }
+
+    /* Notes the outcome of the call and passes the status on. Only errors
+     * count as failed, a call without a valid reading still worked */
+    SenseHatStatus done(SenseHatStatus status) noexcept {
+        failed = status != SENSE_HAT_OK && status != SENSE_HAT_NO_DATA;
+        return status;
+    }
+private:
+    LatencyHistogram &target;
+    uint64_t begin;
+    bool failed;
+};
+
+#endif /* SENSOR_STATS_HPP */
@@ -0,0 +1,64 @@
+#ifndef SEQLOCK_HPP
+#define SEQLOCK_HPP
+
+#include "atomic"
+#include "cstdint"
+
+/* A single value that many threads may read while others replace it.
+ *
+ * Readers never take a lock: they copy the value and retry if the
+ * sequence number changed during the copy, so a reader only ever waits for
+ * another thread's copy of T, never for I/O. Writers take turns on the
+ * sequence number itself (odd while writing). T must be trivially
+ * copyable. */
+template <typename T>
+class Seqlock {
+public:
+    Seqlock() : seq(0), value() {}
+
+    /* Returns a consistent copy of the value */
+    T load(void) const {
+        T copy;
+        uint64_t before;
+        do {
+            before = seq.load(std::memory_order_acquire);
+            copy = value;
+            std::atomic_thread_fence(std::memory_order_acquire);
+        } while ((before & 1) || seq.load(std::memory_order_relaxed) != before);
+        return copy;
+    }
+
+    void store(const T &next) {
+        uint64_t before = lock();
+        value = next;
+        seq.store(before + 2, std::memory_order_release);
+    }
+
+    /* Replaces the value with update(value). Writers are serialised, so no
+     * update is lost */
+    template <typename F>
+    void update(F update) {
+        uint64_t before = lock();
+        T next = value;
+        update(next);
+        value = next;
+        seq.store(before + 2, std::memory_order_release);
+    }
+
+private:
+    // Makes the sequence number odd, returns the even number it had
+    uint64_t lock(void) {
+        uint64_t before = seq.load(std::memory_order_relaxed);
+        while ((before & 1) || !seq.compare_exchange_weak(before, before + 1,
+                    std::memory_order_acquire, std::memory_order_relaxed)) {
+            before = seq.load(std::memory_order_relaxed);
+        }
+        std::atomic_thread_fence(std::memory_order_release);
+        return before;
+    }
+
+    std::atomic<uint64_t> seq;
+    T value;
+};
+
+#endif /* SEQLOCK_HPP */
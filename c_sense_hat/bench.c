@@ -0,0 +1,272 @@
+#define _POSIX_C_SOURCE 200809L
+#include "SenseHatSensors.h"
+#include "math.h"
+#include "stdio.h"
+#include "stdlib.h"
+#include "string.h"
+#include "time.h"
+
+/* Micro benchmark of the C API.
+ *
+ * Runs against the synthetic replay backend and a file backed framebuffer,
+ * so it works on any Linux machine. Every function is called a number of
+ * times, each call is timed on its own and the latency distribution and
+ * throughput are written as JSON, one object per function.
+ *
+ * Usage: bench [iterations] [output file] */
+
+#define DEFAULT_ITERATIONS 10000
+#define BENCH_FB "/tmp/sense_hat_bench_fb"
+
+static volatile float sink; // Keeps results from being optimised away
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static void b_get_humidity(SenseHatSensors *s) { sink = get_humidity(s); }
+static void b_get_pressure(SenseHatSensors *s) { sink = get_pressure(s); }
+static void b_get_temperature_from_humidity(SenseHatSensors *s) { sink = get_temperature_from_humidity(s); }
+static void b_get_temperature_from_pressure(SenseHatSensors *s) { sink = get_temperature_from_pressure(s); }
+static void b_get_temperature(SenseHatSensors *s) { sink = get_temperature(s); }
+static void b_get_orientation_radians(SenseHatSensors *s) { sink = get_orientation_radians(s).yaw; }
+static void b_get_orientation_degrees(SenseHatSensors *s) { sink = get_orientation_degrees(s).yaw; }
+static void b_get_orientation(SenseHatSensors *s) { sink = get_orientation(s).yaw; }
+static void b_get_compass(SenseHatSensors *s) { sink = get_compass(s); }
+static void b_get_compass_raw(SenseHatSensors *s) { sink = get_compass_raw(s).x; }
+static void b_get_gyroscope(SenseHatSensors *s) { sink = get_gyroscope(s).yaw; }
+static void b_get_gyroscope_raw(SenseHatSensors *s) { sink = get_gyroscope_raw(s).x; }
+static void b_get_accelerometer(SenseHatSensors *s) { sink = get_accelerometer(s).yaw; }
+static void b_get_accelerometer_raw(SenseHatSensors *s) { sink = get_accelerometer_raw(s).x; }
+static void b_get_imu_sample(SenseHatSensors *s) { sink = get_imu_sample(s).accel.z; }
+static void b_get_environment(SenseHatSensors *s) { sink = get_environment(s, 0).pressure; }
+static void b_peek_imu_sample(SenseHatSensors *s) { sink = peek_imu_sample(s).accel.z; }
+static void b_peek_environment(SenseHatSensors *s) { sink = peek_environment(s).pressure; }
+static void b_get_window_stats(SenseHatSensors *s) { sink = get_window_stats(s, CHANNEL_ACCEL_MAGNITUDE).mean; }
+// The same read on a second instance with 100 rules on the accelerometer,
+// none of which fire, against the one rule of the first
+static SenseHatSensors *ruled;
+static void b_get_imu_sample_rules(SenseHatSensors *s) {
+    (void) s;
+    sink = get_imu_sample(ruled).accel.z;
+}
+// Bulk conversions, over a buffer of 1024 samples per call
+#define BULK 1024
+static Orientation bulk_pose[BULK];
+static Quaternion bulk_quaternion[BULK];
+static Coordinates bulk_vector[BULK];
+static float bulk_length[BULK];
+static void b_radians_to_degrees(SenseHatSensors *s) {
+    (void) s;
+    radians_to_degrees(bulk_pose, bulk_pose, BULK);
+    degrees_to_radians(bulk_pose, bulk_pose, BULK);
+    sink = bulk_pose[0].yaw;
+}
+static void b_quaternions_to_euler(SenseHatSensors *s) {
+    (void) s;
+    quaternions_to_euler(bulk_quaternion, bulk_pose, BULK);
+    sink = bulk_pose[0].yaw;
+}
+static void b_magnitudes(SenseHatSensors *s) {
+    (void) s;
+    magnitudes(bulk_vector, bulk_length, BULK);
+    sink = bulk_length[0];
+}
+// The same calls made by a script, and a loop of plain arithmetic
+static const char *bench_script =
+    "def humidity_() { return humidity() }\n"
+    "def set_pixel_() { return set_pixel(0xF800, 3, 4) }\n"
+    "def sum(n) { var s = 0; var i = 0; while i < n { s += i * 0.5; i += 1 } return s }\n";
+static SenseHatScript *script;
+static int script_humidity, script_set_pixel, script_sum;
+static void b_script_humidity(SenseHatSensors *s) {
+    double result;
+    (void) s;
+    script_call(script, script_humidity, NULL, 0, &result);
+    sink = (float) result;
+}
+static void b_script_set_pixel(SenseHatSensors *s) {
+    double result;
+    (void) s;
+    script_call(script, script_set_pixel, NULL, 0, &result);
+    sink = (float) result;
+}
+static void b_script_sum(SenseHatSensors *s) {
+    double n = 1000, result;
+    (void) s;
+    script_call(script, script_sum, &n, 1, &result);
+    sink = (float) result;
+}
+static void b_try_get_humidity(SenseHatSensors *s) {
+    float humidity;
+    try_get_humidity(s, &humidity);
+    sink = humidity;
+}
+static void b_try_get_orientation(SenseHatSensors *s) {
+    Orientation orientation;
+    try_get_orientation(s, &orientation);
+    sink = orientation.yaw;
+}
+static void b_set_imu_config(SenseHatSensors *s) { set_imu_config(s, TRUE, TRUE, TRUE); }
+static void b_set_pixel(SenseHatSensors *s) { set_pixel(s, 0xF800, 3, 4); }
+static void b_set_pixel_out_of_range(SenseHatSensors *s) { set_pixel(s, 0xF800, 8, 4); }
+static void b_try_set_pixel(SenseHatSensors *s) { try_set_pixel(s, 0xF800, 3, 4); }
+static void b_set_pixels(SenseHatSensors *s) { set_pixels(s, 0x07E0); }
+static void b_set_image(SenseHatSensors *s) {
+    static uint16_t image[64];
+    set_image(s, image);
+}
+static void b_set_image_rgb888(SenseHatSensors *s) {
+    static uint8_t image[192];
+    set_image_rgb888(s, image);
+}
+static void b_clear(SenseHatSensors *s) { clear(s); }
+static void b_frame(SenseHatSensors *s) {
+    begin_frame(s);
+    set_pixel(s, 0x001F, 1, 1);
+    commit_frame(s);
+}
+
+typedef struct bench {
+    const char *name;
+    void (*call)(SenseHatSensors *);
+} bench;
+
+static const bench benches[] = {
+    {"get_humidity", b_get_humidity},
+    {"get_pressure", b_get_pressure},
+    {"get_temperature_from_humidity", b_get_temperature_from_humidity},
+    {"get_temperature_from_pressure", b_get_temperature_from_pressure},
+    {"get_temperature", b_get_temperature},
+    {"get_environment", b_get_environment},
+    {"get_orientation_radians", b_get_orientation_radians},
+    {"get_orientation_degrees", b_get_orientation_degrees},
+    {"get_orientation", b_get_orientation},
+    {"get_compass", b_get_compass},
+    {"get_compass_raw", b_get_compass_raw},
+    {"get_gyroscope", b_get_gyroscope},
+    {"get_gyroscope_raw", b_get_gyroscope_raw},
+    {"get_accelerometer", b_get_accelerometer},
+    {"get_accelerometer_raw", b_get_accelerometer_raw},
+    {"get_imu_sample", b_get_imu_sample},
+    {"peek_imu_sample", b_peek_imu_sample},
+    {"peek_environment", b_peek_environment},
+    {"get_window_stats", b_get_window_stats},
+    {"get_imu_sample 100 rules", b_get_imu_sample_rules},
+    {"radians_to_degrees+degrees_to_radians x1024", b_radians_to_degrees},
+    {"quaternions_to_euler x1024", b_quaternions_to_euler},
+    {"magnitudes x1024", b_magnitudes},
+    {"script humidity()", b_script_humidity},
+    {"script set_pixel()", b_script_set_pixel},
+    {"script loop x1000", b_script_sum},
+    {"try_get_humidity", b_try_get_humidity},
+    {"try_get_orientation", b_try_get_orientation},
+    {"set_imu_config", b_set_imu_config},
+    {"set_pixel", b_set_pixel},
+    {"set_pixel_out_of_range", b_set_pixel_out_of_range},
+    {"try_set_pixel", b_try_set_pixel},
+    {"set_pixels", b_set_pixels},
+    {"set_image", b_set_image},
+    {"set_image_rgb888", b_set_image_rgb888},
+    {"clear", b_clear},
+    {"begin_frame+commit_frame", b_frame},
+};
+
+static int compare_u64(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *) a;
+    uint64_t y = *(const uint64_t *) b;
+    return (x > y) - (x < y);
+}
+
+/* Value below which the given fraction of the sorted samples fall */
+static uint64_t percentile(const uint64_t *sorted, size_t count, double fraction) {
+    size_t i = (size_t) (fraction * (count - 1) + 0.5);
+    return sorted[i];
+}
+
+int main(int argc, char **argv) {
+    size_t iterations = argc > 1 ? (size_t) strtoul(argv[1], NULL, 10) : DEFAULT_ITERATIONS;
+    FILE *out = argc > 2 ? fopen(argv[2], "w") : stdout;
+    if (iterations == 0 || out == NULL) {
+        fprintf(stderr, "usage: %s [iterations] [output file]\n", argv[0]);
+        return 1;
+    }
+
+    SenseHatSensors *sense = SenseHatSensors_new_replay(NULL, 0, BENCH_FB, SENSE_HAT_ALL);
+    uint64_t *samples = malloc(iterations * sizeof(uint64_t));
+    if (sense == NULL || samples == NULL) {
+        fprintf(stderr, "Could not set up the benchmark\n");
+        return 1;
+    }
+    for (size_t i = 0; i < BULK; i++) {
+        float a = 0.001f * i;
+        bulk_quaternion[i].w = cosf(a);
+        bulk_quaternion[i].x = sinf(a);
+        bulk_vector[i].x = a;
+        bulk_vector[i].y = 1.0f;
+        bulk_vector[i].z = -a;
+    }
+    script = script_load(sense, bench_script, NULL, 0);
+    if (script == NULL) {
+        fprintf(stderr, "Could not load the benchmark script\n");
+        return 1;
+    }
+    script_humidity = script_function(script, "humidity_");
+    script_set_pixel = script_function(script, "set_pixel_");
+    script_sum = script_function(script, "sum");
+    // Also makes every IMU read pay for updating a rolling window
+    watch_channel(sense, CHANNEL_ACCEL_MAGNITUDE, 1000, 100);
+    // And checking a rule
+    SensorRule rule = {CHANNEL_ACCEL_MAGNITUDE, RULE_ABOVE, 16.0f, 0.0f, 0};
+    add_rule(sense, &rule);
+    ruled = SenseHatSensors_new_replay(NULL, 0, BENCH_FB, SENSE_HAT_IMU);
+    if (ruled == NULL) {
+        fprintf(stderr, "Could not set up the benchmark\n");
+        return 1;
+    }
+    watch_channel(ruled, CHANNEL_ACCEL_MAGNITUDE, 1000, 100);
+    for (int i = 0; i < 100; i++) {
+        rule.channel = CHANNEL_ACCEL_X + i % 4;
+        rule.kind = i % 3;
+        // Past the 16 g range of the accelerometer either way, so none fire
+        rule.threshold = rule.kind == RULE_BELOW ? -16.0f : 16.0f;
+        add_rule(ruled, &rule);
+    }
+
+    size_t count = sizeof(benches) / sizeof(benches[0]);
+    fprintf(out, "[\n");
+    for (size_t b = 0; b < count; b++) {
+        // Warm up caches and lazy initialisation
+        for (size_t i = 0; i < 100; i++) {
+            benches[b].call(sense);
+        }
+        uint64_t start = now_ns();
+        for (size_t i = 0; i < iterations; i++) {
+            uint64_t t0 = now_ns();
+            benches[b].call(sense);
+            samples[i] = now_ns() - t0;
+        }
+        uint64_t total = now_ns() - start;
+        qsort(samples, iterations, sizeof(uint64_t), compare_u64);
+
+        fprintf(out, "  {\"name\": \"%s\", \"iterations\": %zu, \"p50_ns\": %llu, \"p99_ns\": %llu, "
+                "\"max_ns\": %llu, \"calls_per_s\": %.0f}%s\n",
+                benches[b].name, iterations,
+                (unsigned long long) percentile(samples, iterations, 0.50),
+                (unsigned long long) percentile(samples, iterations, 0.99),
+                (unsigned long long) samples[iterations - 1],
+                iterations / (total / 1e9), b + 1 < count ? "," : "");
+    }
+    fprintf(out, "]\n");
+
+    free(samples);
+    script_delete(script);
+    SenseHatSensors_delete(ruled);
+    SenseHatSensors_delete(sense);
+    if (out != stdout) {
+        fclose(out);
+    }
+    return 0;
+}
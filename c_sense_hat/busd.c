@@ -0,0 +1,80 @@
+#define _POSIX_C_SOURCE 200809L
+#include "SenseHatSensors.h"
+#include "signal.h"
+#include "stdio.h"
+#include "stdlib.h"
+#include "unistd.h"
+
+/* Sensor daemon. Owns the Sense HAT sensors and publishes every reading on
+ * a shared memory bus, so any number of processes can read them with
+ * SenseHatSensors_attach without each one talking to the I2C bus and
+ * running its own fusion.
+ *
+ * Usage: busd [-n bus name] [-e environment interval ms] [-r trace | -s]
+ *   -r plays back a trace recorded with record_trace instead of the
+ *      hardware, -s plays a synthetic signal. Both run at 100 Hz. */
+
+#define REPLAY_RATE_HZ 100
+
+static volatile sig_atomic_t running = 1;
+
+static void stop(int sig) {
+    (void) sig;
+    running = 0;
+}
+
+int main(int argc, char **argv) {
+    const char *name = SENSE_HAT_BUS;
+    const char *trace = NULL;
+    int replay = 0;
+    uint32_t environment_ms = 1000;
+    int opt;
+    while ((opt = getopt(argc, argv, "n:e:r:s")) != -1) {
+        switch (opt) {
+        case 'n':
+            name = optarg;
+            break;
+        case 'e':
+            environment_ms = (uint32_t) strtoul(optarg, NULL, 10);
+            break;
+        case 'r':
+            trace = optarg;
+            replay = 1;
+            break;
+        case 's':
+            replay = 1;
+            break;
+        default:
+            fprintf(stderr, "usage: %s [-n bus name] [-e environment ms] [-r trace | -s]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    unsigned int sensors = SENSE_HAT_IMU | SENSE_HAT_PRESSURE | SENSE_HAT_HUMIDITY;
+    SenseHatSensors *sense = replay
+        ? SenseHatSensors_new_replay(trace, REPLAY_RATE_HZ, NULL, sensors)
+        : SenseHatSensors_new_with(sensors);
+    if (sense == NULL) {
+        fprintf(stderr, "Could not open the sensors\n");
+        return 1;
+    }
+    if (!publish_bus(sense, name, environment_ms)) {
+        fprintf(stderr, "Could not publish %s\n", name);
+        SenseHatSensors_delete(sense);
+        return 1;
+    }
+
+    struct sigaction action;
+    action.sa_handler = stop;
+    action.sa_flags = 0;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGINT, &action, NULL);
+    sigaction(SIGTERM, &action, NULL);
+    while (running) {
+        sleep(1);
+    }
+
+    stop_bus(sense);
+    SenseHatSensors_delete(sense);
+    return 0;
+}
@@ -0,0 +1,91 @@
+#define _POSIX_C_SOURCE 200809L
+#include "Capture.h"
+#include "stdio.h"
+#include "unistd.h"
+
+/* Converts capture segments written by start_capture to CSV on stdout.
+ *
+ * Usage: capture2csv [-e] segment...
+ *   Prints the IMU samples, or with -e the environment samples, of the
+ *   segments in the order given. Floats are printed with 9 significant
+ *   digits, which reads back to the same value. */
+
+// Blocks are copied or decompressed here
+static CaptureImuBlock imu_block;
+static CaptureEnvironmentBlock environment_block;
+
+static void print_imu(const CaptureImuBlock *block) {
+    for (uint32_t i = 0; i < block->header.count; i++) {
+        uint8_t valid = block->valid[i];
+        printf("%llu,%.9g,%.9g,%.9g,%.9g,%.9g,%.9g,%.9g,%.9g,%.9g,%.9g,%.9g,%.9g,%d,%d,%d,%d\n",
+            (unsigned long long) block->timestamp[i],
+            block->roll[i], block->pitch[i], block->yaw[i],
+            block->compass_x[i], block->compass_y[i], block->compass_z[i],
+            block->gyro_x[i], block->gyro_y[i], block->gyro_z[i],
+            block->accel_x[i], block->accel_y[i], block->accel_z[i],
+            !!(valid & CAPTURE_FUSION_VALID), !!(valid & CAPTURE_COMPASS_VALID),
+            !!(valid & CAPTURE_GYRO_VALID), !!(valid & CAPTURE_ACCEL_VALID));
+    }
+}
+
+static void print_environment(const CaptureEnvironmentBlock *block) {
+    for (uint32_t i = 0; i < block->header.count; i++) {
+        uint8_t valid = block->valid[i];
+        printf("%llu,%.9g,%.9g,%.9g,%.9g,%d,%d,%d,%d\n",
+            (unsigned long long) block->timestamp[i],
+            block->humidity[i], block->pressure[i],
+            block->temperature_from_humidity[i], block->temperature_from_pressure[i],
+            !!(valid & CAPTURE_HUMIDITY_VALID), !!(valid & CAPTURE_PRESSURE_VALID),
+            !!(valid & CAPTURE_TEMPERATURE_FROM_HUMIDITY_VALID),
+            !!(valid & CAPTURE_TEMPERATURE_FROM_PRESSURE_VALID));
+    }
+}
+
+int main(int argc, char **argv) {
+    int environment = 0;
+    int opt;
+    while ((opt = getopt(argc, argv, "e")) != -1) {
+        switch (opt) {
+        case 'e':
+            environment = 1;
+            break;
+        default:
+            fprintf(stderr, "usage: %s [-e] segment...\n", argv[0]);
+            return 1;
+        }
+    }
+    if (optind >= argc) {
+        fprintf(stderr, "usage: %s [-e] segment...\n", argv[0]);
+        return 1;
+    }
+
+    if (environment) {
+        printf("timestamp,humidity,pressure,temperature_from_humidity,temperature_from_pressure,"
+            "humidity_valid,pressure_valid,temperature_from_humidity_valid,temperature_from_pressure_valid\n");
+    } else {
+        printf("timestamp,roll,pitch,yaw,compass_x,compass_y,compass_z,gyro_x,gyro_y,gyro_z,"
+            "accel_x,accel_y,accel_z,fusion_valid,compass_valid,gyro_valid,accel_valid\n");
+    }
+    int status = 0;
+    for (int i = optind; i < argc; i++) {
+        CaptureSegment segment;
+        if (capture_open(&segment, argv[i]) != 0) {
+            fprintf(stderr, "%s: not a capture segment\n", argv[i]);
+            status = 1;
+            continue;
+        }
+        for (size_t n = 0; n < segment.blocks; n++) {
+            if (environment) {
+                if (capture_read_environment(&segment, n, &environment_block) == 0) {
+                    print_environment(&environment_block);
+                }
+            } else {
+                if (capture_read_imu(&segment, n, &imu_block) == 0) {
+                    print_imu(&imu_block);
+                }
+            }
+        }
+        capture_close(&segment);
+    }
+    return status;
+}
@@ -0,0 +1,174 @@
+#define _POSIX_C_SOURCE 200809L
+#include "Capture.h"
+#include "stdio.h"
+#include "stdlib.h"
+#include "string.h"
+#include "time.h"
+#include "unistd.h"
+
+/* Benchmark of the capture codec on recorded captures.
+ *
+ * Reads every block of the segments given, raw or compressed, then times
+ * compressing and decompressing them again and checks the round trip is
+ * exact. Writes one JSON object per sample kind with the compression
+ * ratio against the bare columns (timestamp, floats and valid byte of
+ * each sample), the throughput in samples and in bytes of those columns,
+ * and how many times faster than real time the samples decode.
+ *
+ * Usage: capturebench [-r repetitions] segment... */
+
+#define DEFAULT_REPETITIONS 20
+
+typedef struct kind_bench {
+    const char *name;
+    CaptureKind kind;
+    size_t block_size;          // sizeof the block struct
+    size_t sample_bytes;        // Bare columns of one sample
+    uint8_t *blocks;            // Decoded blocks, block_size apart
+    size_t count;
+    size_t capacity;
+} kind_bench;
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/* Room for one more block, NULL if out of memory */
+static CaptureBlockHeader * next_block(kind_bench *k) {
+    if (k->count == k->capacity) {
+        size_t capacity = k->capacity ? 2 * k->capacity : 16;
+        uint8_t *grown = realloc(k->blocks, capacity * k->block_size);
+        if (!grown) {
+            return NULL;
+        }
+        k->blocks = grown;
+        k->capacity = capacity;
+    }
+    return (CaptureBlockHeader *) (k->blocks + k->count * k->block_size);
+}
+
+static CaptureBlockHeader * block(const kind_bench *k, size_t n) {
+    return (CaptureBlockHeader *) (k->blocks + n * k->block_size);
+}
+
+static void run(const kind_bench *k, int repetitions, int last, FILE *out) {
+    size_t capacity = CAPTURE_BLOCK_BYTES;
+    uint8_t *packed = malloc(k->count * capacity);
+    size_t *sizes = malloc(k->count * sizeof(size_t));
+    CaptureBlockHeader *decoded = malloc(k->block_size);
+    if (!packed || !sizes || !decoded) {
+        fprintf(stderr, "Out of memory\n");
+        exit(1);
+    }
+
+    uint64_t samples = 0, packed_bytes = 0, duration = 0;
+    for (size_t n = 0; n < k->count; n++) {
+        const CaptureBlockHeader *b = block(k, n);
+        samples += b->count;
+        duration += b->last - b->first;
+    }
+
+    uint64_t start = now_ns();
+    for (int r = 0; r < repetitions; r++) {
+        for (size_t n = 0; n < k->count; n++) {
+            sizes[n] = capture_encode(block(k, n), packed + n * capacity, capacity);
+        }
+    }
+    uint64_t encode_ns = now_ns() - start;
+    for (size_t n = 0; n < k->count; n++) {
+        // A block that does not compress is stored raw
+        packed_bytes += sizeof(CaptureBlockHeader) +
+            (sizes[n] ? (sizes[n] + 7) / 8 * 8 : CAPTURE_BLOCK_BYTES - sizeof(CaptureBlockHeader));
+    }
+
+    size_t mismatches = 0;
+    start = now_ns();
+    for (int r = 0; r < repetitions; r++) {
+        for (size_t n = 0; n < k->count; n++) {
+            if (sizes[n] == 0) {
+                continue;
+            }
+            if (capture_decode(block(k, n), packed + n * capacity, sizes[n], decoded) != 0 ||
+                    (r == 0 && memcmp(decoded, block(k, n), k->block_size) != 0)) {
+                mismatches++;
+            }
+        }
+    }
+    uint64_t decode_ns = now_ns() - start;
+
+    double total = (double) samples * repetitions;
+    double bare = (double) samples * k->sample_bytes;
+    fprintf(out, "  {\"kind\": \"%s\", \"blocks\": %zu, \"samples\": %llu, \"bare_bytes\": %.0f, "
+            "\"compressed_bytes\": %llu, \"ratio\": %.2f, \"bits_per_sample\": %.1f, "
+            "\"encode_samples_per_s\": %.0f, \"encode_mb_per_s\": %.1f, "
+            "\"decode_samples_per_s\": %.0f, \"decode_mb_per_s\": %.1f, "
+            "\"decode_x_real_time\": %.0f, \"mismatches\": %zu}%s\n",
+            k->name, k->count, (unsigned long long) samples, bare,
+            (unsigned long long) packed_bytes, packed_bytes ? bare / packed_bytes : 0.0,
+            samples ? 8.0 * packed_bytes / samples : 0.0,
+            encode_ns ? total / (encode_ns / 1e9) : 0.0,
+            encode_ns ? total * k->sample_bytes / (encode_ns / 1e3) : 0.0,
+            decode_ns ? total / (decode_ns / 1e9) : 0.0,
+            decode_ns ? total * k->sample_bytes / (decode_ns / 1e3) : 0.0,
+            decode_ns ? (duration / 1e6) * repetitions / (decode_ns / 1e9) : 0.0,
+            mismatches, last ? "" : ",");
+    free(packed);
+    free(sizes);
+    free(decoded);
+}
+
+int main(int argc, char **argv) {
+    int repetitions = DEFAULT_REPETITIONS;
+    int opt;
+    while ((opt = getopt(argc, argv, "r:")) != -1) {
+        switch (opt) {
+        case 'r':
+            repetitions = atoi(optarg);
+            break;
+        default:
+            repetitions = 0;
+        }
+    }
+    if (repetitions <= 0 || optind >= argc) {
+        fprintf(stderr, "usage: %s [-r repetitions] segment...\n", argv[0]);
+        return 1;
+    }
+
+    kind_bench kinds[2] = {
+        {"imu", CAPTURE_IMU, sizeof(CaptureImuBlock), 8 + 12 * 4 + 1, NULL, 0, 0},
+        {"environment", CAPTURE_ENVIRONMENT, sizeof(CaptureEnvironmentBlock), 8 + 4 * 4 + 1, NULL, 0, 0},
+    };
+    for (int i = optind; i < argc; i++) {
+        CaptureSegment segment;
+        if (capture_open(&segment, argv[i]) != 0) {
+            fprintf(stderr, "%s: not a capture segment\n", argv[i]);
+            return 1;
+        }
+        for (size_t n = 0; n < segment.blocks; n++) {
+            for (int k = 0; k < 2; k++) {
+                CaptureBlockHeader *b = next_block(&kinds[k]);
+                if (!b) {
+                    fprintf(stderr, "Out of memory\n");
+                    return 1;
+                }
+                int read = kinds[k].kind == CAPTURE_IMU ?
+                    capture_read_imu(&segment, n, (CaptureImuBlock *) b) :
+                    capture_read_environment(&segment, n, (CaptureEnvironmentBlock *) b);
+                if (read == 0) {
+                    kinds[k].count++;
+                }
+            }
+        }
+        capture_close(&segment);
+    }
+
+    printf("[\n");
+    for (int k = 0; k < 2; k++) {
+        run(&kinds[k], repetitions, k == 1, stdout);
+        free(kinds[k].blocks);
+    }
+    printf("]\n");
+    return 0;
+}
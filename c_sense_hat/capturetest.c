@@ -0,0 +1,328 @@
+#define _POSIX_C_SOURCE 200809L
+#include "Capture.h"
+#include "stdio.h"
+#include "stdlib.h"
+#include "string.h"
+#include "unistd.h"
+
+/* Checks of the capture codec and reader.
+ *
+ * Segments are written to a temporary directory the way CaptureWriter
+ * writes them, then cut short or damaged, so it runs on any machine and
+ * needs nothing but the capture objects.
+ *
+ * Usage: capturetest */
+
+#define SEGMENT_BLOCKS 3
+
+static int failures = 0;
+
+// The blocks of every segment written, in order, as they were encoded
+static CaptureImuBlock imu_first;
+static CaptureEnvironmentBlock environment;
+static CaptureImuBlock imu_last;
+static CaptureBlockHeader *blocks[SEGMENT_BLOCKS] = {
+    &imu_first.header, &environment.header, &imu_last.header
+};
+// Where the blocks of the last segment written start, and the file size
+static CaptureIndexEntry entries[SEGMENT_BLOCKS];
+static long segment_end;
+
+static void check(int ok, const char *what) {
+    printf("%s: %s\n", ok ? "ok" : "FAILED", what);
+    if (!ok) {
+        failures++;
+    }
+}
+
+/* count IMU samples 10 ms apart from start, with a few invalid values */
+static void make_imu(CaptureImuBlock *b, uint32_t count, uint64_t start) {
+    memset(b, 0, sizeof(CaptureImuBlock));
+    b->header.magic = CAPTURE_BLOCK_MAGIC;
+    b->header.kind = CAPTURE_IMU;
+    b->header.count = count;
+    for (uint32_t i = 0; i < count; i++) {
+        // Jitter, so the delta-of-deltas are not all zero
+        b->timestamp[i] = start + i * 10000 + (i % 7) * 3;
+        b->roll[i] = 0.001f * i;
+        b->pitch[i] = -0.25f;
+        b->yaw[i] = 0.5f * (i % 13);
+        b->compass_x[i] = 20.0f + 0.01f * (i % 50);
+        b->compass_y[i] = -4.0f;
+        b->compass_z[i] = 41.5f - 0.02f * i;
+        b->gyro_x[i] = i % 2 ? 0.001f : -0.001f;
+        b->gyro_y[i] = 0.0f;
+        b->gyro_z[i] = 1e-6f * i;
+        b->accel_x[i] = 0.0f;
+        b->accel_y[i] = 0.0f;
+        b->accel_z[i] = 1.0f + (i % 3) * 0.0005f;
+        b->valid[i] = i % 50 == 0 ? CAPTURE_GYRO_VALID | CAPTURE_ACCEL_VALID : 0x0F;
+    }
+    b->header.first = b->timestamp[0];
+    b->header.last = b->timestamp[count - 1];
+}
+
+/* count environment samples one second apart from start */
+static void make_environment(CaptureEnvironmentBlock *b, uint32_t count, uint64_t start) {
+    memset(b, 0, sizeof(CaptureEnvironmentBlock));
+    b->header.magic = CAPTURE_BLOCK_MAGIC;
+    b->header.kind = CAPTURE_ENVIRONMENT;
+    b->header.count = count;
+    for (uint32_t i = 0; i < count; i++) {
+        b->timestamp[i] = start + i * 1000000;
+        b->humidity[i] = 40.0f + 0.1f * (i % 10);
+        b->pressure[i] = 1013.25f;
+        b->temperature_from_humidity[i] = 21.0f + 0.01f * i;
+        b->temperature_from_pressure[i] = 20.5f;
+        b->valid[i] = 0x0F;
+    }
+    b->header.first = b->timestamp[0];
+    b->header.last = b->timestamp[count - 1];
+}
+
+/* Bytes of the block structure of kind */
+static size_t block_size(uint32_t kind) {
+    return kind == CAPTURE_IMU ? sizeof(CaptureImuBlock) : sizeof(CaptureEnvironmentBlock);
+}
+
+/* True if the columns of a and b, blocks of the same kind, are equal */
+static int same_columns(const CaptureBlockHeader *a, const CaptureBlockHeader *b) {
+    return a->kind == b->kind && a->count == b->count && a->first == b->first && a->last == b->last &&
+        memcmp(a + 1, b + 1, block_size(a->kind) - sizeof(CaptureBlockHeader)) == 0;
+}
+
+/* Seals block with its CRC, compressed unless raw, and appends it to file
+ * like CaptureWriter does. Returns the bytes written, 0 if it could not */
+static size_t put_block(FILE *file, CaptureBlockHeader *block, uint32_t sequence, CaptureEncoding encoding) {
+    static uint8_t packed[CAPTURE_BLOCK_BYTES];
+    memset(packed, 0, sizeof(packed));
+    size_t total;
+    block->sequence = sequence;
+    block->encoding = encoding;
+    if (encoding == CAPTURE_COMPRESSED) {
+        size_t size = capture_encode(block, packed + sizeof(CaptureBlockHeader),
+            CAPTURE_BLOCK_BYTES - sizeof(CaptureBlockHeader) - 8);
+        if (size == 0) {
+            return 0;
+        }
+        block->bytes = size;
+        total = (sizeof(CaptureBlockHeader) + size + 7) & ~(size_t) 7;
+    } else {
+        memcpy(packed, block, block_size(block->kind));
+        block->bytes = CAPTURE_BLOCK_BYTES - sizeof(CaptureBlockHeader);
+        total = CAPTURE_BLOCK_BYTES;
+    }
+    block->crc = 0;
+    uint32_t crc = capture_crc32(0, block, sizeof(CaptureBlockHeader));
+    block->crc = capture_crc32(crc, packed + sizeof(CaptureBlockHeader), block->bytes);
+    memcpy(packed, block, sizeof(CaptureBlockHeader));
+    return fwrite(packed, 1, total, file) == total ? total : 0;
+}
+
+/* Writes the blocks to a segment at path, with an index at the end if
+ * indexed. Fills entries and segment_end. 0 on success */
+static int write_segment(const char *path, CaptureEncoding encoding, int indexed) {
+    FILE *file = fopen(path, "wb");
+    if (file == NULL) {
+        return -1;
+    }
+    uint8_t page[CAPTURE_HEADER_BYTES];
+    memset(page, 0, sizeof(page));
+    CaptureHeader *header = (CaptureHeader *) page;
+    memcpy(header->magic, CAPTURE_MAGIC, sizeof(header->magic));
+    header->version = CAPTURE_VERSION;
+    header->byte_order = CAPTURE_BYTE_ORDER;
+    header->header_bytes = CAPTURE_HEADER_BYTES;
+    header->block_bytes = CAPTURE_BLOCK_BYTES;
+    header->imu_samples = CAPTURE_IMU_SAMPLES;
+    header->environment_samples = CAPTURE_ENVIRONMENT_SAMPLES;
+    header->encoding = encoding;
+    int failed = fwrite(page, 1, sizeof(page), file) != sizeof(page);
+    uint64_t offset = CAPTURE_HEADER_BYTES;
+    for (uint32_t n = 0; n < SEGMENT_BLOCKS && !failed; n++) {
+        size_t size = put_block(file, blocks[n], n, encoding);
+        entries[n].offset = offset;
+        entries[n].first = blocks[n]->first;
+        entries[n].last = blocks[n]->last;
+        entries[n].kind = blocks[n]->kind;
+        entries[n].count = blocks[n]->count;
+        offset += size;
+        failed = size == 0;
+    }
+    if (indexed && !failed) {
+        CaptureIndexFooter footer;
+        memset(&footer, 0, sizeof(footer));
+        footer.offset = offset;
+        footer.entries = SEGMENT_BLOCKS;
+        footer.crc = capture_crc32(0, entries, sizeof(entries));
+        footer.magic = CAPTURE_INDEX_MAGIC;
+        failed = fwrite(entries, 1, sizeof(entries), file) != sizeof(entries) ||
+            fwrite(&footer, 1, sizeof(footer), file) != sizeof(footer);
+    }
+    segment_end = ftell(file);
+    if (fclose(file) != 0) {
+        failed = 1;
+    }
+    return failed ? -1 : 0;
+}
+
+/* Flips the bits of the byte at offset in the file at path */
+static void flip_byte(const char *path, long offset) {
+    FILE *file = fopen(path, "r+b");
+    int c = file ? (fseek(file, offset, SEEK_SET), fgetc(file)) : EOF;
+    if (c == EOF || fseek(file, offset, SEEK_SET) != 0 || fputc(c ^ 0xFF, file) == EOF) {
+        fprintf(stderr, "Could not damage %s\n", path);
+    }
+    if (file) {
+        fclose(file);
+    }
+}
+
+/* Reads block n of segment, whatever its kind. 0 on success */
+static int read_any(const CaptureSegment *segment, size_t n, CaptureBlockHeader *out) {
+    const CaptureBlockHeader *block = capture_block(segment, n);
+    if (block == NULL) {
+        return -1;
+    }
+    if (block->kind == CAPTURE_IMU) {
+        return capture_read_imu(segment, n, (CaptureImuBlock *) out);
+    }
+    return capture_read_environment(segment, n, (CaptureEnvironmentBlock *) out);
+}
+
+/* Checks that segment opens with the first count blocks, each read back
+ * as written. Closes the segment */
+static void check_blocks(const char *path, size_t count, const char *what) {
+    static CaptureImuBlock out;     // Big enough for either kind
+    CaptureSegment segment;
+    int ok = capture_open(&segment, path) == 0 && segment.blocks == count;
+    for (size_t n = 0; n < count && ok; n++) {
+        ok = read_any(&segment, n, &out.header) == 0 && same_columns(&out.header, blocks[n]);
+    }
+    check(ok, what);
+    capture_close(&segment);
+}
+
+static void check_codec(void) {
+    static uint8_t packed[CAPTURE_BLOCK_BYTES];
+    static CaptureImuBlock imu;
+    static CaptureEnvironmentBlock env;
+
+    size_t size = capture_encode(&imu_first.header, packed, sizeof(packed));
+    check(size > 0 && size < sizeof(CaptureImuBlock) / 2, "full IMU block compresses");
+    check(size > 0 && capture_decode(&imu_first.header, packed, size, &imu.header) == 0 &&
+        same_columns(&imu.header, &imu_first.header), "full IMU block round trip");
+
+    size = capture_encode(&imu_last.header, packed, sizeof(packed));
+    check(size > 0 && capture_decode(&imu_last.header, packed, size, &imu.header) == 0 &&
+        same_columns(&imu.header, &imu_last.header), "part filled IMU block round trip");
+    check(capture_decode(&imu_last.header, packed, size / 2, &imu.header) != 0,
+        "half the columns do not decode");
+
+    size = capture_encode(&environment.header, packed, sizeof(packed));
+    check(size > 0 && capture_decode(&environment.header, packed, size, &env.header) == 0 &&
+        same_columns(&env.header, &environment.header), "environment block round trip");
+
+    check(capture_encode(&imu_first.header, packed, 64) == 0, "no room to encode");
+    CaptureBlockHeader empty = imu_first.header;
+    empty.count = 0;
+    check(capture_encode(&empty, packed, sizeof(packed)) == 0, "empty block not encoded");
+}
+
+static void check_segments(const char *directory) {
+    char path[256];
+    snprintf(path, sizeof(path), "%s/capture-000000.shc", directory);
+    CaptureSegment segment;
+
+    // Closed compressed segment, the index is read
+    if (write_segment(path, CAPTURE_COMPRESSED, 1) != 0) {
+        check(0, "write indexed segment");
+        return;
+    }
+    check_blocks(path, SEGMENT_BLOCKS, "indexed segment read back");
+    check(capture_open(&segment, path) == 0 && segment.index != NULL && segment.scanned == NULL &&
+        capture_seek(&segment, CAPTURE_ENVIRONMENT, 0) == 1 &&
+        capture_seek(&segment, CAPTURE_IMU, imu_first.header.last + 1) == 2 &&
+        capture_seek(&segment, CAPTURE_IMU, imu_last.header.last + 1) == SEGMENT_BLOCKS,
+        "seek with the index");
+    capture_close(&segment);
+
+    // Index cut short, the blocks are walked instead
+    if (truncate(path, segment_end - 8) != 0) {
+        check(0, "truncate segment");
+        return;
+    }
+    check_blocks(path, SEGMENT_BLOCKS, "segment with a cut index read back");
+
+    // Never closed, so no index
+    write_segment(path, CAPTURE_COMPRESSED, 0);
+    check(capture_open(&segment, path) == 0 && segment.scanned != NULL &&
+        segment.blocks == SEGMENT_BLOCKS && capture_seek(&segment, CAPTURE_IMU, imu_last.header.first) == 2,
+        "segment without an index walked");
+    capture_close(&segment);
+    check_blocks(path, SEGMENT_BLOCKS, "segment without an index read back");
+
+    // Cut in the middle of the last block, only that block is lost
+    long middle = (long) (entries[2].offset + (segment_end - entries[2].offset) / 2);
+    if (truncate(path, middle) != 0) {
+        check(0, "truncate segment");
+        return;
+    }
+    check_blocks(path, SEGMENT_BLOCKS - 1, "segment cut mid-block keeps the whole blocks");
+    if (truncate(path, (long) entries[0].offset + 16) != 0) {
+        check(0, "truncate segment");
+        return;
+    }
+    check_blocks(path, 0, "segment cut in the first block header has no blocks");
+
+    // One byte of the middle block flipped, the CRC catches it
+    static CaptureEnvironmentBlock env;
+    write_segment(path, CAPTURE_COMPRESSED, 1);
+    flip_byte(path, (long) (entries[1].offset + sizeof(CaptureBlockHeader) + 5));
+    check(capture_open(&segment, path) == 0 && segment.blocks == SEGMENT_BLOCKS &&
+        capture_block(&segment, 0) != NULL && capture_block(&segment, 1) == NULL &&
+        capture_block(&segment, 2) != NULL && capture_read_environment(&segment, 1, &env) != 0,
+        "flipped byte in the columns fails the CRC");
+    capture_close(&segment);
+    write_segment(path, CAPTURE_COMPRESSED, 1);
+    flip_byte(path, (long) entries[0].offset + 12);
+    check(capture_open(&segment, path) == 0 && capture_block(&segment, 0) == NULL &&
+        capture_block(&segment, 1) != NULL, "flipped byte in a block header fails the CRC");
+    capture_close(&segment);
+    write_segment(path, CAPTURE_COMPRESSED, 1);
+    flip_byte(path, segment_end - sizeof(CaptureIndexFooter) - 3);
+    check_blocks(path, SEGMENT_BLOCKS, "flipped byte in the index falls back to walking");
+
+    // Raw segment, blocks used in place
+    write_segment(path, CAPTURE_RAW, 0);
+    check(capture_open(&segment, path) == 0 && segment.blocks == SEGMENT_BLOCKS &&
+        capture_imu_block(&segment, 0) != NULL && capture_environment_block(&segment, 1) != NULL &&
+        capture_imu_block(&segment, 1) == NULL &&
+        same_columns(&capture_imu_block(&segment, 2)->header, &imu_last.header), "raw segment used in place");
+    capture_close(&segment);
+    check_blocks(path, SEGMENT_BLOCKS, "raw segment read back");
+    if (truncate(path, CAPTURE_HEADER_BYTES + 2 * CAPTURE_BLOCK_BYTES + 100) != 0) {
+        check(0, "truncate segment");
+        return;
+    }
+    check_blocks(path, SEGMENT_BLOCKS - 1, "raw segment cut mid-block keeps the whole blocks");
+    unlink(path);
+}
+
+int main(void) {
+    char directory[] = "/tmp/sense_hat_capturetest_XXXXXX";
+    if (mkdtemp(directory) == NULL) {
+        fprintf(stderr, "Could not create a capture directory\n");
+        return 1;
+    }
+    make_imu(&imu_first, CAPTURE_IMU_SAMPLES, 1700000000000000ull);
+    make_environment(&environment, 100, 1700000000000000ull);
+    make_imu(&imu_last, 200, imu_first.header.last + 10000);
+
+    check_codec();
+    check_segments(directory);
+
+    rmdir(directory);
+    printf("%d failed\n", failures);
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,99 @@
+#define _POSIX_C_SOURCE 200809L
+#include "SenseHatSensors.h"
+#include "stdio.h"
+#include "stdlib.h"
+#include "string.h"
+#include "unistd.h"
+
+/* Checks of the LED frame functions.
+ *
+ * SENSE_HAT_FB points the LEDs at a temporary file, so it runs on any
+ * Linux machine. The file is read back after every step to see what a
+ * real framebuffer would show.
+ *
+ * Usage: fbtest */
+
+#define FB_BYTES 128
+
+static int failures = 0;
+
+static void check(int ok, const char *what) {
+    printf("%s: %s\n", ok ? "ok" : "FAILED", what);
+    if (!ok) {
+        failures++;
+    }
+}
+
+/* Reads the whole framebuffer file into fb */
+static void read_fb(const char *path, uint16_t fb[64]) {
+    FILE *file = fopen(path, "rb");
+    memset(fb, 0, FB_BYTES);
+    if (file == NULL || fread(fb, 1, FB_BYTES, file) != FB_BYTES) {
+        fprintf(stderr, "Could not read %s\n", path);
+    }
+    if (file != NULL) {
+        fclose(file);
+    }
+}
+
+int main(void) {
+    char path[] = "/tmp/sense_hat_fbtest_XXXXXX";
+    int fd = mkstemp(path);
+    if (fd < 0) {
+        fprintf(stderr, "Could not create a framebuffer file\n");
+        return 1;
+    }
+    // The mapping is 128 bytes, the file must be as long
+    uint8_t zeros[FB_BYTES];
+    memset(zeros, 0, FB_BYTES);
+    if (write(fd, zeros, FB_BYTES) != FB_BYTES) {
+        fprintf(stderr, "Could not write %s\n", path);
+        close(fd);
+        unlink(path);
+        return 1;
+    }
+    close(fd);
+    setenv("SENSE_HAT_FB", path, 1);
+
+    SenseHatSensors *sense = SenseHatSensors_new_with(SENSE_HAT_LED);
+    if (sense == NULL) {
+        fprintf(stderr, "Could not open the LEDs\n");
+        unlink(path);
+        return 1;
+    }
+
+    uint16_t before[64], after[64];
+    uint16_t red = RGB565(255, 0, 0);
+    Bool_t written;
+
+    check(try_clear(sense) == SENSE_HAT_OK, "clear");
+    read_fb(path, before);
+
+    check(try_begin_frame(sense) == SENSE_HAT_OK, "begin_frame");
+    check(try_set_pixel(sense, red, 3, 4) == SENSE_HAT_OK, "set_pixel in a frame");
+    check(try_set_pixels(sense, red) == SENSE_HAT_OK, "set_pixels in a frame");
+    read_fb(path, after);
+    check(memcmp(before, after, FB_BYTES) == 0, "nothing shown before commit_frame");
+    check(try_commit_frame(sense, &written) == SENSE_HAT_OK && written, "commit_frame writes");
+    read_fb(path, after);
+    check(after[4 * 8 + 3] == red && after[0] == red && after[63] == red, "frame shown after commit_frame");
+
+    check(try_begin_frame(sense) == SENSE_HAT_OK, "begin_frame");
+    check(try_commit_frame(sense, &written) == SENSE_HAT_OK && !written, "empty frame not written");
+    check(try_begin_frame(sense) == SENSE_HAT_OK, "begin_frame");
+    check(try_set_pixel(sense, red, 3, 4) == SENSE_HAT_OK, "set_pixel to the colour shown");
+    check(try_commit_frame(sense, &written) == SENSE_HAT_OK && !written, "unchanged frame not written");
+    check(try_commit_frame(sense, &written) == SENSE_HAT_OK && !written, "commit_frame without begin_frame");
+
+    read_fb(path, before);
+    check(try_set_pixel(sense, 0, 8, 0) == SENSE_HAT_OUT_OF_RANGE, "x out of range");
+    check(try_set_pixel(sense, 0, 0, 8) == SENSE_HAT_OUT_OF_RANGE, "y out of range");
+    check(try_set_pixel(sense, 0, 255, 255) == SENSE_HAT_OUT_OF_RANGE, "x and y out of range");
+    read_fb(path, after);
+    check(memcmp(before, after, FB_BYTES) == 0, "nothing drawn out of range");
+
+    SenseHatSensors_delete(sense);
+    unlink(path);
+    printf("%d failed\n", failures);
+    return failures == 0 ? 0 : 1;
+}
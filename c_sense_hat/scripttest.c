@@ -0,0 +1,178 @@
+#define _POSIX_C_SOURCE 200809L
+#include "SenseHatSensors.h"
+#include "stdio.h"
+#include "stdlib.h"
+#include "string.h"
+
+/* Checks of the script compiler and VM: results of small scripts, runtime
+ * and compile errors, and the nesting limit.
+ *
+ * Scripts are loaded for a SenseHatSensors that plays the synthetic
+ * signal, so it runs on any Linux machine.
+ *
+ * Usage: scripttest */
+
+// Deeper than the compiler allows, shallow enough to stay cheap
+#define DEEP 100000
+
+static int failures = 0;
+static SenseHatSensors *sense;
+
+static void check(int ok, const char *what) {
+    printf("%s: %s\n", ok ? "ok" : "FAILED", what);
+    if (!ok) {
+        failures++;
+    }
+}
+
+/* Checks that source does not compile, with an error mentioning reason */
+static void check_error(const char *source, const char *reason, const char *what) {
+    char error[160] = "";
+    SenseHatScript *script = script_load(sense, source, error, sizeof(error));
+    check(script == NULL && strstr(error, reason) != NULL, what);
+    if (script == NULL && strstr(error, reason) == NULL) {
+        printf("    got \"%s\"\n", error);
+    }
+    script_delete(script);
+}
+
+/* Loads source, runs its top level so the globals are set, and calls
+ * function with count arguments. Checks that it returns expected */
+static void check_call(const char *source, const char *function, const double *args, size_t count,
+        double expected, const char *what) {
+    char error[160] = "";
+    SenseHatScript *script = script_load(sense, source, error, sizeof(error));
+    double result = 0.0;
+    int ok = script != NULL && script_run(script) == SENSE_HAT_OK &&
+        script_call(script, script_function(script, function), args, count, &result) == SENSE_HAT_OK &&
+        result == expected;
+    check(ok, what);
+    if (!ok) {
+        printf("    got %g, \"%s%s\"\n", result, error, script ? script_error(script) : "");
+    }
+    script_delete(script);
+}
+
+/* Same as check_call, for a call that stops with a runtime error
+ * mentioning reason */
+static void check_fault(const char *source, const char *function, const double *args, size_t count,
+        const char *reason, const char *what) {
+    SenseHatScript *script = script_load(sense, source, NULL, 0);
+    double result;
+    check(script != NULL && script_run(script) == SENSE_HAT_OK &&
+        script_call(script, script_function(script, function), args, count, &result) == SENSE_HAT_OUT_OF_RANGE &&
+        strstr(script_error(script), reason) != NULL, what);
+    script_delete(script);
+}
+
+/* head, open count times, middle, close count times. Freed by the caller */
+static char * nest(const char *head, const char *open, const char *middle, const char *close, size_t count) {
+    size_t size = strlen(head) + (strlen(open) + strlen(close)) * count + strlen(middle) + 1;
+    char *text = malloc(size);
+    if (text == NULL) {
+        fprintf(stderr, "Out of memory\n");
+        exit(1);
+    }
+    char *p = text + sprintf(text, "%s", head);
+    for (size_t i = 0; i < count; i++) {
+        p += sprintf(p, "%s", open);
+    }
+    p += sprintf(p, "%s", middle);
+    for (size_t i = 0; i < count; i++) {
+        p += sprintf(p, "%s", close);
+    }
+    return text;
+}
+
+/* Checks that nesting count levels deep compiles if ok, and fails to
+ * compile otherwise */
+static void check_nesting(const char *head, const char *open, const char *middle, const char *close,
+        size_t count, int ok, const char *what) {
+    char *source = nest(head, open, middle, close, count);
+    if (ok) {
+        char error[160] = "";
+        SenseHatScript *script = script_load(sense, source, error, sizeof(error));
+        check(script != NULL, what);
+        script_delete(script);
+    } else {
+        check_error(source, "nested too deep", what);
+    }
+    free(source);
+}
+
+int main(void) {
+    sense = SenseHatSensors_new_replay(NULL, 0, NULL, SENSE_HAT_IMU);
+    if (sense == NULL) {
+        fprintf(stderr, "Could not open the replay\n");
+        return 1;
+    }
+
+    static const double three_five[] = {3, 5};
+    static const double ten[] = {10};
+    static const double four[] = {4};
+    static const double minus_one[] = {-1};
+
+    // Results
+    check_call("def f(a, b) { return a + b * 2 - (a - b) / 2 }", "f", three_five, 2, 14, "precedence");
+    check_call("def f(a, b) { return a % b + (a < b) + (a >= b) * 10 + (a != b and not (a == b)) * 100 }",
+        "f", three_five, 2, 104, "comparisons and logic");
+    check_call("def f(n) { if n < 2 { return 1 }\n return n * f(n - 1) }", "f", ten, 1, 3628800, "recursion");
+    check_call("def f(x) { if x < 0 { return -1 } elif x == 0 { return 0 } else { return 1 } }",
+        "f", minus_one, 1, -1, "elif chain");
+    check_call("def f(n) {\n var sum = 0\n var i = 0\n while 1 {\n i += 1\n"
+        " if i > n { break }\n if i % 2 { continue }\n sum += i\n }\n return sum\n}",
+        "f", ten, 1, 30, "loop with break and continue");
+    check_call("var base = 7\narray a[4]\ndef f(i) {\n a[i] = i * base\n return a[i] + len(a)\n}",
+        "f", three_five, 1, 25, "globals and arrays");
+    check_call("def f(x) { return g(x) * 2 }\ndef g(x) { return x + 1 }", "f", four, 1, 10,
+        "call of a function defined later");
+    check_call("def f(x) { if x { var y = 2 }\n var y = x\n return y }", "f", four, 1, 4,
+        "locals end with their block");
+    check_call("def f(x) { return abs(-x) }", "f", four, 1, 4, "built in");
+
+    // Runtime errors
+    const char *bounds = "array a[4]\ndef f(i) { return a[i] }\ndef g(i) { a[i] = 1 }";
+    check_fault(bounds, "f", four, 1, "index 4 is outside a", "read past an array");
+    check_fault(bounds, "f", minus_one, 1, "index -1 is outside a", "read before an array");
+    check_fault(bounds, "g", four, 1, "index 4 is outside a", "write past an array");
+    check_fault("def f(n) { return f(n + 1) }", "f", four, 1, "calls nested too deep", "endless recursion");
+    SenseHatScript *script = script_load(sense, "def f(a) { return a }", NULL, 0);
+    double result;
+    check(script != NULL && script_function(script, "g") == -1 &&
+        script_call(script, script_function(script, "f"), three_five, 2, &result) == SENSE_HAT_OUT_OF_RANGE,
+        "script_call checks the function and its arguments");
+    script_delete(script);
+
+    // Compile errors
+    check_error("print x", "'x' is not declared", "read of an undeclared variable");
+    check_error("x = 1", "'x' is not declared", "assignment to an undeclared variable");
+    check_error("if 1 { var y = 1 }\nprint y", "'y' is not declared", "local used outside its block");
+    check_error("var x = 1\nvar x = 2", "'x' is already declared", "variable declared twice");
+    check_error("def f(a) { return a }\nprint f(1, 2)", "f takes 1 arguments, not 2", "too many arguments");
+    check_error("def f(a, b) { return a }\nprint f(1)", "f takes 2 arguments, not 1", "too few arguments");
+    check_error("print abs(1, 2)", "abs takes 1 arguments, not 2", "built in with too many arguments");
+    check_error("print g(1)\ndef g(a, b) { return a }", "'g' is called with 1 arguments",
+        "definition disagrees with an earlier call");
+    check_error("print g(1)", "'g' is not defined", "call of a function never defined");
+    check_error("break", "break outside a loop", "break at the top level");
+    check_error("def f() { if 1 { break } }", "break outside a loop", "break in a function outside a loop");
+    check_error("continue", "continue outside a loop", "continue at the top level");
+    check_error("array a[0]", "array size must be", "empty array");
+    check_error("array a[2.5]", "array size must be", "array size not whole");
+    check_error("array a[70000]", "array size must be", "array larger than the heap");
+    check_error("array a[40000]\narray b[40000]", "array size must be", "arrays larger than the heap together");
+
+    // Nesting
+    check_nesting("print ", "(", "1", ")", 150, 1, "150 parentheses");
+    check_nesting("print ", "(", "1", ")", DEEP, 0, "too many parentheses");
+    check_nesting("print ", "-", "1", "", DEEP, 0, "too many unary minus");
+    check_nesting("print ", "not ", "1", "", DEEP, 0, "too many not");
+    check_nesting("print ", "abs(", "1", ")", DEEP, 0, "too many nested calls");
+    check_nesting("", "if 1 {", "", "}", 150, 1, "150 nested blocks");
+    check_nesting("", "if 1 {", "", "}", DEEP, 0, "too many nested blocks");
+    check_nesting("", "while 1 {", "", "}", DEEP, 0, "too many nested loops");
+
+    SenseHatSensors_delete(sense);
+    printf("%d failed\n", failures);
+    return failures == 0 ? 0 : 1;
+}
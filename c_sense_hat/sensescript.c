@@ -0,0 +1,103 @@
+#define _POSIX_C_SOURCE 200809L
+#include "SenseHatSensors.h"
+#include "signal.h"
+#include "stdio.h"
+#include "stdlib.h"
+#include "string.h"
+#include "unistd.h"
+
+/* Runs a script (see Script.hpp for the language) on the Sense HAT.
+ *
+ * With -r the sensors play back a trace file instead, "-" for the
+ * synthetic signal, and the LEDs are written to the file given with -f or
+ * in SENSE_HAT_FB, so scripts can be tried on any Linux machine. Ctrl-C
+ * stops the script at its next loop iteration or sleep.
+ *
+ * Usage: sensescript [-r trace] [-f framebuffer] script */
+
+static SenseHatScript *script;
+
+static void on_signal(int signal) {
+    (void) signal;
+    script_stop(script);
+}
+
+/* The whole file as a string, NULL if it cannot be read */
+static char * read_file(const char *path) {
+    FILE *file = fopen(path, "rb");
+    if (!file) {
+        return NULL;
+    }
+    char *text = NULL;
+    long size = -1;
+    if (fseek(file, 0, SEEK_END) == 0 && (size = ftell(file)) >= 0 && fseek(file, 0, SEEK_SET) == 0) {
+        text = malloc(size + 1);
+    }
+    if (text && fread(text, 1, size, file) == (size_t) size) {
+        text[size] = '\0';
+    } else {
+        free(text);
+        text = NULL;
+    }
+    fclose(file);
+    return text;
+}
+
+int main(int argc, char **argv) {
+    const char *trace = NULL;
+    const char *fb_path = NULL;
+    int replay = 0, usage = 0;
+    int opt;
+    while ((opt = getopt(argc, argv, "r:f:")) != -1) {
+        switch (opt) {
+        case 'r':
+            replay = 1;
+            trace = strcmp(optarg, "-") == 0 ? NULL : optarg;
+            break;
+        case 'f':
+            fb_path = optarg;
+            break;
+        default:
+            usage = 1;
+        }
+    }
+    if (usage || optind != argc - 1) {
+        fprintf(stderr, "usage: %s [-r trace] [-f framebuffer] script\n", argv[0]);
+        return 1;
+    }
+
+    char *source = read_file(argv[optind]);
+    if (!source) {
+        fprintf(stderr, "%s: cannot read the script\n", argv[optind]);
+        return 1;
+    }
+    SenseHatSensors *sense = replay ?
+        SenseHatSensors_new_replay(trace, 0, fb_path, SENSE_HAT_ALL) : SenseHatSensors_new();
+    if (!sense) {
+        fprintf(stderr, "Could not open the Sense HAT\n");
+        return 1;
+    }
+    char error[256];
+    script = script_load(sense, source, error, sizeof(error));
+    free(source);
+    if (!script) {
+        fprintf(stderr, "%s: %s\n", argv[optind], error);
+        SenseHatSensors_delete(sense);
+        return 1;
+    }
+
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = on_signal;
+    sigaction(SIGINT, &action, NULL);
+    sigaction(SIGTERM, &action, NULL);
+
+    int status = 0;
+    if (script_run(script) != SENSE_HAT_OK) {
+        fprintf(stderr, "%s: %s\n", argv[optind], script_error(script));
+        status = 1;
+    }
+    script_delete(script);
+    SenseHatSensors_delete(sense);
+    return status;
+}